@@ -0,0 +1,90 @@
+#include "applog.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten/emscripten.h>
+
+// One console call per batch; warnings make the whole batch stand out
+EM_JS(void, js_applog_emit_internal, (const char* text, int warn), {
+    var message = UTF8ToString(text);
+    if (warn) {
+        console.warn(message);
+    } else {
+        console.log(message);
+    }
+});
+#endif
+
+int applogLevel = APPLOG_DEFAULT_LEVEL;
+
+static uint32_t sampleEvery[APPLOG_CATEGORY_COUNT] = { 1, 1, 1 };
+static uint32_t sampleCounter[APPLOG_CATEGORY_COUNT];
+
+static char lines[APPLOG_RING_SIZE][APPLOG_LINE_SIZE];
+static int lineCount = 0;
+static int droppedLines = 0;
+static bool pendingWarning = false;
+static char batch[APPLOG_RING_SIZE * APPLOG_LINE_SIZE + 64];
+
+static const char* levelNames[] = { "DEBUG", "INFO", "WARNING", "ERROR" };
+static const char* categoryNames[] = { "NET", "GAME", "UI" };
+
+void applog_set_level(AppLogLevel level) {
+    applogLevel = level;
+}
+
+void applog_set_sampling(AppLogCategory category, uint32_t everyN) {
+    if (category < 0 || category >= APPLOG_CATEGORY_COUNT) return;
+    sampleEvery[category] = everyN > 0 ? everyN : 1;
+    sampleCounter[category] = 0;
+}
+
+bool applog_sample(AppLogCategory category) {
+    uint32_t every = sampleEvery[category];
+    return every <= 1 || sampleCounter[category]++ % every == 0;
+}
+
+void applog_write(AppLogLevel level, AppLogCategory category, const char* format, ...) {
+    if (lineCount == APPLOG_RING_SIZE) {
+        droppedLines++;
+        return;
+    }
+    char* line = lines[lineCount++];
+    int prefix = snprintf(line, APPLOG_LINE_SIZE, "%s [%s]: ", levelNames[level], categoryNames[category]);
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line + prefix, APPLOG_LINE_SIZE - prefix, format, args);
+    va_end(args);
+    if (level >= APPLOG_WARN) pendingWarning = true;
+}
+
+void applog_flush(void) {
+    if (lineCount == 0 && droppedLines == 0) return;
+
+    size_t length = 0;
+    for (int i = 0; i < lineCount; i++) {
+        size_t n = strlen(lines[i]);
+        memcpy(batch + length, lines[i], n);
+        length += n;
+        batch[length++] = '\n';
+    }
+    if (droppedLines > 0) {
+        length += snprintf(batch + length, sizeof(batch) - length, "WARNING [LOG]: %d log lines dropped\n", droppedLines);
+        pendingWarning = true;
+    }
+    if (length > 0 && batch[length - 1] == '\n') length--; // The console adds its own
+    batch[length] = '\0';
+
+#ifdef __EMSCRIPTEN__
+    js_applog_emit_internal(batch, pendingWarning);
+#else
+    fputs(batch, stderr);
+    fputc('\n', stderr);
+#endif
+
+    lineCount = 0;
+    droppedLines = 0;
+    pendingWarning = false;
+}
@@ -0,0 +1,60 @@
+#ifndef APPLOG_H
+#define APPLOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Leveled, sampled client logging.
+//
+// APPLOG() checks the level (and the category's sampling counter) before its
+// arguments are evaluated, so disabled calls cost one comparison. Enabled
+// entries are formatted into a fixed ring of lines and written out in one
+// batch by applog_flush(), which the main loop calls once per iteration,
+// instead of one console write per call. Warnings and errors are never
+// sampled. If the ring fills up between flushes, new lines are dropped and
+// counted.
+//
+// Build with -DAPPLOG_DEFAULT_LEVEL=APPLOG_DEBUG to see per-message logs.
+
+typedef enum AppLogLevel {
+    APPLOG_DEBUG = 0,
+    APPLOG_INFO,
+    APPLOG_WARN,
+    APPLOG_ERROR,
+    APPLOG_NONE,
+} AppLogLevel;
+
+typedef enum AppLogCategory {
+    APPLOG_NET = 0, // Connection and inbound/outbound messages
+    APPLOG_GAME,    // Tokens, dice, rooms
+    APPLOG_UI,
+    APPLOG_CATEGORY_COUNT,
+} AppLogCategory;
+
+#ifndef APPLOG_DEFAULT_LEVEL
+#define APPLOG_DEFAULT_LEVEL APPLOG_INFO
+#endif
+
+#define APPLOG_RING_SIZE 256
+#define APPLOG_LINE_SIZE 192
+
+extern int applogLevel;
+
+void applog_set_level(AppLogLevel level);
+// Keep one in every `everyN` debug/info entries of a category (1 keeps all)
+void applog_set_sampling(AppLogCategory category, uint32_t everyN);
+
+bool applog_sample(AppLogCategory category);
+void applog_write(AppLogLevel level, AppLogCategory category, const char* format, ...);
+
+// Writes everything buffered since the last flush
+void applog_flush(void);
+
+#define APPLOG(level, category, ...) \
+    do { \
+        if ((int)(level) >= applogLevel && ((level) >= APPLOG_WARN || applog_sample(category))) { \
+            applog_write((level), (category), __VA_ARGS__); \
+        } \
+    } while (0)
+
+#endif // APPLOG_H
@@ -0,0 +1,29 @@
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+// Timing, random numbers and the test map shared by the benchmarks. Each
+// bench is a single translation unit, so these are defined here.
+#include <stdbool.h>
+#include <time.h>
+
+static inline double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// xorshift32 with a fixed seed, so every run sees the same workload
+static unsigned int rng_state = 12345;
+static inline unsigned int next_rand(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+// 16x16 rooms with a door in every wall
+static inline bool bench_room_wall(int x, int y) {
+    return (x % 16 == 0 || y % 16 == 0) && x % 16 != 8 && y % 16 != 8;
+}
+
+#endif // BENCH_UTIL_H
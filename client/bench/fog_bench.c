@@ -0,0 +1,91 @@
+// Microbenchmark for the fog of war engine on a full-size map.
+//
+// Builds natively (no raylib/Emscripten needed):
+//   gcc -O2 -I.. fog_bench.c ../fog.c -o fog_bench
+//   ./fog_bench
+//
+// Fills a 256x256 grid with walled rooms, adds viewers and then moves a few
+// of them one cell per simulated frame, timing fog_update() and the reveal
+// run extraction, and comparing the run-length encoded reveal deltas with
+// sending the whole revealed mask.
+#include "fog.h"
+#include "bench_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAP_SIZE 256
+#define FRAMES 2000
+#define MAX_RUNS 4096
+
+static void build_rooms(FogGrid* fog) {
+    for (int y = 0; y < MAP_SIZE; y++) {
+        for (int x = 0; x < MAP_SIZE; x++) {
+            if (bench_room_wall(x, y)) fog_apply_run(fog, FOG_LAYER_WALLS, FOG_OP_SET, y, x, 1);
+        }
+    }
+}
+
+static void run(int numViewers, int movers) {
+    static FogGrid fog; // Large, keep it off the stack
+    static uint16_t runs[MAX_RUNS * 3];
+    fog_init(&fog, MAP_SIZE, MAP_SIZE);
+    build_rooms(&fog);
+
+    int* x = malloc(sizeof(int) * numViewers);
+    int* y = malloc(sizeof(int) * numViewers);
+    for (int i = 0; i < numViewers; i++) {
+        x[i] = 1 + next_rand() % (MAP_SIZE - 2);
+        y[i] = 1 + next_rand() % (MAP_SIZE - 2);
+        fog_set_viewer(&fog, i, x[i], y[i], true);
+    }
+    double start = now_ns();
+    fog_update(&fog);
+    double initialMs = (now_ns() - start) / 1e6;
+    while (fog_take_reveal_runs(&fog, runs, MAX_RUNS) > 0) {}
+
+    double totalMs = 0.0;
+    double worstMs = 0.0;
+    long long runCount = 0;
+    long long revealedFrames = 0;
+    for (int frame = 0; frame < FRAMES; frame++) {
+        for (int m = 0; m < movers; m++) {
+            int i = (int)(next_rand() % numViewers);
+            x[i] += (int)(next_rand() % 3) - 1;
+            y[i] += (int)(next_rand() % 3) - 1;
+            if (x[i] < 0) x[i] = 0;
+            if (y[i] < 0) y[i] = 0;
+            if (x[i] >= MAP_SIZE) x[i] = MAP_SIZE - 1;
+            if (y[i] >= MAP_SIZE) y[i] = MAP_SIZE - 1;
+            fog_set_viewer(&fog, i, x[i], y[i], true);
+        }
+        start = now_ns();
+        fog_update(&fog);
+        int count;
+        int frameRuns = 0;
+        while ((count = fog_take_reveal_runs(&fog, runs, MAX_RUNS)) > 0) frameRuns += count;
+        double ms = (now_ns() - start) / 1e6;
+        totalMs += ms;
+        if (ms > worstMs) worstMs = ms;
+        runCount += frameRuns;
+        if (frameRuns > 0) revealedFrames++;
+    }
+
+    // A reveal run is 6 bytes on the wire; the full mask is one bit per cell
+    printf("%5d viewers, %2d moving/frame: initial %7.3f ms, update avg %.4f ms (max %.3f), "
+           "%.1f runs (%.0f bytes) per revealing frame vs %d bytes full mask\n",
+           numViewers, movers, initialMs, totalMs / FRAMES, worstMs,
+           revealedFrames ? (double)runCount / revealedFrames : 0.0,
+           revealedFrames ? (double)runCount * 6 / revealedFrames : 0.0, MAP_SIZE * MAP_SIZE / 8);
+
+    free(x);
+    free(y);
+    fog_free(&fog);
+}
+
+int main(void) {
+    run(10, 1);
+    run(100, 4);
+    run(1000, 16);
+    run(5000, 64);
+    return 0;
+}
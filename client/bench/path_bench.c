@@ -0,0 +1,102 @@
+// Microbenchmark for the pathfinding engine on the client's 200x200 map.
+//
+// Builds natively (no raylib/Emscripten needed):
+//   gcc -O2 -I.. path_bench.c ../pathfind.c -o path_bench
+//   ./path_bench
+//
+// Fills the grid with walled rooms and scattered tokens, then simulates drags:
+// one field search when a drag starts, a path trace per mouse move, and wall
+// and token changes elsewhere on the map in between. Reports the search cost
+// for the drag range and for the whole map, the per-move cost, and how many
+// cached fields the changes made stale.
+#include "pathfind.h"
+#include "bench_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAP_SIZE 200
+#define DRAGS 500
+#define MOVES_PER_DRAG 60
+#define MAX_PATH (MAP_SIZE * MAP_SIZE)
+
+static void build_rooms(PathGrid* grid) {
+    for (int y = 0; y < MAP_SIZE; y++) {
+        for (int x = 0; x < MAP_SIZE; x++) {
+            if (bench_room_wall(x, y)) path_set_wall(grid, x, y, true);
+        }
+    }
+}
+
+static void run(int numTokens, int maxCost, int changesPerMove) {
+    static PathGrid grid;
+    static int path[MAX_PATH];
+    path_init(&grid, MAP_SIZE, MAP_SIZE);
+    build_rooms(&grid);
+    for (int i = 0; i < numTokens; i++) {
+        path_set_token(&grid, i, (int)(next_rand() % MAP_SIZE), (int)(next_rand() % MAP_SIZE));
+    }
+
+    double searchMs = 0.0;
+    double worstSearchMs = 0.0;
+    double moveMs = 0.0;
+    double worstMoveMs = 0.0;
+    long long pathCells = 0;
+    long long reached = 0;
+    for (int drag = 0; drag < DRAGS; drag++) {
+        int id = (int)(next_rand() % numTokens);
+        int ox = (int)(next_rand() % MAP_SIZE);
+        int oy = (int)(next_rand() % MAP_SIZE);
+        path_set_token(&grid, id, ox, oy);
+
+        double start = now_ns();
+        const PathField* field = path_field(&grid, id, ox, oy, maxCost);
+        double ms = (now_ns() - start) / 1e6;
+        searchMs += ms;
+        if (ms > worstSearchMs) worstSearchMs = ms;
+
+        int x = ox;
+        int y = oy;
+        for (int move = 0; move < MOVES_PER_DRAG; move++) {
+            // Something changes somewhere on the map now and then
+            for (int c = 0; c < changesPerMove; c++) {
+                int wx = (int)(next_rand() % MAP_SIZE);
+                int wy = (int)(next_rand() % MAP_SIZE);
+                if (next_rand() & 1) {
+                    path_set_wall(&grid, wx, wy, next_rand() & 1);
+                } else {
+                    path_set_token(&grid, (int)(next_rand() % numTokens), wx, wy);
+                }
+            }
+            x += (int)(next_rand() % 3) - 1;
+            y += (int)(next_rand() % 3) - 1;
+
+            start = now_ns();
+            field = path_field(&grid, id, ox, oy, maxCost);
+            pathCells += path_trace(&grid, field, x, y, path, MAX_PATH);
+            ms = (now_ns() - start) / 1e6;
+            moveMs += ms;
+            if (ms > worstMoveMs) worstMoveMs = ms;
+        }
+        for (int cy = field->minY; cy <= field->maxY; cy++) {
+            for (int cx = field->minX; cx <= field->maxX; cx++) {
+                reached += path_cost(&grid, field, cx, cy) != PATH_UNREACHED;
+            }
+        }
+    }
+
+    printf("%4d tokens, range %5d, %d changes/move: search avg %.4f ms (max %.3f), %.0f cells reached; "
+           "move avg %.4f ms (max %.3f), %.1f path cells; %d searches, %d cache hits, %d invalidations\n",
+           numTokens, maxCost, changesPerMove, searchMs / DRAGS, worstSearchMs, (double)reached / DRAGS,
+           moveMs / (DRAGS * MOVES_PER_DRAG), worstMoveMs, (double)pathCells / (DRAGS * MOVES_PER_DRAG),
+           grid.searches, grid.cacheHits, grid.invalidations);
+    path_free(&grid);
+}
+
+int main(void) {
+    run(100, PATH_MOVE_RANGE, 0);
+    run(100, PATH_MOVE_RANGE, 1);
+    run(1000, PATH_MOVE_RANGE, 4);
+    run(100, PATH_UNREACHED - 1, 0);
+    run(1000, PATH_UNREACHED - 1, 1);
+    return 0;
+}
@@ -0,0 +1,421 @@
+// Replays recorded inbound traffic through the client's game state at full speed.
+//
+// Builds natively (no raylib/Emscripten needed); the --wrap flags route the
+// allocator through counters so every allocation made while replaying is seen:
+//   gcc -O2 -I.. replay_bench.c ../game_state.c ../token_store.c ../motion.c ../fog.c ../pathfind.c ../message_log.c ../applog.c -lm -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=free -o replay_bench
+//   ./replay_bench                      synthetic session
+//   ./replay_bench session.trace        trace recorded with F6 in the client
+//   ./replay_bench --write out.trace    writes the synthetic session as a trace
+//
+// Events are applied in frames, the events of one network_poll() each, and
+// after every frame the remote drags are advanced and the fog is updated like
+// the main loop does. Reports events per second for applying the events and
+// for the whole frame, and the allocations made while replaying (after setup).
+//
+// The client only moves tokens it already holds, so every token the trace
+// mentions is placed at its first position before the replay starts.
+#include "game_state.h"
+#include "protocol.h"
+#include "applog.h"
+#include "bench_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GRID_SIZE 50.0f
+#define MAP_SIZE 200
+#define PASSES 5
+#define MAX_TOKEN_ID 100000
+
+// Synthetic session
+#define SESSION_SECONDS 120
+#define FRAME_MS (1000.0 / 60.0)
+#define SESSION_TOKENS 300
+#define SESSION_PLAYERS 8
+#define SAMPLE_MS (1000.0 / 15.0) // Drag samples per player, like DRAG_SEND_INTERVAL
+#define TICK_MS 50.0              // Server tick; updates arrive in batches
+
+// Allocation counters, see the build line
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* pointer, size_t size);
+void __real_free(void* pointer);
+
+static long long allocations = 0;
+static long long allocatedBytes = 0;
+
+void* __wrap_malloc(size_t size) {
+    allocations++;
+    allocatedBytes += (long long)size;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    allocations++;
+    allocatedBytes += (long long)(count * size);
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* pointer, size_t size) {
+    allocations++;
+    allocatedBytes += (long long)size;
+    return __real_realloc(pointer, size);
+}
+
+void __wrap_free(void* pointer) {
+    __real_free(pointer);
+}
+
+typedef struct Trace {
+    GameTraceRecord* records;
+    size_t count;
+    size_t capacity;
+} Trace;
+
+static NetEvent* trace_add(Trace* trace, double timeMs, int type) {
+    if (trace->count == trace->capacity) {
+        trace->capacity = trace->capacity ? trace->capacity * 2 : 4096;
+        trace->records = realloc(trace->records, sizeof(GameTraceRecord) * trace->capacity);
+    }
+    GameTraceRecord* record = &trace->records[trace->count++];
+    memset(record, 0, sizeof(*record));
+    record->timeMs = timeMs;
+    record->event.type = type;
+    return &record->event;
+}
+
+static void add_fog_run(Trace* trace, double timeMs, int layer, int op, int row, int start, int length) {
+    NetEvent* event = trace_add(trace, timeMs, NET_EVENT_FOG_RUN);
+    event->id = row;
+    event->seq = (uint32_t)start;
+    event->time = (uint32_t)length;
+    event->flags = layer | op << 8;
+}
+
+static void add_line(Trace* trace, double timeMs, int type, const char* sender, const char* text,
+                     const char* detail, uint32_t seq) {
+    NetEvent* event = trace_add(trace, timeMs, type);
+    snprintf(event->sender, sizeof(event->sender), "%s", sender);
+    snprintf(event->text, sizeof(event->text), "%s", text);
+    snprintf(event->detail, sizeof(event->detail), "%s", detail);
+    event->seq = seq;
+}
+
+typedef struct Drag {
+    int tokenId;
+    float x, y;          // Current position
+    float stepX, stepY;  // Per sample
+    int samplesLeft;
+    uint32_t seq;
+    double nextSample;
+} Drag;
+
+// A session in a room: init_state, walls, a history page, then players
+// dragging tokens, chatting and rolling, walls being edited, people coming
+// and going, and a snapshot resync halfway through
+static void build_session(Trace* trace) {
+    static float tokenX[SESSION_TOKENS];
+    static float tokenY[SESSION_TOKENS];
+    char sender[SESSION_PLAYERS][NET_EVENT_SENDER_SIZE];
+    char text[NET_EVENT_TEXT_SIZE];
+    for (int p = 0; p < SESSION_PLAYERS; p++) {
+        snprintf(sender[p], sizeof(sender[p]), "%08x-player-%d", next_rand(), p);
+    }
+
+    double t = 0.0;
+    snprintf(trace_add(trace, t, NET_EVENT_CLIENT_ID)->text, NET_EVENT_TEXT_SIZE, "bench-client");
+    for (int i = 0; i < SESSION_TOKENS; i++) {
+        NetEvent* event = trace_add(trace, t, NET_EVENT_UPDATE_TOKEN);
+        event->id = i;
+        event->x = tokenX[i] = (float)(next_rand() % MAP_SIZE) * GRID_SIZE;
+        event->y = tokenY[i] = (float)(next_rand() % MAP_SIZE) * GRID_SIZE;
+        event->flags = MOVE_FLAG_FINAL;
+    }
+    trace_add(trace, t, NET_EVENT_READY);
+
+    t += 100.0;
+    snprintf(trace_add(trace, t, NET_EVENT_ROOM_JOINED)->text, NET_EVENT_TEXT_SIZE, "bench-room");
+    add_fog_run(trace, t, FOG_LAYER_WALLS, FOG_OP_RESET, 0, 0, 0);
+    add_fog_run(trace, t, FOG_LAYER_REVEALED, FOG_OP_RESET, 0, 0, 0);
+    // The rooms' walls, as runs
+    for (int y = 0; y < MAP_SIZE; y++) {
+        for (int x = 0; x < MAP_SIZE; x++) {
+            if (!bench_room_wall(x, y)) continue;
+            int start = x;
+            while (x + 1 < MAP_SIZE && bench_room_wall(x + 1, y)) x++;
+            add_fog_run(trace, t, FOG_LAYER_WALLS, FOG_OP_SET, y, start, x - start + 1);
+        }
+    }
+    for (int p = 0; p < SESSION_PLAYERS; p++) {
+        strcpy(trace_add(trace, t, NET_EVENT_USER_JOINED)->text, sender[p]);
+    }
+
+    // The newest history page, newest line first
+    uint32_t seq = 5000;
+    t += 100.0;
+    for (int i = 0; i < 50; i++) {
+        snprintf(text, sizeof(text), "earlier line %d", i);
+        add_line(trace, t, NET_EVENT_CHAT_MESSAGE, sender[i % SESSION_PLAYERS], text, "", seq - (uint32_t)i);
+    }
+    trace_add(trace, t, NET_EVENT_HISTORY_END)->seq = seq - 49;
+    trace->records[trace->count - 1].event.flags = HISTORY_FLAG_MORE;
+
+    Drag drags[SESSION_PLAYERS];
+    memset(drags, 0, sizeof(drags));
+    double start = t;
+    double nextTick = t;
+    double nextChat = t + 1500.0;
+    double nextRoll = t + 4000.0;
+    double nextWall = t + 5000.0;
+    double nextPage = t + 20000.0;
+    double resyncAt = t + SESSION_SECONDS * 500.0;
+    uint32_t oldestPage = seq - 49;
+    double rejoinAt = 0.0;
+    int rejoining = 0;
+    // Samples queue up between server ticks and arrive together
+    static NetEvent pending[SESSION_PLAYERS * 8];
+    int pendingCount = 0;
+
+    for (t = start; t < start + SESSION_SECONDS * 1000.0; t += FRAME_MS) {
+        for (int p = 0; p < SESSION_PLAYERS; p++) {
+            Drag* drag = &drags[p];
+            if (drag->samplesLeft == 0) {
+                // Pick up another token and drag it a few cells over 1-3 seconds
+                drag->tokenId = (int)(next_rand() % SESSION_TOKENS);
+                drag->x = tokenX[drag->tokenId];
+                drag->y = tokenY[drag->tokenId];
+                drag->samplesLeft = 15 + (int)(next_rand() % 30);
+                float dx = (float)((int)(next_rand() % 17) - 8) * GRID_SIZE;
+                float dy = (float)((int)(next_rand() % 17) - 8) * GRID_SIZE;
+                drag->stepX = dx / drag->samplesLeft;
+                drag->stepY = dy / drag->samplesLeft;
+                drag->nextSample = t + (next_rand() % 1000);
+            }
+            if (t < drag->nextSample || pendingCount == (int)(sizeof(pending) / sizeof(pending[0]))) continue;
+            drag->nextSample += SAMPLE_MS;
+            drag->x += drag->stepX;
+            drag->y += drag->stepY;
+            drag->samplesLeft--;
+            NetEvent* event = &pending[pendingCount++];
+            memset(event, 0, sizeof(*event));
+            event->type = NET_EVENT_UPDATE_TOKEN;
+            event->id = drag->tokenId;
+            event->x = drag->x;
+            event->y = drag->y;
+            event->seq = ++drag->seq;
+            event->time = (uint32_t)(t + p * 7919.0); // The sender's own clock
+            event->flags = drag->samplesLeft == 0 ? MOVE_FLAG_FINAL : 0;
+            strcpy(event->sender, sender[p]);
+            if (drag->samplesLeft == 0) {
+                tokenX[drag->tokenId] = drag->x;
+                tokenY[drag->tokenId] = drag->y;
+            }
+        }
+        if (t >= nextTick) {
+            nextTick += TICK_MS;
+            for (int i = 0; i < pendingCount; i++) {
+                trace_add(trace, t, NET_EVENT_UPDATE_TOKEN);
+                trace->records[trace->count - 1].event = pending[i];
+            }
+            pendingCount = 0;
+        }
+        if (t >= nextChat) {
+            nextChat += 500.0 + next_rand() % 2000;
+            snprintf(text, sizeof(text), "moving up to the door, cover me %u", next_rand() % 100);
+            add_line(trace, t, NET_EVENT_CHAT_MESSAGE, sender[next_rand() % SESSION_PLAYERS], text, "", ++seq);
+        }
+        if (t >= nextRoll) {
+            nextRoll += 1000.0 + next_rand() % 5000;
+            unsigned int roll = 1 + next_rand() % 20;
+            snprintf(text, sizeof(text), "1d20+5 = %u (%u)", roll + 5, roll);
+            char detail[NET_EVENT_DETAIL_SIZE];
+            snprintf(detail, sizeof(detail), "range 6..25  mean 15.5  %.1f%% lower  5.0%% equal", (roll - 1) * 5.0);
+            add_line(trace, t, NET_EVENT_DICE_RESULT, sender[next_rand() % SESSION_PLAYERS], text, detail, ++seq);
+        }
+        if (t >= nextWall) {
+            nextWall += 2000.0 + next_rand() % 6000;
+            int row = (int)(next_rand() % MAP_SIZE);
+            int column = (int)(next_rand() % (MAP_SIZE - 4));
+            add_fog_run(trace, t, FOG_LAYER_WALLS, (next_rand() & 1) ? FOG_OP_SET : FOG_OP_CLEAR, row, column, 4);
+            add_fog_run(trace, t, FOG_LAYER_REVEALED, FOG_OP_SET, row, column, 12);
+        }
+        if (t >= nextPage && oldestPage > 50) {
+            // The user scrolled back to the top of the log
+            nextPage += 20000.0;
+            for (int i = 1; i <= 50; i++) {
+                snprintf(text, sizeof(text), "older line %u", oldestPage - (uint32_t)i);
+                add_line(trace, t, NET_EVENT_DICE_ROLL, sender[i % SESSION_PLAYERS], text, "", oldestPage - (uint32_t)i);
+            }
+            oldestPage -= 50;
+            trace_add(trace, t, NET_EVENT_HISTORY_END)->seq = oldestPage;
+            trace->records[trace->count - 1].event.flags = HISTORY_FLAG_MORE;
+        }
+        if (t >= resyncAt) {
+            // Fell behind: the server dropped the queue and sends a snapshot
+            resyncAt = 1e18;
+            snprintf(trace_add(trace, t, NET_EVENT_ROOM_JOINED)->text, NET_EVENT_TEXT_SIZE, "bench-room");
+            for (int i = 0; i < SESSION_TOKENS; i++) {
+                NetEvent* event = trace_add(trace, t, NET_EVENT_UPDATE_TOKEN);
+                event->id = i;
+                event->x = tokenX[i];
+                event->y = tokenY[i];
+                event->flags = MOVE_FLAG_FINAL;
+            }
+        }
+        // Now and then someone drops out and comes back half a second later
+        if (rejoinAt > 0.0 && t >= rejoinAt) {
+            rejoinAt = 0.0;
+            snprintf(trace_add(trace, t, NET_EVENT_USER_JOINED)->text, NET_EVENT_TEXT_SIZE, "%s", sender[rejoining]);
+        } else if (rejoinAt == 0.0 && next_rand() % 600 == 0) {
+            rejoining = (int)(next_rand() % SESSION_PLAYERS);
+            rejoinAt = t + 500.0;
+            snprintf(trace_add(trace, t, NET_EVENT_USER_LEFT)->text, NET_EVENT_TEXT_SIZE, "%s", sender[rejoining]);
+        }
+    }
+}
+
+static bool load_trace(Trace* trace, const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        return false;
+    }
+    GameTraceHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, GAME_TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != GAME_TRACE_VERSION || header.recordSize != sizeof(GameTraceRecord)) {
+        fprintf(stderr, "%s: not a version %d trace\n", path, GAME_TRACE_VERSION);
+        fclose(file);
+        return false;
+    }
+    GameTraceRecord record;
+    while (fread(&record, sizeof(record), 1, file) == 1) {
+        trace_add(trace, record.timeMs, record.event.type);
+        trace->records[trace->count - 1] = record;
+    }
+    fclose(file);
+    return true;
+}
+
+static bool write_trace(const Trace* trace, const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        perror(path);
+        return false;
+    }
+    GameTraceHeader header = { GAME_TRACE_MAGIC, GAME_TRACE_VERSION, sizeof(GameTraceRecord) };
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(trace->records, sizeof(GameTraceRecord), trace->count, file) == trace->count;
+    return fclose(file) == 0 && ok;
+}
+
+// Places every token the trace moves at its first position
+static void place_tokens(GameState* game, const Trace* trace) {
+    for (size_t i = 0; i < trace->count; i++) {
+        const NetEvent* event = &trace->records[i].event;
+        if (event->type != NET_EVENT_UPDATE_TOKEN || event->id < 0 || event->id > MAX_TOKEN_ID) continue;
+        if (token_store_find(&game->tokens, event->id) != NULL) continue;
+        game_add_token(game, (Token){ event->id, event->x, event->y, GRID_SIZE, GRID_SIZE });
+    }
+}
+
+typedef struct PassResult {
+    double applyMs;           // Applying events
+    double frameMs;           // Applying events, advancing drags and updating fog
+    int frames;
+    long long allocations;    // Made while replaying
+    long long allocatedBytes;
+    long long setupAllocations;
+} PassResult;
+
+static PassResult replay(const Trace* trace) {
+    static GameState game;
+    PassResult result = { 0 };
+    long long before = allocations;
+    game_init(&game, GRID_SIZE, MAP_SIZE, MAP_SIZE);
+    place_tokens(&game, trace);
+    fog_update(&game.fog);
+    result.setupAllocations = allocations - before;
+
+    before = allocations;
+    long long bytesBefore = allocatedBytes;
+    int minRow, maxRow;
+    uint16_t runs[3 * 256];
+    size_t i = 0;
+    while (i < trace->count) {
+        double timeMs = trace->records[i].timeMs;
+        double start = now_ns();
+        // One network_poll(): everything that arrived by this frame
+        for (; i < trace->count && trace->records[i].timeMs == timeMs; i++) {
+            game_apply_event(&game, &trace->records[i].event, timeMs);
+        }
+        double applied = now_ns();
+        game_advance(&game, timeMs);
+        fog_update(&game.fog);
+        while (fog_take_reveal_runs(&game.fog, runs, 256) > 0) {
+        }
+        fog_take_dirty_rows(&game.fog, &minRow, &maxRow);
+        double end = now_ns();
+        result.applyMs += (applied - start) / 1e6;
+        result.frameMs += (end - start) / 1e6;
+        result.frames++;
+    }
+    result.allocations = allocations - before;
+    result.allocatedBytes = allocatedBytes - bytesBefore;
+
+    game_free(&game);
+    applog_flush();
+    return result;
+}
+
+int main(int argc, char** argv) {
+    Trace trace = { 0 };
+    const char* writePath = NULL;
+    const char* readPath = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--write") == 0 && i + 1 < argc) {
+            writePath = argv[++i];
+        } else {
+            readPath = argv[i];
+        }
+    }
+    if (readPath != NULL) {
+        if (!load_trace(&trace, readPath)) {
+            free(trace.records);
+            return 1;
+        }
+    } else {
+        build_session(&trace);
+    }
+    if (writePath != NULL) {
+        bool written = write_trace(&trace, writePath);
+        if (written) {
+            printf("wrote %zu events to %s\n", trace.count, writePath);
+        } else {
+            fprintf(stderr, "%s: write failed\n", writePath);
+        }
+        free(trace.records);
+        return written ? 0 : 1;
+    }
+
+    int counts[NET_EVENT_HISTORY_END + 1] = { 0 };
+    for (size_t i = 0; i < trace.count; i++) {
+        int type = trace.records[i].event.type;
+        if (type > 0 && type <= NET_EVENT_HISTORY_END) counts[type]++;
+    }
+    double span = trace.count > 0 ? (trace.records[trace.count - 1].timeMs - trace.records[0].timeMs) / 1000.0 : 0.0;
+    printf("%s: %zu events over %.1f s (%d token updates, %d fog runs, %d chat/dice lines)\n",
+           readPath ? readPath : "synthetic session", trace.count, span, counts[NET_EVENT_UPDATE_TOKEN],
+           counts[NET_EVENT_FOG_RUN], counts[NET_EVENT_CHAT_MESSAGE] + counts[NET_EVENT_DICE_ROLL] + counts[NET_EVENT_DICE_RESULT]);
+
+    // Warnings (unknown tokens) are still shown, per-event logs are not
+    applog_set_level(APPLOG_WARN);
+    for (int pass = 0; pass < PASSES; pass++) {
+        PassResult r = replay(&trace);
+        printf("pass %d: %d frames, apply %.0f events/s (%.0f ns/event), with advance and fog %.0f events/s "
+               "(%.3f ms/frame); %lld allocations (%lld bytes) while replaying, %lld in setup\n",
+               pass + 1, r.frames, trace.count / (r.applyMs / 1000.0), r.applyMs * 1e6 / trace.count,
+               trace.count / (r.frameMs / 1000.0), r.frameMs / r.frames, r.allocations, r.allocatedBytes, r.setupAllocations);
+    }
+    free(trace.records);
+    return 0;
+}
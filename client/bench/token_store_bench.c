@@ -0,0 +1,106 @@
+// Microbenchmark for the token store at large table sizes.
+//
+// Builds natively (no raylib/Emscripten needed):
+//   gcc -O2 -I.. token_store_bench.c ../token_store.c -lm -o token_store_bench
+//   ./token_store_bench
+//
+// For each size it times id lookups, point picks, moves and a full iteration,
+// and compares lookup/pick against the old linear scan.
+#include "token_store.h"
+#include "bench_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define GRID_SIZE 50.0f
+#define OPS 200000
+
+static Token* linear_find(TokenStore* store, int id) {
+    for (int i = 0; i < store->count; i++) {
+        if (store->tokens[i].id == id) return &store->tokens[i];
+    }
+    return NULL;
+}
+
+static Token* linear_pick(TokenStore* store, float x, float y) {
+    for (int i = 0; i < store->count; i++) {
+        const Token* t = &store->tokens[i];
+        if (x >= t->x && x < t->x + t->width && y >= t->y && y < t->y + t->height) return &store->tokens[i];
+    }
+    return NULL;
+}
+
+static void run(int numTokens) {
+    // Roughly one token per four grid cells, like a crowded battle map
+    int cellsPerSide = 1;
+    while (cellsPerSide * cellsPerSide < numTokens * 4) cellsPerSide++;
+    float worldSize = cellsPerSide * GRID_SIZE;
+
+    TokenStore store;
+    token_store_init(&store, GRID_SIZE);
+
+    double start = now_ns();
+    for (int i = 0; i < numTokens; i++) {
+        float x = (float)(next_rand() % (unsigned int)(worldSize - GRID_SIZE));
+        float y = (float)(next_rand() % (unsigned int)(worldSize - GRID_SIZE));
+        token_store_add(&store, (Token){ i, x, y, GRID_SIZE, GRID_SIZE });
+    }
+    double insertNs = (now_ns() - start) / numTokens;
+
+    volatile unsigned int sink = 0;
+    int linearOps = numTokens >= 100000 ? OPS / 100 : OPS / 10;
+
+    start = now_ns();
+    for (int i = 0; i < OPS; i++) sink += token_store_find(&store, next_rand() % numTokens) != NULL;
+    double findNs = (now_ns() - start) / OPS;
+
+    start = now_ns();
+    for (int i = 0; i < linearOps; i++) sink += linear_find(&store, next_rand() % numTokens) != NULL;
+    double linearFindNs = (now_ns() - start) / linearOps;
+
+    start = now_ns();
+    for (int i = 0; i < OPS; i++) {
+        sink += token_store_pick(&store, (float)(next_rand() % (unsigned int)worldSize), (float)(next_rand() % (unsigned int)worldSize)) != NULL;
+    }
+    double pickNs = (now_ns() - start) / OPS;
+
+    start = now_ns();
+    for (int i = 0; i < linearOps; i++) {
+        sink += linear_pick(&store, (float)(next_rand() % (unsigned int)worldSize), (float)(next_rand() % (unsigned int)worldSize)) != NULL;
+    }
+    double linearPickNs = (now_ns() - start) / linearOps;
+
+    start = now_ns();
+    for (int i = 0; i < OPS; i++) {
+        int id = next_rand() % numTokens;
+        Token* t = token_store_find(&store, id);
+        float dx = (float)((int)(next_rand() % 21) - 10);
+        float dy = (float)((int)(next_rand() % 21) - 10);
+        token_store_move(&store, id, t->x + dx, t->y + dy);
+    }
+    double moveNs = (now_ns() - start) / OPS;
+
+    int iterations = 100;
+    start = now_ns();
+    for (int it = 0; it < iterations; it++) {
+        float sum = 0;
+        for (int i = 0; i < store.count; i++) sum += store.tokens[i].x;
+        sink += (unsigned int)sum;
+    }
+    double iterateNs = (now_ns() - start) / ((double)iterations * numTokens);
+
+    printf("tokens=%d\n", numTokens);
+    printf("  insert          %8.1f ns/op\n", insertNs);
+    printf("  find (hash)     %8.1f ns/op   linear %10.1f ns/op\n", findNs, linearFindNs);
+    printf("  pick (spatial)  %8.1f ns/op   linear %10.1f ns/op\n", pickNs, linearPickNs);
+    printf("  move            %8.1f ns/op\n", moveNs);
+    printf("  iterate         %8.2f ns/token\n", iterateNs);
+
+    token_store_free(&store);
+    (void)sink;
+}
+
+int main(void) {
+    run(10000);
+    run(100000);
+    return 0;
+}
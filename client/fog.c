@@ -0,0 +1,364 @@
+#include "fog.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define EMPTY_SLOT -1
+#define INITIAL_VIEWERS 16
+
+// Octant transforms for shadowcasting: (xx, xy, yx, yy)
+static const int OCTANTS[8][4] = {
+    { 1, 0, 0, 1 }, { 0, 1, 1, 0 }, { 0, -1, 1, 0 }, { -1, 0, 0, 1 },
+    { -1, 0, 0, -1 }, { 0, -1, -1, 0 }, { 0, 1, -1, 0 }, { 1, 0, 0, -1 },
+};
+
+static unsigned int hash_int(unsigned int x) {
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+// --- viewer table (token id -> dense index) ---
+
+static int find_slot(const FogGrid* fog, int id) {
+    unsigned int mask = (unsigned int)fog->slotCapacity - 1;
+    unsigned int slot = hash_int((unsigned int)id) & mask;
+    while (fog->slots[slot] != EMPTY_SLOT) {
+        if (fog->viewers[fog->slots[slot]].id == id) return (int)slot;
+        slot = (slot + 1) & mask;
+    }
+    return -1;
+}
+
+static void insert_slot(FogGrid* fog, int id, int index) {
+    unsigned int mask = (unsigned int)fog->slotCapacity - 1;
+    unsigned int slot = hash_int((unsigned int)id) & mask;
+    while (fog->slots[slot] != EMPTY_SLOT) {
+        slot = (slot + 1) & mask;
+    }
+    fog->slots[slot] = index;
+}
+
+static void remove_slot(FogGrid* fog, int slot) {
+    unsigned int mask = (unsigned int)fog->slotCapacity - 1;
+    unsigned int hole = (unsigned int)slot;
+    unsigned int next = (hole + 1) & mask;
+    while (fog->slots[next] != EMPTY_SLOT) {
+        unsigned int home = hash_int((unsigned int)fog->viewers[fog->slots[next]].id) & mask;
+        // Shift the entry back if the hole lies between its home slot and its current slot
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            fog->slots[hole] = fog->slots[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    fog->slots[hole] = EMPTY_SLOT;
+}
+
+static void rehash(FogGrid* fog, int newCapacity) {
+    free(fog->slots);
+    fog->slotCapacity = newCapacity;
+    fog->slots = malloc(sizeof(int) * newCapacity);
+    memset(fog->slots, 0xff, sizeof(int) * newCapacity);
+    for (int i = 0; i < fog->viewerCount; i++) {
+        insert_slot(fog, fog->viewers[i].id, i);
+    }
+}
+
+// --- bit rows ---
+
+static void mark_rows(FogGrid* fog, int minRow, int maxRow) {
+    if (minRow < fog->dirtyMinRow) fog->dirtyMinRow = minRow;
+    if (maxRow > fog->dirtyMaxRow) fog->dirtyMaxRow = maxRow;
+}
+
+// ORs a viewer window row whose bit 0 is grid column `first` into a grid row
+static void or_window_row(uint64_t* row, uint64_t bits, int first) {
+    if (first < 0) {
+        bits >>= -first;
+        first = 0;
+    }
+    int word = first >> 6;
+    int shift = first & 63;
+    row[word] |= bits << shift;
+    if (shift != 0 && word + 1 < FOG_ROW_WORDS) {
+        row[word + 1] |= bits >> (64 - shift);
+    }
+}
+
+// Sets or clears columns [start, end) of a row; returns true if any bit changed
+static bool write_range(uint64_t* row, int start, int end, bool value) {
+    bool changed = false;
+    while (start < end) {
+        int word = start >> 6;
+        int wordEnd = (word + 1) << 6;
+        int stop = end < wordEnd ? end : wordEnd;
+        int count = stop - start;
+        uint64_t mask = (count == 64 ? ~0ULL : ((1ULL << count) - 1)) << (start & 63);
+        uint64_t next = value ? row[word] | mask : row[word] & ~mask;
+        changed |= next != row[word];
+        row[word] = next;
+        start = stop;
+    }
+    return changed;
+}
+
+// First column at or after `from` whose bit equals `value`, or `limit`
+static int next_bit(const uint64_t* row, int from, bool value, int limit) {
+    while (from < limit) {
+        int word = from >> 6;
+        uint64_t bits = (value ? row[word] : ~row[word]) & (~0ULL << (from & 63));
+        if (bits != 0) {
+            int x = (word << 6) + __builtin_ctzll(bits);
+            return x < limit ? x : limit;
+        }
+        from = (word + 1) << 6;
+    }
+    return limit;
+}
+
+// --- shadowcasting ---
+
+// Recursive shadowcasting over one octant: scans rows of cells moving away
+// from the viewer between two slopes, and recurses into the gap above each
+// run of walls.
+static void cast_light(const FogGrid* fog, FogViewer* viewer, int distance, float start, float end, const int* t) {
+    if (start < end) return;
+    const int radius = FOG_SIGHT_RADIUS;
+    float newStart = 0.0f;
+    for (; distance <= radius; distance++) {
+        bool blocked = false;
+        int dy = -distance;
+        for (int dx = -distance; dx <= 0; dx++) {
+            float leftSlope = (dx - 0.5f) / (dy + 0.5f);
+            float rightSlope = (dx + 0.5f) / (dy - 0.5f);
+            if (start < rightSlope) continue;
+            if (end > leftSlope) break;
+
+            int ox = dx * t[0] + dy * t[1];
+            int oy = dx * t[2] + dy * t[3];
+            int x = viewer->cellX + ox;
+            int y = viewer->cellY + oy;
+            bool inside = x >= 0 && y >= 0 && x < fog->width && y < fog->height;
+            if (inside && dx * dx + dy * dy <= radius * radius) {
+                viewer->mask[oy + radius] |= 1ULL << (ox + radius);
+            }
+
+            bool opaque = !inside || fog_bit(fog->walls[y], x);
+            if (blocked) {
+                if (opaque) {
+                    newStart = rightSlope;
+                } else {
+                    blocked = false;
+                    start = newStart;
+                }
+            } else if (opaque && distance < radius) {
+                blocked = true;
+                cast_light(fog, viewer, distance + 1, start, leftSlope, t);
+                newStart = rightSlope;
+            }
+        }
+        if (blocked) break;
+    }
+}
+
+static void compute_view(const FogGrid* fog, FogViewer* viewer) {
+    memset(viewer->mask, 0, sizeof(viewer->mask));
+    viewer->mask[FOG_SIGHT_RADIUS] = 1ULL << FOG_SIGHT_RADIUS;
+    for (int i = 0; i < 8; i++) {
+        cast_light(fog, viewer, 1, 1.0f, 0.0f, OCTANTS[i]);
+    }
+}
+
+// --- public API ---
+
+void fog_init(FogGrid* fog, int width, int height) {
+    memset(fog, 0, sizeof(*fog));
+    fog->width = width < FOG_MAX_SIZE ? width : FOG_MAX_SIZE;
+    fog->height = height < FOG_MAX_SIZE ? height : FOG_MAX_SIZE;
+    fog->viewerCapacity = INITIAL_VIEWERS;
+    fog->viewers = malloc(sizeof(FogViewer) * fog->viewerCapacity);
+    fog->slots = NULL;
+    rehash(fog, INITIAL_VIEWERS * 2);
+    fog->dirtyMinRow = 0;
+    fog->dirtyMaxRow = fog->height - 1;
+}
+
+void fog_free(FogGrid* fog) {
+    free(fog->viewers);
+    free(fog->slots);
+    fog->viewers = NULL;
+    fog->slots = NULL;
+    fog->viewerCount = 0;
+    fog->viewerCapacity = 0;
+}
+
+void fog_set_viewer(FogGrid* fog, int id, int cellX, int cellY, bool local) {
+    if (cellX < 0) cellX = 0;
+    if (cellY < 0) cellY = 0;
+    if (cellX >= fog->width) cellX = fog->width - 1;
+    if (cellY >= fog->height) cellY = fog->height - 1;
+
+    int slot = find_slot(fog, id);
+    FogViewer* viewer;
+    if (slot >= 0) {
+        viewer = &fog->viewers[fog->slots[slot]];
+        viewer->local = local;
+        if (viewer->cellX == cellX && viewer->cellY == cellY) return;
+    } else {
+        if (fog->viewerCount == fog->viewerCapacity) {
+            fog->viewerCapacity *= 2;
+            fog->viewers = realloc(fog->viewers, sizeof(FogViewer) * fog->viewerCapacity);
+        }
+        viewer = &fog->viewers[fog->viewerCount++];
+        viewer->id = id;
+        viewer->local = local;
+        if (fog->viewerCount * 2 > fog->slotCapacity) {
+            rehash(fog, fog->slotCapacity * 2);
+        } else {
+            insert_slot(fog, id, fog->viewerCount - 1);
+        }
+    }
+    viewer->cellX = cellX;
+    viewer->cellY = cellY;
+    viewer->dirty = true;
+    fog->visibleDirty = true;
+}
+
+void fog_remove_viewer(FogGrid* fog, int id) {
+    int slot = find_slot(fog, id);
+    if (slot < 0) return;
+    int index = fog->slots[slot];
+    remove_slot(fog, slot);
+
+    int last = fog->viewerCount - 1;
+    if (index != last) {
+        fog->viewers[index] = fog->viewers[last];
+        fog->slots[find_slot(fog, fog->viewers[index].id)] = index;
+    }
+    fog->viewerCount--;
+    fog->visibleDirty = true;
+}
+
+void fog_apply_run(FogGrid* fog, int layer, int op, int row, int start, int length) {
+    uint64_t (*bits)[FOG_ROW_WORDS] = layer == FOG_LAYER_WALLS ? fog->walls : fog->revealed;
+    if (op == FOG_OP_RESET) {
+        memset(bits, 0, sizeof(fog->walls));
+        mark_rows(fog, 0, fog->height - 1);
+        if (layer == FOG_LAYER_WALLS) {
+            for (int i = 0; i < fog->viewerCount; i++) fog->viewers[i].dirty = true;
+        }
+        fog->visibleDirty = true; // Revealed is merged with what is visible again
+        return;
+    }
+
+    if (row < 0 || row >= fog->height) return;
+    int end = start + length;
+    if (start < 0) start = 0;
+    if (end > fog->width) end = fog->width;
+    if (start >= end || !write_range(bits[row], start, end, op == FOG_OP_SET)) return;
+    mark_rows(fog, row, row);
+
+    if (layer == FOG_LAYER_WALLS) {
+        // Only viewers whose window overlaps the run can see the change
+        for (int i = 0; i < fog->viewerCount; i++) {
+            FogViewer* viewer = &fog->viewers[i];
+            if (abs(viewer->cellY - row) <= FOG_SIGHT_RADIUS &&
+                viewer->cellX + FOG_SIGHT_RADIUS >= start && viewer->cellX - FOG_SIGHT_RADIUS < end) {
+                viewer->dirty = true;
+                fog->visibleDirty = true;
+            }
+        }
+    } else {
+        fog->visibleDirty = true;
+    }
+}
+
+bool fog_update(FogGrid* fog) {
+    fog->recomputed = 0;
+    if (!fog->visibleDirty) return false;
+    fog->visibleDirty = false;
+
+    for (int i = 0; i < fog->viewerCount; i++) {
+        FogViewer* viewer = &fog->viewers[i];
+        if (!viewer->dirty) continue;
+        compute_view(fog, viewer);
+        viewer->dirty = false;
+        fog->recomputed++;
+        if (!viewer->local) continue;
+
+        // Cells this viewer reveals for the first time are ours to report
+        int first = viewer->cellX - FOG_SIGHT_RADIUS;
+        for (int r = 0; r < FOG_WINDOW; r++) {
+            int y = viewer->cellY - FOG_SIGHT_RADIUS + r;
+            if (viewer->mask[r] == 0 || y < 0 || y >= fog->height) continue;
+            uint64_t row[FOG_ROW_WORDS] = { 0 };
+            or_window_row(row, viewer->mask[r], first);
+            for (int w = 0; w < FOG_ROW_WORDS; w++) {
+                fog->pending[y][w] |= row[w] & ~fog->revealed[y][w];
+            }
+        }
+    }
+
+    // Rebuild the visible layer as the union of all viewers, then fold it
+    // into the revealed layer
+    uint64_t visible[FOG_MAX_SIZE][FOG_ROW_WORDS];
+    memset(visible, 0, sizeof(uint64_t) * FOG_ROW_WORDS * fog->height);
+    for (int i = 0; i < fog->viewerCount; i++) {
+        const FogViewer* viewer = &fog->viewers[i];
+        int first = viewer->cellX - FOG_SIGHT_RADIUS;
+        for (int r = 0; r < FOG_WINDOW; r++) {
+            int y = viewer->cellY - FOG_SIGHT_RADIUS + r;
+            if (viewer->mask[r] != 0 && y >= 0 && y < fog->height) {
+                or_window_row(visible[y], viewer->mask[r], first);
+            }
+        }
+    }
+
+    bool changed = false;
+    for (int y = 0; y < fog->height; y++) {
+        bool rowChanged = false;
+        for (int w = 0; w < FOG_ROW_WORDS; w++) {
+            uint64_t revealed = fog->revealed[y][w] | visible[y][w];
+            rowChanged |= visible[y][w] != fog->visible[y][w] || revealed != fog->revealed[y][w];
+            fog->visible[y][w] = visible[y][w];
+            fog->revealed[y][w] = revealed;
+        }
+        if (rowChanged) {
+            mark_rows(fog, y, y);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+int fog_take_reveal_runs(FogGrid* fog, uint16_t* runs, int maxRuns) {
+    int count = 0;
+    for (int y = 0; y < fog->height && count < maxRuns; y++) {
+        uint64_t* row = fog->pending[y];
+        int x = next_bit(row, 0, true, fog->width);
+        while (count < maxRuns) {
+            int start = next_bit(row, x, true, fog->width);
+            if (start >= fog->width) break;
+            int end = next_bit(row, start, false, fog->width);
+            write_range(row, start, end, false);
+            runs[count * 3] = (uint16_t)y;
+            runs[count * 3 + 1] = (uint16_t)start;
+            runs[count * 3 + 2] = (uint16_t)(end - start);
+            count++;
+            x = end;
+        }
+    }
+    return count;
+}
+
+bool fog_take_dirty_rows(FogGrid* fog, int* minRow, int* maxRow) {
+    if (fog->dirtyMinRow > fog->dirtyMaxRow) return false;
+    *minRow = fog->dirtyMinRow;
+    *maxRow = fog->dirtyMaxRow;
+    fog->dirtyMinRow = fog->height;
+    fog->dirtyMaxRow = -1;
+    return true;
+}
@@ -0,0 +1,104 @@
+#ifndef FOG_H
+#define FOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Fog of war and line of sight on the map grid.
+//
+// Every token is a viewer with a sight radius. Its field of view is computed
+// with recursive shadowcasting over the wall grid and kept as a small bitmask
+// window around the token, one 64-bit word per row. The grid-wide layers
+// (walls, currently visible, revealed so far) are packed bitsets with one row
+// of FOG_ROW_WORDS words per grid row, so merging a viewer into the visible
+// layer or finding newly revealed cells is a handful of word operations per
+// row rather than a loop over cells.
+//
+// Viewers are only recomputed when they move to another cell or a wall
+// inside their window changes; fog_update() then rebuilds the visible layer
+// and folds it into the revealed layer. Reveal changes go over the wire as
+// runs of cells (row, start, length), see fog_take_reveal_runs().
+//
+// The engine does not depend on raylib so it can be benchmarked natively.
+
+#define FOG_MAX_SIZE 256                     // Largest grid side in cells
+#define FOG_ROW_WORDS (FOG_MAX_SIZE / 64)
+#define FOG_SIGHT_RADIUS 12                  // Cells; the window below must fit one word
+#define FOG_WINDOW (FOG_SIGHT_RADIUS * 2 + 1)
+
+// Layers and run operations, shared with the fog_runs wire record
+#define FOG_LAYER_WALLS 0
+#define FOG_LAYER_REVEALED 1
+
+#define FOG_OP_SET 0
+#define FOG_OP_CLEAR 1
+#define FOG_OP_RESET 2 // Clear the whole layer (sent before a full state)
+
+typedef struct FogViewer {
+    int id;                      // Token id
+    int cellX;                   // Cell the field of view was computed from
+    int cellY;
+    bool dirty;                  // Needs recomputing in the next fog_update()
+    bool local;                  // Moved by us, so its reveals are ours to report
+    uint64_t mask[FOG_WINDOW];   // Bit i of mask[r] is cell (cellX - R + i, cellY - R + r)
+} FogViewer;
+
+typedef struct FogGrid {
+    int width;
+    int height;
+
+    uint64_t walls[FOG_MAX_SIZE][FOG_ROW_WORDS];
+    uint64_t visible[FOG_MAX_SIZE][FOG_ROW_WORDS];
+    uint64_t revealed[FOG_MAX_SIZE][FOG_ROW_WORDS];
+    uint64_t pending[FOG_MAX_SIZE][FOG_ROW_WORDS]; // Revealed by local viewers, not yet reported
+
+    FogViewer* viewers;          // Dense array
+    int viewerCount;
+    int viewerCapacity;
+    int* slots;                  // id -> viewer index (linear probing), -1 if empty
+    int slotCapacity;            // Power of two
+
+    bool visibleDirty;           // Some viewer changed since the last fog_update()
+    int dirtyMinRow;             // Rows whose drawn state changed, for texture updates
+    int dirtyMaxRow;             // (dirtyMinRow > dirtyMaxRow when clean)
+
+    int recomputed;              // Viewers recomputed by the last fog_update()
+} FogGrid;
+
+// width/height are in cells, at most FOG_MAX_SIZE
+void fog_init(FogGrid* fog, int width, int height);
+void fog_free(FogGrid* fog);
+
+// Places a token's viewer at a cell, adding it if needed. Does nothing if the
+// viewer is already there, so it is cheap to call on every position update.
+// `local` marks viewers moved by this client.
+void fog_set_viewer(FogGrid* fog, int id, int cellX, int cellY, bool local);
+void fog_remove_viewer(FogGrid* fog, int id);
+
+// Applies a run of cells to a layer (FOG_OP_SET or FOG_OP_CLEAR), or clears
+// the layer (FOG_OP_RESET, row/start/length ignored). Walls changes mark the
+// viewers that can see them for recomputing.
+void fog_apply_run(FogGrid* fog, int layer, int op, int row, int start, int length);
+
+// Recomputes dirty viewers and rebuilds the visible and revealed layers.
+// Returns true if anything that is drawn changed.
+bool fog_update(FogGrid* fog);
+
+// Moves up to maxRuns runs of cells newly revealed by local viewers into
+// `runs` as (row, start, length) triples and returns how many were written.
+// Call until it returns 0 to drain everything.
+int fog_take_reveal_runs(FogGrid* fog, uint16_t* runs, int maxRuns);
+
+// Returns the rows changed since the last call in [*minRow, *maxRow] and
+// resets them. Returns false if nothing changed.
+bool fog_take_dirty_rows(FogGrid* fog, int* minRow, int* maxRow);
+
+// Tests cell x of a layer row, e.g. fog_bit(fog->revealed[y], x)
+static inline bool fog_bit(const uint64_t* row, int x) {
+    return (row[x >> 6] >> (x & 63)) & 1;
+}
+
+_Static_assert(FOG_WINDOW <= 64, "A viewer's window row must fit one word");
+_Static_assert(FOG_MAX_SIZE % 64 == 0, "Grid rows are whole words");
+
+#endif // FOG_H
@@ -0,0 +1,32 @@
+#include "frame_stats.h"
+#include <string.h>
+
+void frame_stats_init(FrameStats* stats, double now) {
+    memset(stats, 0, sizeof(*stats));
+    stats->windowStart = now;
+}
+
+bool frame_stats_record(FrameStats* stats, double workSeconds, bool rendered, double now) {
+    stats->loops++;
+    stats->workTime += workSeconds;
+    if (rendered) {
+        stats->frames++;
+        if (workSeconds > stats->maxWork) stats->maxWork = workSeconds;
+    }
+
+    double elapsed = now - stats->windowStart;
+    if (elapsed < 1.0) return false;
+
+    stats->framesPerSecond = (float)(stats->frames / elapsed);
+    stats->loopsPerSecond = (float)(stats->loops / elapsed);
+    stats->avgFrameWorkMs = stats->frames > 0 ? (float)(stats->workTime * 1000.0 / stats->frames) : 0.0f;
+    stats->maxFrameWorkMs = (float)(stats->maxWork * 1000.0);
+    stats->busyPercent = (float)(stats->workTime * 100.0 / elapsed);
+
+    stats->windowStart = now;
+    stats->loops = 0;
+    stats->frames = 0;
+    stats->workTime = 0;
+    stats->maxWork = 0;
+    return true;
+}
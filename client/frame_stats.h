@@ -0,0 +1,31 @@
+#ifndef FRAME_STATS_H
+#define FRAME_STATS_H
+
+#include <stdbool.h>
+
+// Per-second frame counters for comparing the render-on-demand loop against
+// continuous redraws. "Work" is the time spent in a loop iteration before it
+// waits (idle sleep or the frame limiter in EndDrawing), so busyPercent
+// approximates the CPU share the main loop actually uses.
+typedef struct FrameStats {
+    double windowStart;
+    int loops;
+    int frames;
+    double workTime;
+    double maxWork;
+
+    // Results of the last completed one-second window
+    float framesPerSecond;
+    float loopsPerSecond;
+    float avgFrameWorkMs;
+    float maxFrameWorkMs;
+    float busyPercent;
+} FrameStats;
+
+void frame_stats_init(FrameStats* stats, double now);
+
+// Records one loop iteration. Returns true when a new one-second window was
+// published (so an on-screen readout knows to refresh).
+bool frame_stats_record(FrameStats* stats, double workSeconds, bool rendered, double now);
+
+#endif // FRAME_STATS_H
@@ -0,0 +1,211 @@
+#include "game_state.h"
+#include "protocol.h"
+#include "applog.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+void game_init(GameState* game, float cellSize, int columns, int rows) {
+    token_store_init(&game->tokens, cellSize);
+    motion_init(&game->remoteMotion);
+    fog_init(&game->fog, columns, rows);
+    path_init(&game->paths, columns, rows);
+    message_log_init(&game->chatLog, GAME_CHAT_LOG_LINES, GAME_CHAT_LOG_ARENA);
+    message_log_init(&game->roomLog, GAME_ROOM_LOG_LINES, GAME_ROOM_LOG_ARENA);
+    game->historyOldest = 0;
+    game->historyMore = true;
+    game->historyPending = false;
+    game->clientId[0] = '\0';
+    game->roomId[0] = '\0';
+    game->ready = false;
+    game->viewportUnsent = true;
+    game->draggedTokenId = -1;
+}
+
+void game_free(GameState* game) {
+    token_store_free(&game->tokens);
+    fog_free(&game->fog);
+    path_free(&game->paths);
+    message_log_free(&game->chatLog);
+    message_log_free(&game->roomLog);
+}
+
+int game_token_cell_x(const GameState* game, const Token* token) {
+    return (int)floorf((token->x + token->width * 0.5f) / game->tokens.cellSize);
+}
+
+int game_token_cell_y(const GameState* game, const Token* token) {
+    return (int)floorf((token->y + token->height * 0.5f) / game->tokens.cellSize);
+}
+
+void game_update_token_cell(GameState* game, const Token* token, bool local) {
+    int cellX = game_token_cell_x(game, token);
+    int cellY = game_token_cell_y(game, token);
+    fog_set_viewer(&game->fog, token->id, cellX, cellY, local);
+    if (token->id != game->draggedTokenId) {
+        path_set_token(&game->paths, token->id, cellX, cellY);
+    }
+}
+
+Token* game_add_token(GameState* game, Token token) {
+    Token* stored = token_store_add(&game->tokens, token);
+    game_update_token_cell(game, stored, false);
+    return stored;
+}
+
+void game_apply_fog_run(GameState* game, int layer, int op, int row, int start, int length) {
+    fog_apply_run(&game->fog, layer, op, row, start, length);
+    if (layer != FOG_LAYER_WALLS) return;
+    if (op == FOG_OP_RESET) {
+        path_clear_walls(&game->paths);
+        return;
+    }
+    for (int x = start; x < start + length; x++) {
+        path_set_wall(&game->paths, x, row, op == FOG_OP_SET);
+    }
+}
+
+void game_log_room(GameState* game, const char* message) {
+    message_log_append(&game->roomLog, message, NULL, 0);
+}
+
+int game_advance(GameState* game, double nowMs) {
+    int movingIds[MOTION_MAX_TRACKS];
+    int movingCount = game->remoteMotion.count;
+    for (int i = 0; i < movingCount; i++) {
+        movingIds[i] = game->remoteMotion.tracks[i].tokenId;
+    }
+    int tracks = motion_update(&game->remoteMotion, &game->tokens, nowMs);
+    // Only viewers that moved to another cell are recomputed by fog_update()
+    for (int i = 0; i < movingCount; i++) {
+        const Token* token = token_store_find(&game->tokens, movingIds[i]);
+        if (token != NULL) game_update_token_cell(game, token, false);
+    }
+    return tracks;
+}
+
+// Starts the dice and chat log over for a new room (or a new connection,
+// which may have missed lines); its history is paged in again
+static void reset_chat_history(GameState* game, bool inRoom) {
+    message_log_clear(&game->chatLog);
+    game->historyOldest = 0;
+    game->historyMore = inRoom;
+    game->historyPending = false;
+}
+
+// Adds a dice or chat line. Lines older than any held come from a history
+// page, newest first, and go in front.
+static void add_chat_line(GameState* game, const char* text, const char* detail, uint32_t seq) {
+    MessageLog* log = &game->chatLog;
+    uint32_t evicted = log->evicted;
+    if (seq != 0 && game->historyOldest != 0 && seq < game->historyOldest) {
+        if (message_log_prepend(log, text, detail, seq) == NULL) {
+            game->historyMore = false; // Scrollback is full
+            return;
+        }
+    } else {
+        message_log_append(log, text, detail, seq);
+    }
+    if (seq != 0 && (game->historyOldest == 0 || seq < game->historyOldest)) {
+        game->historyOldest = seq;
+    }
+    if (log->evicted != evicted) {
+        game->historyMore = false; // The oldest lines are gone, so older ones would leave a gap
+    }
+}
+
+// "You" or the first characters of the sender's id
+static const char* sender_name(const GameState* game, const char* senderId) {
+    if (senderId == NULL) return "?";
+    return strcmp(senderId, game->clientId) == 0 ? "You" : senderId;
+}
+
+static int on_update_token(GameState* game, const char* senderId, const NetEvent* event, double nowMs) {
+    if (event->id == game->draggedTokenId) {
+        return 0; // We are holding this token; our own samples win locally
+    }
+    Token* token = token_store_find(&game->tokens, event->id);
+    if (token == NULL) {
+        APPLOG(APPLOG_WARN, APPLOG_GAME, "Token with ID %d not found for update from sender %s.", event->id, senderId ? senderId : "(null)");
+        return 0;
+    }
+    motion_push(&game->remoteMotion, &game->tokens, event->id, event->seq, event->time, event->x, event->y,
+                (event->flags & MOVE_FLAG_FINAL) != 0, nowMs);
+    game_update_token_cell(game, token, false); // Snapshot values land at once, drags move it via remoteMotion
+    APPLOG(APPLOG_DEBUG, APPLOG_NET, "Updating token %d to (%.2f, %.2f) from sender %s", event->id, event->x, event->y, senderId ? senderId : "(null)");
+    return GAME_CHANGED_WORLD;
+}
+
+static void on_dice_result(GameState* game, const char* senderId, const NetEvent* event) {
+    APPLOG(APPLOG_INFO, APPLOG_GAME, "Dice result from %s: %s", senderId ? senderId : "(null)", event->text);
+    char text[NET_EVENT_TEXT_SIZE + 16];
+    snprintf(text, sizeof(text), "%.8s: %s", sender_name(game, senderId), event->text);
+    add_chat_line(game, text, event->detail, event->seq); // detail is the distribution summary
+}
+
+int game_apply_event(GameState* game, const NetEvent* event, double nowMs) {
+    const char* senderId = event->sender[0] ? event->sender : NULL;
+    char text[NET_EVENT_TEXT_SIZE + 16];
+    switch (event->type) {
+        case NET_EVENT_CLIENT_ID:
+            strncpy(game->clientId, event->text, sizeof(game->clientId) - 1);
+            game->clientId[sizeof(game->clientId) - 1] = '\0';
+            return 0;
+        case NET_EVENT_UPDATE_TOKEN:
+            return on_update_token(game, senderId, event, nowMs);
+        case NET_EVENT_DICE_ROLL:
+            APPLOG(APPLOG_INFO, APPLOG_GAME, "Received dice roll message from %s: %s", senderId ? senderId : "(null)", event->text);
+            add_chat_line(game, event->text, "", event->seq);
+            return GAME_CHANGED_UI;
+        case NET_EVENT_DICE_RESULT:
+            on_dice_result(game, senderId, event);
+            return GAME_CHANGED_UI;
+        case NET_EVENT_CHAT_MESSAGE:
+            APPLOG(APPLOG_DEBUG, APPLOG_GAME, "Chat from %s: %s", senderId ? senderId : "(null)", event->text);
+            snprintf(text, sizeof(text), "%.8s: %s", sender_name(game, senderId), event->text);
+            add_chat_line(game, text, "", event->seq);
+            return GAME_CHANGED_UI;
+        case NET_EVENT_HISTORY_END: {
+            bool more = (event->flags & HISTORY_FLAG_MORE) != 0;
+            APPLOG(APPLOG_DEBUG, APPLOG_NET, "History page down to %u (%s)", event->seq, more ? "more" : "complete");
+            game->historyPending = false;
+            if (!more) game->historyMore = false;
+            return GAME_CHANGED_UI;
+        }
+        case NET_EVENT_ROOM_JOINED:
+            strncpy(game->roomId, event->text, sizeof(game->roomId) - 1);
+            game->roomId[sizeof(game->roomId) - 1] = '\0';
+            APPLOG(APPLOG_INFO, APPLOG_GAME, "Joined room: %s", game->roomId);
+            reset_chat_history(game, true);
+            snprintf(text, sizeof(text), "Joined room: %s", game->roomId);
+            game_log_room(game, text);
+            return GAME_CHANGED_UI;
+        case NET_EVENT_ROOM_LEFT:
+            APPLOG(APPLOG_INFO, APPLOG_GAME, "Left room: %s", game->roomId);
+            snprintf(text, sizeof(text), "Left room: %s", game->roomId);
+            game_log_room(game, text);
+            game->roomId[0] = '\0';
+            reset_chat_history(game, false);
+            return GAME_CHANGED_UI;
+        case NET_EVENT_USER_JOINED:
+        case NET_EVENT_USER_LEFT: {
+            bool joined = event->type == NET_EVENT_USER_JOINED;
+            APPLOG(APPLOG_INFO, APPLOG_GAME, "User %s %s room %s", event->text, joined ? "joined" : "left", game->roomId);
+            snprintf(text, sizeof(text), "User %s %s", event->text, joined ? "joined" : "left");
+            game_log_room(game, text);
+            return GAME_CHANGED_UI;
+        }
+        case NET_EVENT_READY:
+            game->ready = true;
+            game->viewportUnsent = true; // A new connection starts without an area of interest
+            reset_chat_history(game, true);
+            APPLOG(APPLOG_INFO, APPLOG_NET, "Network is ready to send messages.");
+            game_log_room(game, "Network ready!");
+            return GAME_CHANGED_UI;
+        case NET_EVENT_FOG_RUN:
+            game_apply_fog_run(game, event->flags & 0xff, event->flags >> 8, event->id, (int)event->seq, (int)event->time);
+            return GAME_CHANGED_WORLD;
+        default:
+            return 0;
+    }
+}
@@ -0,0 +1,107 @@
+#ifndef GAME_STATE_H
+#define GAME_STATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "net_queue.h"
+#include "token_store.h"
+#include "motion.h"
+#include "fog.h"
+#include "pathfind.h"
+#include "message_log.h"
+
+// Everything the client knows about the table, and how inbound network
+// events change it.
+//
+// network_poll() hands every event it drains from the inbound queue (see
+// net_queue.h) to game_apply_event(): token updates go through the motion
+// tracker into the token store, fog runs into the fog grid and the walls of
+// the pathfinding grid, chat and dice lines into the logs, room events into
+// the room id and the logs. main.c draws from this state and edits it for
+// local input; the event handling itself has no raylib or Emscripten
+// dependency, so it builds natively and recorded sessions can be replayed
+// through it (bench/replay_bench.c).
+
+#define GAME_ID_SIZE 64
+#define GAME_CHAT_LOG_LINES 65536       // Dice and chat scrollback
+#define GAME_CHAT_LOG_ARENA (4u << 20)  // Bytes of text it holds
+#define GAME_ROOM_LOG_LINES 4096
+#define GAME_ROOM_LOG_ARENA (256u << 10)
+
+// What an event changed, so the caller knows what to redraw
+#define GAME_CHANGED_WORLD 1 // Tokens or fog
+#define GAME_CHANGED_UI 2    // Logs, room or connection state shown in the panel
+
+typedef struct GameState {
+    TokenStore tokens;
+    MotionTracker remoteMotion;    // Interpolates tokens dragged by other players
+    FogGrid fog;
+    PathGrid paths;                // Walls and token cells for movement range and drag paths
+
+    // Dice and chat lines of the room, with older ones paged in from the
+    // server as the view scrolls back; a line's detail is the tooltip shown
+    // on hover (the distribution summary of a roll, "" if none). The room log
+    // holds local events.
+    MessageLog chatLog;
+    MessageLog roomLog;
+    uint32_t historyOldest;        // Oldest history seq held, 0 if none
+    bool historyMore;              // The server may have older lines
+    bool historyPending;           // A history_request is unanswered
+
+    char clientId[GAME_ID_SIZE];
+    char roomId[GAME_ID_SIZE];     // "" outside a room
+    bool ready;                    // Connected and past init_state, messages may be sent
+    bool viewportUnsent;           // The server's idea of our view is out of date
+    int draggedTokenId;            // Token the local user holds, -1 if none
+} GameState;
+
+// cellSize is the grid size in world units, columns/rows the map size in cells
+void game_init(GameState* game, float cellSize, int columns, int rows);
+void game_free(GameState* game);
+
+// Applies one inbound event; nowMs is the local clock at arrival. Returns
+// GAME_CHANGED_* flags. Heartbeat replies are not game state and are ignored.
+int game_apply_event(GameState* game, const NetEvent* event, double nowMs);
+
+// Advances remotely dragged tokens to nowMs and moves their fog viewers and
+// pathfinding cells along. Returns the number of tokens still animating.
+int game_advance(GameState* game, double nowMs);
+
+// Adds a token, or repositions it if the id already exists, and puts its fog
+// viewer and pathfinding cell on it. Returns the stored token.
+Token* game_add_token(GameState* game, Token token);
+
+// Cell under a token's centre
+int game_token_cell_x(const GameState* game, const Token* token);
+int game_token_cell_y(const GameState* game, const Token* token);
+
+// Keeps a token's fog viewer and pathfinding cell on the cell under its
+// centre. Cheap when the token stays in its cell, so it is called on every
+// position change. The dragged token stays on its pathfinding cell until it
+// is dropped, so its movement range does not have to be searched again.
+void game_update_token_cell(GameState* game, const Token* token, bool local);
+
+// Fog runs from the network and from local wall editing; walls also block movement
+void game_apply_fog_run(GameState* game, int layer, int op, int row, int start, int length);
+
+void game_log_room(GameState* game, const char* message);
+
+// Recorded inbound traffic: a GameTraceHeader followed by one GameTraceRecord
+// per event, in the order network_poll() applied them. Events drained in the
+// same poll share timeMs. Records are the in-memory NetEvent layout, so a
+// trace is replayed on a machine of the same endianness.
+#define GAME_TRACE_MAGIC "RVTTRACE"
+#define GAME_TRACE_VERSION 2 // 2: NetEvent.detail
+
+typedef struct GameTraceHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;           // sizeof(GameTraceRecord)
+} GameTraceHeader;
+
+typedef struct GameTraceRecord {
+    double timeMs;                 // Local clock at arrival
+    NetEvent event;
+} GameTraceRecord;                 // 328 bytes
+
+#endif // GAME_STATE_H
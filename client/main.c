@@ -3,151 +3,208 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-
-#include <time.h>
+#include <math.h>
 
 #include "network.h"
+#include "game_state.h"
+#include "frame_stats.h"
+#include "map_view.h"
+#include "map_tiles.h"
+#include "sprite_atlas.h"
+#include "applog.h"
+#include "telemetry.h"
+#include "net_queue.h"
+
+#define HISTORY_PAGE_LINES 50        // Lines asked for per history_request
+#define HISTORY_PREFETCH_LINES 10    // Ask for older lines when the view gets this close to the oldest one
+#define LOG_WHEEL_LINES 3            // Lines scrolled per mouse wheel notch
+#define DICE_EXPR_SIZE 32
+#define DICE_EXPR_CHARS "0123456789dDkKhHlL!+-% " // Dice syntax only, so the JSON fallback needs no escaping
+#define DRAG_SEND_INTERVAL (1.0 / 15.0) // Seconds between streamed drag samples
+#define IDLE_SLEEP_MS 16 // How long an idle loop iteration yields to the browser
+#define MAP_COLUMNS 200  // Map size in grid cells
+#define MAP_ROWS 200
+#define ZOOM_STEP 1.1f             // Zoom factor per mouse wheel notch
+#define KEY_PAN_SPEED 600.0f       // Screen pixels per second for arrow key panning
+#define MIN_GRID_LINE_PIXELS 8.0f  // Coarser grid lines are drawn when cells get smaller than this
+#define MAP_TILES_URL "maps/default" // Tiled battle map (see tools/cut_tiles.py), fetched as needed
+#define PORTRAIT_SIZE 96           // Token portraits are packed into the sprite atlas at this size
+#define BATCH_QUAD_LIMIT 2048      // rlgl's default vertex batch on GLES2; more quads flush an extra draw call
+#define DEMO_TOKEN_BASE 1000000    // F3 spawns local-only tokens from this id, to load-test drawing
+#define DEMO_TOKEN_COUNT 100
+#define VIEWPORT_SEND_INTERVAL 0.2 // Seconds between viewport reports while the camera moves
+#define FOG_RUNS_PER_SEND 256      // Reveal runs drained per network_send_fog_runs() call
+
+GameState game; // Tokens, fog, paths, logs and room; large, so not on the stack
+MapTiles mapTiles; // Large (upload slots), so not on the stack
+SpriteAtlas tokenAtlas;
+
+// One token in the frame's draw list; sorted so tokens sharing a texture are
+// drawn back to back and raylib can batch them
+typedef struct TokenDraw {
+    Texture2D texture;
+    Rectangle source;
+    int index;   // Dense index in the token store, keeps stacking order within a batch
+    int onTop;   // The dragged token goes last
+} TokenDraw;
+
+static int compare_token_draws(const void* a, const void* b) {
+    const TokenDraw* da = (const TokenDraw*)a;
+    const TokenDraw* db = (const TokenDraw*)b;
+    if (da->onTop != db->onTop) return da->onTop - db->onTop;
+    if (da->texture.id != db->texture.id) return da->texture.id < db->texture.id ? -1 : 1;
+    return da->index - db->index;
+}
 
-#define MAX_TOKENS 5
-#define MAX_DICE_MESSAGES 5
-#define MAX_ROOM_LOG_MESSAGES 10
-
-// Define a simple Token structure
-typedef struct Token {
-    int id;
-    float x;
-    float y;
-    float width;
-    float height;
-} Token;
-
-Token tokens[MAX_TOKENS];
-int numTokens = 0;
+// Sprite atlas source: a token's portrait. Tokens do not carry portrait
+// images yet, so each gets the token sprite tinted with a colour of its own.
+static Image token_portrait(int key, void* user) {
+    Image portrait = ImageCopy(*(const Image*)user);
+    if (portrait.data == NULL) return portrait;
+    ImageResize(&portrait, PORTRAIT_SIZE, PORTRAIT_SIZE);
+    unsigned int hash = (unsigned int)key * 2654435761U;
+    ImageColorTint(&portrait, (Color){ 128 + (hash >> 25), 128 + ((hash >> 17) & 127), 128 + ((hash >> 9) & 127), 255 });
+    return portrait;
+}
 
-Token* draggedToken = NULL; // Pointer to the token currently being dragged
+// Fog overlay colour of a cell
+static Color fog_cell_color(int x, int y) {
+    if (!fog_bit(game.fog.revealed[y], x)) return (Color){ 20, 20, 28, 255 };
+    if (fog_bit(game.fog.walls[y], x)) return (Color){ 90, 64, 48, 255 };
+    if (!fog_bit(game.fog.visible[y], x)) return (Color){ 20, 20, 28, 150 };
+    return BLANK;
+}
 
-char diceRollMessages[MAX_DICE_MESSAGES][64];
-volatile int numDiceRollMessages = 0;
+uint32_t moveSeq = 0; // Sequence number of the last move sample we sent
+
+// A scrollable log panel. Only the rows in view are laid out and drawn.
+typedef struct LogView {
+    MessageLog* log;
+    Rectangle area;
+    int rowHeight;
+    int fontSize;
+    Color color;
+    uint32_t scroll;       // Rows scrolled back from the newest line
+    uint32_t seenAppended; // log->appended when scroll was last adjusted
+} LogView;
+
+// Render-on-demand: a frame is only drawn when something marked it dirty.
+// The UI panel is cached in a render texture and rebuilt when its contents change.
+bool frameDirty = true;
+bool uiLayerDirty = true;
+
+static int log_view_rows(const LogView* view) {
+    return (int)view->area.height / view->rowHeight;
+}
 
-char my_client_id[64]; // Store our own client ID
-// char current_room_id[64]; // Store the current room ID - Defined in network.c
+// Newest lines stay in view unless the user scrolled back; then the view
+// stays on the lines it shows while new ones arrive
+static void log_view_follow(LogView* view) {
+    uint32_t added = view->log->appended - view->seenAppended;
+    view->seenAppended = view->log->appended;
+    if (view->scroll > 0) view->scroll += added;
+    uint32_t rows = (uint32_t)log_view_rows(view);
+    uint32_t maxScroll = view->log->count > rows ? view->log->count - rows : 0;
+    if (view->scroll > maxScroll) view->scroll = maxScroll;
+}
 
-char roomLogMessages[MAX_ROOM_LOG_MESSAGES][128];
-volatile int numRoomLogMessages = 0;
+static bool log_view_scroll(LogView* view, int lines) {
+    uint32_t before = view->scroll;
+    view->scroll = lines < 0 && (uint32_t)-lines > view->scroll ? 0 : view->scroll + lines;
+    log_view_follow(view);
+    return view->scroll != before;
+}
 
-bool isNetworkReady = false; // Flag to indicate if network is ready to send messages
+// Index of the line drawn at screen point `point`, or -1. rowY receives its top.
+static int log_view_line_at(const LogView* view, Vector2 point, int* rowY) {
+    if (!CheckCollisionPointRec(point, view->area)) return -1;
+    int row = (int)(view->area.y + view->area.height - point.y) / view->rowHeight;
+    int64_t index = (int64_t)view->log->count - 1 - view->scroll - row;
+    if (row >= log_view_rows(view) || index < 0) return -1;
+    *rowY = (int)(view->area.y + view->area.height) - (row + 1) * view->rowHeight;
+    return (int)index;
+}
 
-// Function to add a message to the room log
-void addRoomLogMessage(const char* message) {
-    if (numRoomLogMessages < MAX_ROOM_LOG_MESSAGES) {
-        strncpy(roomLogMessages[numRoomLogMessages], message, 127);
-        roomLogMessages[numRoomLogMessages][127] = '\0';
-        numRoomLogMessages++;
-    } else {
-        // Shift messages up
-        for (int i = 0; i < MAX_ROOM_LOG_MESSAGES - 1; i++) {
-            strncpy(roomLogMessages[i], roomLogMessages[i+1], 127);
+// Measures how much of a line fits the view's width, once per line
+static void log_view_fit(const LogView* view, MessageLine* line) {
+    int width = (int)view->area.width;
+    if (line->fitWidth == width) return;
+    const char* text = message_log_text(view->log, line);
+    line->fitWidth = (uint16_t)width;
+    if (MeasureText(text, view->fontSize) <= width) {
+        line->fitLength = line->textLength;
+        return;
+    }
+    // Longest prefix that fits with an ellipsis
+    char buffer[MESSAGE_LOG_MAX_TEXT + 4];
+    int low = 0;
+    int high = line->textLength;
+    while (low < high) {
+        int mid = (low + high + 1) / 2;
+        memcpy(buffer, text, mid);
+        strcpy(buffer + mid, "...");
+        if (MeasureText(buffer, view->fontSize) <= width) {
+            low = mid;
+        } else {
+            high = mid - 1;
         }
-        strncpy(roomLogMessages[MAX_ROOM_LOG_MESSAGES - 1], message, 127);
-        roomLogMessages[MAX_ROOM_LOG_MESSAGES - 1][127] = '\0';
     }
+    line->fitLength = (uint16_t)low;
 }
 
-
-// Callback functions for network events
-void network_on_update_token(const char* sender_id, int id, float x, float y) {
-    char sender_id_str[64];
-    if (sender_id) {
-        strncpy(sender_id_str, sender_id, sizeof(sender_id_str) - 1);
-        sender_id_str[sizeof(sender_id_str) - 1] = '\0';
-    } else {
-        strncpy(sender_id_str, "(null)", sizeof(sender_id_str) - 1);
-        sender_id_str[sizeof(sender_id_str) - 1] = '\0';
-    }
-
-    bool found = false;
-    for (int i = 0; i < numTokens; i++) {
-        if (tokens[i].id == id) {
-            tokens[i].x = x;
-            tokens[i].y = y;
-            TraceLog(LOG_INFO, "Updating token %d to (%.2f, %.2f) from sender %s", id, x, y, sender_id_str);
-            found = true;
-            break;
+static void log_view_draw(const LogView* view) {
+    int rows = log_view_rows(view);
+    int bottom = (int)(view->area.y + view->area.height);
+    char buffer[MESSAGE_LOG_MAX_TEXT + 4];
+    for (int row = 0; row < rows; row++) {
+        int64_t index = (int64_t)view->log->count - 1 - view->scroll - row;
+        if (index < 0) break;
+        MessageLine* line = message_log_line(view->log, (uint32_t)index);
+        log_view_fit(view, line);
+        const char* text = message_log_text(view->log, line);
+        if (line->fitLength < line->textLength) {
+            memcpy(buffer, text, line->fitLength);
+            strcpy(buffer + line->fitLength, "...");
+            text = buffer;
         }
+        DrawText(text, (int)view->area.x, bottom - (row + 1) * view->rowHeight + 2, view->fontSize, view->color);
     }
-    if (!found) {
-        TraceLog(LOG_WARNING, "Token with ID %d not found for update from sender %s.", id, sender_id_str);
+    // Scroll bar once there is more than fits
+    if (view->log->count > (uint32_t)rows) {
+        float visibleShare = (float)rows / view->log->count;
+        float height = view->area.height * visibleShare;
+        float y = view->area.y + (view->area.height - height) * (1.0f - (float)view->scroll / (view->log->count - rows));
+        DrawRectangle((int)(view->area.x + view->area.width + 4), (int)y, 3, (int)(height < 4 ? 4 : height), Fade(DARKGRAY, 0.6f));
     }
 }
 
-void network_on_add_dice_roll_message(const char* sender_id, const char* message) {
-    char sender_id_str[64];
-    if (sender_id) {
-        strncpy(sender_id_str, sender_id, sizeof(sender_id_str) - 1);
-        sender_id_str[sizeof(sender_id_str) - 1] = '\0';
-    } else {
-        strncpy(sender_id_str, "(null)", sizeof(sender_id_str) - 1);
-        sender_id_str[sizeof(sender_id_str) - 1] = '\0';
+// Appends typed characters (only those in `allowed`, or any printable one if
+// NULL) and handles backspace. Returns true if the text changed.
+static bool edit_text_input(char* text, int* length, int capacity, const char* allowed) {
+    bool changed = false;
+    int key = GetCharPressed();
+    while (key > 0) {
+        if ((key >= 32) && (key <= 125) && (*length < capacity - 1) && (allowed == NULL || strchr(allowed, key) != NULL)) {
+            text[(*length)++] = (char)key;
+            text[*length] = '\0';
+            changed = true;
+        }
+        key = GetCharPressed();
     }
-    TraceLog(LOG_INFO, "Received dice roll message from %s: %s", sender_id_str, message);
-    if (numDiceRollMessages < MAX_DICE_MESSAGES) {
-        strncpy(diceRollMessages[numDiceRollMessages], message, 63);
-        diceRollMessages[numDiceRollMessages][63] = '\0';
-        numDiceRollMessages++;
-    } else {
-        // Shift messages up
-        for (int i = 0; i < MAX_DICE_MESSAGES - 1; i++) {
-            strncpy(diceRollMessages[i], diceRollMessages[i+1], 63);
-        }
-        strncpy(diceRollMessages[MAX_DICE_MESSAGES - 1], message, 63);
-        diceRollMessages[MAX_DICE_MESSAGES - 1][63] = '\0';
+    if (IsKeyPressed(KEY_BACKSPACE) && *length > 0) {
+        text[--(*length)] = '\0';
+        changed = true;
     }
-}
-
-void network_on_room_joined(const char* room_id) {
-    strncpy(current_room_id, room_id, sizeof(current_room_id) - 1);
-    current_room_id[sizeof(current_room_id) - 1] = '\0';
-    TraceLog(LOG_INFO, "Joined room: %s", current_room_id);
-    char log_msg[128];
-    sprintf(log_msg, "Joined room: %s", current_room_id);
-    addRoomLogMessage(log_msg);
-}
-
-void network_on_room_left() {
-    TraceLog(LOG_INFO, "Left room: %s", current_room_id);
-    char log_msg[128];
-    sprintf(log_msg, "Left room: %s", current_room_id);
-    addRoomLogMessage(log_msg);
-    current_room_id[0] = '\0'; // Clear room ID
-}
-
-void network_on_user_joined_room(const char* user_id) {
-    TraceLog(LOG_INFO, "User %s joined room %s", user_id, current_room_id);
-    char log_msg[128];
-    sprintf(log_msg, "User %s joined", user_id);
-    addRoomLogMessage(log_msg);
-}
-
-void network_on_user_left_room(const char* user_id) {
-    TraceLog(LOG_INFO, "User %s left room %s", user_id, current_room_id);
-    char log_msg[128];
-    sprintf(log_msg, "User %s left", user_id);
-    addRoomLogMessage(log_msg);
-}
-
-void network_on_ready() {
-    isNetworkReady = true;
-    TraceLog(LOG_INFO, "Network is ready to send messages.");
-    addRoomLogMessage("Network ready!");
+    return changed;
 }
 
 int main(void)
 {
-    TraceLog(LOG_INFO, "Initial my_client_id: %s", my_client_id);
+    APPLOG(APPLOG_DEBUG, APPLOG_NET, "Initial my_client_id: %s", my_client_id);
     char test_id[64];
     strncpy(test_id, "TEST_UUID_12345", sizeof(test_id) - 1);
     test_id[sizeof(test_id) - 1] = '\0';
-    TraceLog(LOG_INFO, "Strncpy test: %s", test_id);
+    APPLOG(APPLOG_DEBUG, APPLOG_NET, "Strncpy test: %s", test_id);
     const int screenWidth = 800;
     const int screenHeight = 450;
     const int gameScreenWidth = 600;
@@ -155,8 +212,18 @@ int main(void)
 
     Rectangle uiPanel = { gameScreenWidth, 0, screenWidth - gameScreenWidth, screenHeight };
 
-    Rectangle rollDiceButton = { uiPanel.x + 20, 60, uiPanel.width - 40, 40 };
-    const char* rollDiceText = "Roll Dice";
+    // Dice expression, rolled by the server ("2d20kh1+5", "4d6kh3", "3d6!")
+    Rectangle diceInputBox = { uiPanel.x + 20, 60, uiPanel.width - 110, 40 };
+    char diceInputText[DICE_EXPR_SIZE] = "1d20";
+    int diceInputTextLength = strlen(diceInputText);
+    bool diceInputBoxActive = false;
+    int hoveredLine = -1;      // Line of hoveredView under the mouse, for its tooltip
+    int hoveredLineY = 0;
+    const LogView* hoveredView = NULL;
+    bool rollDice = false; // Roll button clicked or Enter pressed in the expression box
+
+    Rectangle rollDiceButton = { uiPanel.x + uiPanel.width - 80, 60, 60, 40 };
+    const char* rollDiceText = "Roll";
 
     Rectangle endTurnButton = { uiPanel.x + 20, 110, uiPanel.width - 40, 40 };
     const char* endTurnText = "End Turn";
@@ -173,49 +240,208 @@ int main(void)
     Rectangle leaveRoomButton = { uiPanel.x + 20 + (uiPanel.width - 40) / 2 + 5, 220, (uiPanel.width - 40) / 2 - 5, 30 };
     const char* leaveRoomText = "Leave";
 
+    game_init(&game, (float)gridSize, MAP_COLUMNS, MAP_ROWS);
+
+    // Dice/chat and room logs; only the rows in view are drawn
+    LogView chatView = { &game.chatLog, { uiPanel.x + 20, 258, uiPanel.width - 40, 96 }, 16, 10, BLACK, 0, 0 };
+    LogView roomView = { &game.roomLog, { uiPanel.x + 20, 360, uiPanel.width - 40, 84 }, 14, 10, DARKGRAY, 0, 0 };
 
     InitWindow(screenWidth, screenHeight, "RayVTT");
 
-    Texture2D tokenTexture = LoadTexture("assets/token.png");
+    // Tokens are drawn from the sprite atlas; the plain texture is the fallback
+    // when a portrait cannot be packed
+    Image tokenImage = LoadImage("assets/token.png");
+    Texture2D tokenTexture = LoadTextureFromImage(tokenImage);
+    sprite_atlas_init(&tokenAtlas, token_portrait, &tokenImage);
+    TokenDraw* tokenDraws = NULL;
+    int tokenDrawCapacity = 0;
+    int tokenBatches = 0;
+    int tokenDrawCalls = 0;
+
+    // The map is drawn through a pan/zoom camera into the area left of the UI panel
+    Rectangle mapViewport = { 0, 0, gameScreenWidth, screenHeight };
+    MapView mapView;
+    map_view_init(&mapView, mapViewport, (float)(MAP_COLUMNS * gridSize), (float)(MAP_ROWS * gridSize));
+    map_tiles_open(&mapTiles, MAP_TILES_URL, (float)gridSize, MAP_TILE_DEFAULT_BUDGET);
+
+    // Fog of war, one texel per grid cell, updated a band of rows at a time
+    Image fogImage = GenImageColor(game.fog.width, game.fog.height, BLANK);
+    Texture2D fogTexture = LoadTextureFromImage(fogImage);
+    UnloadImage(fogImage);
+    SetTextureWrap(fogTexture, TEXTURE_WRAP_CLAMP);
+    Color* fogPixels = malloc(sizeof(Color) * game.fog.width * game.fog.height);
+    uint16_t fogRuns[FOG_RUNS_PER_SEND * 3];
+
+    // Movement range of the dragged token, one texel per grid cell like the
+    // fog, rebuilt only when its cost field is searched again
+    Image pathImage = GenImageColor(game.paths.width, game.paths.height, BLANK);
+    Texture2D pathTexture = LoadTextureFromImage(pathImage);
+    UnloadImage(pathImage);
+    SetTextureWrap(pathTexture, TEXTURE_WRAP_CLAMP);
+    Color* pathPixels = calloc(game.paths.width * game.paths.height, sizeof(Color));
+    const PathField* dragField = NULL;  // Field the range texture shows, NULL if none
+    uint32_t dragFieldVersion = 0;
+    int rangeMinY = 0;                   // Rows of pathPixels holding the range
+    int rangeMaxY = -1;
+    int dragPath[PATH_MOVE_RANGE + 1];   // Cells from the drag origin to the token
+    int dragPathLength = 0;
+    int dragTargetCell = -1;             // Cell dragPath was traced to
+    bool dragInReach = true;
+    double fogUpdateMs = 0.0;
+    bool wallMode = false;      // W held: clicks edit walls and the fog is see-through
+    bool wallPainting = false;
+    bool wallPaintValue = false;
+
+    // Static layers, rebuilt only when invalidated. The grid layer holds the
+    // visible part of the grid and is redrawn when the camera moves.
+    RenderTexture2D gridLayer = LoadRenderTexture(gameScreenWidth, screenHeight);
+    RenderTexture2D uiLayer = LoadRenderTexture((int)uiPanel.width, (int)uiPanel.height);
+    bool gridLayerDirty = true;
+    // Lets the UI code keep using screen coordinates while drawing into uiLayer
+    Camera2D uiLayerCamera = { { -uiPanel.x, 0 }, { 0, 0 }, 0.0f, 1.0f };
+
+    FrameStats frameStats;
+    bool showFrameStats = false;
+    bool showTelemetry = false;      // F4: network and frame time overlay
+    bool continuousRendering = false; // F1: redraw every frame like the old loop, for comparison
+    int activeMotionTracks = 0;
+    int tokensDrawn = 0;
+    int gridLinesDrawn = 0;
+    double previousLoopStart = GetTime();
 
     // Initialize sample tokens
-    numTokens = 3;
-    tokens[0] = (Token){ 0, 100, 100, (float)gridSize, (float)gridSize };
-    tokens[1] = (Token){ 1, 200, 150, (float)gridSize, (float)gridSize };
-    tokens[2] = (Token){ 2, 300, 200, (float)gridSize, (float)gridSize };
+    game_add_token(&game, (Token){ 0, 100, 100, (float)gridSize, (float)gridSize });
+    game_add_token(&game, (Token){ 1, 200, 150, (float)gridSize, (float)gridSize });
+    game_add_token(&game, (Token){ 2, 300, 200, (float)gridSize, (float)gridSize });
 
     bool isDragging = false;
     Vector2 dragOffset = { 0.0f, 0.0f };
+    double lastDragSendTime = 0.0;
+    double lastViewportSendTime = 0.0;
+    Vector2 lastSentPosition = { 0.0f, 0.0f };
+    Vector2 dragOrigin = { 0.0f, 0.0f }; // Where the dragged token was picked up
+    int dragOriginX = 0;                 // Its cell
+    int dragOriginY = 0;
 
     network_init("ws://localhost:8080");
-    TraceLog(LOG_INFO, "Client initialized. My ID: %s", my_client_id);
-
-    srand(time(NULL)); // Seed random number generator
+    APPLOG(APPLOG_INFO, APPLOG_NET, "Client initialized. My ID: %s", my_client_id);
 
     SetTargetFPS(60);
+    frame_stats_init(&frameStats, GetTime());
+    telemetry_init(&telemetry, GetTime());
 
     while (!WindowShouldClose())
     {
+        double loopStart = GetTime();
+        float loopDelta = (float)(loopStart - previousLoopStart);
+        if (loopDelta > 0.1f) loopDelta = 0.1f; // Do not jump after an idle stretch
+        previousLoopStart = loopStart;
+
+        // --- Network ---
+        // Apply everything that arrived since the last frame at one fixed point
+        int changes = network_poll(&game, GetTime() * 1000.0);
+        if (changes != 0) {
+            frameDirty = true;
+        }
+        if (changes & GAME_CHANGED_UI) {
+            uiLayerDirty = true;
+        }
+        // Map tiles decoded since the last frame go into the texture cache
+        if (map_tiles_poll(&mapTiles)) {
+            gridLayerDirty = true;
+            frameDirty = true;
+        }
+
         // --- Event Handling ---
+        if (IsKeyPressed(KEY_F1)) {
+            continuousRendering = !continuousRendering;
+            frameDirty = true;
+        }
+        if (IsKeyPressed(KEY_F2)) {
+            showFrameStats = !showFrameStats;
+            frameDirty = true;
+        }
+        if (IsKeyPressed(KEY_F4)) {
+            showTelemetry = !showTelemetry;
+            frameDirty = true;
+        }
+        if (IsKeyPressed(KEY_F6)) {
+            // Record inbound events for bench/replay_bench.c; stopping downloads the trace
+            if (network_trace_recording()) {
+                size_t events = network_trace_stop();
+                game_log_room(&game, TextFormat("Trace saved: %d events", (int)events));
+            } else {
+                network_trace_start();
+                game_log_room(&game, "Recording trace (F6 to stop)");
+            }
+            uiLayerDirty = true;
+        }
+        if (IsKeyPressed(KEY_F3)) {
+            // Local-only tokens with distinct portraits around the view centre,
+            // for measuring draw calls with a full table
+            static int demoTokens = 0;
+            int first = DEMO_TOKEN_BASE + demoTokens;
+            demoTokens += DEMO_TOKEN_COUNT;
+            for (int i = 0; i < DEMO_TOKEN_COUNT; i++) {
+                float x = mapView.camera.target.x + (float)((i % 10 - 5) * gridSize);
+                float y = mapView.camera.target.y + (float)((i / 10 - 5) * gridSize);
+                game_add_token(&game, (Token){ first + i, x, y, (float)gridSize, (float)gridSize });
+            }
+            APPLOG(APPLOG_INFO, APPLOG_UI, "Added %d demo tokens (%d total)", DEMO_TOKEN_COUNT, game.tokens.count);
+            frameDirty = true;
+        }
+
+        if (wallMode != (IsKeyDown(KEY_W) && !roomInputBoxActive && !diceInputBoxActive)) {
+            wallMode = !wallMode;
+            frameDirty = true;
+        }
+
+        // --- Camera ---
+        // Wheel zooms at the cursor, right or middle drag and the arrow keys pan
+        Vector2 mouseScreen = GetMousePosition();
+        bool mouseOverMap = CheckCollisionPointRec(mouseScreen, mapViewport);
+        bool cameraMoved = false;
+        float wheel = GetMouseWheelMove();
+        if (mouseOverMap && wheel != 0.0f) {
+            cameraMoved |= map_view_zoom_at(&mapView, mouseScreen, wheel > 0.0f ? ZOOM_STEP : 1.0f / ZOOM_STEP);
+        }
+        if (IsMouseButtonDown(MOUSE_BUTTON_RIGHT) || IsMouseButtonDown(MOUSE_BUTTON_MIDDLE)) {
+            Vector2 delta = GetMouseDelta();
+            if ((delta.x != 0.0f || delta.y != 0.0f) && (mouseOverMap || isDragging)) {
+                cameraMoved |= map_view_pan(&mapView, delta);
+            }
+        }
+        Vector2 keyPan = { 0.0f, 0.0f };
+        if (IsKeyDown(KEY_LEFT)) keyPan.x += KEY_PAN_SPEED * loopDelta;
+        if (IsKeyDown(KEY_RIGHT)) keyPan.x -= KEY_PAN_SPEED * loopDelta;
+        if (IsKeyDown(KEY_UP)) keyPan.y += KEY_PAN_SPEED * loopDelta;
+        if (IsKeyDown(KEY_DOWN)) keyPan.y -= KEY_PAN_SPEED * loopDelta;
+        if (keyPan.x != 0.0f || keyPan.y != 0.0f) {
+            cameraMoved |= map_view_pan(&mapView, keyPan);
+        }
+        if (cameraMoved) {
+            game.viewportUnsent = true;
+            gridLayerDirty = true;
+            frameDirty = true;
+        }
+
         if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT))
         {
+            uiLayerDirty = true; // Clicks can change focus or button state
             Vector2 mousePoint = GetMousePosition();
 
             // Check for UI Panel clicks first
             if (CheckCollisionPointRec(mousePoint, uiPanel))
             {
+                roomInputBoxActive = false;
+                diceInputBoxActive = false;
                 if (CheckCollisionPointRec(mousePoint, rollDiceButton))
                 {
-                    if (isNetworkReady) { // Only send if network is ready
-                        TraceLog(LOG_INFO, "Client %s sending dice roll message.", my_client_id);
-                        int roll = (rand() % 20) + 1;
-                        char message[128];
-                        sprintf(message, "{\"type\":\"dice_roll\",\"sender_id\":\"%s\",\"message\":\"Player rolled a d20: %d\"}", my_client_id, roll);
-                        TraceLog(LOG_INFO, "Sending dice roll message: %s", message);
-                        network_send(message);
-                    } else {
-                        TraceLog(LOG_WARNING, "Network not ready. Dice roll not sent.");
-                    }
+                    rollDice = true;
+                }
+                else if (CheckCollisionPointRec(mousePoint, diceInputBox))
+                {
+                    diceInputBoxActive = true;
                 }
                 else if (CheckCollisionPointRec(mousePoint, endTurnButton))
                 {
@@ -227,159 +453,528 @@ int main(void)
                 }
                 else if (CheckCollisionPointRec(mousePoint, joinRoomButton))
                 {
-                    if (isNetworkReady) { // Only send if network is ready
+                    if (game.ready) { // Only send if network is ready
                         network_join_room(roomInputText);
-                        roomInputBoxActive = false;
                     } else {
-                        TraceLog(LOG_WARNING, "Network not ready. Join room not sent.");
+                        APPLOG(APPLOG_WARN, APPLOG_UI, "Network not ready. Join room not sent.");
                     }
                 }
                 else if (CheckCollisionPointRec(mousePoint, leaveRoomButton))
                 {
-                    if (isNetworkReady) { // Only send if network is ready
+                    if (game.ready) { // Only send if network is ready
                         network_leave_room();
-                        roomInputBoxActive = false;
                     } else {
-                        TraceLog(LOG_WARNING, "Network not ready. Leave room not sent.");
+                        APPLOG(APPLOG_WARN, APPLOG_UI, "Network not ready. Leave room not sent.");
                     }
                 }
-                else {
-                    roomInputBoxActive = false;
-                }
             }
             // Check for game area clicks
+            else if (wallMode)
+            {
+                // Toggle the wall under the cursor; dragging paints the same value
+                Vector2 world = map_view_to_world(&mapView, mousePoint);
+                int cellX = (int)floorf(world.x / gridSize);
+                int cellY = (int)floorf(world.y / gridSize);
+                if (cellX >= 0 && cellY >= 0 && cellX < game.fog.width && cellY < game.fog.height) {
+                    wallPainting = true;
+                    wallPaintValue = !fog_bit(game.fog.walls[cellY], cellX);
+                }
+            }
             else
             {
-                if (isNetworkReady) { // Only allow token drag if network is ready
-                    for (int i = 0; i < numTokens; i++) {
-                        if (CheckCollisionPointRec(mousePoint, (Rectangle){ tokens[i].x, tokens[i].y, tokens[i].width, tokens[i].height }))
-                        {
-                            isDragging = true;
-                            draggedToken = &tokens[i];
-                            dragOffset.x = mousePoint.x - draggedToken->x;
-                            dragOffset.y = mousePoint.y - draggedToken->y;
-                            break;
-                        }
+                if (game.ready) { // Only allow token drag if network is ready
+                    mousePoint = map_view_to_world(&mapView, mousePoint);
+                    Token* picked = token_store_pick(&game.tokens, mousePoint.x, mousePoint.y);
+                    if (picked != NULL)
+                    {
+                        isDragging = true;
+                        game.draggedTokenId = picked->id;
+                        dragOffset.x = mousePoint.x - picked->x;
+                        dragOffset.y = mousePoint.y - picked->y;
+                        lastSentPosition = (Vector2){ picked->x, picked->y };
+                        dragOrigin = lastSentPosition;
+                        dragOriginX = game_token_cell_x(&game, picked);
+                        dragOriginY = game_token_cell_y(&game, picked);
+                        dragTargetCell = -1;
+                        motion_cancel(&game.remoteMotion, picked->id);
+                        network_set_held_token(picked->id);
                     }
                 } else {
-                    TraceLog(LOG_WARNING, "Network not ready. Token drag not allowed.");
+                    APPLOG(APPLOG_WARN, APPLOG_UI, "Network not ready. Token drag not allowed.");
                 }
             }
         }
 
-        if (roomInputBoxActive) {
-            int key = GetCharPressed();
-            while (key > 0) {
-                if ((key >= 32) && (key <= 125) && (roomInputTextLength < 63)) {
-                    roomInputText[roomInputTextLength] = (char)key;
-                    roomInputTextLength++;
-                }
-                key = GetCharPressed();
+        if (roomInputBoxActive && edit_text_input(roomInputText, &roomInputTextLength, sizeof(roomInputText), NULL)) {
+            uiLayerDirty = true;
+        }
+        if (diceInputBoxActive) {
+            if (edit_text_input(diceInputText, &diceInputTextLength, sizeof(diceInputText), DICE_EXPR_CHARS)) {
+                uiLayerDirty = true;
+            }
+            if (IsKeyPressed(KEY_ENTER)) {
+                rollDice = true;
+            }
+        }
+        if (rollDice) {
+            rollDice = false;
+            if (!game.ready) { // Only send if network is ready
+                APPLOG(APPLOG_WARN, APPLOG_UI, "Network not ready. Dice roll not sent.");
+            } else if (diceInputTextLength > 0) {
+                APPLOG(APPLOG_DEBUG, APPLOG_NET, "Client %s rolling %s", my_client_id, diceInputText);
+                network_send_roll_dice(diceInputText);
+            }
+        }
+
+        // --- Logs ---
+        // The wheel scrolls the log under the mouse; lines that arrived keep
+        // a scrolled-back view where it is
+        Vector2 mouse = GetMousePosition();
+        LogView* logViews[2] = { &chatView, &roomView };
+        for (int i = 0; i < 2; i++) {
+            if (wheel != 0.0f && CheckCollisionPointRec(mouse, logViews[i]->area)) {
+                if (log_view_scroll(logViews[i], wheel > 0.0f ? LOG_WHEEL_LINES : -LOG_WHEEL_LINES)) uiLayerDirty = true;
+            } else if (logViews[i]->seenAppended != logViews[i]->log->appended) {
+                log_view_follow(logViews[i]);
             }
-            if (IsKeyPressed(KEY_BACKSPACE)) {
-                if (roomInputTextLength > 0) {
-                    roomInputTextLength--;
-                    roomInputText[roomInputTextLength] = '\0';
+        }
+        // Page in older history once the view gets close to the oldest line held
+        if (game.ready && game.historyMore && !game.historyPending &&
+            chatView.scroll + log_view_rows(&chatView) + HISTORY_PREFETCH_LINES >= game.chatLog.count) {
+            network_send_history_request(game.historyOldest, HISTORY_PAGE_LINES);
+            game.historyPending = true;
+        }
+
+        // Line under the mouse; its distribution summary, or the whole text
+        // if it was cut, is drawn as a tooltip
+        int hovered = -1;
+        const LogView* hoveredIn = NULL;
+        for (int i = 0; i < 2 && hovered < 0; i++) {
+            int rowY;
+            int index = log_view_line_at(logViews[i], mouse, &rowY);
+            if (index < 0) continue;
+            MessageLine* line = message_log_line(logViews[i]->log, (uint32_t)index);
+            log_view_fit(logViews[i], line);
+            if (line->detailLength > 0 || line->fitLength < line->textLength) {
+                hovered = index;
+                hoveredIn = logViews[i];
+                hoveredLineY = rowY;
+            }
+        }
+        if (hovered != hoveredLine || hoveredIn != hoveredView || uiLayerDirty) {
+            hoveredLine = hovered;
+            hoveredView = hoveredIn;
+            frameDirty = true;
+        }
+
+
+        if (wallPainting) {
+            Vector2 world = map_view_to_world(&mapView, GetMousePosition());
+            int cellX = (int)floorf(world.x / gridSize);
+            int cellY = (int)floorf(world.y / gridSize);
+            if (cellX >= 0 && cellY >= 0 && cellX < game.fog.width && cellY < game.fog.height &&
+                fog_bit(game.fog.walls[cellY], cellX) != wallPaintValue) {
+                int op = wallPaintValue ? FOG_OP_SET : FOG_OP_CLEAR;
+                game_apply_fog_run(&game, FOG_LAYER_WALLS, op, cellY, cellX, 1);
+                if (game.ready) {
+                    uint16_t run[3] = { (uint16_t)cellY, (uint16_t)cellX, 1 };
+                    network_send_fog_runs(FOG_LAYER_WALLS, op, run, 1);
                 }
             }
+            if (!IsMouseButtonDown(MOUSE_BUTTON_LEFT)) {
+                wallPainting = false;
+            }
+        }
+
+        // Tell the server what we are looking at, so it only sends token
+        // updates from around the view
+        if (game.viewportUnsent && game.ready && GetTime() - lastViewportSendTime >= VIEWPORT_SEND_INTERVAL) {
+            Rectangle view = map_view_visible(&mapView);
+            network_send_viewport(view.x, view.y, view.width, view.height);
+            lastViewportSendTime = GetTime();
+            game.viewportUnsent = false;
         }
 
+        Token* draggedToken = isDragging ? token_store_find(&game.tokens, game.draggedTokenId) : NULL;
 
         if (IsMouseButtonReleased(MOUSE_BUTTON_LEFT))
         {
             if (isDragging && draggedToken != NULL) {
-                if (isNetworkReady) { // Only send if network is ready
-                    TraceLog(LOG_INFO, "Client %s sending move token message.", my_client_id);
-                    // Send token position to server
-                    char message[128];
-                    sprintf(message, "{\"type\":\"move_token\",\"sender_id\":\"%s\",\"id\":%d,\"x\":%.2f,\"y\":%.2f}", my_client_id, draggedToken->id, draggedToken->x, draggedToken->y);
-                    network_send(message);
+                // Out of reach: the token goes back where it was picked up
+                if (!dragInReach) {
+                    APPLOG(APPLOG_INFO, APPLOG_GAME, "Token %d is out of reach, moving it back", draggedToken->id);
+                    token_store_move(&game.tokens, game.draggedTokenId, dragOrigin.x, dragOrigin.y);
+                }
+                if (game.ready) { // Only send if network is ready
+                    APPLOG(APPLOG_DEBUG, APPLOG_NET, "Client %s sending move token message.", my_client_id);
+                    // Send the final token position to server
+                    network_send_move_token(draggedToken->id, draggedToken->x, draggedToken->y, ++moveSeq, (uint32_t)(GetTime() * 1000.0), true);
                 } else {
-                    TraceLog(LOG_WARNING, "Network not ready. Move token not sent.");
+                    APPLOG(APPLOG_WARN, APPLOG_UI, "Network not ready. Move token not sent.");
                 }
             }
+            if (isDragging) {
+                network_set_held_token(-1);
+            }
             isDragging = false;
+            game.draggedTokenId = -1;
+            if (draggedToken != NULL) {
+                game_update_token_cell(&game, draggedToken, true); // Now on its new pathfinding cell
+            }
             draggedToken = NULL;
+            dragField = NULL;
+            dragPathLength = 0;
+            frameDirty = true;
         }
 
         if (isDragging && draggedToken != NULL)
         {
-            Vector2 mousePoint = GetMousePosition();
-            draggedToken->x = mousePoint.x - dragOffset.x;
-            draggedToken->y = mousePoint.y - dragOffset.y;
+            Vector2 mousePoint = map_view_to_world(&mapView, GetMousePosition());
+            float newX = mousePoint.x - dragOffset.x;
+            float newY = mousePoint.y - dragOffset.y;
+
+            // Constrain token to the map
+            if (newX < 0) newX = 0;
+            if (newY < 0) newY = 0;
+            if (newX + draggedToken->width > mapView.worldWidth) newX = mapView.worldWidth - draggedToken->width;
+            if (newY + draggedToken->height > mapView.worldHeight) newY = mapView.worldHeight - draggedToken->height;
+            if (newX != draggedToken->x || newY != draggedToken->y) {
+                token_store_move(&game.tokens, game.draggedTokenId, newX, newY);
+                game_update_token_cell(&game, draggedToken, true);
+                frameDirty = true;
+            }
 
-            // Constrain token to game area
-            if (draggedToken->x < 0) draggedToken->x = 0;
-            if (draggedToken->y < 0) draggedToken->y = 0;
-            if (draggedToken->x + draggedToken->width > gameScreenWidth) draggedToken->x = gameScreenWidth - draggedToken->width;
-            if (draggedToken->y + draggedToken->height > screenHeight) draggedToken->y = screenHeight - draggedToken->height;
+            // Movement range from where the drag started, and the path to the
+            // cell under the token. The range is searched once per drag (or
+            // when a wall or token near it changes); moves only trace a path.
+            const PathField* field = path_field(&game.paths, game.draggedTokenId, dragOriginX, dragOriginY, PATH_MOVE_RANGE);
+            if (field != dragField || field->version != dragFieldVersion) {
+                for (int y = rangeMinY; y <= rangeMaxY; y++) {
+                    memset(&pathPixels[y * game.paths.width], 0, sizeof(Color) * game.paths.width);
+                }
+                int minY = rangeMinY < field->minY ? rangeMinY : field->minY;
+                int maxY = rangeMaxY > field->maxY ? rangeMaxY : field->maxY;
+                for (int y = field->minY; y <= field->maxY; y++) {
+                    for (int x = field->minX; x <= field->maxX; x++) {
+                        if (path_cost(&game.paths, field, x, y) != PATH_UNREACHED) {
+                            pathPixels[y * game.paths.width + x] = (Color){ 80, 160, 255, 70 };
+                        }
+                    }
+                }
+                UpdateTextureRec(pathTexture, (Rectangle){ 0, (float)minY, (float)game.paths.width, (float)(maxY - minY + 1) },
+                                 &pathPixels[minY * game.paths.width]);
+                rangeMinY = field->minY;
+                rangeMaxY = field->maxY;
+                dragField = field;
+                dragFieldVersion = field->version;
+                dragTargetCell = -1;
+                frameDirty = true;
+            }
+            int targetX = game_token_cell_x(&game, draggedToken);
+            int targetY = game_token_cell_y(&game, draggedToken);
+            if (targetY * game.paths.width + targetX != dragTargetCell) {
+                dragTargetCell = targetY * game.paths.width + targetX;
+                dragPathLength = path_trace(&game.paths, field, targetX, targetY, dragPath, PATH_MOVE_RANGE + 1);
+                dragInReach = dragPathLength > 0;
+                frameDirty = true;
+            }
+
+            // Stream intermediate positions, rate limited, so other players see the drag
+            double now = GetTime();
+            if (game.ready && now - lastDragSendTime >= DRAG_SEND_INTERVAL &&
+                (newX != lastSentPosition.x || newY != lastSentPosition.y)) {
+                network_send_move_token(game.draggedTokenId, newX, newY, ++moveSeq, (uint32_t)(now * 1000.0), false);
+                lastDragSendTime = now;
+                lastSentPosition = (Vector2){ newX, newY };
+            }
         }
 
-        BeginDrawing();
+        // Advance remotely dragged tokens. Keep drawing for one frame after the
+        // last track finishes so the final position is shown.
+        int motionTracks = game_advance(&game, GetTime() * 1000.0);
+        if (motionTracks > 0 || activeMotionTracks > 0) {
+            frameDirty = true;
+        }
+        activeMotionTracks = motionTracks;
 
-        ClearBackground(RAYWHITE);
+        // --- Fog of war ---
+        // Only viewers that moved to another cell this frame are recomputed
+        double fogStart = GetTime();
+        if (fog_update(&game.fog)) {
+            frameDirty = true;
+        }
+        if (game.fog.recomputed > 0) {
+            fogUpdateMs = (GetTime() - fogStart) * 1000.0;
+        }
+        // Cells our own drags revealed go to the server as runs
+        if (game.ready) {
+            int runCount;
+            while ((runCount = fog_take_reveal_runs(&game.fog, fogRuns, FOG_RUNS_PER_SEND)) > 0) {
+                network_send_fog_runs(FOG_LAYER_REVEALED, FOG_OP_SET, fogRuns, runCount);
+            }
+        }
 
-        // Draw grid
-        for (int i = 0; i <= gameScreenWidth; i += gridSize)
-        {
-            DrawLine(i, 0, i, screenHeight, LIGHTGRAY);
+        if (uiLayerDirty) {
+            frameDirty = true;
         }
-        for (int i = 0; i <= screenHeight; i += gridSize)
-        {
-            DrawLine(0, i, gameScreenWidth, i, LIGHTGRAY);
+        if (telemetry_tick(&telemetry, GetTime()) && showTelemetry) {
+            frameDirty = true;
         }
 
-        // Draw all tokens
-        for (int i = 0; i < numTokens; i++) {
-            DrawTexturePro(tokenTexture, 
-                         (Rectangle){ 0, 0, (float)tokenTexture.width, (float)tokenTexture.height }, 
-                         (Rectangle){ tokens[i].x, tokens[i].y, tokens[i].width, tokens[i].height }, 
-                         (Vector2){ 0, 0 }, 
-                         0.0f, 
-                         WHITE);
+        if (!frameDirty && !continuousRendering) {
+            // Nothing changed: skip the frame entirely and give the CPU back.
+            // PollInputEvents() is normally called by EndDrawing().
+            if (frame_stats_record(&frameStats, GetTime() - loopStart, false, GetTime()) && showFrameStats) {
+                frameDirty = true;
+            }
+            applog_flush();
+            emscripten_sleep(IDLE_SLEEP_MS);
+            PollInputEvents();
+            continue;
+        }
+        frameDirty = false;
+
+        // Only the visible part of the map is drawn
+        Rectangle visible = map_view_visible(&mapView);
+
+        // --- Cached layers ---
+        if (gridLayerDirty) {
+            // The viewport is at the screen origin, so the map camera also
+            // works inside the viewport-sized render texture
+            BeginTextureMode(gridLayer);
+            ClearBackground(GRAY); // Outside the map, when zoomed out past its edges
+            BeginMode2D(mapView.camera);
+            DrawRectangleRec(visible, RAYWHITE);
+            map_tiles_draw(&mapTiles, visible, mapView.camera.zoom);
+            float step = map_view_grid_step(&mapView, (float)gridSize, MIN_GRID_LINE_PIXELS);
+            gridLinesDrawn = 0;
+            for (float x = ceilf(visible.x / step) * step; x <= visible.x + visible.width; x += step)
+            {
+                DrawLineV((Vector2){ x, visible.y }, (Vector2){ x, visible.y + visible.height }, LIGHTGRAY);
+                gridLinesDrawn++;
+            }
+            for (float y = ceilf(visible.y / step) * step; y <= visible.y + visible.height; y += step)
+            {
+                DrawLineV((Vector2){ visible.x, y }, (Vector2){ visible.x + visible.width, y }, LIGHTGRAY);
+                gridLinesDrawn++;
+            }
+            EndMode2D();
+            EndTextureMode();
+            gridLayerDirty = false;
         }
 
-        // Draw UI Panel
-        DrawRectangleRec(uiPanel, Fade(LIGHTGRAY, 0.5f));
-        DrawText("UI PANEL", uiPanel.x + 20, 20, 20, DARKGRAY);
+        if (uiLayerDirty) {
+            BeginTextureMode(uiLayer);
+            BeginMode2D(uiLayerCamera);
+            ClearBackground(RAYWHITE);
+
+            // Draw UI Panel
+            DrawRectangleRec(uiPanel, Fade(LIGHTGRAY, 0.5f));
+            DrawText("UI PANEL", uiPanel.x + 20, 20, 20, DARKGRAY);
 
-        // Draw Buttons
-        DrawRectangleRec(rollDiceButton, WHITE);
-        DrawText(rollDiceText, rollDiceButton.x + 10, rollDiceButton.y + 10, 20, BLACK);
+            // Draw Buttons
+            DrawRectangleRec(diceInputBox, WHITE);
+            if (diceInputBoxActive) {
+                DrawRectangleLines((int)diceInputBox.x, (int)diceInputBox.y, (int)diceInputBox.width, (int)diceInputBox.height, RED);
+            }
+            DrawText(diceInputText, (int)diceInputBox.x + 5, (int)diceInputBox.y + 15, 10, BLACK);
+            DrawRectangleRec(rollDiceButton, WHITE);
+            DrawText(rollDiceText, rollDiceButton.x + 10, rollDiceButton.y + 10, 20, BLACK);
+
+            DrawRectangleRec(endTurnButton, WHITE);
+            DrawText(endTurnText, endTurnButton.x + 10, endTurnButton.y + 10, 20, BLACK);
+
+            // Draw Room Management UI
+            DrawText(TextFormat("Current Room: %s", game.roomId), uiPanel.x + 20, 160, 10, BLACK);
+            DrawRectangleRec(roomInputBox, WHITE);
+            if (roomInputBoxActive) {
+                DrawRectangleLines((int)roomInputBox.x, (int)roomInputBox.y, (int)roomInputBox.width, (int)roomInputBox.height, RED);
+            }
+            DrawText(roomInputText, (int)roomInputBox.x + 5, (int)roomInputBox.y + 8, 10, BLACK);
+
+            DrawRectangleRec(joinRoomButton, WHITE);
+            DrawText(joinRoomText, joinRoomButton.x + 10, joinRoomButton.y + 10, 20, BLACK);
+
+            DrawRectangleRec(leaveRoomButton, WHITE);
+            DrawText(leaveRoomText, leaveRoomButton.x + 10, leaveRoomButton.y + 10, 20, BLACK);
 
-        DrawRectangleRec(endTurnButton, WHITE);
-        DrawText(endTurnText, endTurnButton.x + 10, endTurnButton.y + 10, 20, BLACK);
+            // Dice/chat and room logs, the rows in view only
+            log_view_draw(&chatView);
+            log_view_draw(&roomView);
 
-        // Draw Room Management UI
-        DrawText(TextFormat("Current Room: %s", current_room_id), uiPanel.x + 20, 160, 10, BLACK);
-        DrawRectangleRec(roomInputBox, WHITE);
-        if (roomInputBoxActive) {
-            DrawRectangleLines((int)roomInputBox.x, (int)roomInputBox.y, (int)roomInputBox.width, (int)roomInputBox.height, RED);
+            EndMode2D();
+            EndTextureMode();
+            uiLayerDirty = false;
         }
-        DrawText(roomInputText, (int)roomInputBox.x + 5, (int)roomInputBox.y + 8, 10, BLACK);
 
-        DrawRectangleRec(joinRoomButton, WHITE);
-        DrawText(joinRoomText, joinRoomButton.x + 10, joinRoomButton.y + 10, 20, BLACK);
+        BeginDrawing();
+
+        // The cached layers are not fully opaque where they were blended, so
+        // still start from a known background
+        ClearBackground(RAYWHITE);
+
+        // Render textures are stored bottom-up, hence the negative source heights
+        DrawTextureRec(gridLayer.texture, (Rectangle){ 0, 0, (float)gridLayer.texture.width, (float)-gridLayer.texture.height }, (Vector2){ 0, 0 }, WHITE);
 
-        DrawRectangleRec(leaveRoomButton, WHITE);
-        DrawText(leaveRoomText, leaveRoomButton.x + 10, leaveRoomButton.y + 10, 20, BLACK);
+        // Refresh the fog texture rows that changed
+        int fogMinRow, fogMaxRow;
+        if (fog_take_dirty_rows(&game.fog, &fogMinRow, &fogMaxRow)) {
+            for (int y = fogMinRow; y <= fogMaxRow; y++) {
+                for (int x = 0; x < game.fog.width; x++) {
+                    fogPixels[y * game.fog.width + x] = fog_cell_color(x, y);
+                }
+            }
+            UpdateTextureRec(fogTexture, (Rectangle){ 0, (float)fogMinRow, (float)game.fog.width, (float)(fogMaxRow - fogMinRow + 1) },
+                             &fogPixels[fogMinRow * game.fog.width]);
+        }
+
+        // Draw the tokens in view, grouped by texture. Atlas portraits all
+        // share one texture, so a table full of them is a single batch; within
+        // a batch tokens keep store order so overlaps stack as before.
+        sprite_atlas_begin_frame(&tokenAtlas);
+        const int* visibleTokens = token_store_query(&game.tokens, visible.x, visible.y, visible.width, visible.height, &tokensDrawn);
+        if (tokensDrawn > tokenDrawCapacity) {
+            tokenDrawCapacity = tokensDrawn * 2;
+            tokenDraws = realloc(tokenDraws, sizeof(TokenDraw) * tokenDrawCapacity);
+        }
+        // A repack moves every sprite, so if one happens part way through,
+        // look the earlier tokens up again (they all fit after the repack)
+        int rebuildsBefore = tokenAtlas.rebuilds;
+        for (int i = 0; i < tokensDrawn; i++) {
+            if (tokenAtlas.rebuilds != rebuildsBefore) {
+                rebuildsBefore = tokenAtlas.rebuilds;
+                i = 0;
+            }
+            const Token* token = &game.tokens.tokens[visibleTokens[i]];
+            TokenDraw* draw = &tokenDraws[i];
+            draw->index = visibleTokens[i];
+            draw->onTop = token->id == game.draggedTokenId;
+            if (sprite_atlas_get(&tokenAtlas, token->id, &draw->source)) {
+                draw->texture = tokenAtlas.texture;
+            } else {
+                draw->texture = tokenTexture;
+                draw->source = (Rectangle){ 0, 0, (float)tokenTexture.width, (float)tokenTexture.height };
+            }
+        }
+        qsort(tokenDraws, tokensDrawn, sizeof(TokenDraw), compare_token_draws);
+
+        BeginScissorMode((int)mapViewport.x, (int)mapViewport.y, (int)mapViewport.width, (int)mapViewport.height);
+        BeginMode2D(mapView.camera);
+        tokenBatches = 0;
+        tokenDrawCalls = 0;
+        int batchQuads = 0;
+        for (int i = 0; i < tokensDrawn; i++) {
+            const TokenDraw* draw = &tokenDraws[i];
+            const Token* token = &game.tokens.tokens[draw->index];
+            // A texture switch or a full vertex batch makes raylib flush a draw call
+            if (i == 0 || draw->texture.id != tokenDraws[i - 1].texture.id) {
+                tokenBatches++;
+                tokenDrawCalls++;
+                batchQuads = 0;
+            } else if (batchQuads == BATCH_QUAD_LIMIT) {
+                tokenDrawCalls++;
+                batchQuads = 0;
+            }
+            batchQuads++;
+            DrawTexturePro(draw->texture, draw->source,
+                           (Rectangle){ token->x, token->y, token->width, token->height },
+                           (Vector2){ 0, 0 }, 0.0f, WHITE);
+        }
+        DrawTexturePro(fogTexture, (Rectangle){ 0, 0, (float)game.fog.width, (float)game.fog.height },
+                       (Rectangle){ 0, 0, (float)(game.fog.width * gridSize), (float)(game.fog.height * gridSize) },
+                       (Vector2){ 0, 0 }, 0.0f, wallMode ? Fade(WHITE, 0.4f) : WHITE);
+        if (dragField != NULL) {
+            // Movement range and the path the dragged token takes, or its
+            // cell in red if it cannot get there
+            DrawTexturePro(pathTexture, (Rectangle){ 0, 0, (float)game.paths.width, (float)game.paths.height },
+                           (Rectangle){ 0, 0, (float)(game.paths.width * gridSize), (float)(game.paths.height * gridSize) },
+                           (Vector2){ 0, 0 }, 0.0f, WHITE);
+            for (int i = 1; i < dragPathLength; i++) {
+                Vector2 from = { (dragPath[i - 1] % game.paths.width + 0.5f) * gridSize, (dragPath[i - 1] / game.paths.width + 0.5f) * gridSize };
+                Vector2 to = { (dragPath[i] % game.paths.width + 0.5f) * gridSize, (dragPath[i] / game.paths.width + 0.5f) * gridSize };
+                DrawLineEx(from, to, 4.0f / mapView.camera.zoom, DARKBLUE);
+            }
+            if (!dragInReach && dragTargetCell >= 0) {
+                DrawRectangleLinesEx((Rectangle){ (float)(dragTargetCell % game.paths.width * gridSize), (float)(dragTargetCell / game.paths.width * gridSize),
+                                                  (float)gridSize, (float)gridSize }, 3.0f / mapView.camera.zoom, RED);
+            }
+        }
+        EndMode2D();
+        EndScissorMode();
+
+        DrawTextureRec(uiLayer.texture, (Rectangle){ 0, 0, (float)uiLayer.texture.width, (float)-uiLayer.texture.height }, (Vector2){ uiPanel.x, uiPanel.y }, WHITE);
+
+        if (hoveredView != NULL && hoveredLine >= 0 && (uint32_t)hoveredLine < hoveredView->log->count) {
+            // Tooltip left of the panel, which is too narrow for it
+            const MessageLine* line = message_log_line(hoveredView->log, (uint32_t)hoveredLine);
+            const char* tip = line->detailLength > 0 ? message_log_detail(hoveredView->log, line) : message_log_text(hoveredView->log, line);
+            int width = MeasureText(tip, 10) + 10;
+            DrawRectangle((int)uiPanel.x - width, hoveredLineY, width, 16, Fade(BLACK, 0.8f));
+            DrawText(tip, (int)uiPanel.x - width + 5, hoveredLineY + 3, 10, WHITE);
+        }
 
-        // Draw Dice Roll Messages
-        for (int i = 0; i < numDiceRollMessages; i++) {
-            DrawText(diceRollMessages[i], uiPanel.x + 20, 260 + (i * 20), 10, BLACK);
+        if (showFrameStats) {
+            DrawRectangle(5, 5, 300, 116, Fade(BLACK, 0.6f));
+            DrawText(TextFormat("%s  frames/s %.0f  loops/s %.0f", continuousRendering ? "continuous" : "on-demand",
+                                frameStats.framesPerSecond, frameStats.loopsPerSecond), 10, 10, 10, WHITE);
+            DrawText(TextFormat("work/frame %.2f ms (max %.2f)  busy %.1f%%",
+                                frameStats.avgFrameWorkMs, frameStats.maxFrameWorkMs, frameStats.busyPercent), 10, 28, 10, WHITE);
+            DrawText(TextFormat("zoom %.2f  tokens drawn %d/%d  grid lines %d",
+                                mapView.camera.zoom, tokensDrawn, game.tokens.count, gridLinesDrawn), 10, 46, 10, WHITE);
+            DrawText(TextFormat("map tiles %d (+%d loading)  cache %.1f/%.0f MB  evicted %d  held %d",
+                                mapTiles.tilesDrawn, mapTiles.tilesMissing, mapTiles.cachedBytes / 1048576.0,
+                                mapTiles.budgetBytes / 1048576.0, mapTiles.evictions, mapTiles.tilesHeld), 10, 64, 10, WHITE);
+            DrawText(TextFormat("token draw calls %d in %d batch(es)  atlas %d sprites, %d repacks, %d unbatched",
+                                tokenDrawCalls, tokenBatches, tokenAtlas.count, tokenAtlas.rebuilds, tokenAtlas.misses), 10, 82, 10, WHITE);
+            DrawText(TextFormat("fog %d viewers  last recompute %.3f ms%s",
+                                game.fog.viewerCount, fogUpdateMs, wallMode ? "  [wall edit]" : ""), 10, 100, 10, WHITE);
         }
 
-        // Draw Room Log Messages
-        for (int i = 0; i < numRoomLogMessages; i++) {
-            DrawText(roomLogMessages[i], uiPanel.x + 20, 360 + (i * 15), 10, DARKGRAY);
+        if (showTelemetry) {
+            const TelemetryHistogram* rtt = &telemetry.rttMs;
+            const TelemetryHistogram* frame = &telemetry.frameMs;
+            int y = screenHeight - 77;
+            DrawRectangle(5, y - 5, 330, 77, Fade(BLACK, 0.6f));
+            DrawText(TextFormat("rtt %.1f ms  p50 %.1f  p99 %.1f  max %.1f  (%u pings)",
+                                rtt->last, telemetry_histogram_quantile(rtt, 0.5), telemetry_histogram_quantile(rtt, 0.99),
+                                rtt->max, rtt->count), 10, y, 10, WHITE);
+            DrawText(TextFormat("frame %.2f ms  p50 %.2f  p99 %.2f  max %.2f",
+                                frame->last, telemetry_histogram_quantile(frame, 0.5), telemetry_histogram_quantile(frame, 0.99),
+                                frame->max), 10, y + 18, 10, WHITE);
+            DrawText(TextFormat("in %.0f msg/s %.1f KB/s  out %.0f msg/s %.1f KB/s",
+                                telemetry.messagesInPerSecond, telemetry.bytesInPerSecond / 1024.0f,
+                                telemetry.messagesOutPerSecond, telemetry.bytesOutPerSecond / 1024.0f), 10, y + 36, 10, WHITE);
+            DrawText(TextFormat("inbound queue max %d/%d  spilled %d",
+                                telemetry.maxQueueDepth, NET_QUEUE_CAPACITY, telemetry.maxQueueSpilled), 10, y + 54, 10, WHITE);
         }
 
+        // Measured before EndDrawing(), which also waits for the target frame rate
+        double frameWork = GetTime() - loopStart;
+        telemetry_histogram_add(&telemetry.frameMs, frameWork * 1000.0);
+        if (frame_stats_record(&frameStats, frameWork, true, GetTime()) && showFrameStats) {
+            frameDirty = true;
+        }
 
         EndDrawing();
+
+        // Write out this iteration's log lines in one batch
+        applog_flush();
     }
 
+    map_tiles_close(&mapTiles);
+    UnloadTexture(fogTexture);
+    free(fogPixels);
+    UnloadTexture(pathTexture);
+    free(pathPixels);
+    UnloadRenderTexture(uiLayer);
+    UnloadRenderTexture(gridLayer);
+    free(tokenDraws);
+    sprite_atlas_free(&tokenAtlas);
     UnloadTexture(tokenTexture);
+    UnloadImage(tokenImage);
+    game_free(&game);
     network_close();
+    applog_flush();
     CloseWindow();
 
     return 0;
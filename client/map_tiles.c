@@ -0,0 +1,490 @@
+#include "map_tiles.h"
+#include <math.h>
+#include <string.h>
+#include "applog.h"
+
+#define MAX_IN_FLIGHT 6 // Concurrent tile fetches
+#define EMPTY_SLOT -1
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten/emscripten.h>
+
+// Fetches the manifest and sets up the tile loader. Tiles are fetched and
+// decoded in a worker (createImageBitmap + OffscreenCanvas), or with
+// createImageBitmap on the page where workers cannot use OffscreenCanvas;
+// either way the main loop only ever sees finished RGBA pixels.
+EM_JS(void, js_map_tiles_open_internal, (const char* base_cstr, MapTileInfo* info, MapTileUpload* uploads, int slotCount, int maxInFlight), {
+    var base = UTF8ToString(base_cstr);
+    if (base.charAt(base.length - 1) !== "/") base += "/";
+    base = new URL(base, location.href).href; // Workers resolve relative URLs against their blob: URL
+    var UPLOAD_SIZE = 16 + 256 * 256 * 4;
+    var format = "png";
+    var queue = [];              // Keys wanted by the last draw, in priority order
+    var pending = new Set();     // Keys being fetched, decoded or waiting for a slot
+    var failed = new Set();
+    var decoded = [];            // Finished tiles waiting for a free upload slot
+    var slotKeys = [];
+    var inFlight = 0;
+
+    function decodeTile(url) {
+        return fetch(url).then(function (response) {
+            if (!response.ok) throw new Error("HTTP " + response.status + " for " + url);
+            return response.blob();
+        }).then(function (blob) {
+            return createImageBitmap(blob);
+        }).then(function (bitmap) {
+            var width = bitmap.width;
+            var height = bitmap.height;
+            var canvas = typeof OffscreenCanvas !== "undefined" ? new OffscreenCanvas(width, height) : document.createElement("canvas");
+            canvas.width = width;
+            canvas.height = height;
+            var context = canvas.getContext("2d");
+            context.drawImage(bitmap, 0, 0);
+            if (bitmap.close) bitmap.close();
+            return { width: width, height: height, data: context.getImageData(0, 0, width, height).data };
+        });
+    }
+
+    function onWorkerMessage(event) {
+        var key = event.data.key;
+        decodeTile(event.data.url).then(function (tile) {
+            self.postMessage({ key: key, width: tile.width, height: tile.height, data: tile.data.buffer }, [tile.data.buffer]);
+        }, function (error) {
+            self.postMessage({ key: key, error: String(error) });
+        });
+    }
+
+    var worker = null;
+    if (typeof Worker !== "undefined" && typeof OffscreenCanvas !== "undefined") {
+        var source = "var decodeTile = " + decodeTile.toString() + "; self.onmessage = " + onWorkerMessage.toString() + ";";
+        worker = new Worker(URL.createObjectURL(new Blob([source], { type: "text/javascript" })));
+        worker.onmessage = function (event) {
+            onDecoded(event.data.key, event.data.error ? null : { width: event.data.width, height: event.data.height, data: new Uint8Array(event.data.data) }, event.data.error);
+        };
+    }
+
+    function tileUrl(key) {
+        var level = key >>> 28;
+        var ty = (key >>> 14) & 0x3fff;
+        var tx = key & 0x3fff;
+        return base + level + "/" + tx + "_" + ty + "." + format;
+    }
+
+    // Copies decoded tiles into free upload slots; returns how many were placed
+    function fillSlots() {
+        var placed = 0;
+        for (var i = 0; i < slotCount && decoded.length > 0; i++) {
+            var slot = uploads + i * UPLOAD_SIZE;
+            if (HEAP32[slot >> 2] !== 0) continue;
+            if (slotKeys[i] !== undefined) {
+                pending.delete(slotKeys[i]); // Uploaded by the main loop since we last looked
+                slotKeys[i] = undefined;
+            }
+            var tile = decoded.shift();
+            HEAPU8.set(tile.data, slot + 16);
+            HEAP32[(slot + 4) >> 2] = tile.key;
+            HEAP32[(slot + 8) >> 2] = tile.width;
+            HEAP32[(slot + 12) >> 2] = tile.height;
+            HEAP32[slot >> 2] = 1;
+            slotKeys[i] = tile.key;
+            placed++;
+        }
+        return placed;
+    }
+
+    function onDecoded(key, tile, error) {
+        inFlight--;
+        if (tile && tile.width <= 256 && tile.height <= 256) {
+            tile.key = key;
+            decoded.push(tile);
+            fillSlots();
+        } else {
+            pending.delete(key);
+            failed.add(key);
+            console.warn("Map tile " + tileUrl(key) + " failed: " + (error || "bad size"));
+        }
+        pump();
+    }
+
+    function pump() {
+        while (inFlight < maxInFlight && queue.length > 0) {
+            var key = queue.shift();
+            if (pending.has(key) || failed.has(key)) continue;
+            pending.add(key);
+            inFlight++;
+            if (worker) {
+                worker.postMessage({ key: key, url: tileUrl(key) });
+            } else {
+                (function (key) {
+                    decodeTile(tileUrl(key)).then(function (tile) { onDecoded(key, tile, null); }, function (error) { onDecoded(key, null, String(error)); });
+                })(key);
+            }
+        }
+    }
+
+    window.rayvttMapTiles = {
+        begin: function () {
+            queue.length = 0;
+        },
+        request: function (key) {
+            if (!pending.has(key) && !failed.has(key)) queue.push(key);
+        },
+        end: pump,
+        refill: function () {
+            for (var i = 0; i < slotCount; i++) {
+                if (slotKeys[i] !== undefined && HEAP32[(uploads + i * UPLOAD_SIZE) >> 2] === 0) {
+                    pending.delete(slotKeys[i]);
+                    slotKeys[i] = undefined;
+                }
+            }
+            return fillSlots();
+        }
+    };
+
+    fetch(base + "manifest.json").then(function (response) {
+        if (!response.ok) throw new Error("HTTP " + response.status);
+        return response.json();
+    }).then(function (manifest) {
+        format = manifest.format || "png";
+        HEAP32[(info + 4) >> 2] = manifest.width;
+        HEAP32[(info + 8) >> 2] = manifest.height;
+        HEAP32[(info + 12) >> 2] = manifest.levels;
+        HEAPF32[(info + 16) >> 2] = manifest.cellPixels || 0;
+        HEAP32[info >> 2] = 1;
+    }).catch(function (error) {
+        console.warn("No map at " + base + ": " + error);
+        HEAP32[info >> 2] = 2;
+    });
+});
+
+EM_JS(void, js_map_tiles_begin_internal, (), {
+    if (window.rayvttMapTiles) window.rayvttMapTiles.begin();
+});
+
+EM_JS(void, js_map_tiles_request_internal, (int key), {
+    window.rayvttMapTiles.request(key >>> 0);
+});
+
+EM_JS(void, js_map_tiles_end_internal, (), {
+    if (window.rayvttMapTiles) window.rayvttMapTiles.end();
+});
+
+EM_JS(int, js_map_tiles_refill_internal, (), {
+    return window.rayvttMapTiles ? window.rayvttMapTiles.refill() : 0;
+});
+#endif
+
+static unsigned int hash_key(unsigned int x) {
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+static int make_key(int level, int tx, int ty) {
+    return (int)(((unsigned int)level << 28) | ((unsigned int)ty << 14) | (unsigned int)tx);
+}
+
+static int key_level(int key) {
+    return (int)((unsigned int)key >> 28);
+}
+
+// --- key -> entry map (linear probing, backward-shift deletion) ---
+
+#define SLOT_MASK (MAP_TILE_CACHE_ENTRIES * 2 - 1)
+
+static int find_entry(const MapTiles* tiles, int key) {
+    unsigned int slot = hash_key((unsigned int)key) & SLOT_MASK;
+    while (tiles->slots[slot] != EMPTY_SLOT) {
+        if (tiles->entries[tiles->slots[slot]].key == key) return tiles->slots[slot];
+        slot = (slot + 1) & SLOT_MASK;
+    }
+    return -1;
+}
+
+static void insert_slot(MapTiles* tiles, int key, int entry) {
+    unsigned int slot = hash_key((unsigned int)key) & SLOT_MASK;
+    while (tiles->slots[slot] != EMPTY_SLOT) {
+        slot = (slot + 1) & SLOT_MASK;
+    }
+    tiles->slots[slot] = entry;
+}
+
+static void remove_slot(MapTiles* tiles, int key) {
+    unsigned int hole = hash_key((unsigned int)key) & SLOT_MASK;
+    while (tiles->entries[tiles->slots[hole]].key != key) {
+        hole = (hole + 1) & SLOT_MASK;
+    }
+    unsigned int next = (hole + 1) & SLOT_MASK;
+    while (tiles->slots[next] != EMPTY_SLOT) {
+        unsigned int home = hash_key((unsigned int)tiles->entries[tiles->slots[next]].key) & SLOT_MASK;
+        // Shift the entry back if the hole lies between its home slot and its current slot
+        if (((next - home) & SLOT_MASK) >= ((next - hole) & SLOT_MASK)) {
+            tiles->slots[hole] = tiles->slots[next];
+            hole = next;
+        }
+        next = (next + 1) & SLOT_MASK;
+    }
+    tiles->slots[hole] = EMPTY_SLOT;
+}
+
+// --- LRU list ---
+
+static void lru_unlink(MapTiles* tiles, int entry) {
+    MapTileEntry* e = &tiles->entries[entry];
+    if (e->lruPrev >= 0) tiles->entries[e->lruPrev].lruNext = e->lruNext; else tiles->lruHead = e->lruNext;
+    if (e->lruNext >= 0) tiles->entries[e->lruNext].lruPrev = e->lruPrev; else tiles->lruTail = e->lruPrev;
+    e->lruPrev = e->lruNext = -1;
+}
+
+static void lru_push_front(MapTiles* tiles, int entry) {
+    MapTileEntry* e = &tiles->entries[entry];
+    e->lruPrev = -1;
+    e->lruNext = tiles->lruHead;
+    if (tiles->lruHead >= 0) tiles->entries[tiles->lruHead].lruPrev = entry;
+    tiles->lruHead = entry;
+    if (tiles->lruTail < 0) tiles->lruTail = entry;
+}
+
+static void touch(MapTiles* tiles, int entry) {
+    if (tiles->lruHead == entry) return;
+    lru_unlink(tiles, entry);
+    lru_push_front(tiles, entry);
+}
+
+static void evict(MapTiles* tiles, int entry) {
+    MapTileEntry* e = &tiles->entries[entry];
+    remove_slot(tiles, e->key);
+    lru_unlink(tiles, entry);
+    UnloadTexture(e->texture);
+    tiles->cachedBytes -= (size_t)e->bytes;
+    e->key = -1;
+    tiles->freeEntries[tiles->freeCount++] = entry;
+    tiles->evictions++;
+}
+
+// Frees the least recently drawn tiles until `bytes` more fit in the budget.
+// The coarsest level is never evicted: it is what missing tiles fall back to.
+// Returns false if they still do not fit, i.e. only pinned tiles are left.
+static bool make_room(MapTiles* tiles, size_t bytes) {
+    int entry = tiles->lruTail;
+    while (entry >= 0 && (tiles->freeCount == 0 || tiles->cachedBytes + bytes > tiles->budgetBytes)) {
+        int prev = tiles->entries[entry].lruPrev;
+        if (key_level(tiles->entries[entry].key) != tiles->info.levels - 1) {
+            evict(tiles, entry);
+        }
+        entry = prev;
+    }
+    return tiles->freeCount > 0 && tiles->cachedBytes + bytes <= tiles->budgetBytes;
+}
+
+// Call after make_room(); there must be a free entry
+static void cache_insert(MapTiles* tiles, int key, Texture2D texture, int bytes) {
+    int entry = tiles->freeEntries[--tiles->freeCount];
+    MapTileEntry* e = &tiles->entries[entry];
+    e->key = key;
+    e->texture = texture;
+    e->bytes = bytes;
+    insert_slot(tiles, key, entry);
+    lru_push_front(tiles, entry);
+    tiles->cachedBytes += (size_t)bytes;
+}
+
+void map_tiles_open(MapTiles* tiles, const char* baseUrl, float gridSize, size_t budgetBytes) {
+    memset(&tiles->info, 0, sizeof(tiles->info));
+    memset(tiles->slots, 0xff, sizeof(tiles->slots));
+    for (int i = 0; i < MAP_TILE_CACHE_ENTRIES; i++) {
+        tiles->entries[i].key = -1;
+        tiles->entries[i].lruPrev = tiles->entries[i].lruNext = -1;
+        tiles->freeEntries[i] = MAP_TILE_CACHE_ENTRIES - 1 - i;
+    }
+    for (int i = 0; i < MAP_TILE_UPLOAD_SLOTS; i++) {
+        tiles->uploads[i].state = MAP_UPLOAD_FREE;
+    }
+    tiles->freeCount = MAP_TILE_CACHE_ENTRIES;
+    tiles->lruHead = tiles->lruTail = -1;
+    tiles->ready = false;
+    tiles->gridSize = gridSize;
+    tiles->scale = 1.0f;
+    tiles->budgetBytes = budgetBytes > 0 ? budgetBytes : MAP_TILE_DEFAULT_BUDGET;
+    tiles->cachedBytes = 0;
+    tiles->tilesDrawn = tiles->tilesMissing = tiles->uploaded = tiles->evictions = tiles->tilesHeld = 0;
+
+#ifdef __EMSCRIPTEN__
+    js_map_tiles_open_internal(baseUrl, &tiles->info, tiles->uploads, MAP_TILE_UPLOAD_SLOTS, MAX_IN_FLIGHT);
+#else
+    (void)baseUrl;
+    tiles->info.state = MAP_INFO_FAILED; // Tiles are only streamed in the browser
+#endif
+}
+
+void map_tiles_close(MapTiles* tiles) {
+    while (tiles->lruHead >= 0) {
+        evict(tiles, tiles->lruHead);
+    }
+}
+
+bool map_tiles_poll(MapTiles* tiles) {
+    bool changed = false;
+
+    if (!tiles->ready && tiles->info.state == MAP_INFO_READY) {
+        if (tiles->info.width <= 0 || tiles->info.height <= 0 || tiles->info.levels <= 0 ||
+            tiles->info.levels > MAP_TILE_MAX_LEVELS || (tiles->info.width - 1) / MAP_TILE_SIZE >= 0x4000 ||
+            (tiles->info.height - 1) / MAP_TILE_SIZE >= 0x4000) {
+            APPLOG(APPLOG_WARN, APPLOG_GAME, "Unusable map manifest (%dx%d px, %d levels)",
+                   tiles->info.width, tiles->info.height, tiles->info.levels);
+            tiles->info.state = MAP_INFO_FAILED;
+            return false;
+        }
+        tiles->scale = tiles->info.cellPixels > 0.0f ? tiles->gridSize / tiles->info.cellPixels : 1.0f;
+        tiles->ready = true;
+        APPLOG(APPLOG_INFO, APPLOG_GAME, "Map %dx%d px, %d mip levels, %.3f world units per pixel",
+               tiles->info.width, tiles->info.height, tiles->info.levels, tiles->scale);
+        changed = true;
+    }
+
+    int held = 0;
+    for (int i = 0; i < MAP_TILE_UPLOAD_SLOTS; i++) {
+        MapTileUpload* upload = &tiles->uploads[i];
+        if (upload->state != MAP_UPLOAD_READY) continue;
+        int bytes = upload->width * upload->height * 4;
+        int existing = find_entry(tiles, upload->key);
+        if (existing >= 0) evict(tiles, existing);
+        // A coarsest level tile goes in over budget if it must, as the
+        // fallback for everything else. Other tiles that do not fit stay
+        // pending in their slot rather than push the cache past its cap.
+        bool pinned = key_level(upload->key) == tiles->info.levels - 1;
+        if (!make_room(tiles, (size_t)bytes) && !(pinned && tiles->freeCount > 0)) {
+            held++;
+            continue;
+        }
+        Image image = { upload->pixels, upload->width, upload->height, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 };
+        Texture2D texture = LoadTextureFromImage(image);
+        SetTextureFilter(texture, TEXTURE_FILTER_BILINEAR);
+        SetTextureWrap(texture, TEXTURE_WRAP_CLAMP); // No bleeding across tile seams
+        cache_insert(tiles, upload->key, texture, bytes);
+        upload->state = MAP_UPLOAD_FREE;
+        tiles->uploaded++;
+        changed = true;
+    }
+    if (held > 0 && tiles->tilesHeld == 0) {
+        APPLOG(APPLOG_WARN, APPLOG_GAME, "Map tile cache budget of %zu bytes is taken by the coarsest level; %d tiles held back",
+               tiles->budgetBytes, held);
+    }
+    tiles->tilesHeld = held;
+
+#ifdef __EMSCRIPTEN__
+    if (changed) {
+        js_map_tiles_refill_internal(); // Slots are free again
+    }
+#endif
+    return changed;
+}
+
+// Size in pixels of a mip level; each level halves the previous one, rounding up
+static int level_extent(int extent, int level) {
+    return (extent + (1 << level) - 1) >> level;
+}
+
+static void request(MapTiles* tiles, int key) {
+    tiles->tilesMissing++;
+#ifdef __EMSCRIPTEN__
+    js_map_tiles_request_internal(key);
+#else
+    (void)key;
+#endif
+}
+
+// Draws tile (level, tx, ty) from its closest cached ancestor. Returns false
+// if no coarser level is cached either.
+static bool draw_fallback(MapTiles* tiles, int level, int tx, int ty, Rectangle dest, int width, int height) {
+    for (int parent = level + 1; parent < tiles->info.levels; parent++) {
+        int shift = parent - level;
+        int entry = find_entry(tiles, make_key(parent, tx >> shift, ty >> shift));
+        if (entry < 0) continue;
+
+        // The child's pixel rectangle, in the parent tile's pixels
+        float factor = 1.0f / (float)(1 << shift);
+        Rectangle source = {
+            (float)(tx * MAP_TILE_SIZE) * factor - (float)((tx >> shift) * MAP_TILE_SIZE),
+            (float)(ty * MAP_TILE_SIZE) * factor - (float)((ty >> shift) * MAP_TILE_SIZE),
+            (float)width * factor,
+            (float)height * factor,
+        };
+        touch(tiles, entry);
+        DrawTexturePro(tiles->entries[entry].texture, source, dest, (Vector2){ 0, 0 }, 0.0f, WHITE);
+        return true;
+    }
+    return false;
+}
+
+void map_tiles_draw(MapTiles* tiles, Rectangle visible, float zoom) {
+    tiles->tilesDrawn = 0;
+    tiles->tilesMissing = 0;
+    if (!tiles->ready) return;
+
+    // Finest level whose pixels are still at least one screen pixel
+    int level = (int)floorf(-log2f(zoom * tiles->scale));
+    if (level < 0) level = 0;
+    if (level > tiles->info.levels - 1) level = tiles->info.levels - 1;
+    int coarsest = tiles->info.levels - 1;
+
+    int levelWidth = level_extent(tiles->info.width, level);
+    int levelHeight = level_extent(tiles->info.height, level);
+    int tilesX = (levelWidth + MAP_TILE_SIZE - 1) / MAP_TILE_SIZE;
+    int tilesY = (levelHeight + MAP_TILE_SIZE - 1) / MAP_TILE_SIZE;
+    float pixelWorld = (float)(1 << level) * tiles->scale; // World size of one pixel at this level
+    float tileWorld = MAP_TILE_SIZE * pixelWorld;
+
+    int firstX = (int)floorf(visible.x / tileWorld);
+    int firstY = (int)floorf(visible.y / tileWorld);
+    int lastX = (int)floorf((visible.x + visible.width) / tileWorld);
+    int lastY = (int)floorf((visible.y + visible.height) / tileWorld);
+    if (firstX < 0) firstX = 0;
+    if (firstY < 0) firstY = 0;
+    if (lastX > tilesX - 1) lastX = tilesX - 1;
+    if (lastY > tilesY - 1) lastY = tilesY - 1;
+
+#ifdef __EMSCRIPTEN__
+    js_map_tiles_begin_internal();
+#endif
+
+    // The coarsest level comes first so there is always something to fall back on
+    if (level != coarsest) {
+        int shift = coarsest - level;
+        for (int ty = firstY >> shift; ty <= lastY >> shift; ty++) {
+            for (int tx = firstX >> shift; tx <= lastX >> shift; tx++) {
+                int key = make_key(coarsest, tx, ty);
+                if (find_entry(tiles, key) < 0) request(tiles, key);
+            }
+        }
+    }
+
+    for (int ty = firstY; ty <= lastY; ty++) {
+        for (int tx = firstX; tx <= lastX; tx++) {
+            int width = levelWidth - tx * MAP_TILE_SIZE;
+            int height = levelHeight - ty * MAP_TILE_SIZE;
+            if (width > MAP_TILE_SIZE) width = MAP_TILE_SIZE;
+            if (height > MAP_TILE_SIZE) height = MAP_TILE_SIZE;
+            Rectangle dest = { tx * tileWorld, ty * tileWorld, width * pixelWorld, height * pixelWorld };
+
+            int key = make_key(level, tx, ty);
+            int entry = find_entry(tiles, key);
+            if (entry >= 0) {
+                touch(tiles, entry);
+                DrawTexturePro(tiles->entries[entry].texture, (Rectangle){ 0, 0, (float)width, (float)height },
+                               dest, (Vector2){ 0, 0 }, 0.0f, WHITE);
+                tiles->tilesDrawn++;
+            } else {
+                request(tiles, key);
+                if (draw_fallback(tiles, level, tx, ty, dest, width, height)) tiles->tilesDrawn++;
+            }
+        }
+    }
+
+#ifdef __EMSCRIPTEN__
+    js_map_tiles_end_internal();
+#endif
+}
@@ -0,0 +1,105 @@
+#ifndef MAP_TILES_H
+#define MAP_TILES_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "raylib.h"
+
+// Tiled map background, streamed on demand.
+//
+// A battle map is cut offline (tools/cut_tiles.py) into MAP_TILE_SIZE tiles
+// at several mip levels: level 0 is full resolution and every next level
+// halves it, down to a single tile. Nothing is preloaded. Drawing a view
+// requests the tiles it needs at the level matching the zoom; the browser
+// fetches and decodes them in a worker, and finished tiles are handed to the
+// main loop through a few fixed upload slots in the WASM heap (same idea as
+// net_queue.h). map_tiles_poll() uploads them into a texture cache that is
+// capped in bytes and evicts the least recently drawn tile first. Missing
+// tiles are drawn from the closest cached coarser level meanwhile.
+//
+// The JS side hardcodes the MapTileUpload and MapTileInfo offsets below.
+
+#define MAP_TILE_SIZE 256
+#define MAP_TILE_MAX_LEVELS 12
+#define MAP_TILE_UPLOAD_SLOTS 4       // Most textures uploaded per frame
+#define MAP_TILE_CACHE_ENTRIES 512    // Power of two, bounds the entry table
+#define MAP_TILE_DEFAULT_BUDGET (48 * 1024 * 1024) // GPU bytes for tile textures
+
+typedef struct MapTileUpload {
+    int32_t state;   // offset 0, MAP_UPLOAD_* below
+    int32_t key;     // offset 4
+    int32_t width;   // offset 8
+    int32_t height;  // offset 12
+    uint8_t pixels[MAP_TILE_SIZE * MAP_TILE_SIZE * 4]; // offset 16, RGBA8
+} MapTileUpload;
+
+#define MAP_UPLOAD_FREE 0
+#define MAP_UPLOAD_READY 1 // Written by JS, waiting for map_tiles_poll()
+
+// Filled in by JS once the manifest has been fetched
+typedef struct MapTileInfo {
+    int32_t state;       // offset 0, MAP_INFO_* below
+    int32_t width;       // offset 4, full resolution image size in pixels
+    int32_t height;      // offset 8
+    int32_t levels;      // offset 12
+    float cellPixels;    // offset 16, image pixels per grid cell
+} MapTileInfo;
+
+#define MAP_INFO_LOADING 0
+#define MAP_INFO_READY 1
+#define MAP_INFO_FAILED 2
+
+typedef struct MapTileEntry {
+    int32_t key;         // -1 for an unused entry
+    Texture2D texture;
+    int bytes;
+    int lruPrev;         // Doubly linked LRU list, most recently drawn first
+    int lruNext;
+} MapTileEntry;
+
+typedef struct MapTiles {
+    MapTileInfo info;
+    MapTileUpload uploads[MAP_TILE_UPLOAD_SLOTS];
+
+    MapTileEntry entries[MAP_TILE_CACHE_ENTRIES];
+    int slots[MAP_TILE_CACHE_ENTRIES * 2]; // key -> entry (linear probing), -1 if empty
+    int freeEntries[MAP_TILE_CACHE_ENTRIES];
+    int freeCount;
+    int lruHead;
+    int lruTail;
+
+    bool ready;          // Manifest loaded and valid
+    float gridSize;      // World size of a grid cell
+    float scale;         // World units per level-0 image pixel
+    size_t budgetBytes;
+    size_t cachedBytes;
+
+    // Counters for the stats overlay
+    int tilesDrawn;
+    int tilesMissing;    // Requested this frame, drawn from a coarser level or not at all
+    int uploaded;
+    int evictions;
+    int tilesHeld;       // Decoded but left in their upload slot, the budget being full of pinned tiles
+} MapTiles;
+
+// Starts loading the map whose manifest is at baseUrl/manifest.json.
+// gridSize is the world size of a grid cell; budgetBytes caps texture memory.
+void map_tiles_open(MapTiles* tiles, const char* baseUrl, float gridSize, size_t budgetBytes);
+void map_tiles_close(MapTiles* tiles);
+
+// Uploads tiles decoded since the last call. Returns true if the map changed
+// (manifest loaded or new tiles available), i.e. the view should be redrawn.
+bool map_tiles_poll(MapTiles* tiles);
+
+// Draws the part of the map inside the world rectangle `visible` at the mip
+// level for `zoom`, and requests the tiles it is missing (replacing the
+// previous frame's requests, so panning away cancels queued fetches).
+// Call inside BeginMode2D with the map camera.
+void map_tiles_draw(MapTiles* tiles, Rectangle visible, float zoom);
+
+_Static_assert(offsetof(MapTileUpload, pixels) == 16, "JS writes MapTileUpload.pixels at offset 16");
+_Static_assert(sizeof(MapTileUpload) == 16 + MAP_TILE_SIZE * MAP_TILE_SIZE * 4, "JS assumes packed upload slots");
+_Static_assert(offsetof(MapTileInfo, cellPixels) == 16, "JS writes MapTileInfo.cellPixels at offset 16");
+
+#endif // MAP_TILES_H
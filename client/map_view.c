@@ -0,0 +1,99 @@
+#include "map_view.h"
+
+#define MAP_VIEW_MAX_ZOOM 4.0f
+
+// Keeps the view inside the map; a map smaller than the view is centred
+static void clamp_target(MapView* view) {
+    float halfWidth = view->viewport.width * 0.5f / view->camera.zoom;
+    float halfHeight = view->viewport.height * 0.5f / view->camera.zoom;
+
+    if (halfWidth * 2.0f >= view->worldWidth) {
+        view->camera.target.x = view->worldWidth * 0.5f;
+    } else if (view->camera.target.x < halfWidth) {
+        view->camera.target.x = halfWidth;
+    } else if (view->camera.target.x > view->worldWidth - halfWidth) {
+        view->camera.target.x = view->worldWidth - halfWidth;
+    }
+
+    if (halfHeight * 2.0f >= view->worldHeight) {
+        view->camera.target.y = view->worldHeight * 0.5f;
+    } else if (view->camera.target.y < halfHeight) {
+        view->camera.target.y = halfHeight;
+    } else if (view->camera.target.y > view->worldHeight - halfHeight) {
+        view->camera.target.y = view->worldHeight - halfHeight;
+    }
+}
+
+void map_view_init(MapView* view, Rectangle viewport, float worldWidth, float worldHeight) {
+    view->viewport = viewport;
+    view->worldWidth = worldWidth;
+    view->worldHeight = worldHeight;
+
+    float fitX = viewport.width / worldWidth;
+    float fitY = viewport.height / worldHeight;
+    view->minZoom = fitX < fitY ? fitX : fitY;
+    if (view->minZoom > 1.0f) view->minZoom = 1.0f;
+    view->maxZoom = MAP_VIEW_MAX_ZOOM;
+
+    // Start at 1:1 in the top-left corner of the map, as before the camera existed
+    view->camera.offset = (Vector2){ viewport.x + viewport.width * 0.5f, viewport.y + viewport.height * 0.5f };
+    view->camera.target = (Vector2){ viewport.width * 0.5f, viewport.height * 0.5f };
+    view->camera.rotation = 0.0f;
+    view->camera.zoom = 1.0f;
+    clamp_target(view);
+}
+
+bool map_view_pan(MapView* view, Vector2 screenDelta) {
+    Vector2 before = view->camera.target;
+    view->camera.target.x -= screenDelta.x / view->camera.zoom;
+    view->camera.target.y -= screenDelta.y / view->camera.zoom;
+    clamp_target(view);
+    return before.x != view->camera.target.x || before.y != view->camera.target.y;
+}
+
+bool map_view_zoom_at(MapView* view, Vector2 screenPoint, float factor) {
+    float zoom = view->camera.zoom * factor;
+    if (zoom < view->minZoom) zoom = view->minZoom;
+    if (zoom > view->maxZoom) zoom = view->maxZoom;
+    if (zoom == view->camera.zoom) {
+        return false;
+    }
+
+    // Re-anchor so the world point under the cursor stays under the cursor
+    Vector2 anchor = map_view_to_world(view, screenPoint);
+    view->camera.zoom = zoom;
+    view->camera.target.x = anchor.x - (screenPoint.x - view->camera.offset.x) / zoom;
+    view->camera.target.y = anchor.y - (screenPoint.y - view->camera.offset.y) / zoom;
+    clamp_target(view);
+    return true;
+}
+
+Rectangle map_view_visible(const MapView* view) {
+    float halfWidth = view->viewport.width * 0.5f / view->camera.zoom;
+    float halfHeight = view->viewport.height * 0.5f / view->camera.zoom;
+    float left = view->camera.target.x - halfWidth;
+    float top = view->camera.target.y - halfHeight;
+    float right = view->camera.target.x + halfWidth;
+    float bottom = view->camera.target.y + halfHeight;
+
+    if (left < 0.0f) left = 0.0f;
+    if (top < 0.0f) top = 0.0f;
+    if (right > view->worldWidth) right = view->worldWidth;
+    if (bottom > view->worldHeight) bottom = view->worldHeight;
+    return (Rectangle){ left, top, right - left, bottom - top };
+}
+
+Vector2 map_view_to_world(const MapView* view, Vector2 screenPoint) {
+    return (Vector2){
+        view->camera.target.x + (screenPoint.x - view->camera.offset.x) / view->camera.zoom,
+        view->camera.target.y + (screenPoint.y - view->camera.offset.y) / view->camera.zoom,
+    };
+}
+
+float map_view_grid_step(const MapView* view, float gridSize, float minPixels) {
+    float step = gridSize;
+    while (step * view->camera.zoom < minPixels) {
+        step *= 2.0f;
+    }
+    return step;
+}
@@ -0,0 +1,41 @@
+#ifndef MAP_VIEW_H
+#define MAP_VIEW_H
+
+#include <stdbool.h>
+#include "raylib.h"
+
+// Pan/zoom view of a map that can be much larger than the window.
+//
+// Tokens, grid and overlays live in world coordinates; the camera maps them
+// into the viewport (the screen area left of the UI panel). Everything drawn
+// through the view should be culled against map_view_visible(), so the cost
+// of a frame follows what is on screen rather than the size of the map.
+typedef struct MapView {
+    Camera2D camera;    // target = world point at the viewport centre
+    Rectangle viewport; // Screen area the map is drawn in
+    float worldWidth;
+    float worldHeight;
+    float minZoom;      // Whole map fits in the viewport
+    float maxZoom;
+} MapView;
+
+void map_view_init(MapView* view, Rectangle viewport, float worldWidth, float worldHeight);
+
+// Moves the view by a screen-space delta (e.g. a mouse drag). Returns true if
+// the camera changed.
+bool map_view_pan(MapView* view, Vector2 screenDelta);
+
+// Multiplies the zoom by `factor`, keeping the world point under `screenPoint`
+// in place. Returns true if the camera changed.
+bool map_view_zoom_at(MapView* view, Vector2 screenPoint, float factor);
+
+// World-space rectangle currently visible, clipped to the map
+Rectangle map_view_visible(const MapView* view);
+
+Vector2 map_view_to_world(const MapView* view, Vector2 screenPoint);
+
+// Spacing of the grid lines worth drawing at the current zoom: the map grid
+// size, doubled until lines are at least minPixels apart on screen
+float map_view_grid_step(const MapView* view, float gridSize, float minPixels);
+
+#endif // MAP_VIEW_H
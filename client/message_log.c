@@ -0,0 +1,116 @@
+#include "message_log.h"
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t round_up_pow2(uint32_t v) {
+    uint32_t p = 1;
+    while (p < v) p <<= 1;
+    return p;
+}
+
+bool message_log_init(MessageLog* log, uint32_t lineCapacity, uint32_t arenaBytes) {
+    memset(log, 0, sizeof(*log));
+    lineCapacity = round_up_pow2(lineCapacity);
+    arenaBytes = round_up_pow2(arenaBytes < 4 * (MESSAGE_LOG_MAX_TEXT * 2 + 2) ? 4 * (MESSAGE_LOG_MAX_TEXT * 2 + 2) : arenaBytes);
+    log->lines = malloc(sizeof(MessageLine) * lineCapacity);
+    log->arena = malloc(arenaBytes);
+    if (log->lines == NULL || log->arena == NULL) {
+        message_log_free(log);
+        return false;
+    }
+    log->lineMask = lineCapacity - 1;
+    log->arenaMask = arenaBytes - 1;
+    return true;
+}
+
+void message_log_free(MessageLog* log) {
+    free(log->lines);
+    free(log->arena);
+    memset(log, 0, sizeof(*log));
+}
+
+void message_log_clear(MessageLog* log) {
+    log->first = 0;
+    log->count = 0;
+    log->arenaTail = 0;
+    log->arenaHead = 0;
+}
+
+static size_t clamp_length(const char* s) {
+    size_t length = s ? strlen(s) : 0;
+    return length > MESSAGE_LOG_MAX_TEXT ? MESSAGE_LOG_MAX_TEXT : length;
+}
+
+// Copies "text\0detail\0" to arena position `pos` and fills in the line
+static void store_line(MessageLog* log, MessageLine* line, uint32_t pos, const char* text, size_t textLength,
+                       const char* detail, size_t detailLength, uint32_t seq) {
+    char* out = &log->arena[pos & log->arenaMask];
+    memcpy(out, text, textLength);
+    out[textLength] = '\0';
+    memcpy(out + textLength + 1, detail, detailLength);
+    out[textLength + 1 + detailLength] = '\0';
+    line->textPos = pos;
+    line->seq = seq;
+    line->textLength = (uint8_t)textLength;
+    line->detailLength = (uint8_t)detailLength;
+    line->fitWidth = 0;
+    line->fitLength = 0;
+    line->reserved = 0;
+}
+
+static void evict_oldest(MessageLog* log) {
+    log->first++;
+    log->count--;
+    log->evicted++;
+    log->arenaTail = log->count > 0 ? message_log_line(log, 0)->textPos : log->arenaHead;
+}
+
+MessageLine* message_log_append(MessageLog* log, const char* text, const char* detail, uint32_t seq) {
+    size_t textLength = clamp_length(text);
+    size_t detailLength = clamp_length(detail);
+    uint32_t size = (uint32_t)(textLength + detailLength + 2);
+    uint32_t arenaSize = log->arenaMask + 1;
+
+    // A span never wraps; if it would, it starts over at the beginning
+    uint32_t pos = log->arenaHead;
+    uint32_t offset = pos & log->arenaMask;
+    if (offset + size > arenaSize) pos += arenaSize - offset;
+
+    while (log->count > 0 && (log->count > log->lineMask || pos + size - log->arenaTail > arenaSize)) {
+        evict_oldest(log);
+    }
+    if (log->count == 0) log->arenaTail = pos;
+
+    MessageLine* line = message_log_line(log, log->count);
+    store_line(log, line, pos, text ? text : "", textLength, detail ? detail : "", detailLength, seq);
+    log->arenaHead = pos + size;
+    log->count++;
+    log->appended++;
+    return line;
+}
+
+MessageLine* message_log_prepend(MessageLog* log, const char* text, const char* detail, uint32_t seq) {
+    if (log->count == 0) {
+        MessageLine* line = message_log_append(log, text, detail, seq);
+        log->appended--; // Not new; views scrolled back stay where they are
+        return line;
+    }
+    if (log->count > log->lineMask) return NULL;
+
+    size_t textLength = clamp_length(text);
+    size_t detailLength = clamp_length(detail);
+    uint32_t size = (uint32_t)(textLength + detailLength + 2);
+
+    // Ends right before the oldest text, or at the end of the arena if that
+    // would wrap
+    uint32_t offset = log->arenaTail & log->arenaMask;
+    uint32_t pos = offset >= size ? log->arenaTail - size : log->arenaTail - offset - size;
+    if (log->arenaHead - pos > log->arenaMask + 1) return NULL;
+
+    log->first--;
+    log->count++;
+    MessageLine* line = message_log_line(log, 0);
+    store_line(log, line, pos, text ? text : "", textLength, detail ? detail : "", detailLength, seq);
+    log->arenaTail = pos;
+    return line;
+}
@@ -0,0 +1,72 @@
+#ifndef MESSAGE_LOG_H
+#define MESSAGE_LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Scrollback for the dice/chat and room logs.
+//
+// Lines live in a ring of fixed-size entries, and their text in a byte ring
+// (the arena) that each line takes a contiguous "text\0detail\0" span of.
+// Appending is O(1): when either ring is full, the oldest lines are evicted
+// from the front. Older lines paged in from the server are prepended at the
+// front instead, as long as there is room; nothing newer is ever evicted for
+// them.
+//
+// Every line caches how much of its text fits one row of the panel it is
+// drawn in (fitWidth, fitLength), so a line is measured once rather than
+// every time the panel is redrawn. The caller fills these in.
+//
+// No raylib dependency.
+
+#define MESSAGE_LOG_MAX_TEXT 255 // Longer text and detail are cut
+
+typedef struct MessageLine {
+    uint32_t textPos;      // Arena position (free-running) of the text
+    uint32_t seq;          // Server history sequence number, 0 for local lines
+    uint8_t textLength;
+    uint8_t detailLength;  // Detail (a tooltip) follows the text's terminator
+    uint16_t fitWidth;     // Row width fitLength was measured for, 0 if not yet
+    uint16_t fitLength;    // Bytes of the text that fit that width
+    uint16_t reserved;
+} MessageLine;             // 16 bytes
+
+typedef struct MessageLog {
+    MessageLine* lines;
+    uint32_t lineMask;     // Line capacity - 1 (power of two)
+    uint32_t first;        // Ring position of the oldest line (free-running)
+    uint32_t count;
+
+    char* arena;
+    uint32_t arenaMask;    // Arena size - 1 (power of two)
+    uint32_t arenaTail;    // Position of the oldest line's text (free-running)
+    uint32_t arenaHead;    // Position the next appended text goes to
+
+    uint32_t appended;     // Lines appended at the new end, ever
+    uint32_t evicted;      // Lines dropped from the old end, ever
+} MessageLog;
+
+// Capacities are rounded up to powers of two. Returns false if out of memory.
+bool message_log_init(MessageLog* log, uint32_t lineCapacity, uint32_t arenaBytes);
+void message_log_free(MessageLog* log);
+void message_log_clear(MessageLog* log);
+
+// Adds a line at the new end, evicting old lines as needed
+MessageLine* message_log_append(MessageLog* log, const char* text, const char* detail, uint32_t seq);
+// Adds a line before the oldest one; NULL (and nothing added) if the log is full
+MessageLine* message_log_prepend(MessageLog* log, const char* text, const char* detail, uint32_t seq);
+
+// Line `index`, counted from the oldest (0) to count - 1
+static inline MessageLine* message_log_line(const MessageLog* log, uint32_t index) {
+    return &log->lines[(log->first + index) & log->lineMask];
+}
+
+static inline const char* message_log_text(const MessageLog* log, const MessageLine* line) {
+    return &log->arena[line->textPos & log->arenaMask];
+}
+
+static inline const char* message_log_detail(const MessageLog* log, const MessageLine* line) {
+    return message_log_text(log, line) + line->textLength + 1;
+}
+
+#endif // MESSAGE_LOG_H
@@ -0,0 +1,124 @@
+#include "motion.h"
+#include <string.h>
+
+static MotionTrack* find_track(MotionTracker* tracker, int tokenId) {
+    for (int i = 0; i < tracker->count; i++) {
+        if (tracker->tracks[i].tokenId == tokenId) return &tracker->tracks[i];
+    }
+    return NULL;
+}
+
+static void remove_track(MotionTracker* tracker, MotionTrack* track) {
+    int index = (int)(track - tracker->tracks);
+    tracker->tracks[index] = tracker->tracks[--tracker->count];
+}
+
+void motion_init(MotionTracker* tracker) {
+    memset(tracker, 0, sizeof(*tracker));
+}
+
+bool motion_push(MotionTracker* tracker, TokenStore* store, int tokenId, uint32_t seq, uint32_t senderTimeMs,
+                 float x, float y, bool final, double nowMs) {
+    MotionTrack* track = find_track(tracker, tokenId);
+
+    // Snapshot values carry no sequence; they simply replace whatever is animating
+    if (seq == 0) {
+        if (track) remove_track(tracker, track);
+        token_store_move(store, tokenId, x, y);
+        return true;
+    }
+
+    if (track && !track->final && seq <= track->lastSeq) {
+        return false; // Duplicate or out of order
+    }
+
+    double offset = nowMs - (double)senderTimeMs;
+    if (!track || track->final) {
+        // First sample of a new drag
+        if (!track) {
+            if (tracker->count == MOTION_MAX_TRACKS) {
+                token_store_move(store, tokenId, x, y);
+                return true;
+            }
+            track = &tracker->tracks[tracker->count++];
+            track->tokenId = tokenId;
+        }
+        track->offset = offset;
+        track->sampleCount = 0;
+        // Start from where the token is drawn now, one interpolation delay in the past,
+        // so the animation begins without a jump
+        Token* token = token_store_find(store, tokenId);
+        if (token) {
+            track->samples[track->sampleCount++] = (MotionSample){ (double)senderTimeMs - MOTION_INTERPOLATION_DELAY_MS, token->x, token->y };
+        }
+    } else if (offset < track->offset) {
+        track->offset = offset;
+    }
+
+    if (track->sampleCount == MOTION_MAX_SAMPLES) {
+        memmove(&track->samples[0], &track->samples[1], sizeof(MotionSample) * (MOTION_MAX_SAMPLES - 1));
+        track->sampleCount--;
+    }
+    track->samples[track->sampleCount++] = (MotionSample){ (double)senderTimeMs, x, y };
+    track->lastSeq = seq;
+    track->lastArrival = nowMs;
+    track->final = final;
+    return true;
+}
+
+void motion_cancel(MotionTracker* tracker, int tokenId) {
+    MotionTrack* track = find_track(tracker, tokenId);
+    if (track) remove_track(tracker, track);
+}
+
+int motion_update(MotionTracker* tracker, TokenStore* store, double nowMs) {
+    for (int i = tracker->count - 1; i >= 0; i--) {
+        MotionTrack* track = &tracker->tracks[i];
+        const MotionSample* newest = &track->samples[track->sampleCount - 1];
+        double renderTime = nowMs - track->offset - MOTION_INTERPOLATION_DELAY_MS;
+        float x = newest->x;
+        float y = newest->y;
+        bool done = false;
+
+        if (renderTime >= newest->time) {
+            if (track->final) {
+                done = true; // Landed exactly on the final position
+            } else if (track->sampleCount >= 2) {
+                // Dead reckoning from the last two samples, for a short while
+                const MotionSample* prev = &track->samples[track->sampleCount - 2];
+                double span = newest->time - prev->time;
+                double ahead = renderTime - newest->time;
+                if (ahead > MOTION_MAX_EXTRAPOLATION_MS) ahead = MOTION_MAX_EXTRAPOLATION_MS;
+                if (span > 0) {
+                    x += (float)((newest->x - prev->x) * ahead / span);
+                    y += (float)((newest->y - prev->y) * ahead / span);
+                }
+            }
+            if (nowMs - track->lastArrival > MOTION_STALE_TRACK_MS) {
+                // Sender went quiet without a final sample; settle on the last known position
+                x = newest->x;
+                y = newest->y;
+                done = true;
+            }
+        } else {
+            // Interpolate between the samples that bracket renderTime
+            int j = track->sampleCount - 1;
+            while (j > 0 && track->samples[j - 1].time > renderTime) j--;
+            if (j == 0) {
+                x = track->samples[0].x;
+                y = track->samples[0].y;
+            } else {
+                const MotionSample* a = &track->samples[j - 1];
+                const MotionSample* b = &track->samples[j];
+                double span = b->time - a->time;
+                double t = span > 0 ? (renderTime - a->time) / span : 1.0;
+                x = a->x + (float)((b->x - a->x) * t);
+                y = a->y + (float)((b->y - a->y) * t);
+            }
+        }
+
+        token_store_move(store, track->tokenId, x, y);
+        if (done) remove_track(tracker, track);
+    }
+    return tracker->count;
+}
@@ -0,0 +1,63 @@
+#ifndef MOTION_H
+#define MOTION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "token_store.h"
+
+// Smooths remote token drags.
+//
+// Senders stream rate-limited samples stamped with a sequence number and their
+// own clock (ms). Each remotely dragged token gets a track holding the last few
+// samples; every frame the token is placed at "sender now - interpolation delay",
+// interpolating between the bracketing samples and extrapolating briefly past
+// the newest one. The sender clock is mapped to ours with the smallest observed
+// (arrival - send) offset of the current drag, which absorbs clock skew and
+// most network jitter.
+//
+// Only tokens that are moving have a track, so the per-frame cost scales with
+// concurrent drags rather than with the size of the table.
+
+#define MOTION_MAX_SAMPLES 4
+#define MOTION_MAX_TRACKS 256
+#define MOTION_INTERPOLATION_DELAY_MS 100.0
+#define MOTION_MAX_EXTRAPOLATION_MS 100.0
+#define MOTION_STALE_TRACK_MS 1000.0
+
+typedef struct MotionSample {
+    double time; // Sender clock, ms
+    float x;
+    float y;
+} MotionSample;
+
+typedef struct MotionTrack {
+    int tokenId;
+    uint32_t lastSeq;
+    double offset;     // Local arrival time minus sender time
+    double lastArrival;
+    int sampleCount;
+    bool final;        // Newest sample ends the drag
+    MotionSample samples[MOTION_MAX_SAMPLES]; // Oldest first
+} MotionTrack;
+
+typedef struct MotionTracker {
+    MotionTrack tracks[MOTION_MAX_TRACKS];
+    int count;
+} MotionTracker;
+
+void motion_init(MotionTracker* tracker);
+
+// Feeds one streamed position. Samples with seq 0 (snapshots) or that arrive
+// when no track is free are applied immediately. Returns false if the sample
+// was stale and dropped.
+bool motion_push(MotionTracker* tracker, TokenStore* store, int tokenId, uint32_t seq, uint32_t senderTimeMs,
+                 float x, float y, bool final, double nowMs);
+
+// Stops animating a token (e.g. the local user grabbed it).
+void motion_cancel(MotionTracker* tracker, int tokenId);
+
+// Writes interpolated positions into the store. Returns the number of tokens
+// still animating, so callers know whether another frame is needed.
+int motion_update(MotionTracker* tracker, TokenStore* store, double nowMs);
+
+#endif // MOTION_H
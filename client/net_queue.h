@@ -0,0 +1,74 @@
+#ifndef NET_QUEUE_H
+#define NET_QUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Inbound event ring shared between the WebSocket JS glue and the C main loop.
+//
+// The queue lives in the WASM heap. JS (the only producer) decodes each
+// WebSocket message straight into the next slot and bumps `head`; the main
+// loop (the only consumer) drains it once per frame in network_poll() and
+// bumps `tail`. No strings are malloc'd and no C function is called per
+// message. If the ring is full, JS parks events in a JS-side spill list that
+// network_poll() pulls in after draining, so nothing is lost under bursts.
+// JS also counts every inbound WebSocket message and its bytes in the header,
+// for telemetry.h.
+//
+// The JS side hardcodes the offsets below; the static asserts keep them honest.
+
+#define NET_QUEUE_CAPACITY 4096 // Power of two
+#define NET_EVENT_SENDER_SIZE 64
+#define NET_EVENT_TEXT_SIZE 128
+#define NET_EVENT_DETAIL_SIZE 96
+
+typedef enum NetEventType {
+    NET_EVENT_NONE = 0,
+    NET_EVENT_CLIENT_ID = 1,    // text = our client id
+    NET_EVENT_UPDATE_TOKEN = 2, // id, x, y, seq, time, flags, sender
+    NET_EVENT_DICE_ROLL = 3,    // sender, text = message, seq = history sequence (0 if none)
+    NET_EVENT_ROOM_JOINED = 4,  // text = room id
+    NET_EVENT_ROOM_LEFT = 5,
+    NET_EVENT_USER_JOINED = 6,  // text = user id
+    NET_EVENT_USER_LEFT = 7,    // text = user id
+    NET_EVENT_READY = 8,
+    NET_EVENT_FOG_RUN = 9,      // id = row, seq = start, time = length, flags = layer | op << 8
+    NET_EVENT_DICE_RESULT = 10, // sender, text = result line, detail = distribution summary, seq
+    NET_EVENT_PONG = 11,        // x = round-trip time of the last ping in ms
+    NET_EVENT_CHAT_MESSAGE = 12, // sender, text = message, seq
+    NET_EVENT_HISTORY_END = 13, // seq = oldest line of the page, flags = HISTORY_FLAG_MORE
+} NetEventType;
+
+typedef struct NetEvent {
+    int32_t type;                        // offset 0
+    int32_t id;                          // offset 4
+    float x;                             // offset 8
+    float y;                             // offset 12
+    uint32_t seq;                        // offset 16, 0 for snapshot values
+    uint32_t time;                       // offset 20, sender clock in ms
+    int32_t flags;                       // offset 24, MOVE_FLAG_* from protocol.h
+    int32_t reserved;                    // offset 28
+    char sender[NET_EVENT_SENDER_SIZE];  // offset 32
+    char text[NET_EVENT_TEXT_SIZE];      // offset 96
+    char detail[NET_EVENT_DETAIL_SIZE];  // offset 224, "" unless the type says otherwise
+} NetEvent;                              // 320 bytes
+
+typedef struct NetQueue {
+    uint32_t head;     // offset 0, next slot JS writes (free-running)
+    uint32_t tail;     // offset 4, next slot C reads (free-running)
+    uint32_t capacity; // offset 8
+    uint32_t spilled;  // offset 12, events currently parked on the JS side
+    uint32_t messages; // offset 16, WebSocket messages received (free-running)
+    uint32_t bytes;    // offset 20, and their bytes
+    NetEvent events[NET_QUEUE_CAPACITY]; // offset 24
+} NetQueue;
+
+_Static_assert(offsetof(NetEvent, seq) == 16, "JS writes NetEvent.seq at offset 16");
+_Static_assert(offsetof(NetEvent, sender) == 32, "JS writes NetEvent.sender at offset 32");
+_Static_assert(offsetof(NetEvent, text) == 96, "JS writes NetEvent.text at offset 96");
+_Static_assert(offsetof(NetEvent, detail) == 224, "JS writes NetEvent.detail at offset 224");
+_Static_assert(sizeof(NetEvent) == 320, "JS assumes 320-byte NetEvent slots");
+_Static_assert(offsetof(NetQueue, messages) == 16, "JS counts messages at offset 16");
+_Static_assert(offsetof(NetQueue, events) == 24, "JS assumes events start at offset 24");
+
+#endif // NET_QUEUE_H
@@ -1,19 +1,30 @@
 #include "network.h"
+#include "protocol.h"
+#include "net_queue.h"
+#include "applog.h"
+#include "telemetry.h"
 #include <emscripten/emscripten.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
-// Global variable to store the client's own ID (defined in main.c)
-// static char client_id[64] = {0}; // Removed as it's now extern
-char current_room_id[64] = {0}; // Initialize current_room_id
+char my_client_id[64] = {0}; // Our own client ID, for messages that carry a sender
+
+static NetQueue netQueue;
+
+// Trace recording (network_trace_start): every applied event with its arrival time
+static GameTraceRecord* traceRecords = NULL;
+static size_t traceCount = 0;
+static size_t traceCapacity = 0;
+static bool traceRecording = false;
 
 // EM_JS functions for WebSocket communication
-EM_JS(void, js_websocket_init_internal, (const char* url_cstr), {
+EM_JS(void, js_websocket_init_internal, (const char* url_cstr, NetQueue* queue), {
     var url = UTF8ToString(url_cstr);
     var reconnectDelay = 1000; // start with 1 second
     var heartbeatInterval;
     var lastPongTime;
+    var pingSentAt = 0; // performance.now() of the unanswered ping, 0 if none
 
     // Persist client ID across reconnects
     if (!localStorage.rayvttClientId) {
@@ -21,36 +32,380 @@ EM_JS(void, js_websocket_init_internal, (const char* url_cstr), {
         console.log("Generated new client ID:", localStorage.rayvttClientId);
     }
 
+    // Inbound event ring, see net_queue.h for the layout
+    var EVENT_CLIENT_ID = 1;
+    var EVENT_UPDATE_TOKEN = 2;
+    var EVENT_DICE_ROLL = 3;
+    var EVENT_ROOM_JOINED = 4;
+    var EVENT_ROOM_LEFT = 5;
+    var EVENT_USER_JOINED = 6;
+    var EVENT_USER_LEFT = 7;
+    var EVENT_READY = 8;
+    var EVENT_FOG_RUN = 9;
+    var EVENT_DICE_RESULT = 10;
+    var EVENT_PONG = 11;
+    var EVENT_CHAT_MESSAGE = 12;
+    var EVENT_HISTORY_END = 13;
+    var EVENT_SIZE = 320;
+    var capacity = HEAPU32[(queue + 8) >> 2];
+    var spill = [];
+
+    function writeEvent(type, id, x, y, sender, text, seq, time, flags, detail) {
+        var head = HEAPU32[queue >> 2];
+        var slot = queue + 24 + (head & (capacity - 1)) * EVENT_SIZE;
+        HEAP32[slot >> 2] = type;
+        HEAP32[(slot + 4) >> 2] = id;
+        HEAPF32[(slot + 8) >> 2] = x;
+        HEAPF32[(slot + 12) >> 2] = y;
+        HEAPU32[(slot + 16) >> 2] = seq || 0;
+        HEAPU32[(slot + 20) >> 2] = time || 0;
+        HEAP32[(slot + 24) >> 2] = flags || 0;
+        stringToUTF8(sender || "", slot + 32, 64);
+        stringToUTF8(text || "", slot + 96, 128);
+        stringToUTF8(detail || "", slot + 224, 96);
+        HEAPU32[queue >> 2] = head + 1;
+    }
+
+    function hasRoom() {
+        return spill.length === 0 && (HEAPU32[queue >> 2] - HEAPU32[(queue + 4) >> 2]) >>> 0 < capacity;
+    }
+
+    function pushEvent(type, id, x, y, sender, text, seq, time, flags, detail) {
+        if (hasRoom()) {
+            writeEvent(type, id, x, y, sender, text, seq, time, flags, detail);
+        } else {
+            spill.push([type, id, x, y, sender, text, seq, time, flags, detail]);
+            HEAPU32[(queue + 12) >> 2] = spill.length;
+        }
+    }
+
+    // Called from network_poll() after it drained the ring
+    window.rayvttEventQueue = {
+        refill: function () {
+            var i = 0;
+            while (i < spill.length && (HEAPU32[queue >> 2] - HEAPU32[(queue + 4) >> 2]) >>> 0 < capacity) {
+                var e = spill[i++];
+                writeEvent(e[0], e[1], e[2], e[3], e[4], e[5], e[6], e[7], e[8], e[9]);
+            }
+            spill.splice(0, i);
+            HEAPU32[(queue + 12) >> 2] = spill.length;
+            return i;
+        }
+    };
+
+    // Room state this client's tokens reflect. Sent back on reconnect and join so
+    // the server can answer with only the missing deltas instead of a snapshot.
+    // epoch 0 means "unknown", forcing a snapshot.
+    var syncState = { epoch: 0, revision: 0 };
+    window.rayvttSyncState = syncState;
+
+    // Room we are in, so a reconnect goes straight to the shard that owns it.
+    // A room_redirect sets redirectRoom and the socket is closed and reopened
+    // at once with ?room=, since that room lives on another server process.
+    var currentRoom = null;
+    var redirectRoom = null;
+
+    function onRoomRedirect(roomId) {
+        redirectRoom = currentRoom = roomId;
+        syncState.epoch = 0; // The state we know belongs to the room we left
+    }
+
+    function onSyncRevision(epoch, revision, snapshot) {
+        if (snapshot || epoch === syncState.epoch) {
+            syncState.epoch = epoch;
+            syncState.revision = revision;
+        }
+    }
+
+    // Formats a dice_result for the dice log: "4d6kh3 = 14 (6 5 3 | 1)", with
+    // the distribution summary shown on hover, if any, as the event's detail
+    function pushDiceResult(msg) {
+        var line = msg.expr + " = " + msg.total;
+        for (var i = 0; i < msg.terms.length; i++) {
+            var t = msg.terms[i];
+            if (t.rolls.length === 0) continue;
+            var kept = t.keep === 0 ? t.rolls.length : Math.abs(t.keep);
+            line += " (" + t.rolls.slice(0, kept).join(" ");
+            if (kept < t.rolls.length) line += " | " + t.rolls.slice(kept).join(" ");
+            line += ")";
+        }
+        var detail = "";
+        if (msg.dist) {
+            var d = msg.dist;
+            detail = "range " + d.min + ".." + d.max + "  mean " + d.mean.toFixed(1) + "  " +
+                     (d.below * 100).toFixed(1) + "% lower  " + (d.at * 100).toFixed(1) + "% equal";
+        }
+        // The summary has its own field, so a long roll list cannot cut it off
+        pushEvent(EVENT_DICE_RESULT, 0, 0, 0, msg.sender_id, line, msg.seq, 0, 0, detail);
+    }
+
+    // Heartbeat answered; the round trip goes to the telemetry histogram
+    function onPong() {
+        lastPongTime = Date.now();
+        if (pingSentAt > 0) {
+            pushEvent(EVENT_PONG, 0, performance.now() - pingSentAt, 0, null, null);
+            pingSentAt = 0;
+        }
+    }
+
+    // One queue event per run of fog cells; a reset is an event of its own
+    function pushFogRuns(layer, op, count, runAt) {
+        var flags = layer | (op === 2 ? 0 : op) << 8;
+        if (op === 2) {
+            pushEvent(EVENT_FOG_RUN, 0, 0, 0, null, null, 0, 0, layer | 2 << 8);
+        }
+        for (var i = 0; i < count; i++) {
+            pushEvent(EVENT_FOG_RUN, runAt(i * 3), 0, 0, null, null, runAt(i * 3 + 1), runAt(i * 3 + 2), flags);
+        }
+    }
+
+    // Binary frame codec, see protocol.h for the layout
+    var PROTOCOL_VERSION = 1;
+    var textDecoder = new TextDecoder();
+    var textEncoder = new TextEncoder();
+
+    // Decodes a binary frame straight into queue events, without building message objects
+    function decodeFrame(buffer) {
+        var view = new DataView(buffer);
+        var bytes = new Uint8Array(buffer);
+        if (view.byteLength < 1 || view.getUint8(0) !== PROTOCOL_VERSION) {
+            throw new Error("Unsupported protocol version " + view.getUint8(0));
+        }
+        function readStr(pos, lenBytes) {
+            var len = lenBytes === 1 ? view.getUint8(pos) : view.getUint16(pos, true);
+            var start = pos + lenBytes;
+            return [textDecoder.decode(bytes.subarray(start, start + len)), start + len];
+        }
+        // Trailing history sequence number of a dice or chat line, 0 if absent
+        function readSeq(p, end) {
+            return end - p >= 4 ? view.getUint32(p, true) : 0;
+        }
+        // dice_result payload after the sender, in the JSON message shape
+        function readDice(p, end, msg) {
+            var r = readStr(p, 1);
+            msg.expr = r[0];
+            p = r[1];
+            msg.total = view.getFloat64(p, true);
+            if (view.getUint8(p + 8) & 1) {
+                msg.dist = { min: view.getFloat64(p + 9, true), max: view.getFloat64(p + 17, true), mean: view.getFloat32(p + 25, true),
+                             below: view.getFloat32(p + 29, true), at: view.getFloat32(p + 33, true) };
+            }
+            var termCount = view.getUint8(p + 37);
+            p += 38;
+            msg.terms = [];
+            for (var i = 0; i < termCount; i++) {
+                var t = { keep: view.getInt32(p + 9, true), rolls: [] };
+                var rollCount = view.getUint8(p + 21);
+                p += 22;
+                for (var j = 0; j < rollCount; j++, p += 4) t.rolls.push(view.getUint32(p, true));
+                msg.terms.push(t);
+            }
+            msg.seq = readSeq(p, end);
+            return msg;
+        }
+        // Token list of a sync payload followed by epoch, revision, base and flags
+        function readSync(p, end) {
+            var count = view.getUint32(p, true);
+            p += 4;
+            for (var i = 0; i < count && p + 12 <= end; i++, p += 12) {
+                pushEvent(EVENT_UPDATE_TOKEN, view.getInt32(p, true), view.getFloat32(p + 4, true), view.getFloat32(p + 8, true), null, null);
+            }
+            if (end - p >= 13) {
+                onSyncRevision(view.getUint32(p, true), view.getUint32(p + 4, true), (view.getUint8(p + 12) & 1) !== 0);
+            } else {
+                syncState.epoch = 0; // Server without revisions
+            }
+        }
+        var pos = 1;
+        while (pos + 3 <= view.byteLength) {
+            var type = view.getUint8(pos);
+            var end = pos + 3 + view.getUint16(pos + 1, true);
+            var p = pos + 3;
+            var r;
+            if (type === 6) { // update_token
+                var streamed = end - p >= 21;
+                pushEvent(EVENT_UPDATE_TOKEN, view.getInt32(p, true), view.getFloat32(p + 4, true), view.getFloat32(p + 8, true), null, null,
+                          streamed ? view.getUint32(p + 12, true) : 0, streamed ? view.getUint32(p + 16, true) : 0, streamed ? view.getUint8(p + 20) : 1);
+            } else if (type === 3) { // pong
+                onPong();
+            } else if (type === 4) { // init_state
+                r = readStr(p, 1);
+                onClientId(r[0]);
+                readSync(r[1], end);
+                pushEvent(EVENT_READY, 0, 0, 0, null, null);
+            } else if (type === 15) { // state_sync
+                readSync(p, end);
+            } else if (type === 16) { // state_revision
+                onSyncRevision(view.getUint32(p, true), view.getUint32(p + 4, true), false);
+            } else if (type === 7 || type === 14) { // dice_roll, chat_message
+                r = readStr(p, 1);
+                var text = readStr(r[1], 2);
+                pushEvent(type === 7 ? EVENT_DICE_ROLL : EVENT_CHAT_MESSAGE, 0, 0, 0, r[0], text[0], readSeq(text[1], end));
+            } else if (type === 10) { // room_joined
+                currentRoom = readStr(p, 1)[0];
+                pushEvent(EVENT_ROOM_JOINED, 0, 0, 0, null, currentRoom);
+            } else if (type === 11) { // room_left
+                syncState.epoch = 0; // Local moves outside a room are not recorded by the server
+                currentRoom = null;
+                pushEvent(EVENT_ROOM_LEFT, 0, 0, 0, null, null);
+            } else if (type === 12) { // user_joined
+                pushEvent(EVENT_USER_JOINED, 0, 0, 0, null, readStr(p, 1)[0]);
+            } else if (type === 13) { // user_left
+                pushEvent(EVENT_USER_LEFT, 0, 0, 0, null, readStr(p, 1)[0]);
+            } else if (type === 17) { // room_redirect
+                onRoomRedirect(readStr(p, 1)[0]);
+            } else if (type === 18) { // fog_runs
+                var runsAt = p + 4;
+                pushFogRuns(view.getUint8(p), view.getUint8(p + 1), Math.min(view.getUint16(p + 2, true), Math.floor((end - runsAt) / 6)),
+                            function (i) { return view.getUint16(runsAt + i * 2, true); });
+            } else if (type === 21) { // dice_result
+                r = readStr(p, 1);
+                pushDiceResult(readDice(r[1], end, { sender_id: r[0] }));
+            } else if (type === 23) { // history_end
+                pushEvent(EVENT_HISTORY_END, 0, 0, 0, null, null, view.getUint32(p, true), 0, view.getUint8(p + 4) & 1);
+            }
+            pos = end;
+        }
+    }
+
+    // Encodes a record whose payload is a single u8-prefixed string (or nothing)
+    function encodeFrame(type, str) {
+        var payload = str !== undefined ? textEncoder.encode(str).subarray(0, 255) : null;
+        var length = payload ? payload.length + 1 : 0;
+        var frame = new Uint8Array(4 + length);
+        frame[0] = PROTOCOL_VERSION;
+        frame[1] = type;
+        frame[2] = length & 0xff;
+        frame[3] = length >> 8;
+        if (payload) {
+            frame[4] = payload.length;
+            frame.set(payload, 5);
+        }
+        return frame;
+    }
+
+    function isBinary(ws) {
+        return ws.protocol === "rayvtt.bin.1";
+    }
+
+    function onClientId(clientId) {
+        if (clientId) {
+            localStorage.rayvttClientId = clientId; // Store the client ID
+            pushEvent(EVENT_CLIENT_ID, 0, 0, 0, null, clientId);
+        }
+    }
+
+    // Applies a JSON snapshot or delta; both are plain token positions
+    function applySync(msg) {
+        for (var id in msg.tokens) {
+            var tokenData = msg.tokens[id];
+            pushEvent(EVENT_UPDATE_TOKEN, parseInt(tokenData.id), tokenData.x, tokenData.y, null, null);
+        }
+        if (msg.revision !== undefined) {
+            onSyncRevision(msg.epoch, msg.revision, msg.snapshot !== false);
+        } else {
+            syncState.epoch = 0; // Server without revisions
+        }
+    }
+
+    // JSON fallback path, produces the same queue events as decodeFrame
+    function handleMessage(msg) {
+        if (msg.type === "init_state") {
+            console.log("Received init_state");
+            onClientId(msg.client_id);
+            applySync(msg);
+            pushEvent(EVENT_READY, 0, 0, 0, null, null); // Ready once init_state is applied
+        } else if (msg.type === "state_sync") {
+            applySync(msg);
+        } else if (msg.type === "update_token") {
+            pushEvent(EVENT_UPDATE_TOKEN, parseInt(msg.id), msg.x, msg.y, msg.sender_id, null, msg.seq, msg.t, msg.final === false ? 0 : 1);
+        } else if (msg.type === "update_tokens") { // Per-tick batch from the server
+            for (var i = 0; i < msg.tokens.length; i++) {
+                var update = msg.tokens[i];
+                pushEvent(EVENT_UPDATE_TOKEN, parseInt(update.id), update.x, update.y, update.sender_id, null, update.seq, update.t, update.final === false ? 0 : 1);
+            }
+            if (msg.revision !== undefined) {
+                onSyncRevision(msg.epoch, msg.revision, false);
+            }
+        } else if (msg.type === "dice_roll") {
+            pushEvent(EVENT_DICE_ROLL, 0, 0, 0, msg.sender_id, msg.message, msg.seq);
+        } else if (msg.type === "chat_message") {
+            pushEvent(EVENT_CHAT_MESSAGE, 0, 0, 0, msg.sender_id, msg.message, msg.seq);
+        } else if (msg.type === "history") { // A page of older lines, newest first
+            for (var h = 0; h < msg.messages.length; h++) {
+                handleMessage(msg.messages[h]);
+            }
+            var oldest = msg.messages.length > 0 ? msg.messages[msg.messages.length - 1].seq : 0;
+            pushEvent(EVENT_HISTORY_END, 0, 0, 0, null, null, oldest, 0, msg.more ? 1 : 0);
+        } else if (msg.type === "pong") {
+            onPong();
+        } else if (msg.type === "room_joined") {
+            currentRoom = msg.roomId;
+            pushEvent(EVENT_ROOM_JOINED, 0, 0, 0, null, msg.roomId);
+        } else if (msg.type === "room_left") {
+            syncState.epoch = 0; // Local moves outside a room are not recorded by the server
+            currentRoom = null;
+            pushEvent(EVENT_ROOM_LEFT, 0, 0, 0, null, null);
+        } else if (msg.type === "user_joined") {
+            pushEvent(EVENT_USER_JOINED, 0, 0, 0, null, msg.userId);
+        } else if (msg.type === "user_left") {
+            pushEvent(EVENT_USER_LEFT, 0, 0, 0, null, msg.userId);
+        } else if (msg.type === "room_redirect") {
+            onRoomRedirect(msg.roomId);
+        } else if (msg.type === "fog_runs") {
+            pushFogRuns(msg.layer, msg.op, Math.floor(msg.runs.length / 3), function (i) { return msg.runs[i]; });
+        } else if (msg.type === "dice_result") {
+            pushDiceResult(msg);
+        }
+    }
+
     function setupWebSocket() {
-        var ws = new WebSocket(url);
+        // Our persistent ID, room, last known revision and held token ride along
+        // in the URL, so the server resumes our session and its first message is
+        // either a short delta or a full snapshot
+        var resumeUrl = url + (url.indexOf("?") < 0 ? "?" : "&") +
+            "client_id=" + encodeURIComponent(localStorage.rayvttClientId) +
+            "&epoch=" + syncState.epoch + "&revision=" + syncState.revision;
+        if (currentRoom !== null) {
+            resumeUrl += "&room=" + encodeURIComponent(currentRoom);
+        }
+        if (window.rayvttHeldToken >= 0) {
+            resumeUrl += "&held=" + window.rayvttHeldToken;
+        }
+
+        // Offer the binary protocol first; the server falls back to JSON if it does not support it
+        var ws = new WebSocket(resumeUrl, ["rayvtt.bin.1", "rayvtt.json"]);
+        ws.binaryType = "arraybuffer";
 
         ws.onopen = function () {
-            console.log("WebSocket connected");
+            console.log("WebSocket connected (" + (isBinary(ws) ? "binary" : "json") + ")");
 
             reconnectDelay = 1000; // reset on success
 
-            // Heartbeat loop
+            // Heartbeat loop, which also samples the round-trip time
             lastPongTime = Date.now();
+            pingSentAt = 0;
             heartbeatInterval = setInterval(function () {
                 if (ws.readyState === WebSocket.OPEN) {
-                    ws.send(JSON.stringify({ type: "ping" }));
+                    ws.send(isBinary(ws) ? encodeFrame(2) : JSON.stringify({ type: "ping" }));
+                    pingSentAt = performance.now();
                     if (Date.now() - lastPongTime > 10000) {
                         console.warn("Pong timeout — closing WebSocket");
                         ws.close();
                     }
                 }
-            }, 5000); // Send ping every 5 seconds
-
-            // Optionally notify server of persistent ID
-            ws.send(JSON.stringify({
-                type: "reconnect_request",
-                client_id: localStorage.rayvttClientId
-            }));
+            }, 2000); // Send ping every 2 seconds
         };
 
         ws.onclose = function () {
-            console.warn("WebSocket closed. Reconnecting in " + reconnectDelay + "ms...");
             clearInterval(heartbeatInterval);
+            if (redirectRoom !== null) {
+                console.log("Moving to room " + redirectRoom + " on another server");
+                redirectRoom = null;
+                setTimeout(setupWebSocket, 0);
+                return;
+            }
+            console.warn("WebSocket closed. Reconnecting in " + reconnectDelay + "ms...");
             setTimeout(setupWebSocket, reconnectDelay);
             reconnectDelay = Math.min(reconnectDelay * 2, 10000); // exponential backoff, cap at 10s
         };
@@ -61,66 +416,20 @@ EM_JS(void, js_websocket_init_internal, (const char* url_cstr), {
 
         ws.onmessage = function (event) {
             var data = event.data;
+            HEAPU32[(queue + 16) >> 2] += 1;
+            HEAPU32[(queue + 20) >> 2] += data instanceof ArrayBuffer ? data.byteLength : data.length;
             try {
-                var msg = JSON.parse(data);
-                var sender_id_ptr = 0;
-                var room_id_ptr = 0;
-                var user_id_ptr = 0;
-
-                if (msg.sender_id) {
-                    sender_id_ptr = Module.allocateUTF8(msg.sender_id);
-                }
-                if (msg.roomId) {
-                    room_id_ptr = Module.allocateUTF8(msg.roomId);
-                }
-                if (msg.userId) {
-                    user_id_ptr = Module.allocateUTF8(msg.userId);
-                }
-
-                if (msg.type === "init_state") {
-                    console.log("Received init_state");
-                    if (msg.client_id) {
-                        localStorage.rayvttClientId = msg.client_id; // Store the client ID
-                        var client_id_ptr = Module.allocateUTF8(msg.client_id);
-                        _network_set_client_id(client_id_ptr);
-                        Module._free(client_id_ptr);
-                    }
-                    for (var id in msg.tokens) {
-                        var tokenData = msg.tokens[id];
-                        _network_on_update_token(0, parseInt(tokenData.id), tokenData.x, tokenData.y);
-                    }
-                    _network_on_ready(); // Call network_on_ready after init_state
-                } else if (msg.type === "update_token") {
-                    _network_on_update_token(sender_id_ptr, parseInt(msg.id), msg.x, msg.y);
-                } else if (msg.type === "dice_roll") {
-                    var message_ptr = Module.allocateUTF8(msg.message);
-                    _network_on_add_dice_roll_message(sender_id_ptr, message_ptr);
-                    Module._free(message_ptr);
-                } else if (msg.type === "pong") {
-                    lastPongTime = Date.now();
-                } else if (msg.type === "room_joined") {
-                    _network_on_room_joined(room_id_ptr);
-                } else if (msg.type === "room_left") {
-                    _network_on_room_left();
-                } else if (msg.type === "user_joined") {
-                    _network_on_user_joined_room(user_id_ptr);
-                } else if (msg.type === "user_left") {
-                    _network_on_user_left_room(user_id_ptr);
+                if (data instanceof ArrayBuffer) {
+                    decodeFrame(data);
+                } else {
+                    handleMessage(JSON.parse(data));
                 }
-
-                if (sender_id_ptr) {
-                    Module._free(sender_id_ptr);
-                }
-                if (room_id_ptr) {
-                    Module._free(room_id_ptr);
-                }
-                if (user_id_ptr) {
-                    Module._free(user_id_ptr);
-                }
-
             } catch (e) {
                 console.error("Failed to handle WebSocket message:", e, data);
             }
+            if (redirectRoom !== null) {
+                ws.close();
+            }
         };
 
         window.rayvttWebSocket = ws;
@@ -134,9 +443,51 @@ EM_JS(void, js_websocket_send_internal, (const char* message_cstr), {
         window.rayvttWebSocket.send(UTF8ToString(message_cstr));
     } else {
         console.warn("WebSocket not open. Message not sent: " + UTF8ToString(message_cstr));
+        // A lost move leaves our tokens out of step with the server; resync with a snapshot
+        if (window.rayvttSyncState) window.rayvttSyncState.epoch = 0;
     }
 });
 
+EM_JS(void, js_websocket_send_binary_internal, (const uint8_t* data, int length), {
+    if (window.rayvttWebSocket && window.rayvttWebSocket.readyState === WebSocket.OPEN) {
+        window.rayvttWebSocket.send(HEAPU8.slice(data, data + length));
+    } else {
+        console.warn("WebSocket not open. Binary message not sent (" + length + " bytes)");
+        if (window.rayvttSyncState) window.rayvttSyncState.epoch = 0;
+    }
+});
+
+EM_JS(int, js_websocket_is_binary_internal, (), {
+    return window.rayvttWebSocket && window.rayvttWebSocket.protocol === "rayvtt.bin.1" ? 1 : 0;
+});
+
+EM_JS(void, js_sync_state_internal, (uint32_t* epoch, uint32_t* revision), {
+    var state = window.rayvttSyncState || { epoch: 0, revision: 0 };
+    HEAPU32[epoch >> 2] = state.epoch;
+    HEAPU32[revision >> 2] = state.revision;
+});
+
+EM_JS(void, js_set_held_token_internal, (int token_id), {
+    window.rayvttHeldToken = token_id;
+});
+
+EM_JS(int, js_event_queue_refill_internal, (), {
+    return window.rayvttEventQueue ? window.rayvttEventQueue.refill() : 0;
+});
+
+// Offers a recorded trace as a file download
+EM_JS(void, js_trace_download_internal, (const void* header, int headerLength, const void* records, int recordsLength), {
+    var blob = new Blob([HEAPU8.slice(header, header + headerLength), HEAPU8.slice(records, records + recordsLength)],
+                        { type: "application/octet-stream" });
+    var link = document.createElement("a");
+    link.href = URL.createObjectURL(blob);
+    link.download = "rayvtt-" + new Date().toISOString().replace(/[:.]/g, "-") + ".trace";
+    document.body.appendChild(link);
+    link.click();
+    document.body.removeChild(link);
+    setTimeout(function () { URL.revokeObjectURL(link.href); }, 0);
+});
+
 EM_JS(void, js_websocket_close_internal, (), {
     if (window.rayvttWebSocket) {
         window.rayvttWebSocket.close();
@@ -145,10 +496,81 @@ EM_JS(void, js_websocket_close_internal, (), {
 
 // Public network functions
 void network_init(const char* url) {
-    js_websocket_init_internal(url);
+    netQueue.head = 0;
+    netQueue.tail = 0;
+    netQueue.capacity = NET_QUEUE_CAPACITY;
+    netQueue.spilled = 0;
+    netQueue.messages = 0;
+    netQueue.bytes = 0;
+    js_websocket_init_internal(url, &netQueue);
+}
+
+static void trace_event(const NetEvent* event, double nowMs) {
+    if (traceCount == traceCapacity) {
+        size_t capacity = traceCapacity ? traceCapacity * 2 : 4096;
+        GameTraceRecord* records = realloc(traceRecords, sizeof(GameTraceRecord) * capacity);
+        if (records == NULL) {
+            APPLOG(APPLOG_WARN, APPLOG_NET, "Out of memory, trace recording stopped at %zu events.", traceCount);
+            traceRecording = false;
+            return;
+        }
+        traceRecords = records;
+        traceCapacity = capacity;
+    }
+    traceRecords[traceCount].timeMs = nowMs;
+    traceRecords[traceCount].event = *event;
+    traceCount++;
+}
+
+int network_poll(GameState* game, double nowMs) {
+    telemetry.messagesIn = netQueue.messages;
+    telemetry.bytesIn = netQueue.bytes;
+    telemetry_queue_depth(&telemetry, (int)(netQueue.head - netQueue.tail), (int)netQueue.spilled);
+
+    int changes = 0;
+    for (;;) {
+        while (netQueue.tail != netQueue.head) {
+            const NetEvent* event = &netQueue.events[netQueue.tail & (NET_QUEUE_CAPACITY - 1)];
+            if (event->type == NET_EVENT_PONG) {
+                telemetry_histogram_add(&telemetry.rttMs, event->x); // Nothing on screen changes
+            } else {
+                if (event->type == NET_EVENT_CLIENT_ID) network_set_client_id(event->text);
+                if (traceRecording) trace_event(event, nowMs);
+                changes |= game_apply_event(game, event, nowMs);
+            }
+            netQueue.tail++;
+        }
+        // Pull in anything JS had to park while the ring was full
+        if (netQueue.spilled == 0 || js_event_queue_refill_internal() == 0) break;
+    }
+    return changes;
+}
+
+void network_trace_start(void) {
+    traceCount = 0;
+    traceRecording = true;
+}
+
+bool network_trace_recording(void) {
+    return traceRecording;
+}
+
+size_t network_trace_stop(void) {
+    traceRecording = false;
+    size_t count = traceCount;
+    if (count > 0) {
+        GameTraceHeader header = { GAME_TRACE_MAGIC, GAME_TRACE_VERSION, sizeof(GameTraceRecord) };
+        js_trace_download_internal(&header, (int)sizeof(header), traceRecords, (int)(count * sizeof(GameTraceRecord)));
+    }
+    free(traceRecords);
+    traceRecords = NULL;
+    traceCount = 0;
+    traceCapacity = 0;
+    return count;
 }
 
 void network_send(const char* message) {
+    telemetry_count_out(&telemetry, (uint32_t)strlen(message));
     js_websocket_send_internal(message);
 }
 
@@ -156,16 +578,140 @@ void network_close() {
     js_websocket_close_internal();
 }
 
+bool network_is_binary() {
+    return js_websocket_is_binary_internal() != 0;
+}
+
+void network_send_frame(const ProtoWriter* writer) {
+    if (writer->overflow) {
+        APPLOG(APPLOG_WARN, APPLOG_NET, "Dropping oversized binary frame.");
+        return;
+    }
+    telemetry_count_out(&telemetry, (uint32_t)writer->length);
+    js_websocket_send_binary_internal(writer->data, (int)writer->length);
+}
+
+void network_send_move_token(int id, float x, float y, uint32_t seq, uint32_t timeMs, bool final) {
+    if (network_is_binary()) {
+        ProtoWriter writer;
+        proto_begin(&writer);
+        proto_move_token(&writer, id, x, y, seq, timeMs, final);
+        network_send_frame(&writer);
+    } else {
+        char message[192];
+        snprintf(message, sizeof(message), "{\"type\":\"move_token\",\"sender_id\":\"%s\",\"id\":%d,\"x\":%.2f,\"y\":%.2f,\"seq\":%u,\"t\":%u,\"final\":%s}",
+                 my_client_id, id, x, y, seq, timeMs, final ? "true" : "false");
+        network_send(message);
+    }
+}
+
+void network_set_held_token(int token_id) {
+    js_set_held_token_internal(token_id);
+}
+
+void network_send_dice_roll(const char* text) {
+    if (network_is_binary()) {
+        ProtoWriter writer;
+        proto_begin(&writer);
+        proto_dice_roll(&writer, my_client_id, text);
+        network_send_frame(&writer);
+    } else {
+        char message[256];
+        snprintf(message, sizeof(message), "{\"type\":\"dice_roll\",\"sender_id\":\"%s\",\"message\":\"%s\"}", my_client_id, text);
+        network_send(message);
+    }
+}
+
+void network_send_roll_dice(const char* expr) {
+    if (network_is_binary()) {
+        ProtoWriter writer;
+        proto_begin(&writer);
+        proto_roll_dice(&writer, expr);
+        network_send_frame(&writer);
+    } else {
+        char message[160];
+        snprintf(message, sizeof(message), "{\"type\":\"roll_dice\",\"expr\":\"%s\"}", expr);
+        network_send(message);
+    }
+}
+
+void network_send_history_request(uint32_t before, int limit) {
+    if (network_is_binary()) {
+        ProtoWriter writer;
+        proto_begin(&writer);
+        proto_history_request(&writer, before, limit);
+        network_send_frame(&writer);
+    } else {
+        char message[96];
+        snprintf(message, sizeof(message), "{\"type\":\"history_request\",\"before\":%u,\"limit\":%d}", before, limit);
+        network_send(message);
+    }
+}
+
+void network_send_viewport(float x, float y, float width, float height) {
+    if (network_is_binary()) {
+        ProtoWriter writer;
+        proto_begin(&writer);
+        proto_viewport(&writer, x, y, width, height);
+        network_send_frame(&writer);
+    } else {
+        char message[160];
+        snprintf(message, sizeof(message), "{\"type\":\"viewport\",\"x\":%.1f,\"y\":%.1f,\"width\":%.1f,\"height\":%.1f}", x, y, width, height);
+        network_send(message);
+    }
+}
+
+void network_send_fog_runs(int layer, int op, const uint16_t* runs, int count) {
+    bool binary = network_is_binary();
+    int perMessage = binary ? PROTOCOL_FOG_RUNS_PER_FRAME : 64;
+    for (int first = 0; first < count; first += perMessage) {
+        int n = count - first < perMessage ? count - first : perMessage;
+        const uint16_t* part = runs + first * 3;
+        if (binary) {
+            ProtoWriter writer;
+            proto_begin(&writer);
+            proto_fog_runs(&writer, layer, op, part, n);
+            network_send_frame(&writer);
+        } else {
+            // 64 runs of up to three 3-digit numbers fit comfortably
+            char message[1024];
+            int length = snprintf(message, sizeof(message), "{\"type\":\"fog_runs\",\"layer\":%d,\"op\":%d,\"runs\":[", layer, op);
+            for (int i = 0; i < n * 3; i++) {
+                length += snprintf(message + length, sizeof(message) - length, i == 0 ? "%u" : ",%u", part[i]);
+            }
+            snprintf(message + length, sizeof(message) - length, "]}");
+            network_send(message);
+        }
+    }
+}
+
 void network_join_room(const char* room_id) {
-    char message[128];
-    sprintf(message, "{\"type\":\"join_room\",\"roomId\":\"%s\"}", room_id);
-    network_send(message);
+    // Tell the server what state we hold. Leaving a room forgets it (room_left
+    // zeroes the epoch), so joining a room, even one we just left, gets a
+    // snapshot; only rejoining the room we are in can be answered with a delta.
+    uint32_t epoch, revision;
+    js_sync_state_internal(&epoch, &revision);
+    if (network_is_binary()) {
+        ProtoWriter writer;
+        proto_begin(&writer);
+        proto_join_room(&writer, room_id, epoch, revision);
+        network_send_frame(&writer);
+    } else {
+        char message[160];
+        snprintf(message, sizeof(message), "{\"type\":\"join_room\",\"roomId\":\"%s\",\"epoch\":%u,\"revision\":%u}", room_id, epoch, revision);
+        network_send(message);
+    }
 }
 
 void network_leave_room() {
-    char message[64];
-    sprintf(message, "{\"type\":\"leave_room\"}");
-    network_send(message);
+    if (network_is_binary()) {
+        ProtoWriter writer;
+        proto_begin(&writer);
+        proto_leave_room(&writer);
+        network_send_frame(&writer);
+    } else {
+        network_send("{\"type\":\"leave_room\"}");
+    }
 }
 
 void network_set_client_id(const char* new_client_id) {
@@ -2,16 +2,54 @@
 #define NETWORK_H
 
 extern char my_client_id[64]; // Declare my_client_id as extern
-extern char current_room_id[64]; // Declare current_room_id as extern
 
 #include "raylib.h" // For TraceLog, etc.
+#include "protocol.h"
+#include "game_state.h"
 
 // Function to initialize the WebSocket connection
 void network_init(const char* url);
 
+// Drains inbound events queued by the WebSocket handler and applies them to
+// the game state (game_apply_event). Call once per frame with the local clock;
+// returns the GAME_CHANGED_* flags of everything applied. Heartbeat replies
+// only feed telemetry.h.
+int network_poll(GameState* game, double nowMs);
+
+// Records every event network_poll() applies, for bench/replay_bench.c.
+// Stopping offers the trace as a file download and returns its event count.
+void network_trace_start(void);
+bool network_trace_recording(void);
+size_t network_trace_stop(void);
+
 // Function to send a message over WebSocket
 void network_send(const char* message);
 
+// True once the server accepted the binary subprotocol; JSON is the fallback
+bool network_is_binary();
+void network_send_frame(const ProtoWriter* writer);
+
+// Typed senders, encoded in whichever format was negotiated
+// seq increases with every sample a client sends; timeMs is the sender's clock.
+// Intermediate drag samples pass final = false, the drop passes true.
+void network_send_move_token(int id, float x, float y, uint32_t seq, uint32_t timeMs, bool final);
+void network_send_dice_roll(const char* text);
+// Asks the server to roll a dice expression ("2d20kh1+3"); the result comes back
+// as a NET_EVENT_DICE_RESULT. expr must not need JSON escaping.
+void network_send_roll_dice(const char* expr);
+// Asks for up to `limit` chat and dice lines older than history seq `before`
+// (0: the newest). They arrive as chat and dice events, newest first,
+// followed by NET_EVENT_HISTORY_END.
+void network_send_history_request(uint32_t before, int limit);
+// Area of interest: token updates far outside this world rectangle are not sent to us
+void network_send_viewport(float x, float y, float width, float height);
+// runs holds count (row, start, length) triples; long lists go out in several frames
+void network_send_fog_runs(int layer, int op, const uint16_t* runs, int count);
+
+// Token being dragged (-1 for none). Reported on reconnect so the server keeps
+// the drag alive instead of dropping it when the session resumes.
+void network_set_held_token(int token_id);
+
 // Function to close the WebSocket connection
 void network_close();
 
@@ -19,16 +57,6 @@ void network_close();
 void network_join_room(const char* room_id);
 void network_leave_room();
 
-// Callback functions for game logic (to be implemented in main.c or game.c)
-// These will be called by the network module when relevant messages are received
-void network_on_update_token(const char* sender_id, int id, float x, float y);
-void network_on_add_dice_roll_message(const char* sender_id, const char* message);
-void network_on_room_joined(const char* room_id);
-void network_on_room_left();
-void network_on_user_joined_room(const char* user_id);
-void network_on_user_left_room(const char* user_id);
-void network_on_ready(); // New callback for network ready
-
 // Function to set the client's own ID
 void network_set_client_id(const char* client_id);
 
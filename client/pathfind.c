@@ -0,0 +1,368 @@
+#include "pathfind.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define EMPTY_SLOT -1
+#define INITIAL_TOKENS 16
+#define TOKEN_COUNT_MASK 0x7f
+
+// Straight directions first, so traced paths prefer them on ties
+static const int DIRECTIONS[8][2] = {
+    { 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 },
+    { 1, 1 }, { -1, 1 }, { 1, -1 }, { -1, -1 },
+};
+
+static unsigned int hash_int(unsigned int x) {
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+// --- token table (token id -> dense index) ---
+
+static int find_slot(const PathGrid* grid, int id) {
+    unsigned int mask = (unsigned int)grid->slotCapacity - 1;
+    unsigned int slot = hash_int((unsigned int)id) & mask;
+    while (grid->slots[slot] != EMPTY_SLOT) {
+        if (grid->tokens[grid->slots[slot]].id == id) return (int)slot;
+        slot = (slot + 1) & mask;
+    }
+    return -1;
+}
+
+static void insert_slot(PathGrid* grid, int id, int index) {
+    unsigned int mask = (unsigned int)grid->slotCapacity - 1;
+    unsigned int slot = hash_int((unsigned int)id) & mask;
+    while (grid->slots[slot] != EMPTY_SLOT) {
+        slot = (slot + 1) & mask;
+    }
+    grid->slots[slot] = index;
+}
+
+static void remove_slot(PathGrid* grid, int slot) {
+    unsigned int mask = (unsigned int)grid->slotCapacity - 1;
+    unsigned int hole = (unsigned int)slot;
+    unsigned int next = (hole + 1) & mask;
+    while (grid->slots[next] != EMPTY_SLOT) {
+        unsigned int home = hash_int((unsigned int)grid->tokens[grid->slots[next]].id) & mask;
+        // Shift the entry back if the hole lies between its home slot and its current slot
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            grid->slots[hole] = grid->slots[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    grid->slots[hole] = EMPTY_SLOT;
+}
+
+static void rehash(PathGrid* grid, int newCapacity) {
+    free(grid->slots);
+    grid->slotCapacity = newCapacity;
+    grid->slots = malloc(sizeof(int) * newCapacity);
+    memset(grid->slots, 0xff, sizeof(int) * newCapacity);
+    for (int i = 0; i < grid->tokenCount; i++) {
+        insert_slot(grid, grid->tokens[i].id, i);
+    }
+}
+
+// --- cache invalidation ---
+
+// Marks the fields a change at `cell` can affect: those that reached the cell
+// or one of its neighbours (blocking or freeing it also opens or closes the
+// diagonal steps around it)
+static void touch_cell(PathGrid* grid, int cell) {
+    int x = cell % grid->width;
+    int y = cell / grid->width;
+    for (int i = 0; i < PATH_CACHE_FIELDS; i++) {
+        PathField* field = &grid->fields[i];
+        if (field->tokenId < 0 || field->stale) continue;
+        if (x < field->minX - 1 || x > field->maxX + 1 || y < field->minY - 1 || y > field->maxY + 1) continue;
+        for (int ny = y - 1; ny <= y + 1 && !field->stale; ny++) {
+            for (int nx = x - 1; nx <= x + 1; nx++) {
+                if (path_cost(grid, field, nx, ny) != PATH_UNREACHED) {
+                    field->stale = true;
+                    grid->invalidations++;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+static void touch_all(PathGrid* grid) {
+    for (int i = 0; i < PATH_CACHE_FIELDS; i++) {
+        if (grid->fields[i].tokenId >= 0 && !grid->fields[i].stale) {
+            grid->fields[i].stale = true;
+            grid->invalidations++;
+        }
+    }
+}
+
+// --- grid ---
+
+void path_init(PathGrid* grid, int width, int height) {
+    memset(grid, 0, sizeof(*grid));
+    grid->width = width < PATH_MAX_SIZE ? width : PATH_MAX_SIZE;
+    grid->height = height < PATH_MAX_SIZE ? height : PATH_MAX_SIZE;
+    int cells = grid->width * grid->height;
+    grid->cells = calloc(cells, 1);
+    grid->tokenCapacity = INITIAL_TOKENS;
+    grid->tokens = malloc(sizeof(PathToken) * grid->tokenCapacity);
+    rehash(grid, INITIAL_TOKENS * 2);
+    for (int i = 0; i < PATH_CACHE_FIELDS; i++) {
+        PathField* field = &grid->fields[i];
+        field->tokenId = -1;
+        field->cost = malloc(sizeof(uint16_t) * cells);
+        memset(field->cost, 0xff, sizeof(uint16_t) * cells);
+        field->minX = field->minY = 0;
+        field->maxX = field->maxY = -1;
+    }
+    for (int i = 0; i <= PATH_COST_DIAGONAL; i++) {
+        grid->buckets[i] = malloc(sizeof(int) * cells);
+    }
+}
+
+void path_free(PathGrid* grid) {
+    free(grid->cells);
+    free(grid->tokens);
+    free(grid->slots);
+    for (int i = 0; i < PATH_CACHE_FIELDS; i++) {
+        free(grid->fields[i].cost);
+    }
+    for (int i = 0; i <= PATH_COST_DIAGONAL; i++) {
+        free(grid->buckets[i]);
+    }
+    memset(grid, 0, sizeof(*grid));
+}
+
+void path_set_wall(PathGrid* grid, int x, int y, bool wall) {
+    if (x < 0 || y < 0 || x >= grid->width || y >= grid->height) return;
+    int cell = y * grid->width + x;
+    if (((grid->cells[cell] & PATH_CELL_WALL) != 0) == wall) return;
+    grid->cells[cell] ^= PATH_CELL_WALL;
+    touch_cell(grid, cell);
+}
+
+void path_clear_walls(PathGrid* grid) {
+    int cells = grid->width * grid->height;
+    for (int i = 0; i < cells; i++) {
+        grid->cells[i] &= ~PATH_CELL_WALL;
+    }
+    touch_all(grid);
+}
+
+static void occupy(PathGrid* grid, int cell, int delta) {
+    uint8_t count = grid->cells[cell] & TOKEN_COUNT_MASK;
+    if (delta > 0 && count == TOKEN_COUNT_MASK) return; // Saturated; blocked either way
+    if (delta < 0 && count == 0) return;
+    grid->cells[cell] += delta;
+    touch_cell(grid, cell);
+}
+
+void path_set_token(PathGrid* grid, int id, int x, int y) {
+    if (x < 0) x = 0;
+    if (y < 0) y = 0;
+    if (x >= grid->width) x = grid->width - 1;
+    if (y >= grid->height) y = grid->height - 1;
+    int cell = y * grid->width + x;
+
+    int slot = find_slot(grid, id);
+    if (slot >= 0) {
+        PathToken* token = &grid->tokens[grid->slots[slot]];
+        if (token->cell == cell) return;
+        occupy(grid, token->cell, -1);
+        token->cell = cell;
+        occupy(grid, cell, 1);
+        return;
+    }
+
+    if (grid->tokenCount == grid->tokenCapacity) {
+        grid->tokenCapacity *= 2;
+        grid->tokens = realloc(grid->tokens, sizeof(PathToken) * grid->tokenCapacity);
+    }
+    if ((grid->tokenCount + 1) * 2 > grid->slotCapacity) {
+        rehash(grid, grid->slotCapacity * 2);
+    }
+    int index = grid->tokenCount++;
+    grid->tokens[index] = (PathToken){ id, cell };
+    insert_slot(grid, id, index);
+    occupy(grid, cell, 1);
+}
+
+void path_remove_token(PathGrid* grid, int id) {
+    int slot = find_slot(grid, id);
+    if (slot < 0) return;
+    int index = grid->slots[slot];
+    occupy(grid, grid->tokens[index].cell, -1);
+    remove_slot(grid, slot);
+
+    // Keep the token array dense
+    int last = grid->tokenCount - 1;
+    if (index != last) {
+        grid->tokens[index] = grid->tokens[last];
+        grid->slots[find_slot(grid, grid->tokens[index].id)] = index;
+    }
+    grid->tokenCount--;
+}
+
+// --- search ---
+
+static bool blocked(const PathGrid* grid, const PathField* field, int cell) {
+    uint8_t value = grid->cells[cell];
+    if (value & PATH_CELL_WALL) return true;
+    return (value & TOKEN_COUNT_MASK) > (cell == field->selfCell ? 1 : 0);
+}
+
+// A step from `from` in direction d is allowed if it stays on the grid and a
+// diagonal does not cut a blocked corner; returns the target cell or -1
+static int step_to(const PathGrid* grid, const PathField* field, int from, int d) {
+    int x = from % grid->width + DIRECTIONS[d][0];
+    int y = from / grid->width + DIRECTIONS[d][1];
+    if (x < 0 || y < 0 || x >= grid->width || y >= grid->height) return -1;
+    if (d >= 4 && (blocked(grid, field, y * grid->width + x - DIRECTIONS[d][0]) ||
+                   blocked(grid, field, (y - DIRECTIONS[d][1]) * grid->width + x))) {
+        return -1;
+    }
+    return y * grid->width + x;
+}
+
+static void search(PathGrid* grid, PathField* field) {
+    int width = grid->width;
+
+    // Only the previously reached box holds costs to forget
+    for (int y = field->minY; y <= field->maxY; y++) {
+        memset(&field->cost[y * width + field->minX], 0xff, sizeof(uint16_t) * (field->maxX - field->minX + 1));
+    }
+    field->minX = field->maxX = field->originX;
+    field->minY = field->maxY = field->originY;
+    field->stale = false;
+    field->version++;
+    grid->searches++;
+
+    // Dial's algorithm: step costs are 2 or 3, so everything queued lies within
+    // four consecutive costs and a bucket per cost mod 4 is enough
+    int origin = field->originY * width + field->originX;
+    field->cost[origin] = 0;
+    memset(grid->bucketSize, 0, sizeof(grid->bucketSize));
+    grid->buckets[0][grid->bucketSize[0]++] = origin;
+    int queued = 1;
+    for (int current = 0; queued > 0; current++) {
+        int b = current & PATH_COST_DIAGONAL;
+        while (grid->bucketSize[b] > 0) {
+            int cell = grid->buckets[b][--grid->bucketSize[b]];
+            queued--;
+            if (field->cost[cell] != current) continue; // Reached more cheaply since it was queued
+            int x = cell % width;
+            int y = cell / width;
+
+            // Which neighbours are open, straight ones first; a diagonal also
+            // needs both straight cells beside it open
+            bool open[8];
+            for (int d = 0; d < 4; d++) {
+                int nx = x + DIRECTIONS[d][0];
+                int ny = y + DIRECTIONS[d][1];
+                open[d] = nx >= 0 && ny >= 0 && nx < width && ny < grid->height &&
+                          !blocked(grid, field, ny * width + nx);
+            }
+            open[4] = open[0] && open[2];
+            open[5] = open[1] && open[2];
+            open[6] = open[0] && open[3];
+            open[7] = open[1] && open[3];
+
+            for (int d = 0; d < 8; d++) {
+                if (!open[d]) continue;
+                int nx = x + DIRECTIONS[d][0];
+                int ny = y + DIRECTIONS[d][1];
+                int next = ny * width + nx;
+                if (d >= 4 && blocked(grid, field, next)) continue;
+                int cost = current + (d < 4 ? PATH_COST_STRAIGHT : PATH_COST_DIAGONAL);
+                if (cost > field->maxCost || field->cost[next] <= cost) continue;
+                field->cost[next] = (uint16_t)cost;
+                int nb = cost & PATH_COST_DIAGONAL;
+                grid->buckets[nb][grid->bucketSize[nb]++] = next;
+                queued++;
+
+                if (nx < field->minX) field->minX = nx;
+                if (nx > field->maxX) field->maxX = nx;
+                if (ny < field->minY) field->minY = ny;
+                if (ny > field->maxY) field->maxY = ny;
+            }
+        }
+    }
+}
+
+const PathField* path_field(PathGrid* grid, int tokenId, int x, int y, int maxCost) {
+    if (x < 0) x = 0;
+    if (y < 0) y = 0;
+    if (x >= grid->width) x = grid->width - 1;
+    if (y >= grid->height) y = grid->height - 1;
+    if (maxCost > PATH_UNREACHED - 1) maxCost = PATH_UNREACHED - 1;
+    int slot = find_slot(grid, tokenId);
+    int selfCell = slot >= 0 ? grid->tokens[grid->slots[slot]].cell : -1;
+
+    PathField* field = NULL;
+    PathField* oldest = &grid->fields[0];
+    for (int i = 0; i < PATH_CACHE_FIELDS; i++) {
+        PathField* candidate = &grid->fields[i];
+        if (candidate->tokenId == tokenId && candidate->originX == x && candidate->originY == y &&
+            candidate->maxCost == maxCost) {
+            field = candidate;
+            break;
+        }
+        if (candidate->tokenId < 0 || (oldest->tokenId >= 0 && candidate->lastUsed < oldest->lastUsed)) {
+            oldest = candidate;
+        }
+    }
+    if (field == NULL) {
+        field = oldest;
+        field->tokenId = tokenId;
+        field->originX = x;
+        field->originY = y;
+        field->maxCost = maxCost;
+        field->stale = true;
+    }
+    if (field->selfCell != selfCell) {
+        field->selfCell = selfCell;
+        field->stale = true;
+    }
+    field->lastUsed = ++grid->useClock;
+    if (field->stale) {
+        search(grid, field);
+    } else {
+        grid->cacheHits++;
+    }
+    return field;
+}
+
+int path_trace(const PathGrid* grid, const PathField* field, int x, int y, int* cells, int maxCells) {
+    if (path_cost(grid, field, x, y) == PATH_UNREACHED) return 0;
+    int cell = y * grid->width + x;
+    int count = 0;
+    for (;;) {
+        if (count == maxCells) return 0;
+        cells[count++] = cell;
+        int cost = field->cost[cell];
+        if (cost == 0) break;
+        // Step back to a neighbour the cost came from; steps are symmetric
+        int previous = -1;
+        for (int d = 0; d < 8 && previous < 0; d++) {
+            int neighbour = step_to(grid, field, cell, d);
+            if (neighbour >= 0 && field->cost[neighbour] != PATH_UNREACHED &&
+                field->cost[neighbour] + (d < 4 ? PATH_COST_STRAIGHT : PATH_COST_DIAGONAL) == cost) {
+                previous = neighbour;
+            }
+        }
+        if (previous < 0) return 0;
+        cell = previous;
+    }
+    // Origin first
+    for (int i = 0; i < count / 2; i++) {
+        int swap = cells[i];
+        cells[i] = cells[count - 1 - i];
+        cells[count - 1 - i] = swap;
+    }
+    return count;
+}
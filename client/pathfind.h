@@ -0,0 +1,104 @@
+#ifndef PATHFIND_H
+#define PATHFIND_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Movement range and shortest paths on the map grid, for token drags.
+//
+// A token moves between cells in eight directions. A straight step costs
+// PATH_COST_STRAIGHT, a diagonal one PATH_COST_DIAGONAL (1.5 cells on
+// average), and a diagonal step may not cut the corner of a wall or token.
+// Walls and cells holding other tokens block movement.
+//
+// path_field() returns the cost field of a token from its cell: the cost of
+// the cheapest way to every cell within maxCost, found with a bucket queue
+// (costs are small integers, so no heap is needed). Fields are cached per
+// token and origin, so a drag searches once and every mouse move afterwards
+// only walks a path back through the field. A wall or token change only
+// marks the cached fields whose reached cells touch it as stale; the others
+// are kept. Stale fields are searched again when next asked for.
+//
+// The same rules are checked by the server (server/pathfind.js).
+//
+// The engine does not depend on raylib so it can be benchmarked natively.
+
+#define PATH_MAX_SIZE 256
+#define PATH_COST_STRAIGHT 2
+#define PATH_COST_DIAGONAL 3
+#define PATH_MOVE_RANGE 24          // Cost a token may move in one drag (12 cells)
+#define PATH_UNREACHED 0xFFFF
+#define PATH_CACHE_FIELDS 4
+
+typedef struct PathField {
+    int tokenId;                 // -1 if the slot is unused
+    int originX;
+    int originY;
+    int maxCost;
+    int selfCell;                // Cell the token was registered on, it does not block itself
+    bool stale;                  // A change touched the reached cells, search again
+    uint32_t lastUsed;
+    uint32_t version;            // Bumped on every search, for overlays built from the field
+    uint16_t* cost;              // width * height, PATH_UNREACHED if not within maxCost
+    int minX;                    // Bounding box of the reached cells
+    int minY;
+    int maxX;
+    int maxY;
+} PathField;
+
+typedef struct PathToken {
+    int id;
+    int cell;                    // y * width + x
+} PathToken;
+
+typedef struct PathGrid {
+    int width;
+    int height;
+    uint8_t* cells;              // PATH_CELL_WALL | number of tokens on the cell
+
+    PathToken* tokens;           // Dense array
+    int tokenCount;
+    int tokenCapacity;
+    int* slots;                  // id -> token index (linear probing), -1 if empty
+    int slotCapacity;            // Power of two
+
+    PathField fields[PATH_CACHE_FIELDS];
+    uint32_t useClock;
+
+    int* buckets[PATH_COST_DIAGONAL + 1]; // Search queue, one bucket per cost mod 4
+    int bucketSize[PATH_COST_DIAGONAL + 1];
+
+    int searches;                // Fields searched, ever
+    int cacheHits;               // Fields returned from the cache, ever
+    int invalidations;           // Cached fields marked stale, ever
+} PathGrid;
+
+#define PATH_CELL_WALL 0x80
+
+// width/height are in cells, at most PATH_MAX_SIZE
+void path_init(PathGrid* grid, int width, int height);
+void path_free(PathGrid* grid);
+
+void path_set_wall(PathGrid* grid, int x, int y, bool wall);
+void path_clear_walls(PathGrid* grid);
+
+// Places a token on a cell, adding it if needed. Does nothing if it is
+// already there, so it is cheap to call on every position update.
+void path_set_token(PathGrid* grid, int id, int x, int y);
+void path_remove_token(PathGrid* grid, int id);
+
+// Cost field of a token moving from (x, y), searched up to maxCost. The
+// pointer is valid until the next call.
+const PathField* path_field(PathGrid* grid, int tokenId, int x, int y, int maxCost);
+
+static inline int path_cost(const PathGrid* grid, const PathField* field, int x, int y) {
+    if (x < 0 || y < 0 || x >= grid->width || y >= grid->height) return PATH_UNREACHED;
+    return field->cost[y * grid->width + x];
+}
+
+// Writes the cheapest path from the field's origin to (x, y) into `cells`
+// (y * width + x, origin first) and returns its length, or 0 if the cell is
+// not reached or the path is longer than maxCells
+int path_trace(const PathGrid* grid, const PathField* field, int x, int y, int* cells, int maxCells);
+
+#endif // PATHFIND_H
@@ -0,0 +1,133 @@
+#include "protocol.h"
+#include <string.h>
+
+static void put(ProtoWriter* w, const void* src, size_t n) {
+    if (w->length + n > sizeof(w->data)) {
+        w->overflow = 1;
+        return;
+    }
+    memcpy(w->data + w->length, src, n);
+    w->length += n;
+}
+
+void proto_begin(ProtoWriter* w) {
+    w->length = 0;
+    w->recordStart = 0;
+    w->overflow = 0;
+    proto_write_u8(w, PROTOCOL_VERSION);
+}
+
+void proto_begin_record(ProtoWriter* w, MessageType type) {
+    proto_write_u8(w, (uint8_t)type);
+    w->recordStart = w->length;
+    proto_write_u16(w, 0); // Patched by proto_end_record
+}
+
+void proto_end_record(ProtoWriter* w) {
+    if (w->overflow) return;
+    size_t payload = w->length - w->recordStart - 2;
+    w->data[w->recordStart] = (uint8_t)(payload & 0xff);
+    w->data[w->recordStart + 1] = (uint8_t)(payload >> 8);
+}
+
+void proto_write_u8(ProtoWriter* w, uint8_t v) {
+    put(w, &v, 1);
+}
+
+void proto_write_u16(ProtoWriter* w, uint16_t v) {
+    uint8_t b[2] = { (uint8_t)v, (uint8_t)(v >> 8) };
+    put(w, b, 2);
+}
+
+void proto_write_u32(ProtoWriter* w, uint32_t v) {
+    uint8_t b[4] = { (uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24) };
+    put(w, b, 4);
+}
+
+void proto_write_i32(ProtoWriter* w, int32_t v) {
+    proto_write_u32(w, (uint32_t)v);
+}
+
+void proto_write_f32(ProtoWriter* w, float v) {
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    proto_write_u32(w, bits);
+}
+
+void proto_write_str(ProtoWriter* w, const char* s) {
+    size_t len = s ? strlen(s) : 0;
+    if (len > 255) len = 255;
+    proto_write_u8(w, (uint8_t)len);
+    put(w, s, len);
+}
+
+void proto_write_text(ProtoWriter* w, const char* s) {
+    size_t len = s ? strlen(s) : 0;
+    if (len > 65535) len = 65535;
+    proto_write_u16(w, (uint16_t)len);
+    put(w, s, len);
+}
+
+void proto_move_token(ProtoWriter* w, int id, float x, float y, uint32_t seq, uint32_t timeMs, int final) {
+    proto_begin_record(w, MSG_MOVE_TOKEN);
+    proto_write_i32(w, id);
+    proto_write_f32(w, x);
+    proto_write_f32(w, y);
+    proto_write_u32(w, seq);
+    proto_write_u32(w, timeMs);
+    proto_write_u8(w, final ? MOVE_FLAG_FINAL : 0);
+    proto_end_record(w);
+}
+
+void proto_dice_roll(ProtoWriter* w, const char* sender_id, const char* message) {
+    proto_begin_record(w, MSG_DICE_ROLL);
+    proto_write_str(w, sender_id);
+    proto_write_text(w, message);
+    proto_end_record(w);
+}
+
+void proto_roll_dice(ProtoWriter* w, const char* expr) {
+    proto_begin_record(w, MSG_ROLL_DICE);
+    proto_write_text(w, expr);
+    proto_end_record(w);
+}
+
+void proto_join_room(ProtoWriter* w, const char* room_id, uint32_t epoch, uint32_t revision) {
+    proto_begin_record(w, MSG_JOIN_ROOM);
+    proto_write_str(w, room_id);
+    proto_write_u32(w, epoch);
+    proto_write_u32(w, revision);
+    proto_end_record(w);
+}
+
+void proto_leave_room(ProtoWriter* w) {
+    proto_begin_record(w, MSG_LEAVE_ROOM);
+    proto_end_record(w);
+}
+
+void proto_viewport(ProtoWriter* w, float x, float y, float width, float height) {
+    proto_begin_record(w, MSG_VIEWPORT);
+    proto_write_f32(w, x);
+    proto_write_f32(w, y);
+    proto_write_f32(w, width);
+    proto_write_f32(w, height);
+    proto_end_record(w);
+}
+
+void proto_history_request(ProtoWriter* w, uint32_t before, int limit) {
+    proto_begin_record(w, MSG_HISTORY_REQUEST);
+    proto_write_u32(w, before);
+    proto_write_u16(w, (uint16_t)limit);
+    proto_end_record(w);
+}
+
+void proto_fog_runs(ProtoWriter* w, int layer, int op, const uint16_t* runs, int count) {
+    proto_begin_record(w, MSG_FOG_RUNS);
+    proto_write_u8(w, (uint8_t)layer);
+    proto_write_u8(w, (uint8_t)op);
+    proto_write_u16(w, (uint16_t)count);
+    for (int i = 0; i < count * 3; i++) {
+        proto_write_u16(w, runs[i]);
+    }
+    proto_end_record(w);
+}
@@ -0,0 +1,87 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Binary wire protocol shared with the server (see server/protocol.js for the
+// full layout). A frame is a version byte followed by length-prefixed records:
+//
+//   frame  := u8 version, record*
+//   record := u8 type, u16 payloadLength, payload
+//
+// All values are little-endian. Keep these constants in sync with the server.
+
+#define PROTOCOL_VERSION 1
+#define PROTOCOL_SUBPROTOCOL_BINARY "rayvtt.bin.1"
+#define PROTOCOL_SUBPROTOCOL_JSON "rayvtt.json"
+
+typedef enum MessageType {
+    MSG_RECONNECT_REQUEST = 1,
+    MSG_PING = 2,
+    MSG_PONG = 3,
+    MSG_INIT_STATE = 4,
+    MSG_MOVE_TOKEN = 5,
+    MSG_UPDATE_TOKEN = 6,
+    MSG_DICE_ROLL = 7,
+    MSG_JOIN_ROOM = 8,
+    MSG_LEAVE_ROOM = 9,
+    MSG_ROOM_JOINED = 10,
+    MSG_ROOM_LEFT = 11,
+    MSG_USER_JOINED = 12,
+    MSG_USER_LEFT = 13,
+    MSG_CHAT_MESSAGE = 14,
+    MSG_STATE_SYNC = 15,
+    MSG_STATE_REVISION = 16,
+    MSG_ROOM_REDIRECT = 17,
+    MSG_FOG_RUNS = 18,
+    MSG_VIEWPORT = 19,
+    MSG_ROLL_DICE = 20,
+    MSG_DICE_RESULT = 21,
+    MSG_HISTORY_REQUEST = 22,
+    MSG_HISTORY_END = 23,
+} MessageType;
+
+#define PROTOCOL_MAX_FRAME 1024
+#define MOVE_FLAG_FINAL 1 // Last sample of a drag
+#define SYNC_FLAG_SNAPSHOT 1 // State sync replaces the whole state instead of patching it
+#define HISTORY_FLAG_MORE 1  // history_end: the server has older lines
+// Runs of fog cells that fit one frame next to the version byte and record header
+#define PROTOCOL_FOG_RUNS_PER_FRAME ((PROTOCOL_MAX_FRAME - 1 - 3 - 4) / 6)
+
+// Fixed-size frame builder. Writes past the end are dropped and flagged.
+typedef struct ProtoWriter {
+    uint8_t data[PROTOCOL_MAX_FRAME];
+    size_t length;
+    size_t recordStart;
+    int overflow;
+} ProtoWriter;
+
+void proto_begin(ProtoWriter* w);
+void proto_begin_record(ProtoWriter* w, MessageType type);
+void proto_end_record(ProtoWriter* w);
+
+void proto_write_u8(ProtoWriter* w, uint8_t v);
+void proto_write_u16(ProtoWriter* w, uint16_t v);
+void proto_write_i32(ProtoWriter* w, int32_t v);
+void proto_write_u32(ProtoWriter* w, uint32_t v);
+void proto_write_f32(ProtoWriter* w, float v);
+void proto_write_str(ProtoWriter* w, const char* s);  // u8 length prefix
+void proto_write_text(ProtoWriter* w, const char* s); // u16 length prefix
+
+// Convenience encoders for the messages the client sends
+void proto_move_token(ProtoWriter* w, int id, float x, float y, uint32_t seq, uint32_t timeMs, int final);
+void proto_dice_roll(ProtoWriter* w, const char* sender_id, const char* message);
+// Dice expression for the server to roll (see server/dice.js for the syntax)
+void proto_roll_dice(ProtoWriter* w, const char* expr);
+// epoch/revision identify the room state we already hold (0 if none)
+void proto_join_room(ProtoWriter* w, const char* room_id, uint32_t epoch, uint32_t revision);
+void proto_leave_room(ProtoWriter* w);
+// World rectangle the client shows; the server only sends token updates near it
+void proto_viewport(ProtoWriter* w, float x, float y, float width, float height);
+// Asks for up to `limit` chat and dice lines older than seq `before` (0: the newest)
+void proto_history_request(ProtoWriter* w, uint32_t before, int limit);
+// runs holds count (row, start, length) triples of cells on a fog layer (see fog.h)
+void proto_fog_runs(ProtoWriter* w, int layer, int op, const uint16_t* runs, int count);
+
+#endif // PROTOCOL_H
@@ -0,0 +1,177 @@
+#include "sprite_atlas.h"
+#include <stdlib.h>
+#include <string.h>
+#include "applog.h"
+
+#define EMPTY_SLOT -1
+#define SLOT_MASK (SPRITE_ATLAS_MAX_SPRITES * 2 - 1)
+
+static unsigned int hash_key(unsigned int x) {
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+static int find_sprite(const SpriteAtlas* atlas, int key) {
+    unsigned int slot = hash_key((unsigned int)key) & SLOT_MASK;
+    while (atlas->slots[slot] != EMPTY_SLOT) {
+        if (atlas->sprites[atlas->slots[slot]].key == key) return atlas->slots[slot];
+        slot = (slot + 1) & SLOT_MASK;
+    }
+    return -1;
+}
+
+static void insert_slot(SpriteAtlas* atlas, int key, int sprite) {
+    unsigned int slot = hash_key((unsigned int)key) & SLOT_MASK;
+    while (atlas->slots[slot] != EMPTY_SLOT) {
+        slot = (slot + 1) & SLOT_MASK;
+    }
+    atlas->slots[slot] = sprite;
+}
+
+static void reset_packing(SpriteAtlas* atlas) {
+    atlas->count = 0;
+    atlas->shelfCount = 0;
+    atlas->nextShelfY = 0;
+    memset(atlas->slots, 0xff, sizeof(atlas->slots));
+}
+
+// Finds room for a width x height cell (padding included). Uses the first
+// shelf that is tall enough without wasting more than a third of its height,
+// otherwise opens a new shelf below the last one.
+static bool pack(SpriteAtlas* atlas, int width, int height, int* outX, int* outY) {
+    for (int i = 0; i < atlas->shelfCount; i++) {
+        AtlasShelf* shelf = &atlas->shelves[i];
+        if (height <= shelf->height && height * 3 >= shelf->height * 2 && shelf->x + width <= atlas->size) {
+            *outX = shelf->x;
+            *outY = shelf->y;
+            shelf->x += width;
+            return true;
+        }
+    }
+    if (atlas->shelfCount == SPRITE_ATLAS_MAX_SHELVES || atlas->nextShelfY + height > atlas->size || width > atlas->size) {
+        return false;
+    }
+    AtlasShelf* shelf = &atlas->shelves[atlas->shelfCount++];
+    shelf->y = atlas->nextShelfY;
+    shelf->height = height;
+    shelf->x = width;
+    atlas->nextShelfY += height;
+    *outX = 0;
+    *outY = shelf->y;
+    return true;
+}
+
+// Packs and uploads an image; returns the sprite index or -1 if it does not fit
+static int place(SpriteAtlas* atlas, int key, Image image, unsigned int lastUsed) {
+    if (atlas->count == SPRITE_ATLAS_MAX_SPRITES) return -1;
+    int x, y;
+    if (!pack(atlas, image.width + SPRITE_ATLAS_PADDING, image.height + SPRITE_ATLAS_PADDING, &x, &y)) return -1;
+
+    if (image.format != PIXELFORMAT_UNCOMPRESSED_R8G8B8A8) {
+        ImageFormat(&image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+    }
+    Rectangle rect = { (float)x, (float)y, (float)image.width, (float)image.height };
+    UpdateTextureRec(atlas->texture, rect, image.data);
+
+    int sprite = atlas->count++;
+    atlas->sprites[sprite] = (AtlasSprite){ key, rect, lastUsed };
+    insert_slot(atlas, key, sprite);
+    return sprite;
+}
+
+static int compare_height_desc(const void* a, const void* b) {
+    const AtlasSprite* sa = (const AtlasSprite*)a;
+    const AtlasSprite* sb = (const AtlasSprite*)b;
+    return (int)(sb->rect.height - sa->rect.height);
+}
+
+// Repacks the atlas with the recently used sprites only, tallest first so the
+// shelves fill up tightly. Returns false if nothing would be evicted.
+static bool rebuild(SpriteAtlas* atlas) {
+    unsigned int keepSince = atlas->frame > SPRITE_ATLAS_KEEP_FRAMES ? atlas->frame - SPRITE_ATLAS_KEEP_FRAMES : 0;
+    AtlasSprite* kept = malloc(sizeof(AtlasSprite) * (atlas->count > 0 ? atlas->count : 1));
+    int keptCount = 0;
+    for (int i = 0; i < atlas->count; i++) {
+        if (atlas->sprites[i].lastUsed >= keepSince) kept[keptCount++] = atlas->sprites[i];
+    }
+    if (keptCount == atlas->count) {
+        free(kept);
+        return false;
+    }
+
+    APPLOG(APPLOG_INFO, APPLOG_GAME, "Repacking sprite atlas: keeping %d of %d sprites", keptCount, atlas->count);
+    qsort(kept, keptCount, sizeof(AtlasSprite), compare_height_desc);
+    reset_packing(atlas);
+    // Sprites land in different places, so the old ones would otherwise show
+    // through the padding and the ends of the shelves
+    Image blank = GenImageColor(atlas->size, atlas->size, BLANK);
+    UpdateTexture(atlas->texture, blank.data);
+    UnloadImage(blank);
+    for (int i = 0; i < keptCount; i++) {
+        Image image = atlas->source(kept[i].key, atlas->user);
+        if (image.data == NULL) continue;
+        place(atlas, kept[i].key, image, kept[i].lastUsed);
+        UnloadImage(image);
+    }
+    free(kept);
+    atlas->rebuilds++;
+    return true;
+}
+
+void sprite_atlas_init(SpriteAtlas* atlas, SpriteSourceFn source, void* user) {
+    atlas->size = SPRITE_ATLAS_SIZE;
+    Image blank = GenImageColor(atlas->size, atlas->size, BLANK);
+    atlas->texture = LoadTextureFromImage(blank);
+    UnloadImage(blank);
+    SetTextureFilter(atlas->texture, TEXTURE_FILTER_BILINEAR);
+    atlas->source = source;
+    atlas->user = user;
+    atlas->frame = 1;
+    atlas->fullFrame = 0;
+    atlas->rebuilds = 0;
+    atlas->misses = 0;
+    reset_packing(atlas);
+}
+
+void sprite_atlas_free(SpriteAtlas* atlas) {
+    UnloadTexture(atlas->texture);
+    reset_packing(atlas);
+}
+
+void sprite_atlas_begin_frame(SpriteAtlas* atlas) {
+    atlas->frame++;
+    atlas->misses = 0;
+}
+
+bool sprite_atlas_get(SpriteAtlas* atlas, int key, Rectangle* source) {
+    int sprite = find_sprite(atlas, key);
+    if (sprite < 0) {
+        if (atlas->fullFrame == atlas->frame) {
+            atlas->misses++;
+            return false; // Already found the atlas full this frame
+        }
+        Image image = atlas->source(key, atlas->user);
+        if (image.data == NULL) {
+            atlas->misses++;
+            return false;
+        }
+        sprite = place(atlas, key, image, atlas->frame);
+        if (sprite < 0 && rebuild(atlas)) {
+            sprite = place(atlas, key, image, atlas->frame);
+        }
+        UnloadImage(image);
+        if (sprite < 0) {
+            APPLOG(APPLOG_WARN, APPLOG_GAME, "Sprite atlas full (%d sprites); drawing sprite %d unbatched", atlas->count, key);
+            atlas->fullFrame = atlas->frame;
+            atlas->misses++;
+            return false;
+        }
+    }
+    atlas->sprites[sprite].lastUsed = atlas->frame;
+    *source = atlas->sprites[sprite].rect;
+    return true;
+}
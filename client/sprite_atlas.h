@@ -0,0 +1,73 @@
+#ifndef SPRITE_ATLAS_H
+#define SPRITE_ATLAS_H
+
+#include <stdbool.h>
+#include "raylib.h"
+
+// Runtime texture atlas for token images.
+//
+// Sprites are packed on first use into one large texture with a shelf packer,
+// so every token drawn from the atlas shares a texture and raylib can batch
+// them into a single draw call. The atlas keeps no CPU copies: images come
+// from a source callback, both when a sprite is first needed and when the
+// atlas is rebuilt. When a new sprite does not fit, the atlas is repacked
+// with only the sprites used in the last SPRITE_ATLAS_KEEP_FRAMES frames;
+// if nothing can be evicted the sprite is reported as missing and the caller
+// draws it some other way.
+
+#define SPRITE_ATLAS_SIZE 2048
+#define SPRITE_ATLAS_MAX_SPRITES 2048 // Power of two
+#define SPRITE_ATLAS_MAX_SHELVES 256
+#define SPRITE_ATLAS_KEEP_FRAMES 120
+#define SPRITE_ATLAS_PADDING 2        // Transparent gap against bilinear bleeding
+
+// Returns the image for `key` (any size up to the atlas), or an image with
+// NULL data if there is none. The atlas unloads it after uploading.
+typedef Image (*SpriteSourceFn)(int key, void* user);
+
+typedef struct AtlasSprite {
+    int key;
+    Rectangle rect;        // Source rectangle in the atlas texture
+    unsigned int lastUsed; // Frame number
+} AtlasSprite;
+
+typedef struct AtlasShelf {
+    int y;
+    int height;
+    int x;                 // Next free column
+} AtlasShelf;
+
+typedef struct SpriteAtlas {
+    Texture2D texture;
+    int size;
+
+    AtlasSprite sprites[SPRITE_ATLAS_MAX_SPRITES];
+    int count;
+    int slots[SPRITE_ATLAS_MAX_SPRITES * 2]; // key -> sprite (linear probing), -1 if empty
+
+    AtlasShelf shelves[SPRITE_ATLAS_MAX_SHELVES];
+    int shelfCount;
+    int nextShelfY;
+
+    SpriteSourceFn source;
+    void* user;
+
+    unsigned int frame;
+    unsigned int fullFrame; // Frame in which a sprite did not fit even after repacking
+
+    // Counters for the stats overlay
+    int rebuilds;
+    int misses;             // Sprites that could not be placed this frame
+} SpriteAtlas;
+
+void sprite_atlas_init(SpriteAtlas* atlas, SpriteSourceFn source, void* user);
+void sprite_atlas_free(SpriteAtlas* atlas);
+
+// Starts a new frame for the usage tracking that decides what a rebuild keeps
+void sprite_atlas_begin_frame(SpriteAtlas* atlas);
+
+// Looks up `key`, packing it on first use. Returns false if it is not in the
+// atlas and could not be added.
+bool sprite_atlas_get(SpriteAtlas* atlas, int key, Rectangle* source);
+
+#endif // SPRITE_ATLAS_H
@@ -0,0 +1,59 @@
+#include "telemetry.h"
+#include <math.h>
+#include <string.h>
+
+Telemetry telemetry;
+
+void telemetry_init(Telemetry* t, double now) {
+    memset(t, 0, sizeof(*t));
+    t->windowStart = now;
+}
+
+void telemetry_histogram_add(TelemetryHistogram* h, double ms) {
+    int bucket = 0;
+    if (ms > TELEMETRY_MIN_MS) {
+        bucket = (int)(log2(ms / TELEMETRY_MIN_MS) * TELEMETRY_BUCKETS_PER_DOUBLING);
+        if (bucket >= TELEMETRY_BUCKETS) bucket = TELEMETRY_BUCKETS - 1;
+    }
+    h->counts[bucket]++;
+    h->count++;
+    h->sum += ms;
+    h->last = ms;
+    if (ms > h->max) h->max = ms;
+}
+
+double telemetry_histogram_quantile(const TelemetryHistogram* h, double q) {
+    if (h->count == 0) return 0.0;
+    double target = q * h->count;
+    uint32_t seen = 0;
+    for (int i = 0; i < TELEMETRY_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= target && seen > 0) {
+            double edge = TELEMETRY_MIN_MS * exp2((double)(i + 1) / TELEMETRY_BUCKETS_PER_DOUBLING);
+            return edge < h->max ? edge : h->max; // The last bucket is open ended
+        }
+    }
+    return h->max;
+}
+
+bool telemetry_tick(Telemetry* t, double now) {
+    double elapsed = now - t->windowStart;
+    if (elapsed < 1.0) return false;
+
+    // Unsigned differences stay right when the totals wrap
+    t->messagesInPerSecond = (float)((uint32_t)(t->messagesIn - t->windowMessagesIn) / elapsed);
+    t->bytesInPerSecond = (float)((uint32_t)(t->bytesIn - t->windowBytesIn) / elapsed);
+    t->messagesOutPerSecond = (float)((uint32_t)(t->messagesOut - t->windowMessagesOut) / elapsed);
+    t->bytesOutPerSecond = (float)((uint32_t)(t->bytesOut - t->windowBytesOut) / elapsed);
+    t->maxQueueDepth = t->queueDepth;
+    t->maxQueueSpilled = t->queueSpilled;
+
+    t->windowStart = now;
+    t->windowMessagesIn = t->messagesIn;
+    t->windowBytesIn = t->bytesIn;
+    t->windowMessagesOut = t->messagesOut;
+    t->windowBytesOut = t->bytesOut;
+    t->queueDepth = 0;
+    t->queueSpilled = 0;
+    return true;
+}
@@ -0,0 +1,80 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Client performance counters for the F4 overlay: round-trip time, frame
+// time, message and byte rates in both directions, and inbound queue depth.
+//
+// Histograms have log-spaced buckets (four per doubling, from 0.05 ms to
+// about 3 s), so recording a sample is one log2 and an increment, and
+// quantiles are only read off the buckets when the overlay is drawn. They
+// cover the whole session. Rates and the queue depth are per one-second
+// window, like FrameStats.
+//
+// No raylib or Emscripten dependency.
+
+#define TELEMETRY_BUCKETS 64
+#define TELEMETRY_MIN_MS 0.05
+#define TELEMETRY_BUCKETS_PER_DOUBLING 4
+
+typedef struct TelemetryHistogram {
+    uint32_t counts[TELEMETRY_BUCKETS];
+    uint32_t count;
+    double sum;
+    double max;
+    double last;
+} TelemetryHistogram;
+
+typedef struct Telemetry {
+    TelemetryHistogram rttMs;
+    TelemetryHistogram frameMs;
+
+    // Free-running totals; inbound ones are counted by the WebSocket handler
+    uint32_t messagesIn;
+    uint32_t bytesIn;
+    uint32_t messagesOut;
+    uint32_t bytesOut;
+    int queueDepth;      // Deepest inbound queue seen in this window
+    int queueSpilled;    // Most events parked on the JS side in this window
+
+    // Totals at the start of the current window
+    double windowStart;
+    uint32_t windowMessagesIn;
+    uint32_t windowBytesIn;
+    uint32_t windowMessagesOut;
+    uint32_t windowBytesOut;
+
+    // Results of the last completed one-second window
+    float messagesInPerSecond;
+    float bytesInPerSecond;
+    float messagesOutPerSecond;
+    float bytesOutPerSecond;
+    int maxQueueDepth;
+    int maxQueueSpilled;
+} Telemetry;
+
+extern Telemetry telemetry;
+
+void telemetry_init(Telemetry* t, double now);
+
+void telemetry_histogram_add(TelemetryHistogram* h, double ms);
+// Upper edge of the bucket holding the q-th quantile (0 if empty)
+double telemetry_histogram_quantile(const TelemetryHistogram* h, double q);
+
+static inline void telemetry_count_out(Telemetry* t, uint32_t bytes) {
+    t->messagesOut++;
+    t->bytesOut += bytes;
+}
+
+static inline void telemetry_queue_depth(Telemetry* t, int depth, int spilled) {
+    if (depth > t->queueDepth) t->queueDepth = depth;
+    if (spilled > t->queueSpilled) t->queueSpilled = spilled;
+}
+
+// Publishes the rates once a second has passed. Returns true when it did
+// (so an on-screen readout knows to refresh).
+bool telemetry_tick(Telemetry* t, double now);
+
+#endif // TELEMETRY_H
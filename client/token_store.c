@@ -0,0 +1,375 @@
+#include "token_store.h"
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <math.h>
+
+#define TOKEN_STORE_INITIAL_CAPACITY 16
+#define EMPTY_SLOT -1
+
+static unsigned int hash_int(unsigned int x) {
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+static unsigned int hash_cell(long long key) {
+    return hash_int((unsigned int)key ^ hash_int((unsigned int)(key >> 32)));
+}
+
+static long long make_cell_key(int cx, int cy) {
+    return (long long)(((unsigned long long)(unsigned int)cx << 32) | (unsigned int)cy);
+}
+
+static long long cell_key_for(const TokenStore* store, float x, float y) {
+    return make_cell_key((int)floorf(x / store->cellSize), (int)floorf(y / store->cellSize));
+}
+
+// --- id -> index map (linear probing, backward-shift deletion) ---
+
+static int id_find_slot(const TokenStore* store, int id) {
+    unsigned int mask = (unsigned int)store->idCapacity - 1;
+    unsigned int slot = hash_int((unsigned int)id) & mask;
+    while (store->idSlots[slot] != EMPTY_SLOT) {
+        if (store->idKeys[slot] == id) return (int)slot;
+        slot = (slot + 1) & mask;
+    }
+    return -1;
+}
+
+static void id_insert(TokenStore* store, int id, int index) {
+    unsigned int mask = (unsigned int)store->idCapacity - 1;
+    unsigned int slot = hash_int((unsigned int)id) & mask;
+    while (store->idSlots[slot] != EMPTY_SLOT && store->idKeys[slot] != id) {
+        slot = (slot + 1) & mask;
+    }
+    store->idKeys[slot] = id;
+    store->idSlots[slot] = index;
+}
+
+static void id_remove_slot(TokenStore* store, int slot) {
+    unsigned int mask = (unsigned int)store->idCapacity - 1;
+    unsigned int hole = (unsigned int)slot;
+    unsigned int next = (hole + 1) & mask;
+    while (store->idSlots[next] != EMPTY_SLOT) {
+        unsigned int home = hash_int((unsigned int)store->idKeys[next]) & mask;
+        // Shift the entry back if the hole lies between its home slot and its current slot
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            store->idKeys[hole] = store->idKeys[next];
+            store->idSlots[hole] = store->idSlots[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    store->idSlots[hole] = EMPTY_SLOT;
+}
+
+static void id_rehash(TokenStore* store, int newCapacity) {
+    int* oldKeys = store->idKeys;
+    int* oldSlots = store->idSlots;
+    int oldCapacity = store->idCapacity;
+
+    store->idCapacity = newCapacity;
+    store->idKeys = malloc(sizeof(int) * newCapacity);
+    store->idSlots = malloc(sizeof(int) * newCapacity);
+    memset(store->idSlots, 0xff, sizeof(int) * newCapacity);
+
+    for (int i = 0; i < oldCapacity; i++) {
+        if (oldSlots[i] != EMPTY_SLOT) id_insert(store, oldKeys[i], oldSlots[i]);
+    }
+    free(oldKeys);
+    free(oldSlots);
+}
+
+// --- spatial hash (cell key -> head of an intrusive doubly linked list) ---
+
+static int cell_find_slot(const TokenStore* store, long long key, bool* found) {
+    unsigned int mask = (unsigned int)store->cellCapacity - 1;
+    unsigned int slot = hash_cell(key) & mask;
+    while (store->cellKeys[slot] != LLONG_MIN) {
+        if (store->cellKeys[slot] == key) {
+            *found = true;
+            return (int)slot;
+        }
+        slot = (slot + 1) & mask;
+    }
+    *found = false;
+    return (int)slot;
+}
+
+static void cell_rehash(TokenStore* store, int newCapacity) {
+    long long* oldKeys = store->cellKeys;
+    int* oldHeads = store->cellHeads;
+    int oldCapacity = store->cellCapacity;
+
+    store->cellCapacity = newCapacity;
+    store->cellKeys = malloc(sizeof(long long) * newCapacity);
+    store->cellHeads = malloc(sizeof(int) * newCapacity);
+    for (int i = 0; i < newCapacity; i++) store->cellKeys[i] = LLONG_MIN;
+    memset(store->cellHeads, 0xff, sizeof(int) * newCapacity);
+    store->cellUsed = 0;
+
+    // Empty cells are dropped here, which keeps the table from growing without bound
+    for (int i = 0; i < oldCapacity; i++) {
+        if (oldHeads[i] == EMPTY_SLOT) continue;
+        bool found;
+        int slot = cell_find_slot(store, oldKeys[i], &found);
+        store->cellKeys[slot] = oldKeys[i];
+        store->cellHeads[slot] = oldHeads[i];
+        store->cellUsed++;
+    }
+    free(oldKeys);
+    free(oldHeads);
+}
+
+static int cell_head(const TokenStore* store, long long key) {
+    bool found;
+    int slot = cell_find_slot(store, key, &found);
+    return found ? store->cellHeads[slot] : EMPTY_SLOT;
+}
+
+static void cell_link(TokenStore* store, int index, long long key) {
+    if ((store->cellUsed + 1) * 2 > store->cellCapacity) {
+        // Size for the occupied cells only; empty ones are dropped by the rehash
+        int live = 0;
+        for (int i = 0; i < store->cellCapacity; i++) {
+            if (store->cellHeads[i] != EMPTY_SLOT) live++;
+        }
+        int newCapacity = TOKEN_STORE_INITIAL_CAPACITY * 2;
+        while ((live + 1) * 4 > newCapacity) newCapacity *= 2;
+        cell_rehash(store, newCapacity);
+    }
+    bool found;
+    int slot = cell_find_slot(store, key, &found);
+    if (!found) {
+        store->cellKeys[slot] = key;
+        store->cellHeads[slot] = EMPTY_SLOT;
+        store->cellUsed++;
+    }
+    int head = store->cellHeads[slot];
+    store->cellPrev[index] = EMPTY_SLOT;
+    store->cellNext[index] = head;
+    if (head != EMPTY_SLOT) store->cellPrev[head] = index;
+    store->cellHeads[slot] = index;
+    store->cellKey[index] = key;
+}
+
+static void cell_unlink(TokenStore* store, int index) {
+    int prev = store->cellPrev[index];
+    int next = store->cellNext[index];
+    if (prev != EMPTY_SLOT) {
+        store->cellNext[prev] = next;
+    } else {
+        bool found;
+        int slot = cell_find_slot(store, store->cellKey[index], &found);
+        if (found) store->cellHeads[slot] = next;
+    }
+    if (next != EMPTY_SLOT) store->cellPrev[next] = prev;
+}
+
+// Rewrites every reference to dense index `from` so the token can live at `to`
+static void relocate(TokenStore* store, int from, int to) {
+    store->tokens[to] = store->tokens[from];
+    store->cellKey[to] = store->cellKey[from];
+    store->cellPrev[to] = store->cellPrev[from];
+    store->cellNext[to] = store->cellNext[from];
+
+    int prev = store->cellPrev[to];
+    int next = store->cellNext[to];
+    if (prev != EMPTY_SLOT) {
+        store->cellNext[prev] = to;
+    } else {
+        bool found;
+        int slot = cell_find_slot(store, store->cellKey[to], &found);
+        if (found) store->cellHeads[slot] = to;
+    }
+    if (next != EMPTY_SLOT) store->cellPrev[next] = to;
+
+    int idSlot = id_find_slot(store, store->tokens[to].id);
+    if (idSlot >= 0) store->idSlots[idSlot] = to;
+}
+
+static void ensure_capacity(TokenStore* store, int needed) {
+    if (needed <= store->capacity) return;
+    int newCapacity = store->capacity ? store->capacity * 2 : TOKEN_STORE_INITIAL_CAPACITY;
+    while (newCapacity < needed) newCapacity *= 2;
+    store->tokens = realloc(store->tokens, sizeof(Token) * newCapacity);
+    store->cellNext = realloc(store->cellNext, sizeof(int) * newCapacity);
+    store->cellPrev = realloc(store->cellPrev, sizeof(int) * newCapacity);
+    store->cellKey = realloc(store->cellKey, sizeof(long long) * newCapacity);
+    store->capacity = newCapacity;
+}
+
+static bool overlaps(const Token* t, float x, float y, float width, float height) {
+    return t->x < x + width && t->x + t->width > x && t->y < y + height && t->y + t->height > y;
+}
+
+// --- public API ---
+
+void token_store_init(TokenStore* store, float cellSize) {
+    memset(store, 0, sizeof(*store));
+    store->cellSize = cellSize > 0 ? cellSize : 1.0f;
+
+    store->idCapacity = TOKEN_STORE_INITIAL_CAPACITY * 2;
+    store->idKeys = malloc(sizeof(int) * store->idCapacity);
+    store->idSlots = malloc(sizeof(int) * store->idCapacity);
+    memset(store->idSlots, 0xff, sizeof(int) * store->idCapacity);
+
+    store->cellCapacity = TOKEN_STORE_INITIAL_CAPACITY * 2;
+    store->cellKeys = malloc(sizeof(long long) * store->cellCapacity);
+    store->cellHeads = malloc(sizeof(int) * store->cellCapacity);
+    for (int i = 0; i < store->cellCapacity; i++) store->cellKeys[i] = LLONG_MIN;
+    memset(store->cellHeads, 0xff, sizeof(int) * store->cellCapacity);
+}
+
+void token_store_free(TokenStore* store) {
+    free(store->tokens);
+    free(store->cellNext);
+    free(store->cellPrev);
+    free(store->cellKey);
+    free(store->idKeys);
+    free(store->idSlots);
+    free(store->cellKeys);
+    free(store->cellHeads);
+    free(store->queryResults);
+    memset(store, 0, sizeof(*store));
+}
+
+Token* token_store_add(TokenStore* store, Token token) {
+    Token* existing = token_store_find(store, token.id);
+    if (existing) {
+        existing->width = token.width;
+        existing->height = token.height;
+        if (token.width > store->maxExtent) store->maxExtent = token.width;
+        if (token.height > store->maxExtent) store->maxExtent = token.height;
+        token_store_move(store, token.id, token.x, token.y);
+        return token_store_find(store, token.id);
+    }
+
+    ensure_capacity(store, store->count + 1);
+    if ((store->count + 1) * 2 > store->idCapacity) {
+        id_rehash(store, store->idCapacity * 2);
+    }
+
+    int index = store->count++;
+    store->tokens[index] = token;
+    id_insert(store, token.id, index);
+    cell_link(store, index, cell_key_for(store, token.x, token.y));
+
+    if (token.width > store->maxExtent) store->maxExtent = token.width;
+    if (token.height > store->maxExtent) store->maxExtent = token.height;
+    return &store->tokens[index];
+}
+
+bool token_store_remove(TokenStore* store, int id) {
+    int idSlot = id_find_slot(store, id);
+    if (idSlot < 0) return false;
+    int index = store->idSlots[idSlot];
+
+    cell_unlink(store, index);
+    id_remove_slot(store, idSlot);
+
+    int last = store->count - 1;
+    if (index != last) relocate(store, last, index);
+    store->count--;
+    return true;
+}
+
+void token_store_clear(TokenStore* store) {
+    store->count = 0;
+    store->maxExtent = 0;
+    memset(store->idSlots, 0xff, sizeof(int) * store->idCapacity);
+    for (int i = 0; i < store->cellCapacity; i++) store->cellKeys[i] = LLONG_MIN;
+    memset(store->cellHeads, 0xff, sizeof(int) * store->cellCapacity);
+    store->cellUsed = 0;
+}
+
+Token* token_store_find(TokenStore* store, int id) {
+    int idSlot = id_find_slot(store, id);
+    return idSlot >= 0 ? &store->tokens[store->idSlots[idSlot]] : NULL;
+}
+
+bool token_store_move(TokenStore* store, int id, float x, float y) {
+    int idSlot = id_find_slot(store, id);
+    if (idSlot < 0) return false;
+    int index = store->idSlots[idSlot];
+
+    store->tokens[index].x = x;
+    store->tokens[index].y = y;
+
+    long long key = cell_key_for(store, x, y);
+    if (key != store->cellKey[index]) {
+        cell_unlink(store, index);
+        cell_link(store, index, key);
+    }
+    return true;
+}
+
+Token* token_store_pick(TokenStore* store, float x, float y) {
+    // A token filed under cell (cx, cy) can reach at most `span` cells right/down
+    int span = (int)ceilf(store->maxExtent / store->cellSize);
+    int cx = (int)floorf(x / store->cellSize);
+    int cy = (int)floorf(y / store->cellSize);
+
+    int best = -1;
+    for (int gy = cy - span; gy <= cy; gy++) {
+        for (int gx = cx - span; gx <= cx; gx++) {
+            for (int i = cell_head(store, make_cell_key(gx, gy)); i != EMPTY_SLOT; i = store->cellNext[i]) {
+                const Token* t = &store->tokens[i];
+                if (i > best && x >= t->x && x < t->x + t->width && y >= t->y && y < t->y + t->height) {
+                    best = i;
+                }
+            }
+        }
+    }
+    return best >= 0 ? &store->tokens[best] : NULL;
+}
+
+static int compare_ints(const void* a, const void* b) {
+    int ia = *(const int*)a;
+    int ib = *(const int*)b;
+    return (ia > ib) - (ia < ib);
+}
+
+const int* token_store_query(TokenStore* store, float x, float y, float width, float height, int* outCount) {
+    int count = 0;
+    int x0 = (int)floorf((x - store->maxExtent) / store->cellSize);
+    int y0 = (int)floorf((y - store->maxExtent) / store->cellSize);
+    int x1 = (int)floorf((x + width) / store->cellSize);
+    int y1 = (int)floorf((y + height) / store->cellSize);
+
+    // Scanning more cells than there are tokens is slower than a plain sweep
+    long long cells = (long long)(x1 - x0 + 1) * (long long)(y1 - y0 + 1);
+    if (cells > store->count) {
+        if (store->queryCapacity < store->count) {
+            store->queryCapacity = store->count;
+            store->queryResults = realloc(store->queryResults, sizeof(int) * store->queryCapacity);
+        }
+        for (int i = 0; i < store->count; i++) {
+            if (overlaps(&store->tokens[i], x, y, width, height)) store->queryResults[count++] = i;
+        }
+        *outCount = count;
+        return store->queryResults;
+    }
+
+    for (int gy = y0; gy <= y1; gy++) {
+        for (int gx = x0; gx <= x1; gx++) {
+            for (int i = cell_head(store, make_cell_key(gx, gy)); i != EMPTY_SLOT; i = store->cellNext[i]) {
+                if (!overlaps(&store->tokens[i], x, y, width, height)) continue;
+                if (count == store->queryCapacity) {
+                    store->queryCapacity = store->queryCapacity ? store->queryCapacity * 2 : TOKEN_STORE_INITIAL_CAPACITY;
+                    store->queryResults = realloc(store->queryResults, sizeof(int) * store->queryCapacity);
+                }
+                store->queryResults[count++] = i;
+            }
+        }
+    }
+
+    // Keep results in draw order
+    qsort(store->queryResults, count, sizeof(int), compare_ints);
+    *outCount = count;
+    return store->queryResults;
+}
@@ -0,0 +1,71 @@
+#ifndef TOKEN_STORE_H
+#define TOKEN_STORE_H
+
+#include <stdbool.h>
+
+// Define a simple Token structure
+typedef struct Token {
+    int id;
+    float x;
+    float y;
+    float width;
+    float height;
+} Token;
+
+// Growable token storage.
+//
+// Tokens live in a dense array (draw order, cheap iteration). An open-addressing
+// id -> index map gives O(1) lookups for network updates, and a uniform-grid
+// spatial hash (one cell per map grid square) gives O(1) picking and rect
+// queries. Each token is filed under the cell holding its top-left corner, so
+// lookups only need to scan the few neighbouring cells a token can overlap.
+//
+// The store does not depend on raylib so it can be built and benchmarked natively.
+typedef struct TokenStore {
+    Token* tokens;       // Dense array, tokens[0..count)
+    int count;
+    int capacity;
+
+    int* cellNext;       // Per-token intrusive links for the spatial hash
+    int* cellPrev;
+    long long* cellKey;  // Cell each token is currently filed under
+
+    int* idSlots;        // id -> dense index, -1 for empty slots
+    int* idKeys;
+    int idCapacity;      // Power of two
+
+    long long* cellKeys; // cell key -> first token index, -1 if the cell is empty
+    int* cellHeads;
+    int cellCapacity;    // Power of two
+    int cellUsed;
+
+    float cellSize;
+    float maxExtent;     // Largest token width/height seen, bounds neighbour scans
+
+    int* queryResults;   // Scratch buffer returned by token_store_query
+    int queryCapacity;
+} TokenStore;
+
+void token_store_init(TokenStore* store, float cellSize);
+void token_store_free(TokenStore* store);
+
+// Adds a token, or repositions it if the id already exists. Returns the stored token.
+Token* token_store_add(TokenStore* store, Token token);
+bool token_store_remove(TokenStore* store, int id);
+void token_store_clear(TokenStore* store);
+
+// O(1) lookup by token id. The pointer is valid until the next add/remove.
+Token* token_store_find(TokenStore* store, int id);
+
+// Moves a token and refiles it in the spatial hash if it changed cells.
+// Always use this (not a direct write to x/y) so picking stays correct.
+bool token_store_move(TokenStore* store, int id, float x, float y);
+
+// Returns the topmost (last drawn) token under the point, or NULL.
+Token* token_store_pick(TokenStore* store, float x, float y);
+
+// Collects the dense indices of all tokens overlapping the rectangle.
+// The returned buffer is owned by the store and reused by the next query.
+const int* token_store_query(TokenStore* store, float x, float y, float width, float height, int* outCount);
+
+#endif // TOKEN_STORE_H
@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+"""Cuts a battle map image into the tile pyramid the client streams.
+
+Level 0 is the image at full resolution; every next level halves it (rounding
+up) until the whole map fits in one tile. Each level is cut into 256x256
+tiles (smaller at the right and bottom edges):
+
+    <out>/manifest.json
+    <out>/<level>/<x>_<y>.<format>
+
+manifest.json holds the full image size, the number of levels, the tile
+format and how many image pixels one grid cell spans, which places the map
+on the client's grid.
+
+    pip install pillow
+    python3 tools/cut_tiles.py dungeon.png maps/default --cell-pixels 140
+
+The client loads maps/default (see MAP_TILES_URL in main.c) relative to the
+page, so serve the output next to index.html.
+"""
+
+import argparse
+import json
+import math
+import os
+import sys
+
+from PIL import Image
+
+TILE_SIZE = 256  # Must match MAP_TILE_SIZE in map_tiles.h
+MAX_LEVELS = 12  # MAP_TILE_MAX_LEVELS
+MAX_TILES_PER_AXIS = 0x4000  # Tile keys hold 14 bits per coordinate
+
+Image.MAX_IMAGE_PIXELS = None  # Battle maps are legitimately huge
+
+
+def save_tile(tile, path, fmt, quality):
+    if fmt == "jpg":
+        tile.convert("RGB").save(path, "JPEG", quality=quality, optimize=True)
+    else:
+        tile.save(path, "PNG", optimize=True)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("image")
+    parser.add_argument("out", help="output directory, e.g. maps/default")
+    parser.add_argument("--cell-pixels", type=float, required=True, help="image pixels per grid cell")
+    parser.add_argument("--format", choices=("png", "jpg"), default="jpg")
+    parser.add_argument("--quality", type=int, default=85, help="JPEG quality")
+    args = parser.parse_args()
+
+    image = Image.open(args.image).convert("RGBA")
+    width, height = image.size
+    levels = 1 + max(0, math.ceil(math.log2(max(width, height) / TILE_SIZE)))
+    if levels > MAX_LEVELS:
+        sys.exit(f"{width}x{height} needs {levels} levels, the client supports {MAX_LEVELS}")
+    if math.ceil(max(width, height) / TILE_SIZE) > MAX_TILES_PER_AXIS:
+        sys.exit(f"{width}x{height} has more than {MAX_TILES_PER_AXIS} tiles per axis")
+
+    total = 0
+    level_image = image
+    for level in range(levels):
+        scale = 1 << level
+        level_width = (width + scale - 1) // scale
+        level_height = (height + scale - 1) // scale
+        if level > 0:
+            # Resample from the previous level; the box filter matches a 2x2 average
+            level_image = level_image.resize((level_width, level_height), Image.Resampling.BOX)
+
+        level_dir = os.path.join(args.out, str(level))
+        os.makedirs(level_dir, exist_ok=True)
+        columns = math.ceil(level_width / TILE_SIZE)
+        rows = math.ceil(level_height / TILE_SIZE)
+        for ty in range(rows):
+            for tx in range(columns):
+                box = (tx * TILE_SIZE, ty * TILE_SIZE,
+                       min((tx + 1) * TILE_SIZE, level_width), min((ty + 1) * TILE_SIZE, level_height))
+                save_tile(level_image.crop(box), os.path.join(level_dir, f"{tx}_{ty}.{args.format}"), args.format, args.quality)
+        total += columns * rows
+        print(f"level {level}: {level_width}x{level_height}, {columns}x{rows} tiles", file=sys.stderr)
+
+    manifest = {
+        "width": width,
+        "height": height,
+        "levels": levels,
+        "tileSize": TILE_SIZE,
+        "format": args.format,
+        "cellPixels": args.cell_pixels,
+    }
+    with open(os.path.join(args.out, "manifest.json"), "w") as f:
+        json.dump(manifest, f, indent=2)
+        f.write("\n")
+    print(f"wrote {total} tiles to {args.out}", file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,592 @@
+// Load generator and fan-out latency benchmark for the room server.
+//
+// Spawns a server on a spare port (or targets --url), connects thousands of
+// synthetic clients spread over worker threads and rooms, and drives a mix of
+// streamed move_token samples, dice rolls and room churn (leave_room followed
+// by join_room) at the configured per-client rates. With --shards N the
+// server is started as router.js with N shard processes instead; clients that
+// change to a room on another shard follow its room_redirect. Receivers timestamp every
+// update and dice roll they get from another client:
+//
+//   move latency  sender clock (the move's `t`, 1 ms resolution) to receipt,
+//                 so it includes the server's tick coalescing delay
+//   dice latency  send to receipt of the immediate room broadcast
+//
+// All clients share the machine clock, so latencies are end to end. The
+// server's CPU and RSS (summed over its process tree, so shards count) are
+// sampled from /proc while the measurement runs.
+// A JSON report goes to stdout (or --out) for tracking across commits; a
+// readable summary goes to stderr.
+//
+//   node bench/loadgen.js --clients 2000 --rooms 40 --duration 20
+//   node bench/loadgen.js --clients 4000 --rooms 80 --shards 4
+//   node bench/loadgen.js --help
+
+const { Worker, isMainThread, parentPort, workerData } = require('worker_threads');
+const { performance } = require('perf_hooks');
+const { spawn, execSync } = require('child_process');
+const fs = require('fs');
+const net = require('net');
+const os = require('os');
+const path = require('path');
+
+const DICE_PREFIX = 'bench:';
+
+const DEFAULTS = {
+    clients: 1000,
+    rooms: 20,
+    workers: Math.max(1, Math.min(os.cpus().length - 1, 4)),
+    duration: 15,       // Measured seconds
+    warmup: 3,          // Seconds after all clients connected, not measured
+    moveRate: 10,       // move_token samples per dragging client per second
+    dragFraction: 0.5,  // Share of clients dragging at any time
+    diceRate: 0.05,     // Dice rolls per client per second
+    churnRate: 0.01,    // Room changes per client per second
+    protocol: 'binary', // binary | json | mix
+    connectRate: 500,   // New connections per second during ramp-up
+    tickHz: 20,         // Passed to a spawned server
+    shards: 0,          // Spawn router.js with this many shards (0: a single index.js)
+    viewport: 0,        // Report a viewport this wide around each client's token (0: none, receive everything)
+    url: null,          // Target an already running server (started with RAYVTT_ROOM_TOKENS >= clients) instead of spawning one
+    serverPid: null,    // Process to sample when --url is used
+    out: null,
+};
+
+// --- latency histogram: log-spaced buckets, 1% resolution from 1 us to ~60 s ---
+
+const HIST_MIN_MS = 0.001;
+const HIST_STEP = Math.log(1.01);
+const HIST_BUCKETS = Math.ceil(Math.log(60000 / HIST_MIN_MS) / HIST_STEP) + 1;
+
+class Histogram {
+    constructor(counts) {
+        this.counts = counts || new Float64Array(HIST_BUCKETS);
+    }
+
+    record(ms) {
+        const v = ms > HIST_MIN_MS ? ms : HIST_MIN_MS;
+        const i = Math.min(HIST_BUCKETS - 1, Math.floor(Math.log(v / HIST_MIN_MS) / HIST_STEP));
+        this.counts[i]++;
+    }
+
+    merge(other) {
+        for (let i = 0; i < HIST_BUCKETS; i++) this.counts[i] += other.counts[i];
+    }
+
+    get count() {
+        let n = 0;
+        for (let i = 0; i < HIST_BUCKETS; i++) n += this.counts[i];
+        return n;
+    }
+
+    // Upper edge of the bucket holding the p-th quantile
+    percentile(p) {
+        const total = this.count;
+        if (total === 0) return null;
+        const target = total * p;
+        let seen = 0;
+        for (let i = 0; i < HIST_BUCKETS; i++) {
+            seen += this.counts[i];
+            if (seen >= target) return HIST_MIN_MS * Math.exp((i + 1) * HIST_STEP);
+        }
+        return null;
+    }
+
+    summary() {
+        const round = v => (v === null ? null : Math.round(v * 1000) / 1000);
+        return {
+            count: this.count,
+            p50_ms: round(this.percentile(0.5)),
+            p99_ms: round(this.percentile(0.99)),
+            p999_ms: round(this.percentile(0.999)),
+            max_ms: round(this.percentile(1)),
+        };
+    }
+}
+
+function nowMs() {
+    return performance.timeOrigin + performance.now();
+}
+
+if (isMainThread) {
+    main().catch(error => {
+        console.error(error);
+        process.exit(1);
+    });
+} else {
+    runWorker(workerData);
+}
+
+// --- main thread: options, server process, workers, report ---
+
+function parseArgs(argv) {
+    const options = { ...DEFAULTS };
+    for (let i = 0; i < argv.length; i++) {
+        const arg = argv[i];
+        if (arg === '--help' || arg === '-h') {
+            console.error('Usage: node bench/loadgen.js [--option value ...]\nOptions (defaults):');
+            for (const [key, value] of Object.entries(DEFAULTS)) {
+                console.error(`  --${key.replace(/[A-Z]/g, c => '-' + c.toLowerCase())} ${value}`);
+            }
+            process.exit(0);
+        }
+        const key = arg.replace(/^--/, '').replace(/-([a-z])/g, (_, c) => c.toUpperCase());
+        if (!(key in DEFAULTS)) throw new Error(`Unknown option ${arg}`);
+        const value = argv[++i];
+        options[key] = typeof DEFAULTS[key] === 'number' || key === 'serverPid' ? Number(value) : value;
+    }
+    return options;
+}
+
+function freePort() {
+    return new Promise((resolve, reject) => {
+        const srv = net.createServer();
+        srv.listen(0, '127.0.0.1', () => {
+            const { port } = srv.address();
+            srv.close(() => resolve(port));
+        });
+        srv.on('error', reject);
+    });
+}
+
+async function waitForPort(port, timeoutMs) {
+    const deadline = Date.now() + timeoutMs;
+    while (Date.now() < deadline) {
+        const ok = await new Promise(resolve => {
+            const socket = net.connect(port, '127.0.0.1', () => { socket.end(); resolve(true); });
+            socket.on('error', () => resolve(false));
+        });
+        if (ok) return;
+        await new Promise(r => setTimeout(r, 50));
+    }
+    throw new Error(`Server did not start listening on port ${port}`);
+}
+
+// CPU time (seconds) and RSS (bytes) of a process, from /proc
+const CLOCK_TICKS = (() => {
+    try {
+        return Number(execSync('getconf CLK_TCK').toString()) || 100;
+    } catch (e) {
+        return 100;
+    }
+})();
+
+function readProcess(pid) {
+    try {
+        const stat = fs.readFileSync(`/proc/${pid}/stat`, 'utf8');
+        const fields = stat.slice(stat.lastIndexOf(')') + 2).split(' ');
+        const cpu = (Number(fields[11]) + Number(fields[12])) / CLOCK_TICKS; // utime + stime
+        const rss = Number(fields[21]) * 4096;
+        return { cpu, rss };
+    } catch (e) {
+        return null;
+    }
+}
+
+// Sums readProcess over pid and all its descendants (a router and its shards)
+function readProcessTree(pid) {
+    const children = new Map(); // ppid -> [pid]
+    for (const entry of fs.readdirSync('/proc')) {
+        if (!/^\d+$/.test(entry)) continue;
+        try {
+            const stat = fs.readFileSync(`/proc/${entry}/stat`, 'utf8');
+            const ppid = Number(stat.slice(stat.lastIndexOf(')') + 2).split(' ')[1]);
+            if (!children.has(ppid)) children.set(ppid, []);
+            children.get(ppid).push(Number(entry));
+        } catch (e) {
+            // Process exited while scanning
+        }
+    }
+    const root = readProcess(pid);
+    if (!root) return null;
+    const total = { cpu: root.cpu, rss: root.rss, processes: 1 };
+    const pending = [...(children.get(pid) || [])];
+    while (pending.length > 0) {
+        const child = pending.pop();
+        const p = readProcess(child);
+        if (p) {
+            total.cpu += p.cpu;
+            total.rss += p.rss;
+            total.processes++;
+        }
+        pending.push(...(children.get(child) || []));
+    }
+    return total;
+}
+
+function gitRevision() {
+    try {
+        return execSync('git rev-parse --short HEAD', { cwd: __dirname, stdio: ['ignore', 'pipe', 'ignore'] }).toString().trim();
+    } catch (e) {
+        return null;
+    }
+}
+
+async function main() {
+    const options = parseArgs(process.argv.slice(2));
+    let server = null;
+    let dataDir = null;
+    let url = options.url;
+    let serverPid = options.serverPid;
+
+    if (!url) {
+        const port = await freePort();
+        const metricsPort = await freePort();
+        const entry = options.shards > 0 ? 'router.js' : 'index.js';
+        // A fresh room log per run, so earlier runs are not restored
+        dataDir = fs.mkdtempSync(path.join(os.tmpdir(), 'rayvtt-loadgen-'));
+        server = spawn(process.execPath, [path.join(__dirname, '..', entry)], {
+            env: {
+                ...process.env, RAYVTT_PORT: String(port), RAYVTT_TICK_HZ: String(options.tickHz),
+                RAYVTT_SHARDS: String(options.shards), RAYVTT_LOG_LEVEL: process.env.RAYVTT_LOG_LEVEL || 'warn',
+                RAYVTT_DATA_DIR: process.env.RAYVTT_DATA_DIR ?? dataDir, RAYVTT_METRICS_PORT: String(metricsPort),
+                RAYVTT_ROOM_TOKENS: String(options.clients),
+            },
+            stdio: ['ignore', 'ignore', 'inherit'],
+        });
+        serverPid = server.pid;
+        url = `ws://127.0.0.1:${port}`;
+        await waitForPort(port, 5000);
+        console.error(`Server metrics at http://127.0.0.1:${metricsPort}/metrics`);
+    }
+
+    console.error(`Benchmarking ${url}${options.shards > 0 ? ` (${options.shards} shards)` : ''} with ${options.clients} clients ` +
+        `in ${options.rooms} rooms on ${options.workers} worker(s)`);
+
+    // Split the clients over the workers
+    const workers = [];
+    const perWorker = Math.ceil(options.clients / options.workers);
+    for (let w = 0; w < options.workers; w++) {
+        const first = w * perWorker;
+        const count = Math.min(perWorker, options.clients - first);
+        if (count <= 0) break;
+        workers.push(new Worker(__filename, { workerData: { ...options, url, first, count, connectRate: options.connectRate / options.workers } }));
+    }
+
+    const waitFor = type => Promise.all(workers.map(worker => new Promise((resolve, reject) => {
+        const onMessage = msg => {
+            if (msg.type === type) {
+                worker.off('message', onMessage);
+                resolve(msg);
+            }
+        };
+        worker.on('message', onMessage);
+        worker.once('error', reject);
+    })));
+
+    const connected = await waitFor('connected');
+    const failed = connected.reduce((n, m) => n + m.failed, 0);
+    console.error(`Connected ${options.clients - failed}/${options.clients} clients; warming up for ${options.warmup}s`);
+    workers.forEach(worker => worker.postMessage({ type: 'start' }));
+    await new Promise(r => setTimeout(r, options.warmup * 1000));
+
+    // Measurement window
+    workers.forEach(worker => worker.postMessage({ type: 'measure' }));
+    const startProc = serverPid ? readProcessTree(serverPid) : null;
+    const started = nowMs();
+    let peakRss = startProc ? startProc.rss : 0;
+    const sampler = setInterval(() => {
+        const p = serverPid ? readProcessTree(serverPid) : null;
+        if (p && p.rss > peakRss) peakRss = p.rss;
+    }, 250);
+    await new Promise(r => setTimeout(r, options.duration * 1000));
+    const endProc = serverPid ? readProcessTree(serverPid) : null;
+    if (endProc && endProc.rss > peakRss) peakRss = endProc.rss;
+    const elapsed = (nowMs() - started) / 1000;
+    clearInterval(sampler);
+
+    const resultsPromise = waitFor('results');
+    workers.forEach(worker => worker.postMessage({ type: 'stop' }));
+    const results = await resultsPromise;
+    await Promise.all(workers.map(worker => worker.terminate()));
+    if (server) {
+        const exited = new Promise(resolve => server.once('exit', resolve));
+        server.kill();
+        await exited;
+        fs.rmSync(dataDir, { recursive: true, force: true });
+    }
+
+    // Merge worker results
+    const move = new Histogram();
+    const dice = new Histogram();
+    const totals = { sent: {}, receivedMessages: 0, receivedBytes: 0, sentBytes: 0, errors: 0, disconnects: 0, redirects: 0 };
+    for (const r of results) {
+        move.merge(new Histogram(r.move));
+        dice.merge(new Histogram(r.dice));
+        for (const [type, n] of Object.entries(r.sent)) totals.sent[type] = (totals.sent[type] || 0) + n;
+        totals.receivedMessages += r.receivedMessages;
+        totals.receivedBytes += r.receivedBytes;
+        totals.sentBytes += r.sentBytes;
+        totals.errors += r.errors;
+        totals.disconnects += r.disconnects;
+        totals.redirects += r.redirects;
+    }
+    const sentMessages = Object.values(totals.sent).reduce((a, b) => a + b, 0);
+    const perSecond = v => Math.round(v / elapsed);
+
+    const report = {
+        benchmark: 'rayvtt-loadgen',
+        revision: gitRevision(),
+        timestamp: new Date().toISOString(),
+        node: process.version,
+        cpus: os.cpus().length,
+        config: { ...options, url: options.url },
+        clients: { requested: options.clients, connected: options.clients - failed, disconnects: totals.disconnects, redirects: totals.redirects, errors: totals.errors },
+        duration_s: Math.round(elapsed * 100) / 100,
+        throughput: {
+            sent_msgs_per_s: perSecond(sentMessages),
+            sent_by_type_per_s: Object.fromEntries(Object.entries(totals.sent).map(([k, v]) => [k, perSecond(v)])),
+            received_frames_per_s: perSecond(totals.receivedMessages),
+            received_bytes_per_s: perSecond(totals.receivedBytes),
+            sent_bytes_per_s: perSecond(totals.sentBytes),
+            move_deliveries_per_s: perSecond(move.count),
+        },
+        latency: { move: move.summary(), dice: dice.summary() },
+        server: startProc && endProc ? {
+            pid: serverPid,
+            processes: endProc.processes,
+            cpu_percent: Math.round((endProc.cpu - startProc.cpu) / elapsed * 1000) / 10,
+            rss_mb_end: Math.round(endProc.rss / 1048576 * 10) / 10,
+            rss_mb_peak: Math.round(peakRss / 1048576 * 10) / 10,
+        } : null,
+    };
+
+    const json = JSON.stringify(report, null, 2);
+    if (options.out) {
+        fs.writeFileSync(options.out, json + '\n');
+    } else {
+        process.stdout.write(json + '\n');
+    }
+
+    const fmt = s => (s.count ? `p50 ${s.p50_ms} ms, p99 ${s.p99_ms} ms, p999 ${s.p999_ms} ms (n=${s.count})` : 'no samples');
+    console.error(`Sent ${report.throughput.sent_msgs_per_s} msg/s, received ${report.throughput.received_frames_per_s} frames/s ` +
+        `(${Math.round(report.throughput.received_bytes_per_s / 1024)} KiB/s)`);
+    console.error(`Move fan-out: ${fmt(report.latency.move)}`);
+    console.error(`Dice fan-out: ${fmt(report.latency.dice)}`);
+    if (report.server) {
+        console.error(`Server: ${report.server.cpu_percent}% CPU, RSS ${report.server.rss_mb_end} MB (peak ${report.server.rss_mb_peak} MB)`);
+    }
+    process.exit(0);
+}
+
+// --- worker thread: a slice of the synthetic clients ---
+
+function runWorker(options) {
+    const WebSocket = require('ws');
+    const protocol = require('../protocol');
+
+    const move = new Histogram();
+    const dice = new Histogram();
+    const stats = { sent: {}, receivedMessages: 0, receivedBytes: 0, sentBytes: 0, errors: 0, disconnects: 0, redirects: 0 };
+    let measuring = false;
+    let running = false;
+    let failed = 0;
+    let settled = 0;
+    const clients = [];
+
+    function roomFor(index) {
+        return `bench-${index % options.rooms}`;
+    }
+
+    function pickSubprotocol(index) {
+        if (options.protocol === 'json') return protocol.SUBPROTOCOL_JSON;
+        if (options.protocol === 'mix') return index % 2 ? protocol.SUBPROTOCOL_JSON : protocol.SUBPROTOCOL_BINARY;
+        return protocol.SUBPROTOCOL_BINARY;
+    }
+
+    function send(client, msg) {
+        if (client.ws.readyState !== WebSocket.OPEN) return;
+        const data = client.binary ? protocol.encode(msg) : JSON.stringify(msg);
+        client.ws.send(data);
+        if (measuring) {
+            stats.sent[msg.type] = (stats.sent[msg.type] || 0) + 1;
+            stats.sentBytes += data.length;
+        }
+    }
+
+    function onUpdate(token, now) {
+        if (!token.t) return; // Only streamed samples carry the sender's clock
+        const latency = ((Math.floor(now) % 4294967296) - token.t + 4294967296) % 4294967296;
+        move.record(latency);
+    }
+
+    function onMessage(client, msg, now) {
+        if (msg.type === 'room_redirect') {
+            // The room is on another shard: reconnect there
+            if (measuring) stats.redirects++;
+            client.room = msg.roomId;
+            client.inRoom = false;
+            client.redirected = true;
+            client.ws.close();
+            openSocket(client);
+        } else if (msg.type === 'update_tokens') {
+            for (const token of msg.tokens) onUpdate(token, now);
+        } else if (msg.type === 'update_token') {
+            onUpdate(msg, now);
+        } else if (msg.type === 'dice_roll' && msg.message.startsWith(DICE_PREFIX)) {
+            dice.record(now - Number(msg.message.slice(DICE_PREFIX.length)));
+        }
+    }
+
+    // Exponentially distributed delay (seconds) for a Poisson process of `rate` per second
+    function nextDelay(rate) {
+        return rate > 0 ? -Math.log(1 - Math.random()) / rate * 1000 : Infinity;
+    }
+
+    // With --viewport, tokens wander over a board four viewports wide so that
+    // most of the room is outside any one client's area of interest
+    const worldWidth = options.viewport > 0 ? options.viewport * 4 : 550;
+    const worldHeight = options.viewport > 0 ? options.viewport * 4 : 400;
+
+    function sendViewport(client) {
+        if (options.viewport <= 0) return;
+        const size = options.viewport;
+        send(client, { type: 'viewport', x: client.x - size / 2, y: client.y - size / 2, width: size, height: size });
+    }
+
+    function connect(i) {
+        const index = options.first + i;
+        const client = {
+            index,
+            tokenId: index, // Each synthetic client drags its own token
+            seq: 0,
+            x: Math.random() * worldWidth,
+            y: Math.random() * worldHeight,
+            dragging: Math.random() < options.dragFraction,
+            room: roomFor(index),
+            inRoom: false,
+            nextMove: 0,
+            nextDice: 0,
+            nextChurn: 0,
+            rejoinAt: 0,
+            binary: false,
+            opened: false,
+            redirected: false,
+            ws: null,
+        };
+        clients.push(client);
+        openSocket(client);
+    }
+
+    // Connects straight into the client's room (?room=), which is also how
+    // the router picks the shard
+    function openSocket(client) {
+        const ws = new WebSocket(`${options.url}/?client_id=bench-${client.index}&room=${encodeURIComponent(client.room)}`,
+            [pickSubprotocol(client.index)]);
+        ws.binaryType = 'nodebuffer';
+        client.ws = ws;
+
+        ws.on('open', () => {
+            client.binary = protocol.isBinaryProtocol(ws.protocol);
+            client.inRoom = true;
+            sendViewport(client);
+            if (!client.opened) {
+                client.opened = true;
+                settle();
+            }
+        });
+        ws.on('message', (data, isBinary) => {
+            const now = nowMs();
+            if (measuring) {
+                stats.receivedMessages++;
+                stats.receivedBytes += data.length;
+            }
+            try {
+                if (isBinary) {
+                    for (const msg of protocol.decode(data)) onMessage(client, msg, now);
+                } else {
+                    onMessage(client, JSON.parse(data), now);
+                }
+            } catch (e) {
+                stats.errors++;
+            }
+        });
+        ws.on('error', () => {
+            if (!client.opened) {
+                failed++;
+                settle();
+            } else {
+                stats.errors++;
+            }
+        });
+        ws.on('close', () => {
+            if (client.redirected) {
+                client.redirected = false;
+            } else if (running) {
+                stats.disconnects++;
+            }
+        });
+    }
+
+    function settle() {
+        if (++settled === options.count) {
+            parentPort.postMessage({ type: 'connected', failed });
+        }
+    }
+
+    // Drives every client's event mix on a fixed 10 ms step
+    function step() {
+        const now = nowMs();
+        for (const client of clients) {
+            if (client.ws.readyState !== WebSocket.OPEN) continue;
+
+            if (!client.inRoom) {
+                if (now >= client.rejoinAt) {
+                    client.room = roomFor(Math.floor(Math.random() * options.rooms));
+                    send(client, { type: 'join_room', roomId: client.room });
+                    client.inRoom = true;
+                }
+                continue;
+            }
+
+            if (client.dragging && now >= client.nextMove) {
+                client.x = Math.max(0, Math.min(worldWidth, client.x + (Math.random() - 0.5) * 20));
+                client.y = Math.max(0, Math.min(worldHeight, client.y + (Math.random() - 0.5) * 20));
+                const final = Math.random() < 0.05; // Drop now and then, pick up again later
+                send(client, { type: 'move_token', id: client.tokenId, x: client.x, y: client.y, seq: ++client.seq, t: Math.floor(now) % 4294967296, final });
+                client.nextMove = now + 1000 / options.moveRate;
+                if (final) client.dragging = false;
+            } else if (!client.dragging && Math.random() < options.dragFraction * 0.01) {
+                client.dragging = true;
+            }
+
+            if (now >= client.nextDice) {
+                if (client.nextDice > 0) send(client, { type: 'dice_roll', sender_id: `bench-${client.index}`, message: DICE_PREFIX + now });
+                client.nextDice = now + nextDelay(options.diceRate);
+            }
+
+            if (now >= client.nextChurn) {
+                if (client.nextChurn > 0) {
+                    send(client, { type: 'leave_room' });
+                    client.inRoom = false;
+                    client.rejoinAt = now + 100;
+                }
+                client.nextChurn = now + nextDelay(options.churnRate);
+            }
+        }
+    }
+
+    parentPort.on('message', msg => {
+        if (msg.type === 'start') {
+            running = true;
+            setInterval(step, 10);
+        } else if (msg.type === 'measure') {
+            // Drop anything recorded during warm-up
+            move.counts.fill(0);
+            dice.counts.fill(0);
+            measuring = true;
+        } else if (msg.type === 'stop') {
+            measuring = false;
+            running = false;
+            parentPort.postMessage({ type: 'results', move: move.counts, dice: dice.counts, ...stats });
+        }
+    });
+
+    // Ramp up at the configured connection rate
+    let next = 0;
+    const perStep = Math.max(1, Math.round(options.connectRate / 100));
+    const ramp = setInterval(() => {
+        for (let n = 0; n < perStep && next < options.count; n++) connect(next++);
+        if (next >= options.count) clearInterval(ramp);
+    }, 10);
+}
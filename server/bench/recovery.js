@@ -0,0 +1,158 @@
+// Restart recovery benchmark for the room log (persistence.js).
+//
+// Builds a data directory the way a running server would: --rooms rooms,
+// each with --revisions committed token moves, a share of them with walls
+// and revealed fog. With --snapshot (the default) a snapshot is taken after
+// all but the last --tail revisions of every room, as the server does
+// periodically, so recovery loads the snapshot and replays only the tail;
+// --snapshot 0 leaves everything in the log. Then recovery is run --runs times
+// into an empty registry and timed.
+//
+//   node bench/recovery.js --rooms 5000 --revisions 200 --tail 20
+//   node bench/recovery.js --rooms 5000 --revisions 200 --snapshot 0
+//
+// A JSON report goes to stdout, a readable summary to stderr.
+
+const fs = require('fs');
+const os = require('os');
+const path = require('path');
+
+process.env.RAYVTT_LOG_LEVEL = process.env.RAYVTT_LOG_LEVEL || 'warn';
+const { RoomRegistry } = require('../rooms');
+const { RoomStore } = require('../persistence');
+const { FOG_LAYER, FOG_OP } = require('../fog');
+
+const DEFAULTS = {
+    rooms: 2000,
+    revisions: 200,  // Committed ticks per room
+    tail: 20,        // Revisions per room logged after the snapshot
+    snapshot: 1,     // 0: no snapshot, recovery replays the whole log
+    fogRooms: 0.25,  // Share of rooms with walls and revealed cells
+    runs: 5,
+};
+
+function parseArgs(argv) {
+    const options = { ...DEFAULTS };
+    for (let i = 0; i < argv.length; i += 2) {
+        const key = argv[i].replace(/^--/, '');
+        if (key === 'help' || key === 'h') {
+            console.error('Usage: node bench/recovery.js [--option value ...]\nOptions (defaults):');
+            for (const [k, v] of Object.entries(DEFAULTS)) console.error(`  --${k} ${v}`);
+            process.exit(0);
+        }
+        if (!(key in DEFAULTS)) throw new Error(`Unknown option ${argv[i]}`);
+        options[key] = Number(argv[i + 1]);
+    }
+    return options;
+}
+
+function dirBytes(dir) {
+    return fs.readdirSync(dir).reduce((sum, name) => sum + fs.statSync(path.join(dir, name)).size, 0);
+}
+
+// Commits `count` revisions of random moves in every room
+function commitRevisions(rooms, store, count) {
+    for (let r = 0; r < count; r++) {
+        for (const room of rooms.values()) {
+            const moves = [{ id: Math.floor(Math.random() * 3), x: Math.random() * 10000, y: Math.random() * 10000 }];
+            const revision = room.state.commit(moves);
+            store.tokensCommitted(room, revision, room.state.lastChanges);
+        }
+        if (r % 16 === 15) store.flush(); // Keep batches at server-like sizes
+    }
+}
+
+function waitFor(condition) {
+    return new Promise(resolve => {
+        const check = () => (condition() ? resolve() : setTimeout(check, 5));
+        check();
+    });
+}
+
+async function build(dir, options) {
+    const rooms = new RoomRegistry();
+    const store = new RoomStore(dir, rooms);
+    store.recover(); // Empty directory: just sets up the first segment
+
+    for (let i = 0; i < options.rooms; i++) {
+        const room = rooms.getOrCreate(`bench-${i}`);
+        store.roomCreated(room);
+        if (i < options.rooms * options.fogRooms) {
+            const walls = [];
+            const reveals = [];
+            for (let row = 0; row < 64; row++) {
+                walls.push(row, 20, 1);
+                reveals.push(row, 0, 40);
+            }
+            store.fogChanged(room.id, FOG_LAYER.WALLS, FOG_OP.SET, room.fog.apply(FOG_LAYER.WALLS, FOG_OP.SET, walls));
+            store.fogChanged(room.id, FOG_LAYER.REVEALED, FOG_OP.SET, room.fog.apply(FOG_LAYER.REVEALED, FOG_OP.SET, reveals));
+        }
+    }
+
+    const logged = options.snapshot ? Math.max(0, options.revisions - options.tail) : options.revisions;
+    commitRevisions(rooms, store, logged);
+    if (options.snapshot) {
+        await waitFor(() => !store.flushing);
+        store.snapshot();
+        await waitFor(() => !store.snapshotting);
+        commitRevisions(rooms, store, options.revisions - logged);
+    }
+    await new Promise(resolve => store.close(resolve));
+    return rooms;
+}
+
+async function main() {
+    const options = parseArgs(process.argv.slice(2));
+    const dir = fs.mkdtempSync(path.join(os.tmpdir(), 'rayvtt-recovery-'));
+    try {
+        const buildStart = Date.now();
+        const original = await build(dir, options);
+        const buildMs = Date.now() - buildStart;
+
+        const times = [];
+        let last = null;
+        for (let i = 0; i < options.runs; i++) {
+            const rooms = new RoomRegistry();
+            last = new RoomStore(dir, rooms).recover();
+            times.push(last.ms);
+            // The recovered state must match what was written
+            if (i === 0) {
+                for (const room of original.values()) {
+                    const copy = rooms.get(room.id);
+                    if (!copy || copy.state.revision !== room.state.revision ||
+                        JSON.stringify(copy.state.snapshot()) !== JSON.stringify(room.state.snapshot())) {
+                        throw new Error(`Room ${room.id} was not recovered correctly`);
+                    }
+                }
+            }
+            // recover() starts a new segment number but writes nothing, so runs see the same files
+        }
+        times.sort((a, b) => a - b);
+
+        const report = {
+            benchmark: 'rayvtt-recovery',
+            timestamp: new Date().toISOString(),
+            node: process.version,
+            config: options,
+            data_bytes: dirBytes(dir),
+            build_ms: buildMs,
+            recovered: { rooms: last.rooms, snapshot: last.snapshot, segments: last.segments, records: last.records, skipped: last.skipped },
+            recovery_ms: { min: round(times[0]), median: round(times[Math.floor(times.length / 2)]), max: round(times[times.length - 1]) },
+        };
+        console.log(JSON.stringify(report, null, 2));
+        console.error(`${report.recovered.rooms} rooms, ${(report.data_bytes / 1048576).toFixed(1)} MB on disk, ` +
+            `${report.recovered.records} log records replayed${last.snapshot !== null ? ` after snapshot ${last.snapshot}` : ''}: ` +
+            `recovery median ${report.recovery_ms.median} ms (min ${report.recovery_ms.min}, max ${report.recovery_ms.max})`);
+    } finally {
+        fs.rmSync(dir, { recursive: true, force: true });
+    }
+}
+
+function round(v) {
+    return Math.round(v * 10) / 10;
+}
+
+main().catch(error => {
+    console.error(error);
+    process.exit(1);
+});
@@ -0,0 +1,77 @@
+// A room's chat and dice history.
+//
+// Lines (dice_roll, dice_result and chat_message messages) get consecutive
+// sequence numbers and are kept in a fixed ring, so appending is O(1) and the
+// oldest lines fall off once the room has more than RAYVTT_CHAT_LOG_LINES.
+// Clients do not get the history when they join. They page it in backwards,
+// one history_request at a time, as their log view scrolls up to the oldest
+// line they hold.
+
+const CHAT_LOG_LINES = Number(process.env.RAYVTT_CHAT_LOG_LINES) || 10000;
+const PAGE_LIMIT = 200; // Most lines one history_request returns
+
+class ChatLog {
+    constructor(capacity = CHAT_LOG_LINES) {
+        this.capacity = capacity;
+        this.lines = new Array(capacity);
+        this.nextSeq = 1;  // Sequence number of the next line
+        this.count = 0;
+    }
+
+    get oldestSeq() {
+        return this.nextSeq - this.count;
+    }
+
+    // Numbers the message (msg.seq) and keeps it
+    push(msg) {
+        msg.seq = this.nextSeq++;
+        this.lines[msg.seq % this.capacity] = msg;
+        if (this.count < this.capacity) this.count++;
+        return msg;
+    }
+
+    // Up to `limit` lines older than `before` (0: the newest), newest first,
+    // and whether older ones remain. Both are cut to integers, as lines are
+    // indexed by them.
+    page(before, limit) {
+        before = Math.trunc(before) || 0;
+        limit = Math.trunc(limit) || 0;
+        const end = before > 0 && before < this.nextSeq ? before : this.nextSeq;
+        const start = Math.max(this.oldestSeq, end - Math.min(Math.max(limit, 1), PAGE_LIMIT));
+        const messages = [];
+        for (let seq = end - 1; seq >= start; seq--) {
+            messages.push(this.lines[seq % this.capacity]);
+        }
+        return { messages, more: start > this.oldestSeq };
+    }
+
+    // For snapshots: the next sequence number and the lines, oldest first
+    save() {
+        const lines = [];
+        for (let seq = this.oldestSeq; seq < this.nextSeq; seq++) {
+            lines.push(this.lines[seq % this.capacity]);
+        }
+        return { n: this.nextSeq, l: lines };
+    }
+
+    load(saved) {
+        this.lines = new Array(this.capacity);
+        this.count = 0;
+        if (!saved) return;
+        this.nextSeq = saved.n - saved.l.length;
+        for (const msg of saved.l) this.push(msg);
+    }
+
+    // Re-adds a logged line during recovery, keeping its sequence number
+    replay(msg) {
+        if (msg.seq < this.nextSeq) return; // Already in the snapshot
+        if (msg.seq > this.nextSeq) {
+            // Lines are missing in between; only keep what follows the gap
+            this.count = 0;
+            this.nextSeq = msg.seq;
+        }
+        this.push(msg);
+    }
+}
+
+module.exports = { ChatLog };
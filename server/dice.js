@@ -0,0 +1,458 @@
+// Dice expressions, rolled by the server so results cannot be forged.
+//
+//   expr  := term (('+' | '-') term)*
+//   term  := integer | [count] 'd' (sides | '%') modifier*
+//   modifier := '!'          exploding: a die showing its maximum is rolled again and added
+//             | 'kh' n | 'k' n   keep the n highest dice
+//             | 'kl' n       keep the n lowest dice
+//
+// e.g. "1d20+5", "4d6kh3", "2d20kl1", "3d6!", "1000d6-10". Whitespace and
+// case are ignored.
+//
+// Each room owns a seeded xoshiro128** generator. Large pools are rolled in
+// bulk: one 32-bit draw yields several dice (sides^k <= 2^32, by digit
+// extraction) and only the sum, or the per-face counts when dice are kept, is
+// accumulated, so 1000d6 costs 84 draws and no per-die allocation.
+//
+// Exact outcome distributions come from a memoized convolution cache: pools
+// are built from cached powers of a single die by repeated squaring, keep
+// modifiers by dynamic programming over the faces, and whole expressions are
+// cached by their normalized text. Distributions larger than
+// DIST_MAX_OUTCOMES, and exploding pools that also keep dice, are not computed.
+
+const crypto = require('crypto');
+
+const MAX_EXPRESSION_LENGTH = 100;
+const MAX_TERMS = 16;
+const MAX_DICE = Number(process.env.RAYVTT_DICE_MAX) || 100000; // Dice per expression
+const MAX_SIDES = 1000000;
+const MAX_CONSTANT = 1000000;
+const EXPLODE_DEPTH = 100;      // Rerolls per die; (1/2)^100 never happens in practice
+const ROLLS_SHOWN = 20;         // Pools up to this size report every die
+const COUNTS_MAX_SIDES = 1024;  // Bulk keep uses per-face counts up to this many sides
+const DIST_MAX_OUTCOMES = 20001;
+const DIST_KEEP_WORK = 2e7;     // Upper bound on keep-modifier DP steps
+const DIST_TAIL = 1e-15;        // Exploding dice chains less likely than this are dropped
+const DIST_CACHE_OUTCOMES = 1 << 20; // Cached pmf and cdf values, all entries together (8 MB)
+
+const TWO_32 = 4294967296;
+
+// --- parsing ---
+
+// Returns { terms, text } where text is the normalized expression, or throws
+// an Error whose message can be shown to the player
+function parse(input) {
+    if (typeof input !== 'string' || input.length > MAX_EXPRESSION_LENGTH) {
+        throw new Error(`Expression must be a string of at most ${MAX_EXPRESSION_LENGTH} characters`);
+    }
+    const src = input.toLowerCase().replace(/\s+/g, '');
+    let pos = 0;
+    let dice = 0;
+
+    function integer(what, max) {
+        const start = pos;
+        while (pos < src.length && src[pos] >= '0' && src[pos] <= '9') pos++;
+        if (pos === start) throw new Error(`Expected ${what} at position ${start + 1}`);
+        const value = Number(src.slice(start, pos));
+        if (value > max) throw new Error(`${what} ${value} is larger than ${max}`);
+        return value;
+    }
+
+    function term(sign) {
+        const count = src[pos] === 'd' ? 1 : integer('number', MAX_CONSTANT);
+        if (src[pos] !== 'd') return { sign, count: 0, sides: 0, keep: 0, explode: false, value: count };
+        pos++;
+        let sides;
+        if (src[pos] === '%') {
+            pos++;
+            sides = 100;
+        } else {
+            sides = integer('sides', MAX_SIDES);
+        }
+        if (count < 1 || sides < 1) throw new Error('Dice need a count and sides of at least 1');
+        dice += count;
+        if (dice > MAX_DICE) throw new Error(`At most ${MAX_DICE} dice per roll`);
+
+        const t = { sign, count, sides, keep: 0, explode: false, value: 0 };
+        for (;;) {
+            if (src[pos] === '!' && !t.explode) {
+                pos++;
+                if (sides === 1) throw new Error('A d1 cannot explode');
+                t.explode = true;
+            } else if (src[pos] === 'k' && t.keep === 0) {
+                pos++;
+                const low = src[pos] === 'l';
+                if (low || src[pos] === 'h') pos++;
+                const n = integer('keep count', count);
+                if (n < 1) throw new Error('Keep at least one die');
+                t.keep = low ? -n : n;
+            } else {
+                return t;
+            }
+        }
+    }
+
+    const terms = [term(1)];
+    while (pos < src.length) {
+        const op = src[pos];
+        if (op !== '+' && op !== '-') throw new Error(`Unexpected '${op}' at position ${pos + 1}`);
+        pos++;
+        if (terms.length === MAX_TERMS) throw new Error(`At most ${MAX_TERMS} terms`);
+        terms.push(term(op === '-' ? -1 : 1));
+    }
+    return { terms, text: terms.map((t, i) => (t.sign < 0 ? '-' : i > 0 ? '+' : '') + termText(t)).join('') };
+}
+
+function termText(t) {
+    if (t.count === 0) return String(t.value);
+    let s = `${t.count}d${t.sides}`;
+    if (t.explode) s += '!';
+    if (t.keep > 0) s += `kh${t.keep}`;
+    if (t.keep < 0) s += `kl${-t.keep}`;
+    return s;
+}
+
+// --- random numbers ---
+
+// xoshiro128** (Blackman and Vigna), 32-bit state words, seeded with splitmix32
+class Random {
+    constructor(seed = crypto.randomBytes(4).readUInt32LE(0)) {
+        this.s = new Uint32Array(4);
+        let x = seed >>> 0;
+        for (let i = 0; i < 4; i++) {
+            x = (x + 0x9e3779b9) >>> 0;
+            let z = x;
+            z = Math.imul(z ^ (z >>> 16), 0x85ebca6b);
+            z = Math.imul(z ^ (z >>> 13), 0xc2b2ae35);
+            this.s[i] = (z ^ (z >>> 16)) >>> 0;
+        }
+        if ((this.s[0] | this.s[1] | this.s[2] | this.s[3]) === 0) this.s[0] = 1;
+    }
+
+    nextU32() {
+        const s = this.s;
+        const r = Math.imul(rotl(Math.imul(s[1], 5), 7), 9) >>> 0;
+        const t = s[1] << 9;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 11);
+        return r;
+    }
+
+    // Uniform integer in [0, n) for 1 <= n <= 2^32, without modulo bias:
+    // draws from the partial block at the top of the 32-bit range are redrawn
+    below(n) {
+        const limit = TWO_32 - TWO_32 % n;
+        let r = this.nextU32();
+        while (r >= limit) r = this.nextU32();
+        return r % n;
+    }
+}
+
+function rotl(x, k) {
+    return (x << k) | (x >>> (32 - k));
+}
+
+// Dice per 32-bit draw for a die with this many sides, and their joint range
+const packing = new Map();
+function packingFor(sides) {
+    let p = packing.get(sides);
+    if (!p) {
+        let k = 1;
+        let range = sides;
+        while (sides > 1 && range * sides <= TWO_32) {
+            range *= sides;
+            k++;
+        }
+        p = { k, range };
+        packing.set(sides, p);
+    }
+    return p;
+}
+
+// --- rolling ---
+
+// One die including its explosion chain
+function rollDie(rng, sides, explode) {
+    let total = 0;
+    for (let depth = 0; ; depth++) {
+        const face = rng.below(sides) + 1;
+        total += face;
+        if (!explode || face !== sides || depth === EXPLODE_DEPTH) return total;
+    }
+}
+
+// Small pools, and pools that keep exploded dice: every die is kept in an array
+function rollEach(rng, t) {
+    const rolls = new Array(t.count);
+    for (let i = 0; i < t.count; i++) rolls[i] = rollDie(rng, t.sides, t.explode);
+    if (t.keep !== 0) rolls.sort(t.keep > 0 ? (a, b) => b - a : (a, b) => a - b); // Kept dice first
+    const kept = t.keep === 0 ? t.count : Math.abs(t.keep);
+    let sum = 0;
+    for (let i = 0; i < kept; i++) sum += rolls[i];
+    return { sum, rolls: t.count <= ROLLS_SHOWN ? rolls : [] };
+}
+
+// Rolls `count` plain dice in bulk. Adds each face to `counts` when given and
+// returns the sum and how many dice showed the maximum.
+function rollBulk(rng, count, sides, counts) {
+    const { k, range } = packingFor(sides);
+    let sum = 0;
+    let maxed = 0;
+    for (let left = count; left > 0; left -= k) {
+        let r = rng.below(range);
+        for (let j = Math.min(k, left); j > 0; j--) {
+            const face = r % sides;
+            r = (r - face) / sides;
+            sum += face + 1;
+            if (face === sides - 1) maxed++;
+            if (counts) counts[face]++;
+        }
+    }
+    return { sum, maxed };
+}
+
+function rollTerm(rng, t) {
+    if (t.count === 0) return { sum: t.value, rolls: [] };
+    if (t.count <= ROLLS_SHOWN || (t.keep !== 0 && (t.explode || t.sides > COUNTS_MAX_SIDES))) {
+        return rollEach(rng, t);
+    }
+    if (t.keep === 0) {
+        // Only the total matters; maxed dice explode as a smaller pool of their own
+        let sum = 0;
+        let pool = t.count;
+        for (let depth = 0; pool > 0 && depth <= EXPLODE_DEPTH; depth++) {
+            const r = rollBulk(rng, pool, t.sides, null);
+            sum += r.sum;
+            pool = t.explode ? r.maxed : 0;
+        }
+        return { sum, rolls: [] };
+    }
+    // Keep from per-face counts, highest or lowest faces first
+    const counts = new Uint32Array(t.sides);
+    rollBulk(rng, t.count, t.sides, counts);
+    let left = Math.abs(t.keep);
+    let sum = 0;
+    for (let i = 0; i < t.sides && left > 0; i++) {
+        const face = t.keep > 0 ? t.sides - 1 - i : i;
+        const n = Math.min(left, counts[face]);
+        sum += n * (face + 1);
+        left -= n;
+    }
+    return { sum, rolls: [] };
+}
+
+// --- distributions ---
+
+// A distribution is { min, pmf: Float64Array } over min .. min + pmf.length - 1
+
+class DistributionCache {
+    constructor(limit = DIST_CACHE_OUTCOMES) {
+        this.limit = limit;       // Values held, summed over pmf and cdf of every entry
+        this.size = 0;
+        this.entries = new Map(); // key -> distribution, least recently used first
+        this.hits = 0;
+        this.misses = 0;
+    }
+
+    // Cached result of compute(), which returns null for a distribution not
+    // worth computing; that is not cached, nor is an entry larger than the cache
+    get(key, compute) {
+        let d = this.entries.get(key);
+        if (d !== undefined) {
+            this.hits++;
+            this.entries.delete(key);
+            this.entries.set(key, d);
+            return d;
+        }
+        this.misses++;
+        d = compute();
+        if (d === null) return null;
+        const size = entrySize(d);
+        if (size > this.limit) return d;
+        while (this.size + size > this.limit) {
+            const [oldest, evicted] = this.entries.entries().next().value;
+            this.entries.delete(oldest);
+            this.size -= entrySize(evicted);
+        }
+        this.entries.set(key, d);
+        this.size += size;
+        return d;
+    }
+
+    // Outcome distribution of a parsed expression, or null when too large
+    expression(parsed) {
+        return this.get(`=${parsed.text}`, () => { // Apart from term keys, which hold no cdf
+            let d = { min: 0, pmf: Float64Array.of(1) };
+            for (const t of parsed.terms) {
+                let td = this.term(t);
+                if (!td) return null;
+                if (t.sign < 0) td = negate(td);
+                if (d.pmf.length + td.pmf.length - 1 > DIST_MAX_OUTCOMES) return null;
+                d = convolve(d, td);
+            }
+            return withCdf(d);
+        });
+    }
+
+    term(t) {
+        if (t.count === 0) return { min: t.value, pmf: Float64Array.of(1) };
+        // Sizes are checked up front, so nothing too large is built, even a single die
+        if (t.keep !== 0) {
+            if (t.explode || Math.abs(t.keep) * (t.sides - 1) + 1 > DIST_MAX_OUTCOMES) return null;
+            return this.get(termText(t), () => keepDistribution(t.count, t.sides, t.keep));
+        }
+        if (t.count * (dieOutcomes(t.sides, t.explode) - 1) + 1 > DIST_MAX_OUTCOMES) return null;
+        return this.get(termText(t), () => this.pool(t.sides, t.explode, t.count));
+    }
+
+    // Sum of n independent dice, by squaring: n = 2^a + 2^b + ... and each
+    // power of two is the square of the one below it, all cached. The caller
+    // checks that the sum fits in DIST_MAX_OUTCOMES.
+    pool(sides, explode, n) {
+        const die = this.get(`d${sides}${explode ? '!' : ''}`, () => dieDistribution(sides, explode));
+        let result = null;
+        let power = die;
+        for (let p = 1; ; p *= 2) {
+            if (n & p) result = result ? convolve(result, power) : power;
+            if (p * 2 > n) return result;
+            const squared = p * 2;
+            const base = power;
+            power = this.get(`${squared}d${sides}${explode ? '!' : ''}`, () => convolve(base, base));
+        }
+    }
+}
+
+function entrySize(d) {
+    return d.pmf.length + (d.cdf ? d.cdf.length : 0);
+}
+
+// Rerolls of an exploding die that are kept in its distribution: the chain
+// is truncated where it becomes less likely than DIST_TAIL
+function explodeDepth(sides) {
+    let depth = 0;
+    for (let p = 1 / sides; p > DIST_TAIL && depth < EXPLODE_DEPTH; p /= sides) depth++;
+    return depth;
+}
+
+// Length of dieDistribution(sides, explode).pmf
+function dieOutcomes(sides, explode) {
+    return explode ? sides * (explodeDepth(sides) + 1) : sides;
+}
+
+function dieDistribution(sides, explode) {
+    if (!explode) return { min: 1, pmf: new Float64Array(sides).fill(1 / sides) };
+    // v = sides * k + r with r < sides after k maxed rolls
+    const depth = explodeDepth(sides);
+    const pmf = new Float64Array(sides * (depth + 1));
+    let p = 1 / sides;
+    for (let k = 0; k <= depth; k++, p /= sides) {
+        const last = k === depth ? sides : sides - 1;
+        for (let r = 1; r <= last; r++) pmf[sides * k + r - 1] = p;
+    }
+    return { min: 1, pmf };
+}
+
+// Sum of the |keep| highest (keep > 0) or lowest dice of `count` dice, by
+// walking the faces from the kept end: of the r dice not yet placed, all at
+// or below face f, each shows f with probability 1/f, so the number showing
+// f is binomial. State: (dice placed, kept sum).
+function keepDistribution(count, sides, keep) {
+    const k = Math.abs(keep);
+    const sums = k * sides + 1;
+    if (sides * count * count * sums > DIST_KEEP_WORK) return null;
+    let dp = new Float64Array((count + 1) * sums); // [placed * sums + sum]
+    dp[0] = 1;
+    for (let i = 0; i < sides; i++) {
+        const face = keep > 0 ? sides - i : i + 1;
+        const facesLeft = sides - i;
+        const p = 1 / facesLeft;
+        const next = new Float64Array(dp.length);
+        for (let placed = 0; placed <= count; placed++) {
+            const rest = count - placed;
+            for (let s = 0; s < sums; s++) {
+                const w = dp[placed * sums + s];
+                if (w === 0) continue;
+                if (facesLeft === 1) { // The remaining dice all show this face
+                    const kept = Math.max(0, Math.min(rest, k - placed));
+                    next[count * sums + s + kept * face] += w;
+                    continue;
+                }
+                let b = Math.pow(1 - p, rest); // P(c = 0)
+                for (let c = 0; c <= rest; c++) {
+                    const kept = Math.max(0, Math.min(c, k - placed));
+                    next[(placed + c) * sums + s + kept * face] += w * b;
+                    b *= (rest - c) / (c + 1) * p / (1 - p);
+                }
+            }
+        }
+        dp = next;
+    }
+    const pmf = dp.subarray(count * sums + k, count * sums + sums);
+    return { min: k, pmf: Float64Array.from(pmf) };
+}
+
+function convolve(a, b) {
+    const pmf = new Float64Array(a.pmf.length + b.pmf.length - 1);
+    for (let i = 0; i < a.pmf.length; i++) {
+        const pa = a.pmf[i];
+        if (pa === 0) continue;
+        for (let j = 0; j < b.pmf.length; j++) pmf[i + j] += pa * b.pmf[j];
+    }
+    return { min: a.min + b.min, pmf };
+}
+
+function negate(d) {
+    return { min: -(d.min + d.pmf.length - 1), pmf: Float64Array.from(d.pmf).reverse() };
+}
+
+function withCdf(d) {
+    const cdf = new Float64Array(d.pmf.length);
+    let acc = 0;
+    let mean = 0;
+    for (let i = 0; i < d.pmf.length; i++) {
+        acc += d.pmf[i];
+        cdf[i] = acc;
+        mean += d.pmf[i] * (d.min + i);
+    }
+    return { min: d.min, max: d.min + d.pmf.length - 1, pmf: d.pmf, cdf, mean: mean / acc };
+}
+
+// Where `total` falls in the distribution: mean, range, P(lower) and P(equal)
+function summarize(d, total) {
+    const i = total - d.min;
+    const below = i <= 0 ? 0 : d.cdf[Math.min(i, d.cdf.length) - 1];
+    const at = i >= 0 && i < d.pmf.length ? d.pmf[i] : 0;
+    return { min: d.min, max: d.max, mean: d.mean, below, at };
+}
+
+const distributions = new DistributionCache();
+
+// --- rolling expressions ---
+
+// Rolls an expression and returns the structured dice_result payload
+// (without sender), or throws an Error for an invalid expression:
+//
+//   { expr, total, terms: [{ sign, count, sides, keep, explode, sum, rolls }], dist? }
+//
+// keep is n for "kh n", -n for "kl n"; rolls lists every die of pools up to
+// ROLLS_SHOWN dice, kept dice first. Constants have count 0 and their value
+// as sum. dist is present when the distribution could be computed.
+function roll(rng, input) {
+    const parsed = parse(input);
+    let total = 0;
+    const terms = parsed.terms.map(t => {
+        const r = rollTerm(rng, t);
+        total += t.sign * r.sum;
+        return { sign: t.sign, count: t.count, sides: t.sides, keep: t.keep, explode: t.explode, sum: r.sum, rolls: r.rolls };
+    });
+    const result = { expr: parsed.text, total, terms };
+    const d = distributions.expression(parsed);
+    if (d) result.dist = summarize(d, total);
+    return result;
+}
+
+module.exports = { parse, roll, Random, DistributionCache, distributions, MAX_EXPRESSION_LENGTH };
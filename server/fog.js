@@ -0,0 +1,131 @@
+// Fog of war state of a room: the wall grid and the cells revealed so far.
+//
+// Clients compute line of sight themselves (client/fog.c) and report cells
+// their tokens reveal for the first time; walls are edited by clients too.
+// Both travel as runs of cells, a flat [row, start, length, ...] array, and
+// the server keeps each layer as a bitset so it can tell which reported cells
+// are actually new and only relay those. Joining clients get both layers as
+// runs after their token sync.
+
+const FOG_MAX_SIZE = 256; // Grid side in cells, matches FOG_MAX_SIZE in client/fog.h
+const WORDS_PER_ROW = FOG_MAX_SIZE / 32;
+
+const FOG_LAYER = { WALLS: 0, REVEALED: 1 };
+const FOG_OP = { SET: 0, CLEAR: 1, RESET: 2 };
+
+class FogLayer {
+    constructor() {
+        this.bits = new Uint32Array(FOG_MAX_SIZE * WORDS_PER_ROW);
+    }
+
+    get(row, x) {
+        return (this.bits[row * WORDS_PER_ROW + (x >>> 5)] >>> (x & 31)) & 1;
+    }
+
+    // Sets or clears a run and returns the runs of cells that changed
+    apply(row, start, length, value, changed) {
+        let runStart = -1;
+        const end = start + length;
+        for (let x = start; x <= end; x++) {
+            const differs = x < end && this.get(row, x) !== value;
+            if (differs) {
+                const word = row * WORDS_PER_ROW + (x >>> 5);
+                this.bits[word] = value ? this.bits[word] | (1 << (x & 31)) : this.bits[word] & ~(1 << (x & 31));
+                if (runStart < 0) runStart = x;
+            } else if (runStart >= 0) {
+                changed.push(row, runStart, x - runStart);
+                runStart = -1;
+            }
+        }
+    }
+
+    // All set cells as runs
+    runs() {
+        const out = [];
+        for (let row = 0; row < FOG_MAX_SIZE; row++) {
+            let runStart = -1;
+            for (let x = 0; x <= FOG_MAX_SIZE; x++) {
+                const set = x < FOG_MAX_SIZE && this.get(row, x) === 1;
+                if (set && runStart < 0) {
+                    runStart = x;
+                } else if (!set && runStart >= 0) {
+                    out.push(row, runStart, x - runStart);
+                    runStart = -1;
+                }
+            }
+        }
+        return out;
+    }
+}
+
+class FogState {
+    constructor() {
+        this.layers = [new FogLayer(), new FogLayer()];
+    }
+
+    // Applies runs reported by a client. Returns the runs that changed
+    // anything (possibly empty), or null if the message is invalid.
+    // Clients may edit walls either way but can only add revealed cells.
+    apply(layer, op, runs) {
+        if (!Number.isInteger(layer) || !this.layers[layer] || !Array.isArray(runs) || runs.length % 3 !== 0) return null;
+        if (op !== FOG_OP.SET && !(op === FOG_OP.CLEAR && layer === FOG_LAYER.WALLS)) return null;
+        for (let i = 0; i < runs.length; i += 3) {
+            const [row, start, length] = [runs[i], runs[i + 1], runs[i + 2]];
+            if (!Number.isInteger(row) || !Number.isInteger(start) || !Number.isInteger(length) ||
+                row < 0 || row >= FOG_MAX_SIZE || start < 0 || length < 1 || start + length > FOG_MAX_SIZE) {
+                return null;
+            }
+        }
+        const changed = [];
+        for (let i = 0; i < runs.length; i += 3) {
+            this.layers[layer].apply(runs[i], runs[i + 1], runs[i + 2], op === FOG_OP.SET ? 1 : 0, changed);
+        }
+        return changed;
+    }
+
+    // fog_runs messages that replace a client's fog with this state
+    messages() {
+        return this.layers.map((fogLayer, layer) => ({ type: 'fog_runs', layer, op: FOG_OP.RESET, runs: fogLayer.runs() }));
+    }
+
+    // Layers for persistence (see persistence.js): per layer null when empty,
+    // else [firstWord, base64, ...] for the stretches of the bitset that have
+    // set bits, as revealed areas are usually a small part of the map
+    save() {
+        return this.layers.map(fogLayer => {
+            const bits = fogLayer.bits;
+            const parts = [];
+            let i = 0;
+            while (i < bits.length) {
+                if (bits[i] === 0) {
+                    i++;
+                    continue;
+                }
+                // Extend over short gaps, which cost more as a new part than inline
+                let end = i + 1;
+                for (let gap = 0; end + gap < bits.length && gap < 4; gap++) {
+                    if (bits[end + gap] !== 0) {
+                        end += gap + 1;
+                        gap = -1;
+                    }
+                }
+                parts.push(i, Buffer.from(bits.buffer, bits.byteOffset + i * 4, (end - i) * 4).toString('base64'));
+                i = end;
+            }
+            return parts.length > 0 ? parts : null;
+        });
+    }
+
+    load(saved) {
+        saved.forEach((parts, layer) => {
+            const bits = this.layers[layer].bits;
+            bits.fill(0);
+            const target = Buffer.from(bits.buffer, bits.byteOffset, bits.byteLength);
+            for (let i = 0; parts && i + 1 < parts.length; i += 2) {
+                Buffer.from(parts[i + 1], 'base64').copy(target, parts[i] * 4);
+            }
+        });
+    }
+}
+
+module.exports = { FogState, FOG_LAYER, FOG_OP, FOG_MAX_SIZE };
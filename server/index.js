@@ -1,50 +1,333 @@
+const path = require('path');
+const { performance } = require('perf_hooks');
 const WebSocket = require('ws');
 const { v4: uuidv4 } = require('uuid');
+const protocol = require('./protocol');
+const { RoomRegistry } = require('./rooms');
+const { SessionRegistry } = require('./sessions');
+const { getLogger } = require('./logger');
+const { FOG_LAYER, FOG_MAX_SIZE } = require('./fog');
+const pathfind = require('./pathfind');
+const { Outbound, flushAll, backlogged, stats: outboundStats } = require('./outbound');
+const { Interest } = require('./interest');
+const { RoomStore } = require('./persistence');
+const dice = require('./dice');
+const metrics = require('./metrics');
+const { DEFAULT_ROOM, SHARD_COUNT, SHARD_INDEX, ownsRoom } = require('./sharding');
 
-const wss = new WebSocket.Server({ port: 8080 });
+// Log categories; per-message and per-tick entries are debug level
+const netLog = getLogger('net');
+const msgLog = getLogger('msg');
+const roomLog = getLogger('room');
+const sessionLog = getLogger('session');
+const syncLog = getLogger('sync');
+const fogLog = getLogger('fog');
+const diceLog = getLogger('dice');
+const tickLog = getLogger('tick');
+const storeLog = getLogger('store');
+const metricsLog = getLogger('metrics');
 
-// Map to store rooms: room_id -> Set<WebSocket>
-const rooms = new Map();
-const DEFAULT_ROOM = 'lobby';
+const PORT = Number(process.env.RAYVTT_PORT) || 8080;
 
-// Helper function to broadcast messages within a room
-function broadcastToRoom(roomId, message, senderWs = null) {
+// Started by router.js as one of several shards, this process does not listen
+// itself: the router passes it the sockets of connections to rooms it owns
+const SHARDED = SHARD_COUNT > 1 && typeof process.send === 'function';
+const wss = SHARDED
+    ? new WebSocket.Server({ noServer: true, handleProtocols: protocol.selectSubprotocol })
+    : new WebSocket.Server({ port: PORT, handleProtocols: protocol.selectSubprotocol });
+
+// Registry of rooms: room_id -> Room (clients + pending token moves)
+const rooms = new RoomRegistry();
+
+// Rooms survive restarts through an append-only log and snapshots (see
+// persistence.js). Each shard keeps its own directory. An empty
+// RAYVTT_DATA_DIR keeps everything in memory only.
+const DATA_DIR = process.env.RAYVTT_DATA_DIR ?? path.join(__dirname, 'data');
+const store = DATA_DIR ? new RoomStore(SHARD_COUNT > 1 ? path.join(DATA_DIR, `shard-${SHARD_INDEX}-of-${SHARD_COUNT}`) : DATA_DIR, rooms) : null;
+if (store) {
+    // Synchronous, before the first connection is accepted
+    const recovered = store.recover();
+    storeLog.info('Recovered %d room(s) in %s ms (snapshot %s, %d log record(s))',
+        recovered.rooms, recovered.ms.toFixed(1), recovered.snapshot === null ? 'none' : recovered.snapshot, recovered.records);
+    store.start();
+}
+
+// How long a redirected client gets to close its socket itself
+const REDIRECT_CLOSE_MS = 5 * 1000;
+
+// Token moves are coalesced per room and broadcast once per tick
+const TICK_RATE_HZ = Number(process.env.RAYVTT_TICK_HZ) || 20;
+
+// Longest chat or dice_roll message kept, in UTF-8 bytes (the length of a binary str)
+const MAX_CHAT_BYTES = 255;
+
+// World size of the map, which viewports are clamped to
+const MAP_EXTENT = FOG_MAX_SIZE * pathfind.GRID_SIZE;
+
+// Metrics (see metrics.js). Shards label their series so the router can merge them.
+const registry = new metrics.Registry(SHARDED ? { shard: String(SHARD_INDEX) } : {});
+const roomMessagesIn = registry.counter('rayvtt_room_messages_received_total', 'WebSocket messages received from clients in the room', { label: 'room' });
+const roomBytesIn = registry.counter('rayvtt_room_bytes_received_total', 'Bytes received from clients in the room', { label: 'room' });
+const roomMessagesOut = registry.counter('rayvtt_room_messages_sent_total', 'WebSocket messages sent to clients in the room', { label: 'room' });
+const roomBytesOut = registry.counter('rayvtt_room_bytes_sent_total', 'Bytes sent to clients in the room', { label: 'room' });
+const roomBroadcastSeconds = registry.histogram('rayvtt_room_broadcast_seconds',
+    'Time to encode and send one broadcast or tick batch to every recipient in the room', { label: 'room' });
+const movesRejected = registry.counter('rayvtt_moves_rejected_total', 'Token drags dropped out of reach and moved back to where they started');
+const eventLoopLag = registry.histogram('rayvtt_event_loop_lag_seconds', 'How late a 50 ms timer fired');
+registry.gauge('rayvtt_clients', 'Connected WebSocket clients', { read: () => wss.clients.size });
+registry.gauge('rayvtt_rooms', 'Rooms held in memory', { read: () => rooms.rooms.size });
+registry.gauge('rayvtt_sessions_parked', 'Sessions waiting for their client to reconnect', {
+    read: () => {
+        let parked = 0;
+        for (const room of rooms.values()) parked += room.parked;
+        return parked;
+    },
+});
+registry.gauge('rayvtt_outbound_queued_bytes', 'Bytes queued for clients that fell behind', { read: () => outboundStats.queuedBytes });
+registry.gauge('rayvtt_outbound_backlogged_clients', 'Clients with queued messages or a pending resync', { read: () => backlogged.size });
+registry.counter('rayvtt_outbound_congested_total', 'Times a client went over the outbound high watermark', { read: () => outboundStats.congested });
+registry.counter('rayvtt_outbound_collapsed_updates_total', 'Token updates for clients behind that a newer one replaced', { read: () => outboundStats.collapsed });
+registry.counter('rayvtt_outbound_resyncs_total', 'Outbound queues dropped for a snapshot resync', { read: () => outboundStats.resyncs });
+registry.counter('rayvtt_outbound_disconnects_total', 'Clients disconnected for staying behind', { read: () => outboundStats.disconnects });
+metrics.addProcessMetrics(registry);
+metrics.trackEventLoopLag(eventLoopLag);
+
+// The room's metric series, looked up once and kept on the room
+function roomMetrics(room) {
+    if (!room.metrics) {
+        room.metrics = {
+            messagesIn: roomMessagesIn.labels(room.id),
+            bytesIn: roomBytesIn.labels(room.id),
+            messagesOut: roomMessagesOut.labels(room.id),
+            bytesOut: roomBytesOut.labels(room.id),
+            broadcastSeconds: roomBroadcastSeconds.labels(room.id),
+        };
+    }
+    return room.metrics;
+}
+
+// Serializes a message in the encoding negotiated by the client
+function encodeFor(ws, msg) {
+    return ws.binary ? protocol.encode(msg) : JSON.stringify(msg);
+}
+
+// JSON is ASCII apart from user text, so a string's length stands in for its bytes
+function countSent(room, frame, recipients = 1) {
+    const m = roomMetrics(room);
+    m.messagesOut.inc(recipients);
+    m.bytesOut.inc(frame.length * recipients);
+}
+
+// Messages go through the client's outbound queue (see outbound.js), which
+// holds them back while the client is behind
+function send(ws, msg) {
+    const frame = encodeFor(ws, msg);
+    ws.outbound.send(frame);
+    const room = rooms.get(ws.roomId);
+    if (room) countSent(room, frame);
+}
+
+// Helper function to broadcast messages within a room.
+// Each encoding is serialized at most once and reused for every recipient.
+function broadcastToRoom(roomId, msg, senderWs = null) {
     const room = rooms.get(roomId);
     if (room) {
-        room.forEach(client => {
+        const started = performance.now();
+        let json = null;
+        let binary = null;
+        let jsonCount = 0;
+        let binaryCount = 0;
+        room.clients.forEach(client => {
             if (client !== senderWs && client.readyState === WebSocket.OPEN) {
-                client.send(message);
+                if (client.binary) {
+                    client.outbound.send(binary || (binary = protocol.encode(msg)));
+                    binaryCount++;
+                } else {
+                    client.outbound.send(json || (json = JSON.stringify(msg)));
+                    jsonCount++;
+                }
             }
         });
+        if (binary) countSent(room, binary, binaryCount);
+        if (json) countSent(room, json, jsonCount);
+        roomMetrics(room).broadcastSeconds.observe((performance.now() - started) / 1000);
+    }
+}
+
+// Sessions by client id; parked for a grace period when their socket closes
+const sessions = new SessionRegistry(onSessionExpired);
+
+// Deletes a room nobody is in or expected back to (except the default room)
+function maybeDeleteRoom(roomId) {
+    const room = rooms.get(roomId);
+    if (room && room.isEmpty && roomId !== DEFAULT_ROOM) {
+        rooms.delete(roomId);
+        registry.removeLabel(roomId);
+        if (store) store.roomDeleted(roomId);
+        roomLog.info('Room %s is now empty and deleted.', roomId);
+    }
+}
+
+function clamp(v, min, max) {
+    return Math.min(Math.max(v, min), max);
+}
+
+// Where a drag of token `id` that started at `origin` ends: the drop position
+// if the token can walk there (see pathfind.js), else the origin
+function checkedDrop(room, id, origin, x, y) {
+    if (!room || !origin || !room.state.tokens.has(Number(id)) || pathfind.canReach(room, id, origin, { x, y })) {
+        return { x, y };
     }
+    movesRejected.inc();
+    msgLog.debug('Token %s dropped out of reach in room %s, moved back', id, room.id);
+    return origin;
 }
 
-// Authoritative game state
-let gameState = {
-    tokens: {
-        "0": { id: 0, x: 100, y: 100 },
-        "1": { id: 1, x: 200, y: 150 },
-        "2": { id: 2, x: 300, y: 200 }
+// Drops the tokens a session was still dragging at their last position, so
+// other clients stop interpolating. Tokens listed in `keep` stay held. The
+// drop is unsequenced (seq 0): the client's own next sample of the token,
+// after a resume, must not look stale next to it.
+function releaseHeldTokens(session, keep = null) {
+    for (const [id, held] of session.held) {
+        if (keep && keep.has(id)) continue;
+        session.held.delete(id);
+        const { x, y } = checkedDrop(rooms.get(session.roomId), id, held.origin, held.x, held.y);
+        rooms.queueMove(session.roomId, id, x, y, session.id, 0, 0, true);
+        sessionLog.info('Released token %d held by %s', id, session.id);
     }
-};
+}
+
+// Takes a connected client out of its room
+function leaveRoom(ws) {
+    const room = rooms.get(ws.roomId);
+    if (room) {
+        releaseHeldTokens(ws.session);
+        room.forgetSender(ws.id);
+        room.delete(ws);
+        broadcastToRoom(room.id, { type: "user_left", userId: ws.id });
+        roomLog.info('Client %s left room: %s', ws.id, room.id);
+        maybeDeleteRoom(room.id);
+    }
+    ws.roomId = ws.session.roomId = null;
+}
+
+function enterRoom(ws, roomId) {
+    ws.roomId = ws.session.roomId = roomId;
+    const created = !rooms.has(roomId);
+    const room = rooms.getOrCreate(roomId);
+    if (created && store) store.roomCreated(room);
+    room.add(ws);
+    broadcastToRoom(roomId, { type: "user_joined", userId: ws.id }, ws);
+}
+
+// A parked session was not resumed in time: now the client really leaves
+function onSessionExpired(session) {
+    const room = rooms.get(session.roomId);
+    sessionLog.info('Session %s expired', session.id);
+    if (!room) return;
+    room.parked--;
+    releaseHeldTokens(session);
+    room.forgetSender(session.id);
+    broadcastToRoom(room.id, { type: "user_left", userId: session.id });
+    maybeDeleteRoom(room.id);
+}
+
+// Binds a socket to the session of `clientId`. A parked or still-open session
+// is resumed in O(1): the socket takes its place in the session's room and
+// keeps the drags listed in `held`. Otherwise a new session starts in
+// `roomId` if this shard owns it, or the default room. Exactly one init_state
+// is sent either way.
+function bindSession(ws, clientId, epoch, revision, held, roomId = DEFAULT_ROOM) {
+    const { session, resumed, replaced } = sessions.attach(clientId, ws);
+    ws.id = clientId;
+
+    if (replaced) {
+        // Reconnected before the server noticed the old socket was gone
+        rooms.get(session.roomId)?.delete(replaced);
+        replaced.terminate();
+    } else if (resumed && rooms.has(session.roomId)) {
+        rooms.get(session.roomId).parked--;
+    }
+
+    if (resumed && rooms.has(session.roomId)) {
+        ws.roomId = session.roomId;
+        rooms.get(ws.roomId).add(ws); // Others never saw us leave
+        releaseHeldTokens(session, held);
+        sessionLog.info('Client %s resumed session in room %s (%d held drag(s))', ws.id, ws.roomId, session.held.size);
+    } else {
+        if (resumed) releaseHeldTokens(session); // Session had left all rooms
+        enterRoom(ws, roomId && ownsRoom(roomId) ? roomId : DEFAULT_ROOM);
+        sessionLog.info('Client %s started a session in room %s', ws.id, ws.roomId);
+    }
+
+    if (ws.roomId !== DEFAULT_ROOM) {
+        send(ws, { type: "room_joined", roomId: ws.roomId });
+    }
+    syncState(ws, rooms.get(ws.roomId), epoch, revision, { type: "init_state", client_id: ws.id });
+}
+
+// Brings a client up to date with a room's authoritative state. (epoch, revision)
+// is what the client last saw; it gets the missing deltas or a full snapshot.
+function syncState(ws, room, epoch, revision, extra = { type: "state_sync" }) {
+    const sync = room.state.sync(Number(epoch) || 0, Number(revision));
+    send(ws, Object.assign(extra, sync));
+    ws.syncedEpoch = sync.epoch;
+    ws.syncedRevision = sync.revision;
+    ws.interest.synced(room.state.index);
+    syncLog.info('Synced client %s to revision %d of room %s: %s', ws.id, sync.revision, room.id,
+        sync.snapshot ? 'snapshot' : `delta since ${sync.base}`);
+    // Fog is not versioned; it is small as runs, so it is always sent whole
+    for (const msg of room.fog.messages()) {
+        send(ws, msg);
+    }
+}
+
+// A client whose outbound queue was dropped (see outbound.js) has missed
+// messages, so it is told its room again and gets a snapshot of it. The
+// room is announced even when it is the default room: room_joined is what
+// makes the client drop its chat log, which has a gap now, and page the
+// history in again.
+function resyncClient(ws) {
+    if (ws.readyState !== WebSocket.OPEN) return;
+    const room = ws.roomId ? rooms.get(ws.roomId) : null;
+    netLog.info('Client %s caught up after falling behind, resyncing', ws.id);
+    if (!room) {
+        send(ws, { type: "room_left" });
+        return;
+    }
+    send(ws, { type: "room_joined", roomId: ws.roomId });
+    syncState(ws, room, 0, 0);
+}
+
+// Sends a client to the shard that owns `roomId`. Its session here ends at
+// once, without a grace period, as it continues on the other shard; the
+// client reconnects with ?room= and resumes from its known revision there.
+function redirectToRoom(ws, roomId) {
+    leaveRoom(ws);
+    sessions.remove(ws.session);
+    ws.redirected = true;
+    send(ws, { type: "room_redirect", roomId });
+    setTimeout(() => ws.terminate(), REDIRECT_CLOSE_MS).unref();
+    roomLog.info('Client %s redirected to room %s on another shard', ws.id, roomId);
+}
 
 // Heartbeat configuration
 const heartbeatInterval = 30 * 1000; // 30 seconds
 const heartbeatTimeout = 60 * 1000;  // 60 seconds
 
-wss.on('connection', ws => {
-    // Assign a unique ID to the client
-    ws.id = uuidv4();
-    ws.roomId = DEFAULT_ROOM; // Assign to default room
+wss.on('connection', (ws, req) => {
+    // Reconnecting clients put their id, room, last known room revision and
+    // the token they are dragging in the URL
+    // (?client_id=&room=&epoch=&revision=&held=), so the session resumes and
+    // the very first message can be a delta
+    const query = new URL(req.url, 'http://localhost').searchParams;
+    const resumeId = query.get('client_id');
+    const held = new Set(query.getAll('held').map(Number).filter(Number.isInteger));
 
-    // Add client to the default room
-    if (!rooms.has(DEFAULT_ROOM)) {
-        rooms.set(DEFAULT_ROOM, new Set());
-    }
-    rooms.get(DEFAULT_ROOM).add(ws);
-
-    console.log(`Client ${ws.id} connected. Assigned to room: ${ws.roomId}`);
-    console.log('Total clients in lobby: ' + rooms.get(DEFAULT_ROOM).size);
+    ws.binary = protocol.isBinaryProtocol(ws.protocol);
+    ws.interest = new Interest();
+    ws.outbound = new Outbound(ws, msg => encodeFor(ws, msg), () => resyncClient(ws));
+    netLog.info('Client connected (%s)', ws.binary ? 'binary' : 'json');
 
     // Heartbeat setup for new connection
     ws.isAlive = true;
@@ -52,157 +335,312 @@ wss.on('connection', ws => {
         ws.isAlive = true;
     });
 
-    // Send initial state to the newly connected client
-    ws.send(JSON.stringify({ type: "init_state", client_id: ws.id, tokens: gameState.tokens }));
-    broadcastToRoom(ws.roomId, JSON.stringify({ type: "user_joined", userId: ws.id }), ws);
+    // Resume the client's session, or assign a unique ID and start a new one
+    bindSession(ws, resumeId && resumeId.length <= 64 ? resumeId : uuidv4(), query.get('epoch'), query.get('revision'), held,
+        query.get('room') || DEFAULT_ROOM);
 
 
-    ws.on('message', message => {
+    ws.on('message', (message, isBinary) => {
         ws.isAlive = true; // Reset heartbeat on any message
-        console.log('Received: %s', message);
+        const room = rooms.get(ws.roomId);
+        if (room) {
+            const m = roomMetrics(room);
+            m.messagesIn.inc();
+            m.bytesIn.inc(message.length);
+        }
         try {
-            const msg = JSON.parse(message.toString());
-
-            if (msg.type === "reconnect_request") {
-                // Reconnect logic: if client_id is provided, try to re-assign
-                let foundExisting = false;
-                if (typeof msg.client_id === 'string' && msg.client_id.length > 0) {
-                    for (let client of rooms.get(ws.roomId) || []) { // Check current room first
-                        if (client.id === msg.client_id) {
-                            // Transfer properties from old ws to new ws
-                            ws.id = client.id;
-                            ws.roomId = client.roomId;
-                            ws.isAlive = client.isAlive;
-                            // Remove old client from room and add new one
-                            rooms.get(client.roomId).delete(client);
-                            rooms.get(ws.roomId).add(ws);
-                            console.log(`Client ${ws.id} reconnected. Re-assigned to room: ${ws.roomId}`);
-                            foundExisting = true;
-                            break;
-                        }
-                    }
-                    if (!foundExisting) { // If not found in current room, assign new ID and default room
-                        ws.id = msg.client_id; // Use requested ID if not found
-                        ws.roomId = DEFAULT_ROOM;
-                        if (!rooms.has(DEFAULT_ROOM)) {
-                            rooms.set(DEFAULT_ROOM, new Set());
-                        }
-                        rooms.get(DEFAULT_ROOM).add(ws);
-                        console.log(`Client ${ws.id} reconnected with new ID. Assigned to room: ${ws.roomId}`);
-                    }
-                } else {
-                    // If no client_id provided in reconnect_request, treat as new connection
-                    ws.id = uuidv4();
-                    ws.roomId = DEFAULT_ROOM;
-                    if (!rooms.has(DEFAULT_ROOM)) {
-                        rooms.set(DEFAULT_ROOM, new Set());
-                    }
-                    rooms.get(DEFAULT_ROOM).add(ws);
-                    console.log(`Assigned new client ID (reconnect_request without client_id): ${ws.id}. Assigned to room: ${ws.roomId}`);
-                }
-                ws.send(JSON.stringify({ type: "init_state", client_id: ws.id, tokens: gameState.tokens }));
-                broadcastToRoom(ws.roomId, JSON.stringify({ type: "user_joined", userId: ws.id }), ws);
-                return; // Handled reconnect request, exit message handler
-            } else if (msg.type === "join_room") {
-                const { roomId } = msg;
-                if (typeof roomId !== 'string' || roomId.length === 0) {
-                    console.warn("Invalid join_room data received:", msg);
-                    return;
-                }
-
-                // Remove from current room
-                if (ws.roomId && rooms.has(ws.roomId)) {
-                    rooms.get(ws.roomId).delete(ws);
-                    broadcastToRoom(ws.roomId, JSON.stringify({ type: "user_left", userId: ws.id }));
-                    console.log(`Client ${ws.id} left room: ${ws.roomId}`);
+            if (isBinary) {
+                msgLog.debug('Received binary frame (%d bytes) from %s', message.length, ws.id);
+                for (const msg of protocol.decode(message)) {
+                    handleMessage(ws, msg);
                 }
-
-                // Add to new room
-                ws.roomId = roomId;
-                if (!rooms.has(roomId)) {
-                    rooms.set(roomId, new Set());
-                }
-                rooms.get(roomId).add(ws);
-                console.log(`Client ${ws.id} joined room: ${ws.roomId}`);
-                broadcastToRoom(ws.roomId, JSON.stringify({ type: "user_joined", userId: ws.id }), ws);
-                ws.send(JSON.stringify({ type: "room_joined", roomId: ws.roomId })); // Confirm join
-            } else if (msg.type === "leave_room") {
-                if (ws.roomId && rooms.has(ws.roomId)) {
-                    rooms.get(ws.roomId).delete(ws);
-                    broadcastToRoom(ws.roomId, JSON.stringify({ type: "user_left", userId: ws.id }));
-                    console.log(`Client ${ws.id} left room: ${ws.roomId}`);
-                    ws.roomId = null; // Clear room ID
-                    ws.send(JSON.stringify({ type: "room_left" })); // Confirm leave
-                }
-            } else if (msg.type === "move_token") {
-                const { id, x, y } = msg;
-                // Input Validation for move_token
-                if (typeof id === 'undefined' || (typeof id !== 'string' && typeof id !== 'number') || typeof x !== 'number' || typeof y !== 'number') {
-                    console.warn("Invalid move_token data received:", msg);
-                    return;
-                }
-                // Update authoritative state
-                if (gameState.tokens[id]) {
-                    gameState.tokens[id].x = x;
-                    gameState.tokens[id].y = y;
-                }
-
-                // Broadcast the updated token to clients in the same room
-                console.log(`Server broadcasting update_token from ${ws.id} in room ${ws.roomId}: id=${id}, x=${x}, y=${y}`);
-                const updateTokenMessage = JSON.stringify({ type: "update_token", sender_id: ws.id, id, x, y });
-                broadcastToRoom(ws.roomId, updateTokenMessage, ws);
-            } else if (msg.type === "dice_roll") {
-                // Input Validation for dice_roll
-                if (typeof msg.message !== 'string') {
-                    console.warn("Invalid dice_roll data received:", msg);
-                    return;
-                }
-                // Broadcast dice roll to clients in the same room
-                console.log(`Server broadcasting dice_roll from ${ws.id} in room ${ws.roomId}: ${msg.message}`);
-                const diceRollMessage = JSON.stringify({ type: "dice_roll", sender_id: ws.id, message: msg.message });
-                broadcastToRoom(ws.roomId, diceRollMessage, ws);
-            } else if (msg.type === "chat_message") {
-                // Input Validation for chat_message
-                if (typeof msg.message !== 'string') {
-                    console.warn("Invalid chat_message data received:", msg);
-                    return;
-                }
-                // Broadcast chat message to clients in the same room
-                const chatMessage = JSON.stringify({ type: "chat_message", sender_id: ws.id, message: msg.message });
-                console.log(`Server sending chat_message from ${ws.id} in room ${ws.roomId}: ${chatMessage}`);
-                broadcastToRoom(ws.roomId, chatMessage, ws);
-            } else if (msg.type === "ping") {
-                ws.send(JSON.stringify({ type: "pong" }));
             } else {
-                console.warn("Unknown message type received:", msg.type);
+                msgLog.debug('Received from %s: %s', ws.id, message);
+                handleMessage(ws, JSON.parse(message.toString()));
             }
         } catch (error) {
-            console.error("Failed to parse message or invalid message format: ", error);
+            msgLog.warn("Failed to parse message or invalid message format: %s", error);
         }
     });
 
     ws.on('close', () => {
-        if (ws.roomId && rooms.has(ws.roomId)) {
-            rooms.get(ws.roomId).delete(ws);
-            broadcastToRoom(ws.roomId, JSON.stringify({ type: "user_left", userId: ws.id }));
-            console.log(`Client ${ws.id} disconnected. Left room: ${ws.roomId}. Clients remaining in room: ${rooms.get(ws.roomId).size}`);
-            if (rooms.get(ws.roomId).size === 0 && ws.roomId !== DEFAULT_ROOM) {
-                rooms.delete(ws.roomId); // Clean up empty rooms (except default)
-                console.log(`Room ${ws.roomId} is now empty and deleted.`);
-            }
+        ws.outbound.discard();
+        // Park the session; the client stays in its room until the grace period ends
+        const session = sessions.detach(ws);
+        if (!session) return; // Replaced by a newer connection
+        const room = rooms.get(ws.roomId);
+        if (room) {
+            room.delete(ws);
+            room.parked++;
         }
+        netLog.info('Client %s disconnected from room %s; session kept for %d ms', ws.id, ws.roomId, sessions.graceMs);
     });
 
     ws.on('error', error => {
-        console.error('WebSocket error: ', error);
+        netLog.error('WebSocket error: %s', error);
     });
 });
 
+function handleMessage(ws, msg) {
+    if (ws.redirected) {
+        return; // The client continues on another shard
+    } else if (msg.type === "reconnect_request") {
+        // Older clients connect without an id and announce it here instead.
+        // Swap the session made for this socket for the requested one.
+        if (typeof msg.client_id !== 'string' || msg.client_id.length === 0 || msg.client_id.length > 64 ||
+            msg.client_id === ws.id) {
+            return; // Nothing to resume; the client already has its init_state
+        }
+        const fresh = ws.session;
+        leaveRoom(ws);
+        sessions.remove(fresh);
+        // This connection already received the default room at its sync revision,
+        // so when the session stays there the sync is a (usually empty) delta
+        bindSession(ws, msg.client_id, ws.syncedEpoch, ws.syncedRevision, null);
+        return; // Handled reconnect request, exit message handler
+    } else if (msg.type === "join_room") {
+        const { roomId } = msg;
+        if (typeof roomId !== 'string' || roomId.length === 0) {
+            msgLog.warn("Invalid join_room data received: %j", msg);
+            return;
+        }
+
+        if (!ownsRoom(roomId)) {
+            redirectToRoom(ws, roomId);
+            return;
+        }
+
+        // Move from the current room to the new one
+        leaveRoom(ws);
+        enterRoom(ws, roomId);
+        roomLog.info('Client %s joined room: %s', ws.id, ws.roomId);
+        send(ws, { type: "room_joined", roomId: ws.roomId }); // Confirm join
+        syncState(ws, rooms.get(ws.roomId), msg.epoch, msg.revision);
+    } else if (msg.type === "leave_room") {
+        if (ws.roomId && rooms.has(ws.roomId)) {
+            leaveRoom(ws);
+            send(ws, { type: "room_left" }); // Confirm leave
+        }
+    } else if (msg.type === "move_token") {
+        const { x, y } = msg;
+        // Input Validation for move_token. JSON clients may send the id as a
+        // string; it must name a token of the room either way, so made-up ids
+        // are neither tracked nor relayed.
+        const room = rooms.get(ws.roomId);
+        const id = typeof msg.id === 'string' || typeof msg.id === 'number' ? Number(msg.id) : NaN;
+        if (!Number.isInteger(id) || !Number.isFinite(x) || !Number.isFinite(y)) {
+            msgLog.warn("Invalid move_token data received: %j", msg);
+            return;
+        }
+        if (!room || !room.state.tokens.has(id)) {
+            msgLog.debug('Move of unknown token %d from %s ignored', id, ws.id);
+            return;
+        }
+        // Streamed drag samples carry a sequence number and sender timestamp; older clients send neither
+        const seq = Number.isInteger(msg.seq) && msg.seq > 0 ? msg.seq : 0;
+        const t = Number.isInteger(msg.t) && msg.t >= 0 ? msg.t : 0;
+        const final = msg.final !== false;
+
+        // A drag starts where the token was before its first sample (a move
+        // still waiting for the tick counts); a drop must be within reach of it
+        const held = ws.session.held.get(id);
+        let origin = held ? held.origin : null;
+        if (!origin) {
+            origin = room.pendingMoves.get(id) || room.state.tokens.get(id);
+            origin = { x: origin.x, y: origin.y };
+        }
+        const to = final ? checkedDrop(room, id, origin, x, y) : { x, y };
+
+        // Queue the update for the room's next tick; only the latest position per token is sent
+        // The room's authoritative state is updated when the tick is flushed
+        if (!rooms.queueMove(ws.roomId, id, to.x, to.y, ws.id, seq, t, final)) {
+            return; // Stale drag sample
+        }
+
+        // Remember open drags so they survive a reconnect, or are dropped if the session ends
+        if (final) {
+            ws.session.held.delete(id);
+        } else {
+            ws.session.held.set(id, { x, y, origin });
+        }
+    } else if (msg.type === "dice_roll") {
+        // Input Validation for dice_roll
+        if (typeof msg.message !== 'string') {
+            msgLog.warn("Invalid dice_roll data received: %j", msg);
+            return;
+        }
+        // Broadcast dice roll to clients in the same room
+        const message = truncateChat(msg.message);
+        roomLog.debug('Server broadcasting dice_roll from %s in room %s: %s', ws.id, ws.roomId, message);
+        const diceRollMessage = logChat(ws.roomId, { type: "dice_roll", sender_id: ws.id, message });
+        broadcastToRoom(ws.roomId, diceRollMessage, ws);
+    } else if (msg.type === "roll_dice") {
+        const room = rooms.get(ws.roomId);
+        if (!room) return;
+        let result;
+        try {
+            result = dice.roll(room.rng, msg.expr);
+        } catch (error) {
+            // Only the roller sees why the expression was rejected
+            diceLog.debug('Rejected dice expression from %s: %j (%s)', ws.id, msg.expr, error.message);
+            send(ws, { type: "dice_roll", sender_id: "server", message: `Cannot roll ${String(msg.expr).slice(0, 32)}: ${error.message}` });
+            return;
+        }
+        diceLog.debug('%s rolled %s = %d in room %s', ws.id, result.expr, result.total, ws.roomId);
+        // Everyone gets the authoritative result, including the roller
+        broadcastToRoom(ws.roomId, logChat(ws.roomId, { type: "dice_result", sender_id: ws.id, ...result }));
+    } else if (msg.type === "chat_message") {
+        // Input Validation for chat_message
+        if (typeof msg.message !== 'string') {
+            msgLog.warn("Invalid chat_message data received: %j", msg);
+            return;
+        }
+        // Broadcast chat message to clients in the same room
+        const message = truncateChat(msg.message);
+        const chatMessage = logChat(ws.roomId, { type: "chat_message", sender_id: ws.id, message });
+        roomLog.debug('Server sending chat_message from %s in room %s: %s', ws.id, ws.roomId, message);
+        broadcastToRoom(ws.roomId, chatMessage, ws);
+    } else if (msg.type === "history_request") {
+        // Older chat and dice lines, paged in as the client scrolls back
+        const room = rooms.get(ws.roomId);
+        if (!room) return;
+        // Sequence numbers are u32 (the binary encoding); JSON clients could send anything
+        const before = Math.trunc(Number(msg.before)) || 0;
+        const limit = Math.trunc(Number(msg.limit)) || 0;
+        if (before < 0 || before > 0xffffffff) {
+            msgLog.warn("Invalid history_request data received: %j", msg);
+            return;
+        }
+        const page = room.chatLog.page(before, limit);
+        send(ws, { type: "history", messages: page.messages, more: page.more });
+        roomLog.debug('Sent %d history line(s) before %d to %s', page.messages.length, before, ws.id);
+    } else if (msg.type === "viewport") {
+        const { x, y, width, height } = msg;
+        if (![x, y, width, height].every(Number.isFinite) || width <= 0 || height <= 0) {
+            msgLog.warn("Invalid viewport data received: %j", msg);
+            return;
+        }
+        // Only the map is of interest; a huge rectangle would otherwise have
+        // the spatial index walk a huge range of cells
+        const left = clamp(x, 0, MAP_EXTENT);
+        const top = clamp(y, 0, MAP_EXTENT);
+        ws.interest.setViewport(left, top, clamp(x + width, 0, MAP_EXTENT) - left, clamp(y + height, 0, MAP_EXTENT) - top);
+        const room = rooms.get(ws.roomId);
+        if (room) sendEnteredTokens(ws, room);
+    } else if (msg.type === "fog_runs") {
+        const room = rooms.get(ws.roomId);
+        if (!room) return;
+        const changed = room.fog.apply(msg.layer, msg.op, msg.runs);
+        if (changed === null) {
+            msgLog.warn("Invalid fog_runs data received from %s", ws.id);
+            return;
+        }
+        // Several clients may report the same reveal; only cells new to the room go out
+        if (changed.length > 0) {
+            broadcastToRoom(room.id, { type: "fog_runs", layer: msg.layer, op: msg.op, runs: changed }, ws);
+            if (store) store.fogChanged(room.id, msg.layer, msg.op, changed);
+        }
+        fogLog.debug('Client %s sent %d %s run(s), %d changed', ws.id, msg.runs.length / 3,
+            msg.layer === FOG_LAYER.WALLS ? 'wall' : 'reveal', changed.length / 3);
+    } else if (msg.type === "ping") {
+        send(ws, { type: "pong" });
+    } else {
+        msgLog.warn("Unknown message type received: %s", msg.type);
+    }
+}
+
+// Cuts a message to MAX_CHAT_BYTES at a character boundary, before it is
+// logged, persisted and broadcast
+function truncateChat(message) {
+    if (Buffer.byteLength(message) <= MAX_CHAT_BYTES) return message;
+    const buf = Buffer.allocUnsafe(MAX_CHAT_BYTES);
+    return buf.toString('utf8', 0, buf.write(message, 0, MAX_CHAT_BYTES, 'utf8'));
+}
+
+// Adds a chat or dice line to its room's history, which numbers it (seq)
+function logChat(roomId, msg) {
+    const room = rooms.get(roomId);
+    if (!room) return msg;
+    room.chatLog.push(msg);
+    if (store) store.chatLogged(roomId, msg);
+    return msg;
+}
+
+// Sends the current positions of stale tokens that came into a client's area
+// of interest after it moved its viewport
+function sendEnteredTokens(ws, room) {
+    const entered = ws.interest.refresh(room.state.index);
+    if (entered.length === 0) return;
+    const tokens = entered.map(id => {
+        const t = room.state.tokens.get(id);
+        return { id, x: t.x, y: t.y, final: true };
+    });
+    const complete = ws.interest.complete;
+    send(ws, { type: "update_tokens", epoch: room.state.epoch, revision: complete ? room.state.revision : undefined, tokens });
+}
+
+// Sends each dirty room one batched update frame. Every client gets the moves
+// inside its area of interest (see interest.js), except its own moves so its
+// local drag is not overwritten. Clients that end up with the same moves
+// share one serialized frame. Every batch is one revision of the room state;
+// clients missing updates outside their area are not told the revision.
+function flushRoom(room) {
+    const started = performance.now();
+    // Room.queueMove() only takes moves of the room's tokens, so commit()
+    // accepts them all and the batch is exactly the committed revision
+    const moves = room.takePendingMoves();
+    const previousRevision = room.state.revision;
+    const revision = room.state.commit(moves);
+    if (revision === previousRevision) return;
+    const epoch = room.state.epoch;
+    const frames = new Map(); // included move indices + encoding -> batch and its serialized frame
+    let sent = 0;
+    let frameCount = 0;
+    let frameBytes = 0;
+    room.clients.forEach(client => {
+        if (client.readyState !== WebSocket.OPEN) return;
+        const included = [];
+        for (let i = 0; i < moves.length; i++) {
+            const move = moves[i];
+            if (move.sender_id !== client.id && client.interest.admits(move.id, move.x, move.y)) included.push(i);
+        }
+        if (included.length === 0) return;
+        const complete = client.interest.complete;
+        const key = `${client.binary ? 'b' : 'j'}${complete ? 'r' : ''}:${included.length === moves.length ? '*' : included.join(',')}`;
+        let entry = frames.get(key);
+        if (!entry) {
+            entry = { batch: { type: "update_tokens", epoch, revision: complete ? revision : undefined, tokens: included.map(i => moves[i]) }, frame: null };
+            frames.set(key, entry);
+        }
+        // Clients that are behind collapse the batch into their pending one instead
+        const binary = client.binary;
+        if (client.outbound.sendTokens(entry.batch, () => entry.frame || (entry.frame = binary ? protocol.encode(entry.batch) : JSON.stringify(entry.batch)))) {
+            frameCount++;
+            frameBytes += entry.frame.length;
+        }
+        sent += included.length;
+    });
+    const m = roomMetrics(room);
+    m.messagesOut.inc(frameCount);
+    m.bytesOut.inc(frameBytes);
+    m.broadcastSeconds.observe((performance.now() - started) / 1000);
+    tickLog.debug('Server broadcast %d token update(s) in room %s (revision %d), %d delivered', moves.length, room.id, revision, sent);
+    // After the broadcast; the store only queues the changes commit() recorded
+    if (store) store.tokensCommitted(room, revision, room.state.lastChanges);
+}
+
+const tickInterval = setInterval(() => {
+    for (const room of rooms.takeDirty()) {
+        flushRoom(room);
+    }
+    flushAll(); // Clients that fell behind get what their sockets have room for
+}, 1000 / TICK_RATE_HZ);
+
 // Heartbeat interval
 const interval = setInterval(() => {
     wss.clients.forEach(ws => {
         if (ws.isAlive === false) {
-            console.log(`Client ${ws.id} timed out. Terminating connection.`);
+            netLog.info('Client %s timed out. Terminating connection.', ws.id);
             return ws.terminate();
         }
         ws.isAlive = false;
@@ -212,7 +650,50 @@ const interval = setInterval(() => {
 
 wss.on('close', () => {
     clearInterval(interval);
-    console.log('WebSocket server closed.');
+    clearInterval(tickInterval);
+    netLog.info('WebSocket server closed.');
 });
 
-console.log('WebSocket server started on port 8080');
+// Writes out what the room log still holds before exiting
+function shutdown() {
+    if (!store) process.exit(0);
+    store.close(() => process.exit(0));
+}
+process.on('SIGINT', shutdown);
+process.on('SIGTERM', shutdown);
+
+if (SHARDED) {
+    // The router sends each upgrade request it routed here along with its socket
+    process.on('message', (msg, socket) => {
+        if (!msg || msg.type !== 'upgrade' || !socket) return;
+        const req = { method: msg.req.method, url: msg.req.url, headers: msg.req.headers, socket };
+        wss.handleUpgrade(req, socket, Buffer.from(msg.head, 'base64'), ws => wss.emit('connection', ws, req));
+        socket.resume();
+    });
+
+    // Rooms and their client counts for the router's room directory,
+    // reported when they change
+    let lastPresence = '';
+    setInterval(() => {
+        const counts = {};
+        for (const room of rooms.values()) {
+            counts[room.id] = room.clients.size + room.parked;
+        }
+        const presence = JSON.stringify(counts);
+        if (presence !== lastPresence) {
+            lastPresence = presence;
+            process.send({ type: 'presence', rooms: counts, clients: wss.clients.size });
+        }
+    }, 1000).unref();
+
+    // The router's /metrics asks every shard for its series
+    process.on('message', msg => {
+        if (msg && msg.type === 'metrics') process.send({ type: 'metrics', id: msg.id, families: registry.collect() });
+    });
+
+    process.on('disconnect', () => shutdown()); // Router is gone
+    netLog.info('Shard %d/%d started', SHARD_INDEX, SHARD_COUNT);
+} else {
+    metrics.serveMetrics(metrics.metricsPort(), done => done(registry.collect()), metricsLog);
+    netLog.info('WebSocket server started on port %d', PORT);
+}
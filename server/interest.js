@@ -0,0 +1,93 @@
+// Area of interest of one connection.
+//
+// Clients report the world rectangle they are looking at. Token updates are
+// only sent to a client when the token is near that rectangle, with
+// hysteresis so a token moving along the edge does not flicker in and out:
+// a token enters the area inside the viewport grown by ENTER_MARGIN and only
+// leaves once it is outside the viewport grown by the larger LEAVE_MARGIN.
+// Both margins are fractions of the viewport size.
+//
+// Updates that are filtered out leave the client with an outdated position,
+// so those tokens are remembered as stale. When the viewport moves over a
+// stale token, its current position is sent. While anything is stale the
+// client's state is incomplete, so it is not given new room revisions (it
+// would claim them when reconnecting and get a delta that skips the tokens
+// it never received).
+// Clients that never report a viewport receive every update.
+
+const ENTER_MARGIN = Number(process.env.RAYVTT_AOI_ENTER_MARGIN) || 0.25;
+const LEAVE_MARGIN = Number(process.env.RAYVTT_AOI_LEAVE_MARGIN) || 0.5;
+
+function grow(view, margin) {
+    const dx = view.width * margin;
+    const dy = view.height * margin;
+    return { x: view.x - dx, y: view.y - dy, width: view.width + dx * 2, height: view.height + dy * 2 };
+}
+
+function contains(rect, x, y) {
+    return x >= rect.x && x <= rect.x + rect.width && y >= rect.y && y <= rect.y + rect.height;
+}
+
+class Interest {
+    constructor() {
+        this.enter = null;        // Rectangles derived from the viewport, null until one is reported
+        this.leave = null;
+        this.inside = new Set();  // Token ids currently in the area
+        this.stale = new Set();   // Token ids whose last update the client did not get
+    }
+
+    get filtering() {
+        return this.enter !== null;
+    }
+
+    // True when the client holds every token's latest position
+    get complete() {
+        return this.stale.size === 0;
+    }
+
+    setViewport(x, y, width, height) {
+        const view = { x, y, width, height };
+        this.enter = grow(view, ENTER_MARGIN);
+        this.leave = grow(view, LEAVE_MARGIN);
+    }
+
+    // Decides whether an update of token `id` to (x, y) goes to this client
+    admits(id, x, y) {
+        if (!this.filtering) return true;
+        if (contains(this.enter, x, y) || (this.inside.has(id) && contains(this.leave, x, y))) {
+            this.inside.add(id);
+            this.stale.delete(id);
+            return true;
+        }
+        this.inside.delete(id);
+        this.stale.add(id);
+        return false;
+    }
+
+    // The client was just brought up to date with a full sync
+    synced(index) {
+        this.stale.clear();
+        this.inside.clear();
+        if (this.filtering) index.query(this.enter.x, this.enter.y, this.enter.width, this.enter.height).forEach(id => this.inside.add(id));
+    }
+
+    // Re-evaluates the area after a viewport change and returns the stale
+    // tokens that came into it, whose positions the client now needs
+    refresh(index) {
+        for (const id of this.stale) {
+            if (!index.positions.has(id)) this.stale.delete(id); // Not room state, nothing to resend
+        }
+        for (const id of this.inside) {
+            const p = index.positions.get(id);
+            if (!p || !contains(this.leave, p.x, p.y)) this.inside.delete(id);
+        }
+        const entered = [];
+        for (const id of index.query(this.enter.x, this.enter.y, this.enter.width, this.enter.height)) {
+            this.inside.add(id);
+            if (this.stale.delete(id)) entered.push(id);
+        }
+        return entered;
+    }
+}
+
+module.exports = { Interest };
@@ -0,0 +1,177 @@
+// Leveled, sampled, buffered logging.
+//
+// Log calls only record their format string and arguments into a
+// preallocated ring; formatting and writing happen later, in batches, from a
+// timer. A call below the configured level returns after one comparison, so
+// per-message debug logging costs nothing in production. Pass primitives (or
+// objects that are no longer mutated) as arguments, since they are formatted
+// at flush time, and prefer format strings over template literals on hot paths
+// so disabled calls do not build strings.
+//
+// Configuration (environment):
+//   RAYVTT_LOG_LEVEL   error | warn | info | debug        (default info)
+//   RAYVTT_LOG_SAMPLE  per-category sampling for info and debug entries,
+//                      e.g. "msg=100,tick=20" keeps 1 in 100 / 1 in 20
+//   RAYVTT_LOG_FILE    append to this file instead of stdout
+//
+// Errors and warnings are never sampled. If the ring fills up before a flush,
+// new entries are dropped and the count is reported with the next batch.
+
+const fs = require('fs');
+const util = require('util');
+
+const LEVELS = { error: 0, warn: 1, info: 2, debug: 3 };
+const LEVEL_NAMES = ['ERROR', 'WARN', 'INFO', 'DEBUG'];
+
+const RING_CAPACITY = 8192;
+const FLUSH_INTERVAL_MS = 50;
+const MAX_ARGS = 4;
+
+function parseSampling(spec) {
+    const rates = new Map();
+    for (const part of (spec || '').split(',')) {
+        const [name, every] = part.split('=');
+        const n = Math.floor(Number(every));
+        if (name && n > 1) rates.set(name.trim(), n);
+    }
+    return rates;
+}
+
+const config = {
+    level: LEVELS[process.env.RAYVTT_LOG_LEVEL] ?? LEVELS.info,
+    sampling: parseSampling(process.env.RAYVTT_LOG_SAMPLE),
+};
+
+// Ring storage, one slot per entry
+const ring = {
+    time: new Float64Array(RING_CAPACITY),
+    level: new Uint8Array(RING_CAPACITY),
+    category: new Array(RING_CAPACITY).fill(null),
+    format: new Array(RING_CAPACITY).fill(null),
+    args: Array.from({ length: MAX_ARGS }, () => new Array(RING_CAPACITY).fill(undefined)),
+    argCount: new Uint8Array(RING_CAPACITY),
+    head: 0,   // next slot to write
+    count: 0,  // entries waiting for a flush
+    dropped: 0,
+};
+
+const output = process.env.RAYVTT_LOG_FILE
+    ? fs.createWriteStream(process.env.RAYVTT_LOG_FILE, { flags: 'a' })
+    : process.stdout;
+
+let flushTimer = null;
+
+function record(level, category, format, argCount, a0, a1, a2, a3) {
+    if (ring.count === RING_CAPACITY) {
+        ring.dropped++;
+        return;
+    }
+    const i = ring.head;
+    ring.time[i] = Date.now();
+    ring.level[i] = level;
+    ring.category[i] = category;
+    ring.format[i] = format;
+    ring.argCount[i] = argCount;
+    ring.args[0][i] = a0;
+    ring.args[1][i] = a1;
+    ring.args[2][i] = a2;
+    ring.args[3][i] = a3;
+    ring.head = (i + 1) % RING_CAPACITY;
+    ring.count++;
+
+    if (flushTimer === null) {
+        flushTimer = setTimeout(flush, FLUSH_INTERVAL_MS);
+        flushTimer.unref();
+    }
+}
+
+// Formats everything buffered and hands it to the output in one write
+function formatPending() {
+    const lines = [];
+    let i = (ring.head - ring.count + RING_CAPACITY) % RING_CAPACITY;
+    for (let n = 0; n < ring.count; n++) {
+        const argCount = ring.argCount[i];
+        const args = [];
+        for (let a = 0; a < argCount; a++) {
+            args.push(ring.args[a][i]);
+            ring.args[a][i] = undefined; // Do not keep logged objects alive
+        }
+        lines.push(`${new Date(ring.time[i]).toISOString()} ${LEVEL_NAMES[ring.level[i]]} [${ring.category[i]}] ` +
+            util.format(ring.format[i], ...args));
+        ring.format[i] = null;
+        i = (i + 1) % RING_CAPACITY;
+    }
+    ring.count = 0;
+    if (ring.dropped > 0) {
+        lines.push(`${new Date().toISOString()} WARN [log] ${ring.dropped} log entries dropped (ring full)`);
+        ring.dropped = 0;
+    }
+    return lines.length > 0 ? lines.join('\n') + '\n' : '';
+}
+
+function flush() {
+    flushTimer = null;
+    const text = formatPending();
+    if (text) output.write(text);
+}
+
+// For process exit, when timers will not run again
+function flushSync() {
+    if (flushTimer !== null) {
+        clearTimeout(flushTimer);
+        flushTimer = null;
+    }
+    const text = formatPending();
+    if (!text) return;
+    if (output === process.stdout) {
+        fs.writeSync(1, text);
+    } else {
+        output.end(text);
+    }
+}
+
+process.on('exit', flushSync);
+
+function argCount(args) {
+    return Math.min(args.length - 1, MAX_ARGS);
+}
+
+class Logger {
+    constructor(category) {
+        this.category = category;
+        this.sampleEvery = config.sampling.get(category) || 1;
+        this.sampleCounter = 0;
+        this.tag = this.sampleEvery > 1 ? `${category} 1/${this.sampleEvery}` : category;
+    }
+
+    // True if a call at this level would be recorded; use it to skip
+    // expensive argument preparation
+    enabled(level) {
+        return LEVELS[level] <= config.level;
+    }
+
+    log(level, format, argCount, a0, a1, a2, a3) {
+        if (level > config.level) return;
+        if (level >= LEVELS.info && this.sampleEvery > 1 && this.sampleCounter++ % this.sampleEvery !== 0) return;
+        record(level, this.tag, format, argCount, a0, a1, a2, a3);
+    }
+
+    error(format, a0, a1, a2, a3) { this.log(LEVELS.error, format, argCount(arguments), a0, a1, a2, a3); }
+    warn(format, a0, a1, a2, a3) { this.log(LEVELS.warn, format, argCount(arguments), a0, a1, a2, a3); }
+    info(format, a0, a1, a2, a3) { this.log(LEVELS.info, format, argCount(arguments), a0, a1, a2, a3); }
+    debug(format, a0, a1, a2, a3) { this.log(LEVELS.debug, format, argCount(arguments), a0, a1, a2, a3); }
+}
+
+const loggers = new Map();
+
+// One shared logger per category
+function getLogger(category) {
+    let logger = loggers.get(category);
+    if (!logger) {
+        logger = new Logger(category);
+        loggers.set(category, logger);
+    }
+    return logger;
+}
+
+module.exports = { getLogger, flush, flushSync, LEVELS };
@@ -0,0 +1,245 @@
+// Server metrics, served in the Prometheus text format.
+//
+// Counters, gauges and histograms are plain numbers and typed arrays that the
+// hot path updates in place; nothing is formatted or allocated until a scrape.
+// A metric may have one label (the room). Its children are created on first
+// use and removed with the room, so a long-running server does not keep
+// series for rooms that are gone.
+//
+// A scrape first collects every family into plain objects (collect()). The
+// router merges these from all shards before they are formatted (render()).
+//
+//   RAYVTT_METRICS_PORT  local port of GET /metrics (default 9464, empty: off)
+
+const http = require('http');
+const { performance } = require('perf_hooks');
+
+const DEFAULT_PORT = 9464;
+
+// Seconds, from 100 us to 2.5 s
+const LATENCY_BUCKETS = [0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5];
+
+class Counter {
+    constructor() {
+        this.value = 0;
+    }
+
+    inc(n = 1) {
+        this.value += n;
+    }
+}
+
+class Gauge {
+    constructor() {
+        this.value = 0;
+    }
+
+    set(value) {
+        this.value = value;
+    }
+}
+
+class Histogram {
+    constructor(bounds) {
+        this.bounds = bounds;
+        this.counts = new Float64Array(bounds.length + 1); // Last is +Inf
+        this.sum = 0;
+        this.count = 0;
+    }
+
+    observe(value) {
+        const bounds = this.bounds;
+        let i = 0;
+        while (i < bounds.length && value > bounds[i]) i++;
+        this.counts[i]++;
+        this.sum += value;
+        this.count++;
+    }
+}
+
+// All series of one metric name
+class Family {
+    constructor(name, help, type, label, make, read) {
+        this.name = name;
+        this.help = help;
+        this.type = type;
+        this.label = label;   // Label name, or null for a single series
+        this.make = make;
+        this.read = read;     // Computes the value at scrape time
+        this.children = new Map();
+    }
+
+    labels(value) {
+        let child = this.children.get(value);
+        if (!child) {
+            child = this.make();
+            this.children.set(value, child);
+        }
+        return child;
+    }
+
+    remove(value) {
+        this.children.delete(value);
+    }
+
+    collect(constLabels) {
+        const samples = [];
+        if (this.read) this.labels(null).value = this.read();
+        for (const [value, child] of this.children) {
+            const labels = this.label ? { ...constLabels, [this.label]: value } : constLabels;
+            if (this.type === 'histogram') {
+                let cumulative = 0;
+                for (let i = 0; i < child.counts.length; i++) {
+                    cumulative += child.counts[i];
+                    const le = i < child.bounds.length ? String(child.bounds[i]) : '+Inf';
+                    samples.push({ suffix: '_bucket', labels: { ...labels, le }, value: cumulative });
+                }
+                samples.push({ suffix: '_sum', labels, value: child.sum });
+                samples.push({ suffix: '_count', labels, value: child.count });
+            } else {
+                samples.push({ suffix: '', labels, value: child.value });
+            }
+        }
+        return { name: this.name, help: this.help, type: this.type, samples };
+    }
+}
+
+class Registry {
+    // constLabels are added to every series (the shard, when sharded)
+    constructor(constLabels = {}) {
+        this.constLabels = constLabels;
+        this.families = [];
+    }
+
+    add(name, help, type, options, make) {
+        const family = new Family(name, help, type, options.label || null, make, options.read || null);
+        this.families.push(family);
+        // Unlabeled metrics are used directly rather than through labels()
+        return family.label ? family : family.labels(null);
+    }
+
+    // options.read, here and for gauges, makes the value computed at scrape
+    // time, for totals kept by code that does not know about metrics
+    counter(name, help, options = {}) {
+        return this.add(name, help, 'counter', options, () => new Counter());
+    }
+
+    gauge(name, help, options = {}) {
+        return this.add(name, help, 'gauge', options, () => new Gauge());
+    }
+
+    histogram(name, help, options = {}) {
+        const bounds = options.buckets || LATENCY_BUCKETS;
+        return this.add(name, help, 'histogram', options, () => new Histogram(bounds));
+    }
+
+    // Drops the series of one label value (a deleted room) from every family
+    removeLabel(value) {
+        for (const family of this.families) {
+            if (family.label) family.remove(value);
+        }
+    }
+
+    collect() {
+        return this.families.map(family => family.collect(this.constLabels));
+    }
+}
+
+// Joins the families of several registries (shards); series of the same
+// name are kept apart by their labels
+function merge(lists) {
+    const byName = new Map();
+    for (const families of lists) {
+        for (const family of families) {
+            const existing = byName.get(family.name);
+            if (existing) {
+                existing.samples.push(...family.samples);
+            } else {
+                byName.set(family.name, { ...family, samples: [...family.samples] });
+            }
+        }
+    }
+    return Array.from(byName.values());
+}
+
+function escapeLabel(value) {
+    return String(value).replace(/\\/g, '\\\\').replace(/"/g, '\\"').replace(/\n/g, '\\n');
+}
+
+function formatValue(value) {
+    if (value === Infinity) return '+Inf';
+    if (value === -Infinity) return '-Inf';
+    return Number.isNaN(value) ? 'NaN' : String(value);
+}
+
+function render(families) {
+    const lines = [];
+    for (const family of families) {
+        lines.push(`# HELP ${family.name} ${family.help}`);
+        lines.push(`# TYPE ${family.name} ${family.type}`);
+        for (const sample of family.samples) {
+            const names = Object.keys(sample.labels);
+            const labels = names.length > 0
+                ? `{${names.map(name => `${name}="${escapeLabel(sample.labels[name])}"`).join(',')}}`
+                : '';
+            lines.push(`${family.name}${sample.suffix}${labels} ${formatValue(sample.value)}`);
+        }
+    }
+    return lines.join('\n') + '\n';
+}
+
+// Event loop lag: how late a timer of `intervalMs` fires. Sampling is a
+// single unref'd timer, so it costs nothing measurable.
+function trackEventLoopLag(histogram, intervalMs = 50) {
+    let expected = performance.now() + intervalMs;
+    const timer = setInterval(() => {
+        const now = performance.now();
+        histogram.observe(Math.max(0, now - expected) / 1000);
+        expected = now + intervalMs;
+    }, intervalMs);
+    timer.unref();
+    return timer;
+}
+
+// Process CPU and memory, read at scrape time
+function addProcessMetrics(registry) {
+    registry.gauge('process_resident_memory_bytes', 'Resident set size in bytes', { read: () => process.memoryUsage.rss() });
+    registry.gauge('process_cpu_seconds_total', 'User and system CPU time in seconds', {
+        read: () => {
+            const usage = process.cpuUsage();
+            return (usage.user + usage.system) / 1e6;
+        },
+    });
+}
+
+// Serves GET /metrics on 127.0.0.1. `families(callback)` produces the
+// families to render, possibly asynchronously. Returns null when disabled.
+function serveMetrics(port, families, log) {
+    if (!port) return null;
+    const server = http.createServer((req, res) => {
+        if (req.method !== 'GET' || req.url.split('?')[0] !== '/metrics') {
+            res.writeHead(404, { 'Content-Type': 'text/plain' });
+            res.end('Not found\n');
+            return;
+        }
+        families(list => {
+            const body = render(list);
+            res.writeHead(200, { 'Content-Type': 'text/plain; version=0.0.4', 'Content-Length': Buffer.byteLength(body) });
+            res.end(body);
+        });
+    });
+    // Another server on the same machine may already have the port; the
+    // game server keeps running without metrics then
+    server.on('error', error => log.warn('Metrics endpoint disabled: %s', error.message));
+    server.listen(port, '127.0.0.1', () => log.info('Metrics on http://127.0.0.1:%d/metrics', port));
+    server.unref();
+    return server;
+}
+
+function metricsPort() {
+    const value = process.env.RAYVTT_METRICS_PORT;
+    if (value === undefined) return DEFAULT_PORT;
+    return Number(value) || 0;
+}
+
+module.exports = { Registry, merge, render, trackEventLoopLag, addProcessMetrics, serveMetrics, metricsPort, LATENCY_BUCKETS };
@@ -0,0 +1,208 @@
+// Outbound backpressure for one client connection.
+//
+// Frames go straight to the socket while its bufferedAmount (bytes the kernel
+// has not taken yet) stays under the high watermark. Past it the client is
+// behind: frames wait in a queue here, and token updates, which only matter
+// as the latest position, are collapsed into one pending batch per token
+// instead of queued. The queue is drained on every tick once the socket is
+// back under the low watermark.
+//
+// A client that stays behind is cut off from the stream: when its queue
+// outgrows the byte limit, or it has been behind for longer than the stall
+// limit, everything queued is dropped and it gets a snapshot resync once it
+// has caught up. A client that needs more than one resync within the resync
+// window is disconnected; its session is parked like any other dropped
+// connection. Memory per client is bounded by the limit either way.
+//
+//   RAYVTT_OUT_HIGH_BYTES   high watermark (default 512 KB)
+//   RAYVTT_OUT_LOW_BYTES    low watermark (default 128 KB)
+//   RAYVTT_OUT_LIMIT_BYTES  queued bytes before a resync (default 4 MB)
+//   RAYVTT_OUT_STALL_MS     time behind before a resync (default 15000)
+
+const HIGH_WATERMARK = Number(process.env.RAYVTT_OUT_HIGH_BYTES) || 512 * 1024;
+const LOW_WATERMARK = Number(process.env.RAYVTT_OUT_LOW_BYTES) || 128 * 1024;
+const LIMIT_BYTES = Number(process.env.RAYVTT_OUT_LIMIT_BYTES) || 4 * 1024 * 1024;
+const STALL_MS = Number(process.env.RAYVTT_OUT_STALL_MS) || 15000;
+const RESYNC_WINDOW_MS = 60000;
+
+// Totals over all connections, for metrics
+const stats = {
+    queuedBytes: 0,
+    congested: 0,     // Times a connection went over the high watermark
+    collapsed: 0,     // Token updates replaced by a newer one before they were sent
+    resyncs: 0,
+    disconnects: 0,
+};
+
+// Connections with anything queued or a resync pending; flushAll() drains them
+const backlogged = new Set();
+
+class Outbound {
+    // encode(msg) serializes for this client; onResync() is called once it
+    // has caught up after its queue was dropped
+    constructor(ws, encode, onResync) {
+        this.ws = ws;
+        this.encode = encode;
+        this.onResync = onResync;
+        this.queue = [];          // Frames in order
+        this.queuedBytes = 0;
+        this.tokens = null;       // Collapsed update_tokens batch waiting behind the queue
+        this.behindSince = 0;     // When the client went over the high watermark, 0 if it is not behind
+        this.resyncPending = false;
+        this.lastResync = -Infinity;
+        this.closed = false;      // Disconnected for staying behind
+    }
+
+    get backlogged() {
+        return this.queue.length > 0 || this.tokens !== null || this.resyncPending;
+    }
+
+    // Sends or queues a frame. Returns whether it went out now.
+    send(frame) {
+        if (this.resyncPending || this.closed) return false; // Replaced by the snapshot, or gone
+        if (!this.backlogged && !this.behind()) {
+            this.ws.send(frame);
+            return true;
+        }
+        this.flushTokens(); // Keep the order
+        this.push(frame);
+        this.checkLimits();
+        return false;
+    }
+
+    // Sends or collapses an update_tokens batch. `frame()` returns it
+    // serialized, so clients can share one frame. Returns whether it went out now.
+    sendTokens(update, frame) {
+        if (this.resyncPending || this.closed) return false;
+        if (!this.backlogged && !this.behind()) {
+            this.ws.send(frame());
+            return true;
+        }
+        const { epoch, revision, tokens: moves } = update;
+        if (this.tokens === null || this.tokens.epoch !== epoch) {
+            this.flushTokens();
+            this.tokens = { epoch, revision, complete: true, moves: new Map() };
+        }
+        const batch = this.tokens;
+        // The client may only be told the revision if every collapsed batch told it one
+        batch.complete = batch.complete && revision !== undefined;
+        batch.revision = revision;
+        for (const move of moves) {
+            if (batch.moves.has(move.id)) stats.collapsed++;
+            batch.moves.set(move.id, move);
+        }
+        this.checkLimits();
+        return false;
+    }
+
+    // Sends what the socket has room for. Called every tick while backlogged.
+    flush() {
+        const ws = this.ws;
+        if (this.behindSince > 0 && ws.bufferedAmount > LOW_WATERMARK) {
+            this.checkLimits();
+            return;
+        }
+        this.behindSince = 0;
+        if (this.resyncPending) {
+            this.resyncPending = false;
+            this.recount();
+            this.onResync();
+            return;
+        }
+        while (this.queue.length > 0 && ws.bufferedAmount < HIGH_WATERMARK) {
+            const frame = this.queue.shift();
+            this.queuedBytes -= frame.length;
+            stats.queuedBytes -= frame.length;
+            ws.send(frame);
+        }
+        if (this.queue.length === 0 && this.tokens !== null && ws.bufferedAmount < HIGH_WATERMARK) {
+            ws.send(this.takeTokens());
+        }
+        if (this.backlogged) this.behind();
+        this.recount();
+    }
+
+    // Forgets everything queued, when the connection closes
+    discard() {
+        this.clear();
+        this.resyncPending = false;
+        this.recount();
+    }
+
+    // Whether the socket is over the high watermark; starts the stall clock if so
+    behind() {
+        if (this.ws.bufferedAmount < HIGH_WATERMARK && this.behindSince === 0) return false;
+        if (this.behindSince === 0) {
+            this.behindSince = Date.now();
+            stats.congested++;
+        }
+        return true;
+    }
+
+    push(frame) {
+        this.queue.push(frame);
+        this.queuedBytes += frame.length;
+        stats.queuedBytes += frame.length;
+    }
+
+    // The collapsed token batch as one frame
+    takeTokens() {
+        const batch = this.tokens;
+        this.tokens = null;
+        return this.encode({ type: "update_tokens", epoch: batch.epoch, revision: batch.complete ? batch.revision : undefined,
+            tokens: Array.from(batch.moves.values()) });
+    }
+
+    // The collapsed token batch goes into the queue, before a frame that follows it
+    flushTokens() {
+        if (this.tokens !== null) this.push(this.takeTokens());
+    }
+
+    clear() {
+        stats.queuedBytes -= this.queuedBytes;
+        this.queue = [];
+        this.queuedBytes = 0;
+        this.tokens = null;
+    }
+
+    recount() {
+        if (this.backlogged) {
+            backlogged.add(this);
+        } else {
+            backlogged.delete(this);
+        }
+    }
+
+    // Drops the queue for a snapshot resync, or the connection if it had one
+    // recently or does not catch up for the resync either
+    checkLimits() {
+        const now = Date.now();
+        const collapsedBytes = this.tokens ? this.tokens.moves.size * 32 : 0; // Roughly, as encoded
+        const stalled = this.behindSince > 0 && now - this.behindSince > STALL_MS;
+        if (stalled || this.queuedBytes + collapsedBytes > LIMIT_BYTES) {
+            this.clear();
+            if (this.resyncPending || now - this.lastResync < RESYNC_WINDOW_MS) {
+                this.resyncPending = false;
+                this.closed = true;
+                stats.disconnects++;
+                this.recount();
+                this.ws.terminate();
+                return;
+            }
+            this.lastResync = now;
+            this.resyncPending = true;
+            this.behindSince = now; // The stall limit starts over for the resync
+            stats.resyncs++;
+        }
+        this.recount();
+    }
+}
+
+// Drains every backlogged connection; called once per tick
+function flushAll() {
+    for (const outbound of backlogged) {
+        outbound.flush();
+    }
+}
+
+module.exports = { Outbound, flushAll, backlogged, stats };
@@ -0,0 +1,110 @@
+// Movement rules for token drags, the server side of client/pathfind.c.
+//
+// When a drag ends, the token must be able to walk from the cell it was picked
+// up on to the cell it was dropped on for at most MOVE_RANGE: a straight step
+// costs 2, a diagonal one 3, and walls and other tokens block the way and the
+// corners of diagonal steps. The client draws its range with the same rules
+// and moves a token back itself when it is dropped out of reach, so a
+// rejected move means a client that disagrees with the room, not a user error.
+//
+// A check only looks at the window of cells within range of the origin and
+// stops as soon as it reaches the target, so it is a few hundred cell visits
+// at most and needs no caching.
+
+const { FOG_LAYER, FOG_MAX_SIZE } = require('./fog');
+
+const GRID_SIZE = 50;          // World units per cell, matches gridSize in client/main.c
+const COST_STRAIGHT = 2;
+const COST_DIAGONAL = 3;
+const MOVE_RANGE = 24;         // Matches PATH_MOVE_RANGE in client/pathfind.h
+const RADIUS = Math.floor(MOVE_RANGE / COST_STRAIGHT);
+const SIDE = RADIUS * 2 + 1;
+const UNREACHED = 0xffff;
+
+// Straight directions first, like the client
+const DIRECTIONS = [[1, 0], [-1, 0], [0, 1], [0, -1], [1, 1], [-1, 1], [1, -1], [-1, -1]];
+
+// Scratch space for one check at a time
+const cost = new Uint16Array(SIDE * SIDE);
+const blocked = new Uint8Array(SIDE * SIDE);
+const buckets = [0, 1, 2, 3].map(() => new Int32Array(SIDE * SIDE));
+const bucketSize = new Int32Array(4);
+const nearby = [];
+
+// Cell under the centre of a token whose top-left corner is at v
+function cellOf(v) {
+    return Math.floor((v + GRID_SIZE / 2) / GRID_SIZE);
+}
+
+// Marks walls, cells off the map and cells holding other tokens in the window around (ox, oy)
+function markBlocked(room, id, ox, oy) {
+    const walls = room.fog.layers[FOG_LAYER.WALLS];
+    for (let y = 0; y < SIDE; y++) {
+        const gy = oy - RADIUS + y;
+        for (let x = 0; x < SIDE; x++) {
+            const gx = ox - RADIUS + x;
+            blocked[y * SIDE + x] = gx < 0 || gy < 0 || gx >= FOG_MAX_SIZE || gy >= FOG_MAX_SIZE || walls.get(gy, gx);
+        }
+    }
+    nearby.length = 0;
+    const left = (ox - RADIUS) * GRID_SIZE - GRID_SIZE / 2;
+    const top = (oy - RADIUS) * GRID_SIZE - GRID_SIZE / 2;
+    room.state.index.query(left, top, SIDE * GRID_SIZE, SIDE * GRID_SIZE, nearby);
+    for (const other of nearby) {
+        if (other === id) continue;
+        const token = room.state.tokens.get(other);
+        const x = cellOf(token.x) - ox + RADIUS;
+        const y = cellOf(token.y) - oy + RADIUS;
+        if (x >= 0 && y >= 0 && x < SIDE && y < SIDE) blocked[y * SIDE + x] = 1;
+    }
+}
+
+// Whether token `id` can move from top-left position `from` to `to` in one drag
+function canReach(room, id, from, to) {
+    const ox = cellOf(from.x);
+    const oy = cellOf(from.y);
+    const tx = cellOf(to.x) - ox + RADIUS;
+    const ty = cellOf(to.y) - oy + RADIUS;
+    if (tx === RADIUS && ty === RADIUS) return true;
+    if (tx < 0 || ty < 0 || tx >= SIDE || ty >= SIDE) return false;
+
+    markBlocked(room, Number(id), ox, oy);
+    const target = ty * SIDE + tx;
+    if (blocked[target]) return false;
+
+    // Dial's algorithm over the window, as in client/pathfind.c
+    cost.fill(UNREACHED);
+    bucketSize.fill(0);
+    const origin = RADIUS * SIDE + RADIUS;
+    cost[origin] = 0;
+    buckets[0][bucketSize[0]++] = origin;
+    let queued = 1;
+    for (let current = 0; queued > 0 && current <= MOVE_RANGE; current++) {
+        const b = current & 3;
+        while (bucketSize[b] > 0) {
+            const cell = buckets[b][--bucketSize[b]];
+            queued--;
+            if (cost[cell] !== current) continue;
+            if (cell === target) return true;
+            const x = cell % SIDE;
+            const y = (cell - x) / SIDE;
+            for (let d = 0; d < 8; d++) {
+                const [dx, dy] = DIRECTIONS[d];
+                const nx = x + dx;
+                const ny = y + dy;
+                if (nx < 0 || ny < 0 || nx >= SIDE || ny >= SIDE) continue;
+                const next = ny * SIDE + nx;
+                if (blocked[next]) continue;
+                if (d >= 4 && (blocked[y * SIDE + nx] || blocked[ny * SIDE + x])) continue;
+                const nextCost = current + (d < 4 ? COST_STRAIGHT : COST_DIAGONAL);
+                if (nextCost > MOVE_RANGE || cost[next] <= nextCost) continue;
+                cost[next] = nextCost;
+                buckets[nextCost & 3][bucketSize[nextCost & 3]++] = next;
+                queued++;
+            }
+        }
+    }
+    return false;
+}
+
+module.exports = { canReach, GRID_SIZE, MOVE_RANGE };
@@ -0,0 +1,399 @@
+// Durable room state: an append-only log plus periodic snapshots.
+//
+// Every accepted mutation (room created or deleted, a tick's committed token
+// changes, fog cells that changed) is queued as a small record object. The
+// tick only pushes a reference to data it already built; records are
+// serialized, written and fsynced by a background flush every FSYNC_MS, in
+// one write and one fsync per batch. A crash loses at most the last batch.
+//
+// Records are JSON lines in numbered log segments (log-000007.ndjson):
+//
+//   { k: 'n', r: room, e: epoch }                      room created
+//   { k: 'd', r: room }                                room deleted
+//   { k: 't', r: room, v: revision, c: [id, x, y, ...] } token changes of one revision
+//   { k: 'f', r: room, l: layer, o: op, c: [row, start, length, ...] } fog cells that changed
+//   { k: 'c', r: room, m: message }                    chat or dice line (with its seq)
+//
+// A snapshot (snapshot-000008.ndjson) holds every room's epoch, revision,
+// tokens, fog bitsets and chat log as of the moment segment 8 was started, so recovery
+// loads the newest complete snapshot and replays only the segments from its
+// number on. Snapshots are taken every SNAPSHOT_INTERVAL_MS when anything
+// changed, or as soon as the current segment grows past SNAPSHOT_LOG_BYTES,
+// which bounds the log tail recovery has to replay. Older snapshots and
+// segments are deleted once a newer snapshot is durable.
+
+const fs = require('fs');
+const path = require('path');
+const { getLogger } = require('./logger');
+
+const FSYNC_MS = Number(process.env.RAYVTT_FSYNC_MS) || 100;
+const SNAPSHOT_INTERVAL_MS = Number(process.env.RAYVTT_SNAPSHOT_INTERVAL_MS) || 60 * 1000;
+const SNAPSHOT_LOG_BYTES = Number(process.env.RAYVTT_SNAPSHOT_LOG_BYTES) || 16 * 1024 * 1024;
+
+const log = getLogger('store');
+
+function segmentName(n) {
+    return `log-${String(n).padStart(6, '0')}.ndjson`;
+}
+
+function snapshotName(n) {
+    return `snapshot-${String(n).padStart(6, '0')}.ndjson`;
+}
+
+// Numbers of the files in `dir` named prefix-NNNNNN.ndjson, ascending
+function listNumbered(dir, prefix) {
+    const pattern = new RegExp(`^${prefix}-(\\d+)\\.ndjson$`);
+    return fs.readdirSync(dir)
+        .map(name => pattern.exec(name))
+        .filter(Boolean)
+        .map(match => Number(match[1]))
+        .sort((a, b) => a - b);
+}
+
+function syncDirectory(dir) {
+    const fd = fs.openSync(dir, 'r');
+    try {
+        fs.fsyncSync(fd);
+    } finally {
+        fs.closeSync(fd);
+    }
+}
+
+function flatTokens(changes) {
+    const flat = new Array(changes.length * 3);
+    for (let i = 0; i < changes.length; i++) {
+        flat[i * 3] = changes[i].id;
+        flat[i * 3 + 1] = changes[i].x;
+        flat[i * 3 + 2] = changes[i].y;
+    }
+    return flat;
+}
+
+function unflatTokens(flat) {
+    const tokens = [];
+    for (let i = 0; i + 2 < flat.length; i += 3) {
+        tokens.push({ id: flat[i], x: flat[i + 1], y: flat[i + 2] });
+    }
+    return tokens;
+}
+
+class RoomStore {
+    // rooms is the RoomRegistry whose state is persisted
+    constructor(dir, rooms) {
+        this.dir = dir;
+        this.rooms = rooms;
+        this.pending = [];          // Records and segment switches not written yet
+        this.segment = 0;           // Newest segment number handed out
+        this.writeSegment = 0;      // Segment the first pending record belongs to
+        this.segmentBytes = 0;
+        this.fd = null;             // Open segment being appended to
+        this.fdSegment = 0;
+        this.prunedBelow = 0;       // Segments before this are covered by a durable snapshot
+        this.flushing = false;
+        this.retry = null;          // Parts a failed flush could not write
+        this.snapshotting = false;
+        this.changedSinceSnapshot = false;
+        this.timers = [];
+        this.stats = { records: 0, bytes: 0, fsyncs: 0, lastFsyncMs: 0, maxBatch: 0, snapshots: 0, lastSnapshotMs: 0 };
+    }
+
+    // --- recording, called on the hot path; only queues references ---
+
+    roomCreated(room) {
+        this.push({ k: 'n', r: room.id, e: room.state.epoch });
+    }
+
+    roomDeleted(roomId) {
+        this.push({ k: 'd', r: roomId });
+    }
+
+    // changes are the { id, x, y } objects RoomState.commit() recorded
+    tokensCommitted(room, revision, changes) {
+        this.push({ k: 't', r: room.id, v: revision, changes });
+    }
+
+    fogChanged(roomId, layer, op, runs) {
+        this.push({ k: 'f', r: roomId, l: layer, o: op, c: runs });
+    }
+
+    chatLogged(roomId, msg) {
+        this.push({ k: 'c', r: roomId, m: msg });
+    }
+
+    push(record) {
+        this.pending.push(record);
+        this.changedSinceSnapshot = true;
+    }
+
+    // --- recovery ---
+
+    // Rebuilds the registry from the newest complete snapshot and the log
+    // segments after it. Synchronous: runs once before the server accepts
+    // connections. Returns what was loaded and how long it took.
+    recover() {
+        const started = process.hrtime.bigint();
+        fs.mkdirSync(this.dir, { recursive: true });
+        const result = { rooms: 0, snapshot: null, segments: 0, records: 0, bytes: 0, skipped: 0, ms: 0 };
+
+        let firstSegment = 0;
+        const snapshots = listNumbered(this.dir, 'snapshot');
+        for (let i = snapshots.length - 1; i >= 0; i--) {
+            const loaded = this.loadSnapshot(snapshots[i]);
+            if (loaded) {
+                result.snapshot = snapshots[i];
+                result.bytes += loaded.bytes;
+                firstSegment = snapshots[i];
+                break;
+            }
+        }
+
+        const segments = listNumbered(this.dir, 'log').filter(n => n >= firstSegment);
+        for (const n of segments) {
+            const text = fs.readFileSync(path.join(this.dir, segmentName(n)), 'utf8');
+            result.bytes += text.length;
+            result.segments++;
+            for (const line of text.split('\n')) {
+                if (line.length === 0) continue;
+                let record;
+                try {
+                    record = JSON.parse(line);
+                } catch (e) {
+                    result.skipped++; // Torn write at the end of a segment
+                    continue;
+                }
+                this.replay(record);
+                result.records++;
+            }
+        }
+
+        for (const room of this.rooms.values()) room.state.reindex();
+
+        // Continue in a fresh segment; the restored state becomes the next snapshot
+        this.segment = Math.max(firstSegment, segments.length ? segments[segments.length - 1] : 0) + 1;
+        this.writeSegment = this.segment;
+        this.changedSinceSnapshot = result.records > 0;
+        result.rooms = this.rooms.rooms.size;
+        result.ms = Number(process.hrtime.bigint() - started) / 1e6;
+        return result;
+    }
+
+    // Loads a snapshot into the registry; null if it is incomplete or unreadable
+    loadSnapshot(n) {
+        let lines;
+        try {
+            lines = fs.readFileSync(path.join(this.dir, snapshotName(n)), 'utf8').split('\n');
+            const header = JSON.parse(lines[0]);
+            const footer = JSON.parse(lines[header.rooms + 1]);
+            if (!footer.end) return null;
+        } catch (e) {
+            log.warn('Ignoring unreadable snapshot %d: %s', n, e.message);
+            return null;
+        }
+        for (const id of Array.from(this.rooms.rooms.keys())) this.rooms.delete(id);
+        let bytes = 0;
+        for (let i = 1; i < lines.length - 1; i++) {
+            if (lines[i].length === 0) continue;
+            bytes += lines[i].length;
+            const saved = JSON.parse(lines[i]);
+            if (saved.end) break;
+            const room = this.rooms.getOrCreate(saved.r);
+            room.state.restore(saved.e, saved.v, unflatTokens(saved.t));
+            room.fog.load(saved.f);
+            room.chatLog.load(saved.c);
+        }
+        return { bytes };
+    }
+
+    replay(record) {
+        if (record.k === 'n') {
+            this.rooms.delete(record.r);
+            this.rooms.getOrCreate(record.r).state.restore(record.e, 0, []);
+        } else if (record.k === 'd') {
+            this.rooms.delete(record.r);
+        } else {
+            const room = this.rooms.get(record.r);
+            if (!room) return;
+            if (record.k === 't') {
+                room.state.replay(record.v, record.c);
+            } else if (record.k === 'f') {
+                room.fog.apply(record.l, record.o, record.c);
+            } else if (record.k === 'c') {
+                room.chatLog.replay(record.m);
+            }
+        }
+    }
+
+    // --- writing ---
+
+    start() {
+        this.timers.push(setInterval(() => this.flush(), FSYNC_MS));
+        this.timers.push(setInterval(() => {
+            if (this.changedSinceSnapshot) this.snapshot();
+        }, SNAPSHOT_INTERVAL_MS));
+        this.timers.forEach(timer => timer.unref());
+        if (this.changedSinceSnapshot) this.snapshot();
+    }
+
+    serialize(record) {
+        if (record.k === 't') {
+            return JSON.stringify({ k: 't', r: record.r, v: record.v, c: flatTokens(record.changes) });
+        }
+        return JSON.stringify(record);
+    }
+
+    openSegment(n) {
+        if (this.fd !== null) {
+            fs.closeSync(this.fd);
+            // Left open while a snapshot made it unnecessary
+            if (this.fdSegment < this.prunedBelow) fs.unlinkSync(path.join(this.dir, segmentName(this.fdSegment)));
+        }
+        this.fd = fs.openSync(path.join(this.dir, segmentName(n)), 'a');
+        this.fdSegment = n;
+        syncDirectory(this.dir);
+    }
+
+    // Takes the queued records as serialized lines grouped by segment;
+    // { segment } entries in the queue mark a switch
+    takeParts() {
+        const parts = [];
+        let lines = [];
+        for (const entry of this.pending) {
+            if (entry.segment !== undefined) {
+                parts.push({ segment: this.writeSegment, lines });
+                lines = [];
+                this.writeSegment = entry.segment;
+            } else {
+                lines.push(this.serialize(entry));
+            }
+        }
+        parts.push({ segment: this.writeSegment, lines });
+        this.pending = [];
+        return parts;
+    }
+
+    // Writes everything queued so far, with one write and one fsync per
+    // segment touched. Runs on a timer, never inside a tick.
+    flush() {
+        if (this.flushing || (this.pending.length === 0 && !this.retry)) return;
+        this.flushing = true;
+        const started = process.hrtime.bigint();
+        const parts = (this.retry || []).concat(this.takeParts());
+        this.retry = null;
+
+        const writeNext = i => {
+            if (i === parts.length) {
+                this.flushing = false;
+                this.stats.lastFsyncMs = Number(process.hrtime.bigint() - started) / 1e6;
+                if (this.segmentBytes > SNAPSHOT_LOG_BYTES && !this.snapshotting) this.snapshot();
+                return;
+            }
+            const part = parts[i];
+            if (part.lines.length === 0) return writeNext(i + 1);
+            if (part.segment !== this.fdSegment || this.fd === null) {
+                this.openSegment(part.segment);
+                this.segmentBytes = 0;
+            }
+            const data = Buffer.from(part.lines.join('\n') + '\n');
+            fs.write(this.fd, data, 0, data.length, null, error => {
+                if (error) return this.fail(error, parts.slice(i));
+                fs.fdatasync(this.fd, error => {
+                    if (error) return this.fail(error, parts.slice(i));
+                    this.stats.records += part.lines.length;
+                    this.stats.bytes += data.length;
+                    this.stats.fsyncs++;
+                    this.stats.maxBatch = Math.max(this.stats.maxBatch, part.lines.length);
+                    this.segmentBytes += data.length;
+                    writeNext(i + 1);
+                });
+            });
+        };
+        writeNext(0);
+    }
+
+    fail(error, parts) {
+        // Keep the unwritten parts so the next flush retries them
+        log.error('Writing the room log failed: %s', error.message);
+        this.retry = parts.concat(this.retry || []);
+        this.flushing = false;
+    }
+
+    // Starts a new segment and writes a snapshot of the state as of that
+    // switch. The state is captured synchronously, so it matches the log
+    // position exactly; writing it out is asynchronous.
+    snapshot() {
+        if (this.snapshotting) return;
+        this.snapshotting = true;
+        this.changedSinceSnapshot = false;
+        const started = process.hrtime.bigint();
+        const n = ++this.segment;
+        this.pending.push({ segment: n });
+
+        const lines = [JSON.stringify({ segment: n, rooms: this.rooms.rooms.size, time: new Date().toISOString() })];
+        for (const room of this.rooms.values()) {
+            const state = room.state;
+            lines.push(JSON.stringify({ r: room.id, e: state.epoch, v: state.revision, t: flatTokens(Array.from(state.tokens.values())), f: room.fog.save(), c: room.chatLog.save() }));
+        }
+        lines.push(JSON.stringify({ end: true }));
+        const captureMs = Number(process.hrtime.bigint() - started) / 1e6;
+
+        const file = path.join(this.dir, snapshotName(n));
+        const temp = file + '.tmp';
+        const data = lines.join('\n') + '\n';
+        fs.writeFile(temp, data, error => {
+            if (error) return this.snapshotFailed(error);
+            fs.open(temp, 'r+', (error, fd) => {
+                if (error) return this.snapshotFailed(error);
+                fs.fsync(fd, error => {
+                    fs.closeSync(fd);
+                    if (error) return this.snapshotFailed(error);
+                    fs.renameSync(temp, file);
+                    syncDirectory(this.dir);
+                    this.prune(n);
+                    this.snapshotting = false;
+                    this.stats.snapshots++;
+                    this.stats.lastSnapshotMs = Number(process.hrtime.bigint() - started) / 1e6;
+                    log.info('Snapshot %d: %d rooms, %d KB, captured in %s ms', n, lines.length - 2, Math.round(data.length / 1024), captureMs.toFixed(1));
+                });
+            });
+        });
+    }
+
+    snapshotFailed(error) {
+        log.error('Writing a snapshot failed: %s', error.message);
+        this.snapshotting = false;
+        this.changedSinceSnapshot = true;
+    }
+
+    // Deletes snapshots and segments that snapshot n made unnecessary
+    prune(n) {
+        this.prunedBelow = n;
+        for (const old of listNumbered(this.dir, 'snapshot')) {
+            if (old < n) fs.unlinkSync(path.join(this.dir, snapshotName(old)));
+        }
+        for (const old of listNumbered(this.dir, 'log')) {
+            if (old < n && old !== this.fdSegment) fs.unlinkSync(path.join(this.dir, segmentName(old)));
+        }
+    }
+
+    // Final flush for shutdown: waits for a running flush so records stay in
+    // order, then writes the rest synchronously
+    close(done) {
+        this.timers.forEach(timer => clearInterval(timer));
+        if (this.flushing) {
+            setTimeout(() => this.close(done), 5);
+            return;
+        }
+        for (const part of (this.retry || []).concat(this.takeParts())) {
+            if (part.lines.length === 0) continue;
+            if (part.segment !== this.fdSegment || this.fd === null) this.openSegment(part.segment);
+            fs.writeSync(this.fd, part.lines.join('\n') + '\n');
+            fs.fdatasyncSync(this.fd);
+        }
+        this.retry = null;
+        if (this.fd !== null) fs.closeSync(this.fd);
+        this.fd = null;
+        if (done) done();
+    }
+}
+
+module.exports = { RoomStore };
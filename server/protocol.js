@@ -0,0 +1,505 @@
+// RayVTT wire protocol.
+//
+// Clients negotiate the encoding through the WebSocket subprotocol header.
+// "rayvtt.bin.1" selects the binary format below; "rayvtt.json" (or no
+// subprotocol at all, for older clients) keeps the JSON text messages.
+//
+// Binary frames are little-endian:
+//
+//   frame  := u8 version, record*
+//   record := u8 type, u16 payloadLength, payload
+//   str    := u8 length, utf8 bytes    (ids)
+//   text   := u16 length, utf8 bytes   (free text)
+//
+// Decoders skip records with an unknown type using payloadLength, so new
+// record types and trailing fields can be added without bumping the version.
+// A streamed move_token is 25 bytes on the wire versus 89 bytes of JSON.
+//
+// Room state is versioned (see room_state.js). A sync carries the room epoch,
+// the revision it brings the client to, the base revision it applies on top
+// of and SYNC_FLAG_SNAPSHOT when the token list is the complete state:
+//
+//   sync   := u32 count, count * (i32 id, f32 x, f32 y), u32 epoch, u32 revision, u32 base, u8 flags
+//
+// Fog of war changes are runs of grid cells on one layer (see fog.js):
+//
+//   runs   := u8 layer, u8 op, u16 count, count * (u16 row, u16 start, u16 length)
+//
+// Dice results are rolled by the server (see dice.js). The distribution
+// fields are always present and only meaningful with DICE_FLAG_DISTRIBUTION:
+//
+//   dice   := str expr, f64 total, u8 flags, f64 min, f64 max, f32 mean, f32 below, f32 at,
+//             u8 termCount, termCount * term
+//   term   := u8 flags, u32 count, u32 sides, i32 keep, f64 sum, u8 rollCount, rollCount * u32 roll
+//
+// Dice and chat lines kept in the room's history (see chat_log.js) end with
+// their u32 sequence number. A history page is sent as those same records,
+// newest first, closed by a history_end record.
+// client/protocol.h mirrors these constants and must be kept in sync.
+
+const PROTOCOL_VERSION = 1;
+const SUBPROTOCOL_BINARY = 'rayvtt.bin.1';
+const SUBPROTOCOL_JSON = 'rayvtt.json';
+
+const MSG = {
+    RECONNECT_REQUEST: 1, // str client_id, u32 epoch, u32 revision
+    PING: 2,
+    PONG: 3,
+    INIT_STATE: 4,        // str client_id, sync
+    MOVE_TOKEN: 5,        // i32 id, f32 x, f32 y, u32 seq, u32 t, u8 flags
+    UPDATE_TOKEN: 6,      // i32 id, f32 x, f32 y, u32 seq, u32 t, u8 flags
+    DICE_ROLL: 7,         // str sender_id, text message, u32 seq
+    JOIN_ROOM: 8,         // str roomId, u32 epoch, u32 revision
+    LEAVE_ROOM: 9,
+    ROOM_JOINED: 10,      // str roomId
+    ROOM_LEFT: 11,
+    USER_JOINED: 12,      // str userId
+    USER_LEFT: 13,        // str userId
+    CHAT_MESSAGE: 14,     // str sender_id, text message, u32 seq
+    STATE_SYNC: 15,       // sync
+    STATE_REVISION: 16,   // u32 epoch, u32 revision (closes an update_tokens batch)
+    ROOM_REDIRECT: 17,    // str roomId (reconnect with ?room=, the room is on another shard)
+    FOG_RUNS: 18,         // runs
+    VIEWPORT: 19,         // f32 x, f32 y, f32 width, f32 height (world rectangle the client shows)
+    ROLL_DICE: 20,        // text expr (client asks the server to roll)
+    DICE_RESULT: 21,      // str sender_id, dice, u32 seq
+    HISTORY_REQUEST: 22,  // u32 before (0: newest), u16 limit (client asks for older chat and dice lines)
+    HISTORY_END: 23,      // u32 oldest seq sent, u8 flags (closes a history page)
+};
+
+const TYPE_NAMES = {};
+const TYPE_IDS = {};
+for (const [name, id] of Object.entries(MSG)) {
+    TYPE_NAMES[id] = name.toLowerCase();
+    TYPE_IDS[name.toLowerCase()] = id;
+}
+
+const RECORD_HEADER_SIZE = 3;
+const MOVE_FLAG_FINAL = 1; // Last sample of a drag
+const SYNC_FLAG_SNAPSHOT = 1; // Sync replaces the whole state instead of patching it
+const FOG_RUNS_PER_RECORD = 8192; // Keeps a runs record under the u16 payload limit
+const FOG_OP_SET = 0;
+const FOG_OP_RESET = 2;
+const DICE_FLAG_DISTRIBUTION = 1; // dice: the distribution fields are valid
+const TERM_FLAG_EXPLODE = 1;
+const TERM_FLAG_NEGATIVE = 2;     // Term is subtracted
+const HISTORY_FLAG_MORE = 1;      // history_end: older lines remain
+
+// Picks the encoding for a new connection (ws `handleProtocols` hook)
+function selectSubprotocol(protocols) {
+    if (protocols.has(SUBPROTOCOL_BINARY)) return SUBPROTOCOL_BINARY;
+    if (protocols.has(SUBPROTOCOL_JSON)) return SUBPROTOCOL_JSON;
+    return false;
+}
+
+function isBinaryProtocol(protocol) {
+    return protocol === SUBPROTOCOL_BINARY;
+}
+
+// --- encoding ---
+
+class Writer {
+    constructor(size = 64) {
+        this.buf = Buffer.allocUnsafe(size);
+        this.pos = 0;
+    }
+
+    ensure(n) {
+        if (this.pos + n <= this.buf.length) return;
+        let size = this.buf.length * 2;
+        while (size < this.pos + n) size *= 2;
+        const next = Buffer.allocUnsafe(size);
+        this.buf.copy(next, 0, 0, this.pos);
+        this.buf = next;
+    }
+
+    u8(v) { this.ensure(1); this.buf.writeUInt8(v, this.pos); this.pos += 1; }
+    u16(v) { this.ensure(2); this.buf.writeUInt16LE(v, this.pos); this.pos += 2; }
+    u32(v) { this.ensure(4); this.buf.writeUInt32LE(v >>> 0, this.pos); this.pos += 4; }
+    i32(v) { this.ensure(4); this.buf.writeInt32LE(v | 0, this.pos); this.pos += 4; }
+    f32(v) { this.ensure(4); this.buf.writeFloatLE(v, this.pos); this.pos += 4; }
+    f64(v) { this.ensure(8); this.buf.writeDoubleLE(v, this.pos); this.pos += 8; }
+
+    // Strings longer than the length prefix allows are cut at a character
+    // boundary; Buffer.write() only writes whole characters and reports how
+    // many bytes that was, so the prefix is written from that count
+    str(s) {
+        const max = Math.min(Buffer.byteLength(s || ''), 255);
+        this.ensure(1 + max);
+        const len = this.buf.write(s || '', this.pos + 1, max, 'utf8');
+        this.buf.writeUInt8(len, this.pos);
+        this.pos += 1 + len;
+    }
+
+    text(s) {
+        const max = Math.min(Buffer.byteLength(s || ''), 65535);
+        this.ensure(2 + max);
+        const len = this.buf.write(s || '', this.pos + 2, max, 'utf8');
+        this.buf.writeUInt16LE(len, this.pos);
+        this.pos += 2 + len;
+    }
+
+    beginRecord(type) {
+        this.u8(type);
+        const lengthAt = this.pos;
+        this.u16(0);
+        return lengthAt;
+    }
+
+    endRecord(lengthAt) {
+        this.buf.writeUInt16LE(this.pos - lengthAt - 2, lengthAt);
+    }
+
+    finish() {
+        return this.buf.subarray(0, this.pos);
+    }
+}
+
+function writeSync(w, msg) {
+    const tokens = Object.values(msg.tokens || {});
+    w.u32(tokens.length);
+    for (const t of tokens) {
+        w.i32(t.id);
+        w.f32(t.x);
+        w.f32(t.y);
+    }
+    w.u32(msg.epoch || 0);
+    w.u32(msg.revision || 0);
+    w.u32(msg.base || 0);
+    w.u8(msg.snapshot === false ? 0 : SYNC_FLAG_SNAPSHOT);
+}
+
+function writeDice(w, msg) {
+    const dist = msg.dist;
+    w.str(msg.expr);
+    w.f64(msg.total);
+    w.u8(dist ? DICE_FLAG_DISTRIBUTION : 0);
+    w.f64(dist ? dist.min : 0);
+    w.f64(dist ? dist.max : 0);
+    w.f32(dist ? dist.mean : 0);
+    w.f32(dist ? dist.below : 0);
+    w.f32(dist ? dist.at : 0);
+    w.u8(msg.terms.length);
+    for (const t of msg.terms) {
+        w.u8((t.explode ? TERM_FLAG_EXPLODE : 0) | (t.sign < 0 ? TERM_FLAG_NEGATIVE : 0));
+        w.u32(t.count);
+        w.u32(t.sides);
+        w.i32(t.keep);
+        w.f64(t.sum);
+        w.u8(t.rolls.length);
+        for (const r of t.rolls) w.u32(r);
+    }
+}
+
+function writeRecord(w, msg) {
+    const type = TYPE_IDS[msg.type];
+    if (type === undefined) {
+        throw new Error(`No binary encoding for message type ${msg.type}`);
+    }
+    const at = w.beginRecord(type);
+    switch (type) {
+        case MSG.RECONNECT_REQUEST:
+            w.str(msg.client_id);
+            w.u32(msg.epoch || 0);
+            w.u32(msg.revision || 0);
+            break;
+        case MSG.INIT_STATE:
+            w.str(msg.client_id);
+            writeSync(w, msg);
+            break;
+        case MSG.STATE_SYNC:
+            writeSync(w, msg);
+            break;
+        case MSG.STATE_REVISION:
+            w.u32(msg.epoch);
+            w.u32(msg.revision);
+            break;
+        case MSG.MOVE_TOKEN:
+        case MSG.UPDATE_TOKEN:
+            w.i32(msg.id);
+            w.f32(msg.x);
+            w.f32(msg.y);
+            w.u32(msg.seq || 0);
+            w.u32(msg.t || 0);
+            w.u8(msg.final ? MOVE_FLAG_FINAL : 0);
+            break;
+        case MSG.DICE_ROLL:
+        case MSG.CHAT_MESSAGE:
+            w.str(msg.sender_id);
+            w.text(msg.message);
+            w.u32(msg.seq || 0);
+            break;
+        case MSG.JOIN_ROOM:
+            w.str(msg.roomId);
+            w.u32(msg.epoch || 0);
+            w.u32(msg.revision || 0);
+            break;
+        case MSG.ROOM_JOINED:
+        case MSG.ROOM_REDIRECT:
+            w.str(msg.roomId);
+            break;
+        case MSG.USER_JOINED:
+        case MSG.USER_LEFT:
+            w.str(msg.userId);
+            break;
+        case MSG.ROLL_DICE:
+            w.text(msg.expr);
+            break;
+        case MSG.DICE_RESULT:
+            w.str(msg.sender_id);
+            writeDice(w, msg);
+            w.u32(msg.seq || 0);
+            break;
+        case MSG.HISTORY_REQUEST:
+            w.u32(msg.before || 0);
+            w.u16(msg.limit || 0);
+            break;
+        case MSG.HISTORY_END:
+            w.u32(msg.oldest || 0);
+            w.u8(msg.more ? HISTORY_FLAG_MORE : 0);
+            break;
+        case MSG.VIEWPORT:
+            w.f32(msg.x);
+            w.f32(msg.y);
+            w.f32(msg.width);
+            w.f32(msg.height);
+            break;
+        case MSG.FOG_RUNS:
+            w.u8(msg.layer);
+            w.u8(msg.op);
+            w.u16(msg.runs.length / 3);
+            for (const v of msg.runs) w.u16(v);
+            break;
+        default:
+            break; // ping, pong, leave_room, room_left carry no payload
+    }
+    w.endRecord(at);
+}
+
+// Encodes one or more message objects (JSON shape) into a single binary frame.
+// An "update_tokens" batch becomes one update_token record per token, followed
+// by a state_revision record when the batch carries a revision, a "history"
+// page becomes its lines followed by a history_end record, and long
+// fog_runs messages are split over several records.
+function encode(messages) {
+    const list = Array.isArray(messages) ? messages : [messages];
+    const w = new Writer(16 + list.length * 16);
+    w.u8(PROTOCOL_VERSION);
+    for (const msg of list) {
+        if (msg.type === 'update_tokens') {
+            for (const t of msg.tokens) {
+                writeRecord(w, { type: 'update_token', id: t.id, x: t.x, y: t.y, seq: t.seq, t: t.t, final: t.final });
+            }
+            if (msg.revision !== undefined) {
+                writeRecord(w, { type: 'state_revision', epoch: msg.epoch, revision: msg.revision });
+            }
+        } else if (msg.type === 'history') {
+            for (const line of msg.messages) writeRecord(w, line);
+            const last = msg.messages[msg.messages.length - 1];
+            writeRecord(w, { type: 'history_end', oldest: last ? last.seq : 0, more: msg.more });
+        } else if (msg.type === 'fog_runs' && msg.runs.length > FOG_RUNS_PER_RECORD * 3) {
+            for (let i = 0; i < msg.runs.length; i += FOG_RUNS_PER_RECORD * 3) {
+                // Only the first part may reset the layer
+                const op = i > 0 && msg.op === FOG_OP_RESET ? FOG_OP_SET : msg.op;
+                writeRecord(w, { type: 'fog_runs', layer: msg.layer, op, runs: msg.runs.slice(i, i + FOG_RUNS_PER_RECORD * 3) });
+            }
+        } else {
+            writeRecord(w, msg);
+        }
+    }
+    return w.finish();
+}
+
+// --- decoding ---
+
+// An f32 position or size; NaN and infinities would end up in room state, so
+// a frame carrying one is rejected
+function readCoord(buf, pos) {
+    const v = buf.readFloatLE(pos);
+    if (!Number.isFinite(v)) throw new Error(`Non-finite coordinate at offset ${pos}`);
+    return v;
+}
+
+function readStr(buf, pos, lenBytes) {
+    const len = lenBytes === 1 ? buf.readUInt8(pos) : buf.readUInt16LE(pos);
+    const start = pos + lenBytes;
+    return [buf.toString('utf8', start, start + len), start + len];
+}
+
+function readSync(buf, msg, pos, end) {
+    const count = buf.readUInt32LE(pos);
+    pos += 4;
+    msg.tokens = {};
+    for (let i = 0; i < count && pos + 12 <= end; i++, pos += 12) {
+        const id = buf.readInt32LE(pos);
+        msg.tokens[id] = { id, x: buf.readFloatLE(pos + 4), y: buf.readFloatLE(pos + 8) };
+    }
+    if (end - pos >= 13) {
+        msg.epoch = buf.readUInt32LE(pos);
+        msg.revision = buf.readUInt32LE(pos + 4);
+        msg.base = buf.readUInt32LE(pos + 8);
+        msg.snapshot = (buf.readUInt8(pos + 12) & SYNC_FLAG_SNAPSHOT) !== 0;
+    }
+}
+
+// Optional trailing (epoch, revision) pair of join_room and reconnect_request
+function readKnownRevision(buf, msg, pos, end) {
+    if (end - pos >= 8) {
+        msg.epoch = buf.readUInt32LE(pos);
+        msg.revision = buf.readUInt32LE(pos + 4);
+    }
+}
+
+// Trailing history sequence number of a dice or chat line
+function readSeq(buf, msg, pos, end) {
+    if (end - pos >= 4) msg.seq = buf.readUInt32LE(pos);
+}
+
+function readDice(buf, msg, pos) {
+    [msg.expr, pos] = readStr(buf, pos, 1);
+    msg.total = buf.readDoubleLE(pos);
+    const flags = buf.readUInt8(pos + 8);
+    if (flags & DICE_FLAG_DISTRIBUTION) {
+        msg.dist = {
+            min: buf.readDoubleLE(pos + 9),
+            max: buf.readDoubleLE(pos + 17),
+            mean: buf.readFloatLE(pos + 25),
+            below: buf.readFloatLE(pos + 29),
+            at: buf.readFloatLE(pos + 33),
+        };
+    }
+    const termCount = buf.readUInt8(pos + 37);
+    pos += 38;
+    msg.terms = [];
+    for (let i = 0; i < termCount; i++) {
+        const termFlags = buf.readUInt8(pos);
+        const t = {
+            sign: termFlags & TERM_FLAG_NEGATIVE ? -1 : 1,
+            count: buf.readUInt32LE(pos + 1),
+            sides: buf.readUInt32LE(pos + 5),
+            keep: buf.readInt32LE(pos + 9),
+            explode: (termFlags & TERM_FLAG_EXPLODE) !== 0,
+            sum: buf.readDoubleLE(pos + 13),
+            rolls: new Array(buf.readUInt8(pos + 21)),
+        };
+        pos += 22;
+        for (let j = 0; j < t.rolls.length; j++, pos += 4) t.rolls[j] = buf.readUInt32LE(pos);
+        msg.terms.push(t);
+    }
+    return pos;
+}
+
+function readRecord(buf, type, pos, end) {
+    const msg = { type: TYPE_NAMES[type] };
+    let s;
+    switch (type) {
+        case MSG.RECONNECT_REQUEST:
+            [msg.client_id, s] = readStr(buf, pos, 1);
+            readKnownRevision(buf, msg, s, end);
+            break;
+        case MSG.INIT_STATE:
+            [msg.client_id, s] = readStr(buf, pos, 1);
+            readSync(buf, msg, s, end);
+            break;
+        case MSG.STATE_SYNC:
+            readSync(buf, msg, pos, end);
+            break;
+        case MSG.STATE_REVISION:
+            msg.epoch = buf.readUInt32LE(pos);
+            msg.revision = buf.readUInt32LE(pos + 4);
+            break;
+        case MSG.MOVE_TOKEN:
+        case MSG.UPDATE_TOKEN:
+            msg.id = buf.readInt32LE(pos);
+            msg.x = readCoord(buf, pos + 4);
+            msg.y = readCoord(buf, pos + 8);
+            if (end - pos >= 21) {
+                msg.seq = buf.readUInt32LE(pos + 12);
+                msg.t = buf.readUInt32LE(pos + 16);
+                msg.final = (buf.readUInt8(pos + 20) & MOVE_FLAG_FINAL) !== 0;
+            }
+            break;
+        case MSG.DICE_ROLL:
+        case MSG.CHAT_MESSAGE:
+            [msg.sender_id, s] = readStr(buf, pos, 1);
+            [msg.message, s] = readStr(buf, s, 2);
+            readSeq(buf, msg, s, end);
+            break;
+        case MSG.JOIN_ROOM:
+            [msg.roomId, s] = readStr(buf, pos, 1);
+            readKnownRevision(buf, msg, s, end);
+            break;
+        case MSG.ROOM_JOINED:
+        case MSG.ROOM_REDIRECT:
+            [msg.roomId] = readStr(buf, pos, 1);
+            break;
+        case MSG.USER_JOINED:
+        case MSG.USER_LEFT:
+            [msg.userId] = readStr(buf, pos, 1);
+            break;
+        case MSG.ROLL_DICE:
+            [msg.expr] = readStr(buf, pos, 2);
+            break;
+        case MSG.DICE_RESULT:
+            [msg.sender_id, s] = readStr(buf, pos, 1);
+            readSeq(buf, msg, readDice(buf, msg, s), end);
+            break;
+        case MSG.HISTORY_REQUEST:
+            msg.before = buf.readUInt32LE(pos);
+            msg.limit = buf.readUInt16LE(pos + 4);
+            break;
+        case MSG.HISTORY_END:
+            msg.oldest = buf.readUInt32LE(pos);
+            msg.more = (buf.readUInt8(pos + 4) & HISTORY_FLAG_MORE) !== 0;
+            break;
+        case MSG.VIEWPORT:
+            msg.x = readCoord(buf, pos);
+            msg.y = readCoord(buf, pos + 4);
+            msg.width = readCoord(buf, pos + 8);
+            msg.height = readCoord(buf, pos + 12);
+            break;
+        case MSG.FOG_RUNS: {
+            msg.layer = buf.readUInt8(pos);
+            msg.op = buf.readUInt8(pos + 1);
+            const count = Math.min(buf.readUInt16LE(pos + 2), Math.floor((end - pos - 4) / 6));
+            msg.runs = new Array(count * 3);
+            for (let i = 0; i < count * 3; i++) {
+                msg.runs[i] = buf.readUInt16LE(pos + 4 + i * 2);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    return msg;
+}
+
+// Decodes a binary frame into an array of message objects (JSON shape)
+function decode(buf) {
+    if (buf.length < 1 || buf[0] !== PROTOCOL_VERSION) {
+        throw new Error(`Unsupported protocol version ${buf[0]}`);
+    }
+    const messages = [];
+    let pos = 1;
+    while (pos + RECORD_HEADER_SIZE <= buf.length) {
+        const type = buf.readUInt8(pos);
+        const length = buf.readUInt16LE(pos + 1);
+        const start = pos + RECORD_HEADER_SIZE;
+        const end = start + length;
+        if (end > buf.length) throw new Error('Truncated record');
+        if (TYPE_NAMES[type] !== undefined) messages.push(readRecord(buf, type, start, end));
+        pos = end;
+    }
+    return messages;
+}
+
+module.exports = {
+    PROTOCOL_VERSION,
+    SUBPROTOCOL_BINARY,
+    SUBPROTOCOL_JSON,
+    MSG,
+    selectSubprotocol,
+    isBinaryProtocol,
+    encode,
+    decode,
+};
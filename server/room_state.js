@@ -0,0 +1,185 @@
+// Authoritative token state of a single room.
+//
+// Every committed tick bumps the room's revision and records the tokens it
+// changed. A bounded history of those deltas lets a client that already has
+// revision N catch up by receiving only what changed after N; a client that
+// is further behind than the history reaches (or that knows nothing about
+// this room) gets a full snapshot instead.
+//
+// Revisions only make sense within one room lifetime, so each RoomState also
+// has a random epoch. Clients echo the epoch with their revision; a mismatch
+// (room deleted and recreated, server restart, different room) means snapshot.
+
+const crypto = require('crypto');
+const { SpatialIndex } = require('./spatial_index');
+
+// Upper bound on token changes kept for delta resync, across all revisions
+const HISTORY_LIMIT = Number(process.env.RAYVTT_HISTORY_LIMIT) || 4096;
+
+const DEFAULT_TOKENS = [
+    { id: 0, x: 100, y: 100 },
+    { id: 1, x: 200, y: 150 },
+    { id: 2, x: 300, y: 200 },
+];
+
+// Tokens a new room starts with. RAYVTT_ROOM_TOKENS adds tokens after the
+// defaults, 100 to a row below them, e.g. one per synthetic client of the
+// load generator, which can only move tokens that exist.
+const ROOM_TOKENS = Math.max(Number(process.env.RAYVTT_ROOM_TOKENS) || 0, DEFAULT_TOKENS.length);
+const INITIAL_TOKENS = DEFAULT_TOKENS.slice();
+for (let id = DEFAULT_TOKENS.length; id < ROOM_TOKENS; id++) {
+    INITIAL_TOKENS.push({ id, x: (id % 100) * 50, y: 300 + Math.floor(id / 100) * 50 });
+}
+
+function newEpoch() {
+    return crypto.randomBytes(4).readUInt32LE(0) || 1; // 0 means "no state" on the wire
+}
+
+class RoomState {
+    constructor(tokens = INITIAL_TOKENS, historyLimit = HISTORY_LIMIT) {
+        this.epoch = newEpoch();
+        this.revision = 0;
+        this.tokens = new Map(); // token id -> { id, x, y }
+        this.index = new SpatialIndex(); // Token positions by area, for area-of-interest queries
+        for (const t of tokens) {
+            this.tokens.set(t.id, { id: t.id, x: t.x, y: t.y });
+            this.index.set(t.id, t.x, t.y);
+        }
+        this.historyLimit = historyLimit;
+        this.history = [];       // { revision, changes: [{ id, x, y }] }, oldest first from historyStart
+        this.historyStart = 0;
+        this.historyChanges = 0; // token changes currently retained
+    }
+
+    // Applies a tick's moves and records them as one revision.
+    // Unknown token ids are ignored. Returns the new revision, or the current
+    // one if nothing changed.
+    commit(moves) {
+        const changes = [];
+        for (const move of moves) {
+            const token = this.tokens.get(Number(move.id));
+            if (!token) continue;
+            token.x = move.x;
+            token.y = move.y;
+            this.index.set(token.id, token.x, token.y);
+            changes.push({ id: token.id, x: token.x, y: token.y });
+        }
+        if (changes.length === 0) return this.revision;
+
+        this.revision++;
+        this.history.push({ revision: this.revision, changes });
+        this.historyChanges += changes.length;
+        this.trimHistory();
+        return this.revision;
+    }
+
+    // Changes of the latest revision, as recorded by commit()
+    get lastChanges() {
+        const last = this.history[this.history.length - 1];
+        return last && last.revision === this.revision ? last.changes : [];
+    }
+
+    // Replaces the state with persisted values (see persistence.js). The
+    // history starts empty, so only clients already at `revision` get a delta.
+    restore(epoch, revision, tokens) {
+        this.epoch = epoch;
+        this.revision = revision;
+        this.history = [];
+        this.historyStart = 0;
+        this.historyChanges = 0;
+        for (const t of tokens) {
+            const token = this.tokens.get(t.id);
+            if (token) {
+                token.x = t.x;
+                token.y = t.y;
+            } else {
+                this.tokens.set(t.id, { id: t.id, x: t.x, y: t.y });
+            }
+            this.index.set(t.id, t.x, t.y);
+        }
+    }
+
+    // Re-applies a logged revision during recovery; flat is [id, x, y, ...].
+    // Revisions in the history must be contiguous, so a gap starts the
+    // history over. The spatial index is left alone until reindex().
+    replay(revision, flat) {
+        const changes = [];
+        for (let i = 0; i + 2 < flat.length; i += 3) {
+            const token = this.tokens.get(flat[i]);
+            if (!token) continue;
+            token.x = flat[i + 1];
+            token.y = flat[i + 2];
+            changes.push({ id: token.id, x: token.x, y: token.y });
+        }
+        if (revision !== this.revision + 1 || changes.length === 0) {
+            this.history = [];
+            this.historyStart = 0;
+            this.historyChanges = 0;
+        }
+        this.revision = revision;
+        if (changes.length === 0) return;
+        this.history.push({ revision, changes });
+        this.historyChanges += changes.length;
+        this.trimHistory();
+    }
+
+    reindex() {
+        for (const t of this.tokens.values()) this.index.set(t.id, t.x, t.y);
+    }
+
+    trimHistory() {
+        while (this.historyChanges > this.historyLimit && this.historyStart < this.history.length - 1) {
+            this.historyChanges -= this.history[this.historyStart].changes.length;
+            this.history[this.historyStart++] = null;
+        }
+        // Compact once the dropped prefix dominates, keeping trimming amortized O(1)
+        if (this.historyStart > 64 && this.historyStart * 2 > this.history.length) {
+            this.history = this.history.slice(this.historyStart);
+            this.historyStart = 0;
+        }
+    }
+
+    // Oldest revision a delta can start from
+    get oldestBase() {
+        const first = this.history[this.historyStart];
+        return first ? first.revision - 1 : this.revision;
+    }
+
+    // Tokens changed after `base`, latest value per token, or null when the
+    // history no longer reaches back that far.
+    deltaSince(base) {
+        if (!Number.isInteger(base) || base < this.oldestBase || base > this.revision) return null;
+        const changed = new Map();
+        // Revisions are contiguous, so the first entry after `base` is found by offset
+        for (let i = this.historyStart + (base - this.oldestBase); i < this.history.length; i++) {
+            for (const c of this.history[i].changes) {
+                changed.set(c.id, c);
+            }
+        }
+        return changed;
+    }
+
+    snapshot() {
+        const tokens = {};
+        for (const [id, t] of this.tokens) {
+            tokens[id] = { id, x: t.x, y: t.y };
+        }
+        return tokens;
+    }
+
+    // Builds the sync payload for a client that last saw (epoch, revision).
+    // Falls back to a snapshot when a delta is impossible or would not be smaller.
+    sync(epoch, revision) {
+        const delta = epoch === this.epoch ? this.deltaSince(revision) : null;
+        if (delta === null || delta.size >= this.tokens.size) {
+            return { epoch: this.epoch, revision: this.revision, base: 0, snapshot: true, tokens: this.snapshot() };
+        }
+        const tokens = {};
+        for (const [id, t] of delta) {
+            tokens[id] = { id, x: t.x, y: t.y };
+        }
+        return { epoch: this.epoch, revision: this.revision, base: revision, snapshot: false, tokens };
+    }
+}
+
+module.exports = { RoomState, DEFAULT_TOKENS, HISTORY_LIMIT };
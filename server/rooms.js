@@ -0,0 +1,150 @@
+// Room bookkeeping for the WebSocket server.
+//
+// A room owns its connected clients and the token moves accepted since the
+// last tick. Moves are coalesced per token id (latest position wins) and sent
+// out as one batched frame per room on the next tick. Streamed drag samples
+// keep the sender's sequence number and timestamp so receivers can interpolate.
+// Each room also owns its authoritative token state (see room_state.js) and
+// its fog of war (see fog.js), the generator its dice are rolled with
+// (see dice.js) and its chat and dice history (see chat_log.js).
+// RAYVTT_DICE_SEED makes every room's rolls reproducible.
+
+const { RoomState } = require('./room_state');
+const { FogState } = require('./fog');
+const { Random } = require('./dice');
+const { ChatLog } = require('./chat_log');
+
+const DICE_SEED = process.env.RAYVTT_DICE_SEED;
+
+class Room {
+    constructor(id) {
+        this.id = id;
+        this.clients = new Set();
+        this.pendingMoves = new Map(); // token id -> { id, x, y, seq, t, final, sender_id }
+        this.lastMoveSeq = new Map();  // token id -> { senderId, seq } of the newest accepted move
+        this.state = new RoomState();
+        this.fog = new FogState();
+        this.rng = DICE_SEED !== undefined ? new Random(Number(DICE_SEED)) : new Random();
+        this.chatLog = new ChatLog();
+        this.parked = 0; // Disconnected members whose session may still resume
+    }
+
+    get size() {
+        return this.clients.size;
+    }
+
+    // No connected clients and nobody expected back
+    get isEmpty() {
+        return this.clients.size === 0 && this.parked === 0;
+    }
+
+    add(ws) {
+        this.clients.add(ws);
+    }
+
+    delete(ws) {
+        return this.clients.delete(ws);
+    }
+
+    // Records a move for the next tick, replacing any earlier move of the same token.
+    // `id` is the numeric id of a token in the room state; moves of others are
+    // refused, so neither map below grows past the room's tokens.
+    // Returns false for a stale sample (not newer than the sender's last one).
+    queueMove(id, x, y, senderId, seq = 0, t = 0, final = true) {
+        if (!this.state.tokens.has(id)) return false;
+        const last = this.lastMoveSeq.get(id);
+        if (seq > 0 && last && last.senderId === senderId && seq <= last.seq) {
+            return false;
+        }
+        if (last) {
+            last.senderId = senderId;
+            last.seq = seq;
+        } else {
+            this.lastMoveSeq.set(id, { senderId, seq });
+        }
+
+        const pending = this.pendingMoves.get(id);
+        if (pending) {
+            pending.x = x;
+            pending.y = y;
+            pending.seq = seq;
+            pending.t = t;
+            pending.final = final;
+            pending.sender_id = senderId;
+        } else {
+            this.pendingMoves.set(id, { id, x, y, seq, t, final, sender_id: senderId });
+        }
+        return true;
+    }
+
+    hasPendingMoves() {
+        return this.pendingMoves.size > 0;
+    }
+
+    // A drag that ended needs no stale check any more; the sender's next drag
+    // of the token starts a new sequence check
+    takePendingMoves() {
+        const moves = Array.from(this.pendingMoves.values());
+        this.pendingMoves.clear();
+        for (const move of moves) {
+            if (move.final) this.lastMoveSeq.delete(move.id);
+        }
+        return moves;
+    }
+
+    // Drops the sequence numbers of a client that left the room
+    forgetSender(senderId) {
+        for (const [id, last] of this.lastMoveSeq) {
+            if (last.senderId === senderId) this.lastMoveSeq.delete(id);
+        }
+    }
+}
+
+class RoomRegistry {
+    constructor() {
+        this.rooms = new Map(); // room id -> Room
+        this.dirty = new Set(); // rooms with pending moves
+    }
+
+    get(roomId) {
+        return this.rooms.get(roomId);
+    }
+
+    has(roomId) {
+        return this.rooms.has(roomId);
+    }
+
+    values() {
+        return this.rooms.values();
+    }
+
+    getOrCreate(roomId) {
+        let room = this.rooms.get(roomId);
+        if (!room) {
+            room = new Room(roomId);
+            this.rooms.set(roomId, room);
+        }
+        return room;
+    }
+
+    delete(roomId) {
+        this.dirty.delete(this.rooms.get(roomId));
+        return this.rooms.delete(roomId);
+    }
+
+    queueMove(roomId, id, x, y, senderId, seq, t, final) {
+        const room = this.rooms.get(roomId);
+        if (!room || !room.queueMove(id, x, y, senderId, seq, t, final)) return false;
+        this.dirty.add(room);
+        return true;
+    }
+
+    // Returns the rooms that have moves to flush and resets the dirty set
+    takeDirty() {
+        const dirty = Array.from(this.dirty);
+        this.dirty.clear();
+        return dirty;
+    }
+}
+
+module.exports = { Room, RoomRegistry };
@@ -0,0 +1,189 @@
+// Multi-process entry point: runs one shard process (index.js) per core and
+// routes every WebSocket connection to the shard that owns its room.
+//
+// The router only reads the HTTP upgrade request. It takes the room from the
+// URL (?room=, the default room if absent), then hands the raw socket and the
+// parsed request to the owning shard, which completes the handshake and talks
+// to the client directly. A client that joins a room owned by another shard
+// is told to reconnect there (room_redirect), so the router never proxies
+// game traffic.
+//
+// The only cross-shard state is presence: shards report their rooms and
+// client counts, and GET /rooms on the same port returns the combined list.
+// GET /metrics on the local metrics port (see metrics.js) gathers every
+// shard's series, labelled by shard, along with the router's own.
+//
+//   RAYVTT_SHARDS=4 node router.js
+
+const net = require('net');
+const os = require('os');
+const path = require('path');
+const { fork } = require('child_process');
+const { DEFAULT_ROOM, shardFor } = require('./sharding');
+const { getLogger } = require('./logger');
+const metrics = require('./metrics');
+
+const log = getLogger('router');
+
+const PORT = Number(process.env.RAYVTT_PORT) || 8080;
+const SHARDS = Number(process.env.RAYVTT_SHARDS) || os.cpus().length;
+const MAX_HEADER_BYTES = 16 * 1024;
+const RESTART_DELAY_MS = 1000;
+const METRICS_TIMEOUT_MS = 1000; // Shards that do not answer a scrape in time are left out
+
+const shards = [];
+const presence = []; // shard index -> { rooms: { roomId: clients }, clients }
+
+const registry = new metrics.Registry();
+const routedConnections = registry.counter('rayvtt_router_connections_total', 'WebSocket connections handed to the shard', { label: 'shard' });
+const shardRestarts = registry.counter('rayvtt_router_shard_restarts_total', 'Shard processes restarted after exiting', { label: 'shard' });
+metrics.addProcessMetrics(registry);
+
+// Outstanding scrapes: id -> { families, waiting, done }
+const scrapes = new Map();
+let nextScrapeId = 1;
+
+function finishScrape(id) {
+    const scrape = scrapes.get(id);
+    if (!scrape) return;
+    scrapes.delete(id);
+    clearTimeout(scrape.timer);
+    scrape.done(metrics.merge(scrape.families));
+}
+
+function scrapeShards(done) {
+    const id = nextScrapeId++;
+    const scrape = { families: [registry.collect()], waiting: 0, done, timer: null };
+    scrapes.set(id, scrape);
+    for (const child of shards) {
+        if (child && child.connected) {
+            child.send({ type: 'metrics', id });
+            scrape.waiting++;
+        }
+    }
+    if (scrape.waiting === 0) {
+        finishScrape(id);
+    } else {
+        scrape.timer = setTimeout(() => finishScrape(id), METRICS_TIMEOUT_MS);
+    }
+}
+
+function startShard(index) {
+    const child = fork(path.join(__dirname, 'index.js'), [], {
+        env: { ...process.env, RAYVTT_SHARD_INDEX: String(index), RAYVTT_SHARD_COUNT: String(SHARDS) },
+    });
+    shards[index] = child;
+    presence[index] = { rooms: {}, clients: 0 };
+    child.on('message', msg => {
+        if (msg && msg.type === 'presence') {
+            presence[index] = { rooms: msg.rooms, clients: msg.clients };
+        } else if (msg && msg.type === 'metrics') {
+            const scrape = scrapes.get(msg.id);
+            if (!scrape) return; // Answered after the timeout
+            scrape.families.push(msg.families);
+            if (--scrape.waiting === 0) finishScrape(msg.id);
+        }
+    });
+    child.on('exit', (code, signal) => {
+        log.error('Shard %d exited (%s); restarting', index, signal || code);
+        presence[index] = { rooms: {}, clients: 0 };
+        shardRestarts.labels(String(index)).inc();
+        setTimeout(() => startShard(index), RESTART_DELAY_MS).unref();
+    });
+}
+
+// Splits a raw HTTP request head into request line fields and lowercased headers
+function parseRequestHead(head) {
+    const lines = head.split('\r\n');
+    const [method, url] = lines[0].split(' ');
+    const headers = {};
+    for (let i = 1; i < lines.length; i++) {
+        const colon = lines[i].indexOf(':');
+        if (colon <= 0) continue;
+        const name = lines[i].slice(0, colon).trim().toLowerCase();
+        const value = lines[i].slice(colon + 1).trim();
+        headers[name] = headers[name] !== undefined ? `${headers[name]}, ${value}` : value;
+    }
+    return { method, url: url || '/', headers };
+}
+
+function respond(socket, status, body, contentType = 'text/plain') {
+    socket.end(`HTTP/1.1 ${status}\r\nContent-Type: ${contentType}\r\nContent-Length: ${Buffer.byteLength(body)}\r\n` +
+        `Connection: close\r\n\r\n${body}`);
+}
+
+function roomDirectory() {
+    const rooms = [];
+    let clients = 0;
+    presence.forEach((p, shard) => {
+        clients += p.clients;
+        for (const [id, count] of Object.entries(p.rooms)) {
+            rooms.push({ id, shard, clients: count });
+        }
+    });
+    return { shards: SHARDS, clients, rooms };
+}
+
+function route(socket, head, rest) {
+    const req = parseRequestHead(head);
+    const query = new URL(req.url, 'http://localhost').searchParams;
+
+    if ((req.headers.upgrade || '').toLowerCase() !== 'websocket') {
+        if (req.method === 'GET' && req.url.split('?')[0] === '/rooms') {
+            respond(socket, '200 OK', JSON.stringify(roomDirectory()), 'application/json');
+        } else {
+            respond(socket, '426 Upgrade Required', 'WebSocket upgrade required\n');
+        }
+        return;
+    }
+
+    const room = query.get('room') || DEFAULT_ROOM;
+    const shard = shardFor(room, SHARDS);
+    const child = shards[shard];
+    if (!child || !child.connected) {
+        respond(socket, '503 Service Unavailable', 'Shard unavailable\n');
+        return;
+    }
+    child.send({ type: 'upgrade', req, head: rest.toString('base64') }, socket);
+    routedConnections.labels(String(shard)).inc();
+    log.debug('Routed connection for room %s to shard %d', room, shard);
+}
+
+const server = net.createServer(socket => {
+    let buffered = Buffer.alloc(0);
+    const onData = chunk => {
+        buffered = Buffer.concat([buffered, chunk]);
+        const end = buffered.indexOf('\r\n\r\n');
+        if (end === -1) {
+            if (buffered.length > MAX_HEADER_BYTES) socket.destroy();
+            return;
+        }
+        socket.removeListener('data', onData);
+        socket.pause();
+        route(socket, buffered.toString('latin1', 0, end), buffered.subarray(end + 4));
+    };
+    socket.on('data', onData);
+    socket.on('error', () => socket.destroy());
+});
+
+for (let i = 0; i < SHARDS; i++) {
+    startShard(i);
+}
+
+server.listen(PORT, () => {
+    log.info('Router listening on port %d with %d shard(s)', PORT, SHARDS);
+});
+
+metrics.serveMetrics(metrics.metricsPort(), scrapeShards, log);
+
+function shutdown() {
+    server.close();
+    for (const child of shards) {
+        child.removeAllListeners('exit');
+        child.kill();
+    }
+    process.exit(0);
+}
+
+process.on('SIGINT', shutdown);
+process.on('SIGTERM', shutdown);
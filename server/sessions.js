@@ -0,0 +1,90 @@
+// Client sessions, keyed by client id.
+//
+// A session outlives its WebSocket: when the socket closes the session is
+// parked for a grace period, keeping its room membership and the tokens it was
+// dragging. A client that reconnects with the same id within that window is
+// put straight back where it was, without other players seeing it leave.
+// Lookups are a single Map access, whatever the number of rooms or clients.
+
+const SESSION_GRACE_MS = Number(process.env.RAYVTT_SESSION_GRACE_MS) || 30 * 1000;
+
+class Session {
+    constructor(id) {
+        this.id = id;
+        this.ws = null;          // Current socket, null while parked
+        this.roomId = null;
+        this.held = new Map();   // token id -> { x, y, origin } of drags not yet dropped
+        this.expireTimer = null;
+    }
+
+    get connected() {
+        return this.ws !== null;
+    }
+}
+
+class SessionRegistry {
+    // onExpire(session) runs when a parked session was not resumed in time
+    constructor(onExpire, graceMs = SESSION_GRACE_MS) {
+        this.sessions = new Map(); // client id -> Session
+        this.onExpire = onExpire;
+        this.graceMs = graceMs;
+    }
+
+    get size() {
+        return this.sessions.size;
+    }
+
+    get(id) {
+        return this.sessions.get(id);
+    }
+
+    // Binds ws to the session of `id`, creating it if needed.
+    // `resumed` is true for an existing session; `replaced` is the socket it
+    // was still bound to, if the client reconnected before the old one closed.
+    attach(id, ws) {
+        let session = this.sessions.get(id);
+        const resumed = session !== undefined;
+        let replaced = null;
+        if (resumed) {
+            if (session.expireTimer) {
+                clearTimeout(session.expireTimer);
+                session.expireTimer = null;
+            }
+            replaced = session.ws;
+            if (replaced) replaced.session = null;
+        } else {
+            session = new Session(id);
+            this.sessions.set(id, session);
+        }
+        session.ws = ws;
+        ws.session = session;
+        return { session, resumed, replaced };
+    }
+
+    // Parks the session of a closed socket. Returns null if the socket had
+    // already been replaced by a newer connection.
+    detach(ws) {
+        const session = ws.session;
+        if (!session || session.ws !== ws) return null;
+        session.ws = null;
+        ws.session = null;
+        session.expireTimer = setTimeout(() => this.expire(session), this.graceMs);
+        session.expireTimer.unref();
+        return session;
+    }
+
+    // Ends a session right away, e.g. when its socket adopts another id
+    remove(session) {
+        if (session.expireTimer) clearTimeout(session.expireTimer);
+        if (session.ws) session.ws.session = null;
+        this.sessions.delete(session.id);
+    }
+
+    expire(session) {
+        session.expireTimer = null;
+        this.sessions.delete(session.id);
+        this.onExpire(session);
+    }
+}
+
+module.exports = { Session, SessionRegistry, SESSION_GRACE_MS };
@@ -0,0 +1,31 @@
+// Room ownership when the server runs as several shard processes (router.js).
+//
+// Every room has exactly one owning shard, derived from its id, so the router
+// and all shards agree on it without talking to each other. Clients without a
+// room go to the shard owning the default room.
+
+const DEFAULT_ROOM = 'lobby';
+
+const SHARD_COUNT = Number(process.env.RAYVTT_SHARD_COUNT) || 1;
+const SHARD_INDEX = Number(process.env.RAYVTT_SHARD_INDEX) || 0;
+
+// FNV-1a over the UTF-16 code units; stable across processes and restarts
+function hashRoom(roomId) {
+    let h = 0x811c9dc5;
+    for (let i = 0; i < roomId.length; i++) {
+        h ^= roomId.charCodeAt(i);
+        h = Math.imul(h, 0x01000193);
+    }
+    return h >>> 0;
+}
+
+function shardFor(roomId, shardCount = SHARD_COUNT) {
+    return hashRoom(roomId || DEFAULT_ROOM) % shardCount;
+}
+
+// True if this process owns the room (always, when not sharded)
+function ownsRoom(roomId) {
+    return shardFor(roomId) === SHARD_INDEX;
+}
+
+module.exports = { DEFAULT_ROOM, SHARD_COUNT, SHARD_INDEX, shardFor, ownsRoom };
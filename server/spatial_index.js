@@ -0,0 +1,80 @@
+// Uniform grid over token positions, for finding the tokens inside a rectangle
+// without scanning the whole room. Tokens are filed by their top-left corner.
+
+const DEFAULT_CELL_SIZE = 512; // World units; about ten grid squares
+const CELL_OFFSET = 32768;     // Keeps negative cell coordinates in the numeric key
+
+function cellKey(cx, cy) {
+    return (cx + CELL_OFFSET) * 65536 + (cy + CELL_OFFSET);
+}
+
+class SpatialIndex {
+    constructor(cellSize = DEFAULT_CELL_SIZE) {
+        this.cellSize = cellSize;
+        this.cells = new Map();     // cell key -> Set of token ids
+        this.positions = new Map(); // token id -> { x, y, key }
+    }
+
+    set(id, x, y) {
+        const key = cellKey(Math.floor(x / this.cellSize), Math.floor(y / this.cellSize));
+        const position = this.positions.get(id);
+        if (position) {
+            position.x = x;
+            position.y = y;
+            if (position.key === key) return;
+            this.removeFromCell(id, position.key);
+            position.key = key;
+        } else {
+            this.positions.set(id, { x, y, key });
+        }
+        let cell = this.cells.get(key);
+        if (!cell) {
+            cell = new Set();
+            this.cells.set(key, cell);
+        }
+        cell.add(id);
+    }
+
+    delete(id) {
+        const position = this.positions.get(id);
+        if (!position) return false;
+        this.removeFromCell(id, position.key);
+        this.positions.delete(id);
+        return true;
+    }
+
+    removeFromCell(id, key) {
+        const cell = this.cells.get(key);
+        cell.delete(id);
+        if (cell.size === 0) this.cells.delete(key);
+    }
+
+    // Appends the ids of tokens inside the rectangle to `out`. A rectangle
+    // spanning more cells than there are tokens is answered by scanning the
+    // tokens instead.
+    query(x, y, width, height, out = []) {
+        const cx0 = Math.floor(x / this.cellSize);
+        const cy0 = Math.floor(y / this.cellSize);
+        const cx1 = Math.floor((x + width) / this.cellSize);
+        const cy1 = Math.floor((y + height) / this.cellSize);
+        if ((cx1 - cx0 + 1) * (cy1 - cy0 + 1) > this.positions.size) {
+            for (const [id, p] of this.positions) {
+                if (p.x >= x && p.x <= x + width && p.y >= y && p.y <= y + height) out.push(id);
+            }
+            return out;
+        }
+        for (let cx = cx0; cx <= cx1; cx++) {
+            for (let cy = cy0; cy <= cy1; cy++) {
+                const cell = this.cells.get(cellKey(cx, cy));
+                if (!cell) continue;
+                for (const id of cell) {
+                    const p = this.positions.get(id);
+                    if (p.x >= x && p.x <= x + width && p.y >= y && p.y <= y + height) out.push(id);
+                }
+            }
+        }
+        return out;
+    }
+}
+
+module.exports = { SpatialIndex };